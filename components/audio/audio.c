@@ -2,6 +2,7 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <string.h>
 
 #include "driver/i2c.h"
 
@@ -11,7 +12,10 @@
 #include "ring.h"
 #include "maddec.h"
 #include "fetch_bt.h"
+#include "timeshift.h"
+#include "record.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 static const char* TAG = "rv3.audio";
 
@@ -22,6 +26,24 @@ static const char* TAG = "rv3.audio";
 #define MAX_VOLUME			0
 #define MIN_VOLUME			16
 #define STEP_VOLUME			7
+#define RING_SIZE_IN_KB			144
+/* radio pipeline watchdog. Stream is reopened when input rate or decoded
+ * frames stay too low for stall time.
+ */
+#define WATCHDOG_PERIOD_MS		1000
+#define WATCHDOG_MIN_KBPS		16
+#define WATCHDOG_STALL_TIME_MS		10000
+/* mp3 frames last 24 to 36 ms */
+#define WATCHDOG_MIN_FPS		10
+/* pre-connected stations, chosen by radio menu */
+#define WARM_NB				AUDIO_RADIO_WARM_NB
+/* radio stream is recorded there so it can be paused and rewound */
+#define TIMESHIFT_FILE			"/sdcard/radio/timeshift.bin"
+/* going back live restarts that far behind so ring starts filled */
+#define TIMESHIFT_LIVE_LEAD_MS		5000
+/* recorded songs go to music library */
+#define RECORD_DIR			"/sdcard/Recordings"
+#define RECORD_DB			"/sdcard/music.db"
 
 static void *stb350_hdl;
 static void *socket_hdl;
@@ -29,11 +51,36 @@ static void *file_hdl;
 static void *buffer_hdl;
 static void *decoder_hdl;
 static void *bluetooth_hdl;
+static void *timeshift_hdl;
+static void *record_hdl;
 
 static int is_playing = 0;
 static int is_music_playing = 0;
 static int volume = 8;
 
+static esp_timer_handle_t watchdog_timer;
+static int watchdog_min_kbps = WATCHDOG_MIN_KBPS;
+static int watchdog_stall_time_in_ms = WATCHDOG_STALL_TIME_MS;
+static int watchdog_low_time_in_ms;
+static uint32_t watchdog_bytes;
+static uint32_t watchdog_frames;
+
+static void *warm_hdls[WARM_NB];
+static int is_warm[WARM_NB];
+/* cancelled, task has not ended yet */
+static int is_cooling[WARM_NB];
+/* click to first sound */
+static int64_t play_time;
+static int is_latency_logged;
+static int is_warm_play;
+static char play_station[64];
+/* bitrate variants of next station to play */
+static char *radio_variants;
+static int is_timeshift;
+static int is_paused;
+static uint64_t pause_pos;
+static int is_recording;
+
 static int init_i2c0()
 {
 	i2c_config_t conf;
@@ -86,23 +133,104 @@ static int init_i2s0()
 	return 0;
 }
 
+static void log_latency()
+{
+	int64_t first_frame_time = maddec_first_frame_time(decoder_hdl);
+
+	if (is_latency_logged || !first_frame_time)
+		return ;
+
+	is_latency_logged = 1;
+	ESP_LOGI(TAG, "%s: first sound %d ms after play (%s)", play_station,
+		 (int) ((first_frame_time - play_time) / 1000), is_warm_play ? "warm" : "cold");
+}
+
+static void watchdog_cb(void *arg)
+{
+	struct fetch_socket_radio_stats stats;
+	uint32_t frames = maddec_frame_nb(decoder_hdl);
+	const char *reason = NULL;
+	int kbps;
+
+	log_latency();
+	fetch_socket_radio_get_stats(socket_hdl, &stats);
+	/* connecting or waiting to reconnect, nothing to watch */
+	if (!fetch_socket_radio_is_streaming(socket_hdl)) {
+		watchdog_low_time_in_ms = 0;
+		watchdog_bytes = stats.bytes;
+		watchdog_frames = frames;
+		return ;
+	}
+	kbps = (stats.bytes - watchdog_bytes) * 8 / WATCHDOG_PERIOD_MS;
+	if (kbps < watchdog_min_kbps)
+		reason = "input rate too low";
+	else if (!is_paused && frames - watchdog_frames < WATCHDOG_MIN_FPS * WATCHDOG_PERIOD_MS / 1000)
+		reason = "decoder stalled";
+	watchdog_bytes = stats.bytes;
+	watchdog_frames = frames;
+
+	if (!reason) {
+		watchdog_low_time_in_ms = 0;
+		return ;
+	}
+	watchdog_low_time_in_ms += WATCHDOG_PERIOD_MS;
+	if (watchdog_low_time_in_ms < watchdog_stall_time_in_ms)
+		return ;
+
+	watchdog_low_time_in_ms = 0;
+	fetch_socket_radio_reconnect(socket_hdl, reason);
+}
+
+static int find_warm(char *url, char *path)
+{
+	int i;
+
+	for (i = 0; i < WARM_NB; i++) {
+		if (is_warm[i] && fetch_socket_radio_is_warm(warm_hdls[i], url, path))
+			return i;
+	}
+
+	return -1;
+}
+
+static void init_watchdog()
+{
+	esp_timer_create_args_t args = {
+		.callback = watchdog_cb,
+		.name = "radio_watchdog",
+	};
+
+	assert(esp_timer_create(&args, &watchdog_timer) == ESP_OK);
+}
+
 void audio_init()
 {
+	int i;
+
 	assert(init_i2c0() == 0);
 	assert(init_i2s0() == 0);
 
-	buffer_hdl = ring_create(144);
+	buffer_hdl = ring_create(RING_SIZE_IN_KB);
 	assert(buffer_hdl);
 	stb350_hdl = stb350_create(I2C_NUM_0, I2S_NUM_0, 26);
 	assert(stb350_hdl);
 	socket_hdl = fetch_socket_radio_create(buffer_hdl);
 	assert(socket_hdl);
+	for (i = 0; i < WARM_NB; i++) {
+		warm_hdls[i] = fetch_socket_radio_create(buffer_hdl);
+		assert(warm_hdls[i]);
+	}
 	file_hdl = fetch_file_create(buffer_hdl);
 	assert(file_hdl);
 	bluetooth_hdl = fetch_bt_create(stb350_hdl, 0);
 	assert(bluetooth_hdl);
 	decoder_hdl = maddec_create(buffer_hdl, stb350_hdl);
 	assert(decoder_hdl);
+	timeshift_hdl = timeshift_create(buffer_hdl);
+	assert(timeshift_hdl);
+	record_hdl = record_create();
+	assert(record_hdl);
+	init_watchdog();
 	assert(stb350_init(stb350_hdl) == 0);
 	assert(stb350_set_volume(stb350_hdl, volume * STEP_VOLUME) == 0);
 	printf("audio init done\n");
@@ -111,13 +239,43 @@ void audio_init()
 void audio_radio_play(char *url, char *port_nb, char *path, int rate, int meta,
 		      int anti_ad, void *hdl, audio_track_info_cb track_info_cb)
 {
+	int slot = find_warm(url, path);
+	void *tmp;
+
+	play_time = esp_timer_get_time();
+	is_latency_logged = 0;
+	is_warm_play = slot >= 0;
+	snprintf(play_station, sizeof(play_station), "%s%s", url, path);
 	if (is_playing)
 		audio_radio_stop();
 
 	i2s_set_sample_rates(0, rate);
 	assert(stb350_start(stb350_hdl) == 0);
-	fetch_socket_radio_start(socket_hdl, url, port_nb, path, meta, anti_ad, hdl, track_info_cb);
+	fetch_socket_radio_set_stall_time(socket_hdl, watchdog_stall_time_in_ms);
+	is_timeshift = !timeshift_start(timeshift_hdl, TIMESHIFT_FILE);
+	is_paused = 0;
+	if (slot >= 0) {
+		/* stopped fetcher takes the place of the warm one */
+		tmp = socket_hdl;
+		socket_hdl = warm_hdls[slot];
+		warm_hdls[slot] = tmp;
+		is_warm[slot] = 0;
+		if (is_timeshift)
+			fetch_socket_radio_set_timeshift(socket_hdl, timeshift_hdl);
+		fetch_socket_radio_promote(socket_hdl, hdl, track_info_cb);
+	} else {
+		if (is_timeshift)
+			fetch_socket_radio_set_timeshift(socket_hdl, timeshift_hdl);
+		fetch_socket_radio_start(socket_hdl, url, port_nb, path, meta, anti_ad, hdl,
+					 track_info_cb);
+	}
+	if (radio_variants)
+		fetch_socket_radio_set_variants(socket_hdl, radio_variants);
 	maddec_start(decoder_hdl);
+	watchdog_low_time_in_ms = 0;
+	watchdog_bytes = 0;
+	watchdog_frames = 0;
+	esp_timer_start_periodic(watchdog_timer, WATCHDOG_PERIOD_MS * 1000);
 
 	is_playing = 1;
 }
@@ -127,21 +285,237 @@ void audio_radio_stop()
 	if (!is_playing)
 		return ;
 
-	maddec_stop(decoder_hdl);
+	esp_timer_stop(watchdog_timer);
+	audio_radio_record_stop();
+	if (!is_paused)
+		maddec_stop(decoder_hdl);
 	fetch_socket_radio_stop(socket_hdl);
+	if (is_timeshift)
+		timeshift_stop(timeshift_hdl);
 	stb350_stop(stb350_hdl);
 	ring_reset(buffer_hdl);
 
+	is_timeshift = 0;
+	is_paused = 0;
 	is_playing = 0;
 }
 
-void audio_music_play(char *filepath)
+static int ring_bytes()
+{
+	return ring_level(buffer_hdl) * RING_SIZE_IN_KB * 1024 / 100;
+}
+
+/* stream position being decoded */
+static uint64_t radio_position()
+{
+	return is_paused ? pause_pos : timeshift_tell(timeshift_hdl, ring_bytes());
+}
+
+/* stop decoder and whatever feeds ring, return position decoder was at */
+static uint64_t halt()
+{
+	uint64_t pos;
+
+	if (!is_paused)
+		maddec_stop(decoder_hdl);
+	pos = radio_position();
+	timeshift_pause(timeshift_hdl);
+	ring_reset(buffer_hdl);
+
+	return pos;
+}
+
+/* decoder restarts from pos of recorded stream and catches up with live
+ * one on its own when it gets there.
+ */
+static void play_from(uint64_t pos)
+{
+	halt();
+	is_paused = 0;
+	timeshift_play(timeshift_hdl, pos);
+	maddec_start(decoder_hdl);
+}
+
+/* stream keeps on being recorded while paused */
+void audio_radio_pause()
+{
+	if (!is_playing || !is_timeshift || is_paused)
+		return ;
+
+	pause_pos = halt();
+	is_paused = 1;
+}
+
+void audio_radio_resume()
+{
+	if (!is_playing || !is_paused)
+		return ;
+
+	play_from(pause_pos);
+}
+
+/* move by delta_in_sec of audio, negative to rewind. Paused radio stays
+ * paused.
+ */
+void audio_radio_seek(int delta_in_sec)
+{
+	uint64_t pos;
+
+	if (!is_playing || !is_timeshift)
+		return ;
+	if (timeshift_seek(timeshift_hdl, radio_position(), delta_in_sec * 1000, &pos))
+		return ;
+
+	if (is_paused)
+		pause_pos = pos;
+	else
+		play_from(pos);
+}
+
+void audio_radio_live()
+{
+	uint64_t pos;
+	int delta;
+
+	if (!is_playing || !is_timeshift)
+		return ;
+	pos = radio_position();
+	delta = timeshift_delay(timeshift_hdl, pos) - TIMESHIFT_LIVE_LEAD_MS;
+	if (delta > 0)
+		timeshift_seek(timeshift_hdl, pos, delta, &pos);
+	else if (!is_paused)
+		return ;
+
+	play_from(pos);
+}
+
+/* record playing station, one file per song */
+int audio_radio_record(char *station)
+{
+	if (!is_playing || is_recording)
+		return -1;
+	if (record_start(record_hdl, RECORD_DIR, RECORD_DB, station))
+		return -1;
+
+	fetch_socket_radio_set_record(socket_hdl, record_hdl);
+	is_recording = 1;
+
+	return 0;
+}
+
+void audio_radio_record_stop()
+{
+	if (!is_recording)
+		return ;
+
+	fetch_socket_radio_set_record(socket_hdl, NULL);
+	record_stop(record_hdl);
+	is_recording = 0;
+}
+
+int audio_radio_is_recording()
+{
+	return is_recording;
+}
+
+int audio_radio_is_timeshift()
+{
+	return is_timeshift;
+}
+
+int audio_radio_is_paused()
+{
+	return is_paused;
+}
+
+/* seconds behind live stream, 0 while live */
+int audio_radio_delay()
+{
+	if (!is_timeshift || (!is_paused && timeshift_is_live(timeshift_hdl)))
+		return 0;
+
+	return timeshift_delay(timeshift_hdl, radio_position()) / 1000;
+}
+
+/* per station thresholds for next audio_radio_play, 0 for defaults */
+void audio_radio_set_watchdog(int min_kbps, int stall_time_in_ms)
+{
+	watchdog_min_kbps = min_kbps ? min_kbps : WATCHDOG_MIN_KBPS;
+	watchdog_stall_time_in_ms = stall_time_in_ms ? stall_time_in_ms : WATCHDOG_STALL_TIME_MS;
+}
+
+/* "kbps:path,..." list for next audio_radio_play, NULL for none */
+void audio_radio_set_variants(char *variants)
+{
+	free(radio_variants);
+	radio_variants = variants ? strdup(variants) : NULL;
+}
+
+/* keep a connection to station opened in slot so playing it starts at once,
+ * NULL url releases slot.
+ */
+int audio_radio_warm(int slot, char *url, char *port_nb, char *path, int meta, int anti_ad)
+{
+	int ret;
+
+	assert(slot < WARM_NB);
+	if (url && is_warm[slot] && fetch_socket_radio_is_warm(warm_hdls[slot], url, path))
+		return 0;
+
+	/* we run from ui task, a connecting fetcher can take up to stall time
+	 * to end, so it is collected later and slot stays busy until then.
+	 */
+	if (is_warm[slot]) {
+		fetch_socket_radio_cancel(warm_hdls[slot]);
+		is_cooling[slot] = 1;
+	}
+	is_warm[slot] = 0;
+	if (is_cooling[slot] && !fetch_socket_radio_collect(warm_hdls[slot]))
+		is_cooling[slot] = 0;
+	if (!url)
+		return 0;
+	if (is_cooling[slot]) {
+		ESP_LOGI(TAG, "warm slot %d still stopping, %s%s not warmed", slot, url, path);
+		return -1;
+	}
+
+	fetch_socket_radio_set_stall_time(warm_hdls[slot], watchdog_stall_time_in_ms);
+	ret = fetch_socket_radio_warm(warm_hdls[slot], url, port_nb, path, meta, anti_ad);
+	is_warm[slot] = !ret;
+
+	return ret;
+}
+
+void audio_radio_cool()
+{
+	int i;
+
+	for (i = 0; i < WARM_NB; i++)
+		audio_radio_warm(i, NULL, NULL, NULL, 0, 0);
+}
+
+void audio_radio_stats(struct fetch_socket_radio_stats *stats)
+{
+	fetch_socket_radio_get_stats(socket_hdl, stats);
+}
+
+void audio_radio_timeshift_stats(struct timeshift_stats *stats)
+{
+	timeshift_get_stats(timeshift_hdl, stats);
+}
+
+void audio_radio_record_stats(struct record_stats *stats)
+{
+	record_get_stats(record_hdl, stats);
+}
+
+void audio_music_play(char *filepath, int offset)
 {
 	if (is_music_playing)
 		audio_music_stop();
 
 	assert(stb350_start(stb350_hdl) == 0);
-	fetch_file_start(file_hdl, filepath);
+	fetch_file_start(file_hdl, filepath, offset);
 	maddec_start(decoder_hdl);
 
 	is_music_playing = 1;
@@ -160,6 +534,30 @@ void audio_music_stop()
 	is_music_playing = 0;
 }
 
+/* read start of next song while current one ends */
+void audio_music_prefetch(char *filepath)
+{
+	fetch_file_prefetch(file_hdl, filepath);
+}
+
+void audio_music_stats(struct fetch_file_stats *stats)
+{
+	fetch_file_get_stats(file_hdl, stats);
+}
+
+/* approximate file offset being decoded */
+int audio_music_position()
+{
+	int pos;
+
+	if (!is_music_playing)
+		return 0;
+
+	pos = fetch_file_pos(file_hdl) - ring_bytes();
+
+	return MAX(pos, 0);
+}
+
 void audio_bluetooth_play(void *hdl, audio_track_info_cb track_info_cb)
 {
 	if (!bluetooth_hdl)
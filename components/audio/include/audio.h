@@ -1,14 +1,42 @@
 #ifndef __AUDIO__
 #define __AUDIO__ 1
 
+struct fetch_file_stats;
+struct fetch_socket_radio_stats;
+struct timeshift_stats;
+struct record_stats;
+
+/* stations that can be kept connected ahead by audio_radio_warm() */
+#define AUDIO_RADIO_WARM_NB	2
+
 typedef void (*audio_track_info_cb)(void *hdl, char *track_title);
 
 void audio_init(void);
 void audio_radio_play(char *url, char *port_nb, char *path, int rate, int meta,
 		      int anti_ad, void *hdl, audio_track_info_cb track_info_cb);
 void audio_radio_stop(void);
-void audio_music_play(char *filepath);
+void audio_radio_set_watchdog(int min_kbps, int stall_time_in_ms);
+int audio_radio_warm(int slot, char *url, char *port_nb, char *path, int meta, int anti_ad);
+void audio_radio_cool(void);
+void audio_radio_set_variants(char *variants);
+void audio_radio_stats(struct fetch_socket_radio_stats *stats);
+void audio_radio_timeshift_stats(struct timeshift_stats *stats);
+void audio_radio_record_stats(struct record_stats *stats);
+void audio_radio_pause(void);
+void audio_radio_resume(void);
+void audio_radio_seek(int delta_in_sec);
+void audio_radio_live(void);
+int audio_radio_is_timeshift(void);
+int audio_radio_is_paused(void);
+int audio_radio_delay(void);
+int audio_radio_record(char *station);
+void audio_radio_record_stop(void);
+int audio_radio_is_recording(void);
+void audio_music_play(char *filepath, int offset);
 void audio_music_stop(void);
+int audio_music_position(void);
+void audio_music_prefetch(char *filepath);
+void audio_music_stats(struct fetch_file_stats *stats);
 int audio_sound_level_up(void);
 int audio_sound_level_down(void);
 int audio_sound_get_level(void);
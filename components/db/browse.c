@@ -0,0 +1,374 @@
+#include "db_browse.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.db_browse";
+
+#define BROWSE_MAGIC		0x42335652
+#define BROWSE_VERSION		1
+/* '#', 'a' to 'z' and others */
+#define BROWSE_JUMP_NB		28
+
+/* browse file layout is :
+ *  - struct browse_hdr
+ *  - artist_nb struct browse_entry, sorted by artist sort key.
+ *  - album_nb struct browse_entry, grouped by artist and sorted by album
+ *    sort key.
+ *  - strings area. Artists names first so they can be loaded in one read,
+ *    then albums names.
+ * Names are db directory names, i.e sanitized artist and album names.
+ */
+struct browse_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t artist_nb;
+	uint32_t album_nb;
+	uint32_t strings_offset;
+	uint32_t artist_strings_len;
+	/* first artist index of each initial bucket */
+	uint32_t jump[BROWSE_JUMP_NB];
+};
+
+/* for an artist first is its first album index, for an album it's its first
+ * track index in tracks index.
+ */
+struct browse_entry {
+	uint32_t name;
+	uint32_t first;
+	uint16_t nb;
+	uint16_t name_len;
+};
+
+struct browse {
+	int fd;
+	struct browse_hdr hdr;
+	struct browse_entry *artists;
+	char *artist_strings;
+	/* last artist looked up by name */
+	int artist_idx;
+};
+
+static int initial_bucket(char *key)
+{
+	unsigned char c = key[0];
+
+	if (c < 'a')
+		return 0;
+	if (c > 'z')
+		return BROWSE_JUMP_NB - 1;
+
+	return c - 'a' + 1;
+}
+
+static int write_browse(char *filename, struct browse_hdr *hdr,
+			struct browse_entry *entries, struct db_track *tracks,
+			int track_nb)
+{
+	int entry_nb = hdr->artist_nb + hdr->album_nb;
+	FILE *f;
+	int i;
+
+	f = fopen(filename, "w");
+	if (!f)
+		return -1;
+
+	if (fwrite(hdr, sizeof(*hdr), 1, f) != 1)
+		goto error;
+	if (entry_nb && fwrite(entries, sizeof(*entries), entry_nb, f) != entry_nb)
+		goto error;
+	for (i = 0; i < track_nb; i++) {
+		if (!db_track_is_new_artist(tracks, i))
+			continue;
+		if (fputs(tracks[i].keys->artist_dir, f) < 0 || fputc('\0', f) == EOF)
+			goto error;
+	}
+	for (i = 0; i < track_nb; i++) {
+		if (!db_track_is_new_album(tracks, i))
+			continue;
+		if (fputs(tracks[i].keys->album_dir, f) < 0 || fputc('\0', f) == EOF)
+			goto error;
+	}
+
+	return fclose(f);
+
+error:
+	fclose(f);
+
+	return -1;
+}
+
+static char *artist_name(struct browse *browse, int index)
+{
+	return &browse->artist_strings[browse->artists[index].name];
+}
+
+static int find_artist(struct browse *browse, char *artist)
+{
+	int i;
+
+	if (browse->artist_idx < browse->hdr.artist_nb &&
+	    strcmp(artist_name(browse, browse->artist_idx), artist) == 0)
+		return browse->artist_idx;
+
+	for (i = 0; i < browse->hdr.artist_nb; i++) {
+		if (strcmp(artist_name(browse, i), artist) == 0) {
+			browse->artist_idx = i;
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+static int find_bucket(struct browse *browse, int index)
+{
+	int bucket = 0;
+	int i;
+
+	for (i = 0; i < BROWSE_JUMP_NB; i++) {
+		if (browse->hdr.jump[i] <= index)
+			bucket = i;
+	}
+
+	return bucket;
+}
+
+/* public api */
+int db_browse_build(char *dirname, struct db_track *tracks, int track_nb)
+{
+	struct browse_entry *entries;
+	struct browse_entry *artist = NULL;
+	struct browse_entry *album = NULL;
+	uint32_t strings = 0;
+	struct browse_hdr hdr;
+	char *filename;
+	int bucket = 0;
+	int ret = -1;
+	int i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = BROWSE_MAGIC;
+	hdr.version = BROWSE_VERSION;
+	for (i = 0; i < track_nb; i++) {
+		hdr.artist_nb += db_track_is_new_artist(tracks, i);
+		hdr.album_nb += db_track_is_new_album(tracks, i);
+	}
+	hdr.strings_offset = sizeof(hdr) + (hdr.artist_nb + hdr.album_nb) *
+			     sizeof(struct browse_entry);
+
+	entries = malloc((hdr.artist_nb + hdr.album_nb + 1) * sizeof(struct browse_entry));
+	if (!entries)
+		return -1;
+
+	/* artists names */
+	artist = entries;
+	for (i = 0; i < track_nb; i++) {
+		if (!db_track_is_new_artist(tracks, i))
+			continue;
+		for (; bucket <= initial_bucket(tracks[i].keys->artist); bucket++)
+			hdr.jump[bucket] = artist - entries;
+		artist->name = strings;
+		artist->name_len = strlen(tracks[i].keys->artist_dir) + 1;
+		artist->nb = 0;
+		strings += artist->name_len;
+		artist++;
+	}
+	for (; bucket < BROWSE_JUMP_NB; bucket++)
+		hdr.jump[bucket] = hdr.artist_nb;
+	hdr.artist_strings_len = strings;
+
+	/* albums names and ranges */
+	artist = entries - 1;
+	album = entries + hdr.artist_nb - 1;
+	for (i = 0; i < track_nb; i++) {
+		if (db_track_is_new_artist(tracks, i)) {
+			artist++;
+			artist->first = album + 1 - (entries + hdr.artist_nb);
+		}
+		if (db_track_is_new_album(tracks, i)) {
+			album++;
+			album->name = strings;
+			album->name_len = strlen(tracks[i].keys->album_dir) + 1;
+			album->first = i;
+			album->nb = 0;
+			strings += album->name_len;
+			artist->nb++;
+		}
+		album->nb++;
+	}
+
+	filename = db_index_path(dirname, "browse.tmp");
+	if (!filename)
+		goto error;
+	ret = write_browse(filename, &hdr, entries, tracks, track_nb);
+	free(filename);
+	if (ret)
+		goto error;
+	ret = db_index_replace(dirname, "browse.tmp", "browse");
+	ESP_LOGI(TAG, "browse index has %d artists and %d albums", hdr.artist_nb,
+		 hdr.album_nb);
+
+error:
+	free(entries);
+
+	return ret;
+}
+
+void *db_browse_open(char *dirname)
+{
+	struct browse *browse;
+	char *filename;
+	int ret;
+
+	browse = malloc(sizeof(*browse));
+	if (!browse)
+		return NULL;
+	memset(browse, 0, sizeof(*browse));
+
+	db_index_read_begin();
+	filename = db_index_path(dirname, "browse");
+	if (!filename)
+		goto error;
+	browse->fd = open(filename, O_RDONLY);
+	free(filename);
+	if (browse->fd < 0)
+		goto error;
+
+	ret = read_at(browse->fd, 0, &browse->hdr, sizeof(browse->hdr));
+	if (ret)
+		goto read_error;
+	if (browse->hdr.magic != BROWSE_MAGIC || browse->hdr.version != BROWSE_VERSION) {
+		ESP_LOGW(TAG, "browse index has wrong version. Please update db");
+		goto read_error;
+	}
+
+	/* artists are few, keep them in memory */
+	browse->artists = malloc(browse->hdr.artist_nb * sizeof(struct browse_entry) + 1);
+	browse->artist_strings = malloc(browse->hdr.artist_strings_len + 1);
+	if (!browse->artists || !browse->artist_strings)
+		goto read_error;
+	ret = read_at(browse->fd, sizeof(browse->hdr), browse->artists,
+		      browse->hdr.artist_nb * sizeof(struct browse_entry));
+	if (ret)
+		goto read_error;
+	ret = read_at(browse->fd, browse->hdr.strings_offset, browse->artist_strings,
+		      browse->hdr.artist_strings_len);
+	if (ret)
+		goto read_error;
+	browse->artist_strings[browse->hdr.artist_strings_len] = '\0';
+
+	return browse;
+
+read_error:
+	free(browse->artists);
+	free(browse->artist_strings);
+	close(browse->fd);
+error:
+	db_index_read_end();
+	free(browse);
+
+	return NULL;
+}
+
+void db_browse_close(void *hdl)
+{
+	struct browse *browse = hdl;
+
+	close(browse->fd);
+	db_index_read_end();
+	free(browse->artists);
+	free(browse->artist_strings);
+	free(browse);
+}
+
+int db_browse_artist_nb(void *hdl)
+{
+	struct browse *browse = hdl;
+
+	return browse->hdr.artist_nb;
+}
+
+char *db_browse_artist(void *hdl, int index)
+{
+	struct browse *browse = hdl;
+
+	if (index < 0 || index >= browse->hdr.artist_nb)
+		return NULL;
+
+	return strdup(artist_name(browse, index));
+}
+
+int db_browse_album_nb(void *hdl, char *artist)
+{
+	struct browse *browse = hdl;
+	int artist_idx;
+
+	artist_idx = find_artist(browse, artist);
+	if (artist_idx < 0)
+		return 0;
+
+	return browse->artists[artist_idx].nb;
+}
+
+char *db_browse_album(void *hdl, char *artist, int index)
+{
+	struct browse *browse = hdl;
+	struct browse_entry album;
+	int artist_idx;
+	char *res;
+	int ret;
+
+	artist_idx = find_artist(browse, artist);
+	if (artist_idx < 0 || index < 0 || index >= browse->artists[artist_idx].nb)
+		return NULL;
+
+	ret = read_at(browse->fd, sizeof(browse->hdr) +
+		      (browse->hdr.artist_nb + browse->artists[artist_idx].first + index) *
+		      sizeof(struct browse_entry), &album, sizeof(album));
+	if (ret)
+		return NULL;
+
+	res = malloc(album.name_len);
+	if (!res)
+		return NULL;
+	ret = read_at(browse->fd, browse->hdr.strings_offset + album.name, res,
+		      album.name_len);
+	if (ret) {
+		free(res);
+		return NULL;
+	}
+	res[album.name_len - 1] = '\0';
+
+	return res;
+}
+
+/* return first artist index of next (direction > 0) or previous initial */
+int db_browse_jump(void *hdl, int index, int direction)
+{
+	struct browse *browse = hdl;
+	int bucket;
+	int i;
+
+	if (direction > 0) {
+		for (i = 0; i < BROWSE_JUMP_NB; i++) {
+			if (browse->hdr.jump[i] > index && browse->hdr.jump[i] < browse->hdr.artist_nb)
+				return browse->hdr.jump[i];
+		}
+		return index;
+	}
+
+	bucket = find_bucket(browse, index);
+	if (index > browse->hdr.jump[bucket] || index == 0)
+		return browse->hdr.jump[bucket];
+
+	return browse->hdr.jump[find_bucket(browse, index - 1)];
+}
@@ -10,21 +10,36 @@
 #include <assert.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <time.h>
+#include <utime.h>
 
 #include <errno.h>
 
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
 #include "id3.h"
 #include "utils.h"
+#include "db_index.h"
+#include "db_browse.h"
+#include "db_thumb.h"
 
 static const char* TAG = "rv3.db";
 
+#define ALBUM_CACHE_NB		4
+#define ARENA_INIT_SONG_SZ	128
+/* title of a song already in db from another file gets a number */
+#define TITLE_COPY_MAX		99
+#define ADD_RETRY_MS		1000
+
 struct db_info {
 	char *filepath;
 	struct id3_meta meta;
 };
 
 struct song_cache {
+	/* db entry name, i.e sanitized title */
+	char *name;
 	struct db_info info;
 };
 
@@ -33,6 +48,13 @@ struct album_cache {
 	int song_nb;
 	/* array of album songs cache info ordered by track_nb */
 	struct song_cache *songs;
+	/* songs array, dirname and all strings live in this single
+	 * allocation so an album is released with one free.
+	 */
+	char *arena;
+	int arena_len;
+	int arena_pos;
+	unsigned int last_used;
 };
 
 struct db_builder {
@@ -42,30 +64,101 @@ struct db_builder {
 
 struct db {
 	char *dirname;
-	struct album_cache cache;
+	/* sorted artists and albums lists, NULL if index is missing */
+	void *browse;
+	/* album covers, NULL if none */
+	void *thumb;
+	/* tracks index, NULL if missing */
+	void *index;
+	/* lru of recently visited albums */
+	struct album_cache cache[ALBUM_CACHE_NB];
+	unsigned int tick;
+	int cache_hit_nb;
+	int cache_miss_nb;
 };
 
+/* all handles since boot, for web server */
+static int cache_hit_total;
+static int cache_miss_total;
+
+/* song waiting for db_add_song() background task */
+struct add_request {
+	struct add_request *next;
+	char *dirname;
+	char *filename;
+	struct id3_meta meta;
+	int is_added;
+};
+
+/* index rebuilt from previous one with songs added */
+struct reindex {
+	void *builder;
+	struct add_request *requests;
+	int ret;
+};
+
+static struct add_request *add_head;
+static int is_adding;
+static portMUX_TYPE add_mux = portMUX_INITIALIZER_UNLOCKED;
+
 struct track_nb_song_name {
 	int track_nb;
 	char *song_name;
 };
 
-static void sanitize_path(char *name)
+/* setup db_info pointers inside buffer. buffer must be '\0' terminated */
+static void parse_db_info(char *buffer, struct db_info *db_info)
 {
-	int len = strlen(name);
-	int i;
-
-	for (i = 0; i < len; ++i) {
-		if (name[i] == '/' || name[i] == '?' || name[i] == ':' ||
-		    name[i] == '"')
-			name[i] = '_';
+	db_info->filepath = buffer;
+	buffer += strlen(buffer) + 1;
+	db_info->meta.artist = buffer;
+	buffer += strlen(buffer) + 1;
+	db_info->meta.album = buffer;
+	buffer += strlen(buffer) + 1;
+	db_info->meta.title = buffer;
+	buffer += strlen(buffer) + 1;
+	db_info->meta.track_nb = atoi(buffer);
+	buffer += strlen(buffer) + 1;
+	db_info->meta.duration_in_ms = atoi(buffer);
+	buffer += strlen(buffer) + 1;
+	/* audio info is missing from older db entries */
+	if (!*buffer) {
+		db_info->meta.bitrate = 0;
+		db_info->meta.samplerate = 0;
+		return;
 	}
+	db_info->meta.bitrate = atoi(buffer);
+	buffer += strlen(buffer) + 1;
+	db_info->meta.samplerate = atoi(buffer);
 }
 
-static int read_db_info_by_filename(char *filename, struct db_info *db_info)
+static int dup_db_info(struct db_info *src, struct db_info *db_info)
+{
+	db_info->filepath = strdup(src->filepath);
+	db_info->meta.artist = strdup(src->meta.artist);
+	db_info->meta.album = strdup(src->meta.album);
+	db_info->meta.title = strdup(src->meta.title);
+	db_info->meta.track_nb = src->meta.track_nb;
+	db_info->meta.duration_in_ms = src->meta.duration_in_ms;
+	db_info->meta.bitrate = src->meta.bitrate;
+	db_info->meta.samplerate = src->meta.samplerate;
+
+	if (db_info->filepath && db_info->meta.artist && db_info->meta.album &&
+	    db_info->meta.title)
+		return 0;
+
+	id3_put(&db_info->meta);
+	free(db_info->filepath);
+
+	return -1;
+}
+
+/* read db file content into buffer at pos. buffer is grown as needed and
+ * content is '\0' terminated. Return content length or -1.
+ */
+static int read_db_file(char *filename, char **buffer, int *buffer_len, int pos)
 {
-	char *buffer_init;
-	char *buffer;
+	char *new_buffer;
 	off_t len;
 	int ret;
 	int fd;
@@ -81,40 +174,78 @@ static int read_db_info_by_filename(char *filename, struct db_info *db_info)
 	}
 	lseek(fd, 0, SEEK_SET);
 
-	buffer_init = malloc(len);
-	if (!buffer_init) {
-		close(fd);
-		return -1;
+	if (pos + len + 1 > *buffer_len) {
+		int new_len = *buffer_len ? *buffer_len : len + 1;
+
+		while (pos + len + 1 > new_len)
+			new_len *= 2;
+		new_buffer = realloc(*buffer, new_len);
+		if (!new_buffer) {
+			close(fd);
+			return -1;
+		}
+		*buffer = new_buffer;
+		*buffer_len = new_len;
 	}
 
-	ret = read(fd , buffer_init, len);
-	if (ret != len) {
-		free(buffer_init);
-		close(fd);
+	ret = read(fd , *buffer + pos, len);
+	close(fd);
+	if (ret != len)
+		return -1;
+	(*buffer)[pos + len] = '\0';
+
+	return len + 1;
+}
+
+static int read_db_info_by_filename(char *filename, struct db_info *db_info)
+{
+	struct db_info db_info_raw;
+	char *buffer = NULL;
+	int buffer_len = 0;
+	int ret;
+
+	ret = read_db_file(filename, &buffer, &buffer_len, 0);
+	if (ret < 0) {
+		free(buffer);
 		return -1;
 	}
 
-	buffer = buffer_init;
-	db_info->filepath = strdup(buffer);
-	buffer += strlen(db_info->filepath) + 1;
-	db_info->meta.artist = strdup(buffer);
-	buffer += strlen(db_info->meta.artist) + 1;
-	db_info->meta.album = strdup(buffer);
-	buffer += strlen(db_info->meta.album) + 1;
-	db_info->meta.title = strdup(buffer);
-	buffer += strlen(db_info->meta.title) + 1;
-	db_info->meta.track_nb = atoi(buffer);
-	buffer += strlen(buffer) + 1;
-	db_info->meta.duration_in_ms = atoi(buffer);
-	free(buffer_init);
-	close(fd);
+	parse_db_info(buffer, &db_info_raw);
+	ret = dup_db_info(&db_info_raw, db_info);
+	free(buffer);
 
-	return 0;
+	return ret;
+}
+
+static struct album_cache *lookup_album_cache(struct db *db, char *dirname)
+{
+	int i;
+
+	for (i = 0; i < ALBUM_CACHE_NB; i++) {
+		if (db->cache[i].dirname && strcmp(dirname, db->cache[i].dirname) == 0)
+			return &db->cache[i];
+	}
+
+	return NULL;
+}
+
+static struct song_cache *lookup_song_cache(struct album_cache *cache, char *name)
+{
+	int i;
+
+	for (i = 0; i < cache->song_nb; i++) {
+		if (strcmp(cache->songs[i].name, name) == 0)
+			return &cache->songs[i];
+	}
+
+	return NULL;
 }
 
 static int read_db_info(void *hdl, char *artist, char *album, char *song, struct db_info *db_info)
 {
 	struct db *db = hdl;
+	struct album_cache *cache;
+	struct song_cache *song_cache = NULL;
 	char *filename;
 	int ret;
 
@@ -122,6 +253,21 @@ static int read_db_info(void *hdl, char *artist, char *album, char *song, struct
 	sanitize_path(album);
 	sanitize_path(song);
 
+	/* album may already be in cache, in that case avoid sdcard access */
+	filename = concat3(db->dirname, artist, album);
+	if (!filename)
+		return -1;
+	cache = lookup_album_cache(db, filename);
+	if (cache)
+		song_cache = lookup_song_cache(cache, song);
+	free(filename);
+	if (song_cache) {
+		db->cache_hit_nb++;
+		cache_hit_total++;
+		cache->last_used = ++db->tick;
+		return dup_db_info(&song_cache->info, db_info);
+	}
+
 	filename = concat4(db->dirname, artist, album, song);
 	if (!filename)
 		return -1;
@@ -134,17 +280,8 @@ static int read_db_info(void *hdl, char *artist, char *album, char *song, struct
 
 static void invalidate_cache(void *hdl, struct album_cache *cache)
 {
-	int i;
-
-	for (i = 0; i < cache->song_nb; i++) {
-		db_put_meta(hdl, &cache->songs[i].info.meta);
-		free(cache->songs[i].info.filepath);
-	}
-	free(cache->songs);
-	cache->songs = NULL;
-	cache->song_nb = 0;
-	free(cache->dirname);
-	cache->dirname = NULL;
+	free(cache->arena);
+	memset(cache, 0, sizeof(*cache));
 }
 
 static int sort_songs_array(const void *pa, const void *pb)
@@ -160,10 +297,83 @@ static int sort_songs_array(const void *pa, const void *pb)
 	return 0;
 }
 
-static struct album_cache *refill_cache(void *hdl, char *dirname)
+static char *rebase(char *ptr, char *old_base, char *new_base)
+{
+	return new_base + ((uintptr_t) ptr - (uintptr_t) old_base);
+}
+
+/* arena may have moved during refill. Fix songs pointers */
+static void rebase_cache(struct album_cache *cache, char *old_arena, int song_nb)
+{
+	struct song_cache *song;
+	int i;
+
+	cache->songs = (struct song_cache *) cache->arena;
+	for (i = 0; i < song_nb; i++) {
+		song = &cache->songs[i];
+		song->name = rebase(song->name, old_arena, cache->arena);
+		song->info.filepath = rebase(song->info.filepath, old_arena, cache->arena);
+		song->info.meta.artist = rebase(song->info.meta.artist, old_arena, cache->arena);
+		song->info.meta.album = rebase(song->info.meta.album, old_arena, cache->arena);
+		song->info.meta.title = rebase(song->info.meta.title, old_arena, cache->arena);
+	}
+}
+
+static int arena_add_string(struct album_cache *cache, char *str, int song_nb)
+{
+	int len = strlen(str) + 1;
+	char *old_arena = cache->arena;
+	char *new_arena;
+	int pos;
+
+	if (cache->arena_pos + len > cache->arena_len) {
+		new_arena = realloc(cache->arena, cache->arena_len * 2 + len);
+		if (!new_arena)
+			return -1;
+		cache->arena = new_arena;
+		cache->arena_len = cache->arena_len * 2 + len;
+		rebase_cache(cache, old_arena, song_nb);
+	}
+	pos = cache->arena_pos;
+	memcpy(cache->arena + pos, str, len);
+	cache->arena_pos += len;
+
+	return pos;
+}
+
+static int fill_cache_entry(struct album_cache *cache, char *dirname, char *name, int idx)
+{
+	char *old_arena;
+	char *filename;
+	int name_pos;
+	int pos;
+	int ret;
+
+	name_pos = arena_add_string(cache, name, idx);
+	if (name_pos < 0)
+		return -1;
+
+	filename = concat(dirname, name);
+	if (!filename)
+		return -1;
+	old_arena = cache->arena;
+	pos = cache->arena_pos;
+	ret = read_db_file(filename, &cache->arena, &cache->arena_len, pos);
+	free(filename);
+	if (ret < 0)
+		return -1;
+	if (old_arena != cache->arena)
+		rebase_cache(cache, old_arena, idx);
+	cache->arena_pos += ret;
+
+	cache->songs[idx].name = cache->arena + name_pos;
+	parse_db_info(cache->arena + pos, &cache->songs[idx].info);
+
+	return 0;
+}
+
+static struct album_cache *refill_cache(void *hdl, struct album_cache *cache, char *dirname)
 {
-	struct db *db = hdl;
-	struct album_cache *cache = &db->cache;
 	int count = 0;
 	int idx = 0;
 	struct dirent *entry;
@@ -187,11 +397,14 @@ static struct album_cache *refill_cache(void *hdl, char *dirname)
 		return NULL;
 	}
 
-	cache->songs = malloc(count * sizeof(struct song_cache));
-	if (cache->songs == NULL) {
+	cache->arena_len = count * (sizeof(struct song_cache) + ARENA_INIT_SONG_SZ);
+	cache->arena = malloc(cache->arena_len);
+	if (cache->arena == NULL) {
 		closedir(d);
 		return NULL;
 	}
+	cache->songs = (struct song_cache *) cache->arena;
+	cache->arena_pos = count * sizeof(struct song_cache);
 
 	ESP_LOGI(TAG, "cache song entries is %d", count);
 
@@ -199,26 +412,34 @@ static struct album_cache *refill_cache(void *hdl, char *dirname)
 	rewinddir(d);
 	entry = readdir(d);
 	while (entry) {
-		char *filename;
 		if (entry->d_type != DT_REG)
 			goto skip_entry;
-		filename = concat(dirname, entry->d_name);
-		assert(filename);
-		ESP_LOGI(TAG, "Fill cache entry %d %s", idx, filename);
-		res = read_db_info_by_filename(filename, &cache->songs[idx++].info);
-		assert(res == 0);
-		free(filename);
+		if (idx == count)
+			break;
+		ESP_LOGD(TAG, "Fill cache entry %d %s", idx, entry->d_name);
+		res = fill_cache_entry(cache, dirname, entry->d_name, idx);
+		if (res) {
+			ESP_LOGW(TAG, "unable to cache %s/%s", dirname, entry->d_name);
+			goto skip_entry;
+		}
+		idx++;
 skip_entry:
 		entry = readdir(d);
 	}
 	closedir(d);
 
+	res = arena_add_string(cache, dirname, idx);
+	if (res < 0 || idx == 0) {
+		invalidate_cache(hdl, cache);
+		return NULL;
+	}
+
 	/* order songs by track_nb */
-	qsort(cache->songs, count, sizeof(struct song_cache),
+	qsort(cache->songs, idx, sizeof(struct song_cache),
 	      sort_songs_array);
 
-	cache->song_nb = count;
-	cache->dirname = strdup(dirname);
+	cache->song_nb = idx;
+	cache->dirname = cache->arena + res;
 
 	return cache;
 }
@@ -226,16 +447,33 @@ skip_entry:
 static struct album_cache *get_album_cache(void *hdl, char *dirname)
 {
 	struct db *db = hdl;
-	struct album_cache *cache = &db->cache;
+	struct album_cache *cache = lookup_album_cache(db, dirname);
+	int i;
 
-	if (cache->dirname && strcmp(dirname, cache->dirname) == 0) {
+	if (cache) {
+		db->cache_hit_nb++;
+		cache_hit_total++;
+		cache->last_used = ++db->tick;
 		return cache;
 	}
+	db->cache_miss_nb++;
+	cache_miss_total++;
+
+	/* select an empty slot or evict least recently used album */
+	cache = &db->cache[0];
+	for (i = 1; i < ALBUM_CACHE_NB; i++) {
+		if (!cache->dirname)
+			break;
+		if (!db->cache[i].dirname || db->cache[i].last_used < cache->last_used)
+			cache = &db->cache[i];
+	}
 
 	if (cache->dirname)
 		invalidate_cache(hdl, cache);
 
-	cache = refill_cache(hdl, dirname);
+	cache = refill_cache(hdl, cache, dirname);
+	if (cache)
+		cache->last_used = ++db->tick;
 
 	return cache;
 }
@@ -270,27 +508,108 @@ static int builder_add_album(struct db_builder *builder, struct id3_meta *meta)
 	return 0;
 }
 
-static int is_song_exist(struct db_builder *builder, struct id3_meta *meta)
+/* songs already in db are left alone, unless their entry is the one of
+ * this file and lacks audio info, as written by older versions.
+ */
+static int is_song_exist(struct db_builder *builder, char *filename, struct id3_meta *meta)
 {
+	struct db_info db_info;
 	char *filepath;
-	int fd;
+	int ret;
 
 	filepath = concat4(builder->dirname, meta->artist, meta->album, meta->title);
 	if (!filepath)
 		return 0;
 
-	fd = open(filepath, O_RDONLY);
+	ret = read_db_info_by_filename(filepath, &db_info);
 	free(filepath);
-	if (fd >= 0)
-		close(fd);
+	if (ret)
+		return 0;
 
-	return fd < 0 ? 0 : 1;
+	ret = 1;
+	if (strcmp(db_info.filepath, filename) == 0 &&
+	    ((!db_info.meta.duration_in_ms && meta->duration_in_ms) ||
+	     (!db_info.meta.bitrate && meta->bitrate) ||
+	     (!db_info.meta.samplerate && meta->samplerate)))
+		ret = 0;
+	id3_put(&db_info.meta);
+	free(db_info.filepath);
+
+	return ret;
+}
+
+/* db entry meta would go to is owned by another file */
+static int is_title_taken(struct db_builder *builder, char *filename, struct id3_meta *meta)
+{
+	struct id3_meta meta_dup;
+	struct db_info db_info;
+	char *filepath;
+	int ret;
+
+	if (id3_dup_meta(meta, &meta_dup))
+		return 0;
+	sanitize_path(meta_dup.artist);
+	sanitize_path(meta_dup.album);
+	sanitize_path(meta_dup.title);
+	filepath = concat4(builder->dirname, meta_dup.artist, meta_dup.album, meta_dup.title);
+	id3_put(&meta_dup);
+	if (!filepath)
+		return 0;
+
+	ret = read_db_info_by_filename(filepath, &db_info);
+	free(filepath);
+	if (ret)
+		return 0;
+
+	ret = strcmp(db_info.filepath, filename) != 0;
+	id3_put(&db_info.meta);
+	free(db_info.filepath);
+
+	return ret;
+}
+
+/* a song recorded twice would otherwise only be in db once, second file
+ * gets "title (2)" and so on.
+ */
+static int make_title_unique(struct db_builder *builder, char *filename, struct id3_meta *meta)
+{
+	char *title = meta->title;
+	char *numbered = NULL;
+	int len = strlen(title) + 8;
+	int i;
+
+	for (i = 2; is_title_taken(builder, filename, meta); i++) {
+		if (i > TITLE_COPY_MAX)
+			goto error;
+		if (!numbered) {
+			numbered = malloc(len);
+			if (!numbered)
+				goto error;
+		}
+		snprintf(numbered, len, "%s (%d)", title, i);
+		meta->title = numbered;
+	}
+	if (numbered) {
+		free(title);
+		ESP_LOGI(TAG, "%s added as %s", filename, numbered);
+	}
+
+	return 0;
+
+error:
+	meta->title = title;
+	free(numbered);
+
+	return -1;
 }
 
 static int builder_add_song(struct db_builder *builder, char *filename, struct id3_meta *meta)
 {
 	struct id3_meta meta_dup;
+	struct utimbuf times;
 	char *filepath = NULL;
+	struct stat st;
+	int is_rewrite;
 	char buf[32];
 	int ret;
 	int fd = -1;
@@ -303,7 +622,7 @@ static int builder_add_song(struct db_builder *builder, char *filename, struct i
 	sanitize_path(meta_dup.album);
 	sanitize_path(meta_dup.title);
 
-	if (is_song_exist(builder, &meta_dup)) {
+	if (is_song_exist(builder, filename, &meta_dup)) {
 		id3_put(&meta_dup);
 		return 0;
 	}
@@ -324,6 +643,7 @@ static int builder_add_song(struct db_builder *builder, char *filename, struct i
 	if (!filepath)
 		goto error;
 
+	is_rewrite = stat(filepath, &st) == 0;
 	fd = creat(filepath, 0666);
 	if (fd < 0)
 		goto error;
@@ -354,9 +674,25 @@ static int builder_add_song(struct db_builder *builder, char *filename, struct i
 	if (ret != strlen(buf) + 1)
 		goto error;
 
+	snprintf(buf, 32, "%d", meta->bitrate);
+	ret = write(fd, buf, strlen(buf) + 1);
+	if (ret != strlen(buf) + 1)
+		goto error;
+
+	snprintf(buf, 32, "%d", meta->samplerate);
+	ret = write(fd, buf, strlen(buf) + 1);
+	if (ret != strlen(buf) + 1)
+		goto error;
+
 	id3_put(&meta_dup);
-	free(filepath);
 	close(fd);
+	/* entry time is when song was added, see index_add_song */
+	if (is_rewrite) {
+		times.actime = st.st_atime;
+		times.modtime = st.st_mtime;
+		utime(filepath, &times);
+	}
+	free(filepath);
 
 	return 0;
 
@@ -465,6 +801,53 @@ cleanup:
 	return 0;
 }
 
+static int index_add_song(char *dir, char *name, void *arg)
+{
+	void *index_builder = arg;
+	struct db_info db_info;
+	uint32_t added = 0;
+	struct stat st;
+	char *filename;
+	int ret;
+
+	filename = concat(dir , name);
+	if (!filename)
+		return -1;
+
+	ret = read_db_info_by_filename(filename, &db_info);
+	/* db entries keep their time when rewritten, so it's when song was added */
+	if (!ret && stat(filename, &st) == 0)
+		added = st.st_mtime;
+	free(filename);
+	if (ret)
+		return 0;
+
+	ret = db_index_builder_add(index_builder, db_info.filepath, &db_info.meta, added);
+	id3_put(&db_info.meta);
+	free(db_info.filepath);
+
+	return ret;
+}
+
+static int build_index(char *dirname)
+{
+	struct walk_dir_cbs cbs = {NULL};
+	void *index_builder;
+	int ret;
+
+	index_builder = db_index_builder_create(dirname);
+	if (!index_builder)
+		return -1;
+
+	cbs.reg_cb = index_add_song;
+	ret = walk_dir(dirname, &cbs, index_builder);
+	if (!ret)
+		ret = db_index_builder_commit(index_builder);
+	db_index_builder_destroy(index_builder);
+
+	return ret;
+}
+
 static int builder_open(struct db_builder *builder, char *dirname, char *root_dir)
 {
 	int ret;
@@ -491,6 +874,7 @@ int update_db(char *dirname, char *root_dir)
 	struct walk_dir_cbs cbs = {NULL};
 	struct db_builder builder;
 	int ret;
+	int err;
 
 	ret = builder_open(&builder, dirname, root_dir);
 	if (ret) {
@@ -498,22 +882,235 @@ int update_db(char *dirname, char *root_dir)
 
 		return ret;
 	}
+	if (db_index_write_try()) {
+		ESP_LOGE(TAG, "db %s is in use, close it before updating", dirname);
+		builder_close(&builder);
+
+		return -EBUSY;
+	}
 
 	cbs.reg_cb = add_new_song;
 	ret = walk_dir(root_dir, &cbs, &builder);
 	if (ret)
 		ESP_LOGE(TAG, "failed to populate db %d", ret);
 
+	/* first error is reported, later steps still run */
 	cbs.reg_cb = remove_old_song;
-	ret = walk_dir(dirname, &cbs, &builder);
-	if (ret)
-		ESP_LOGE(TAG, "failed to cleanup db %d", ret);
+	err = walk_dir(dirname, &cbs, &builder);
+	if (err)
+		ESP_LOGE(TAG, "failed to cleanup db %d", err);
+	ret = ret ? ret : err;
 
+	err = build_index(dirname);
+	if (err)
+		ESP_LOGE(TAG, "failed to build db index %d", err);
+	ret = ret ? ret : err;
+
+	db_index_write_end();
 	builder_close(&builder);
 
 	return ret;
 }
 
+static int index_copy_track(struct db_track *track, int idx, void *arg)
+{
+	struct reindex *reindex = arg;
+	struct add_request *req;
+	struct id3_meta meta;
+
+	/* songs are added again */
+	for (req = reindex->requests; req; req = req->next) {
+		if (req->is_added && track->id == db_track_id(req->filename))
+			return 0;
+	}
+
+	meta.artist = track->artist;
+	meta.album = track->album;
+	meta.title = track->title;
+	meta.track_nb = track->track_nb;
+	meta.duration_in_ms = track->duration_in_ms;
+	meta.bitrate = track->bitrate;
+	meta.samplerate = track->samplerate;
+	reindex->ret = db_index_builder_add(reindex->builder, track->filepath, &meta,
+					    track->added);
+
+	return reindex->ret;
+}
+
+/* index is rebuilt from the current one in a single pass instead of
+ * reading every db entry again.
+ */
+static int reindex_with(char *dirname, struct add_request *requests)
+{
+	struct add_request *req;
+	struct reindex reindex;
+	uint32_t now = time(NULL);
+	void *index;
+	int ret;
+
+	index = db_index_open(dirname);
+	if (!index)
+		return build_index(dirname);
+
+	reindex.builder = db_index_builder_create(dirname);
+	if (!reindex.builder) {
+		db_index_close(index);
+		return -1;
+	}
+	reindex.requests = requests;
+	reindex.ret = 0;
+	ret = db_index_scan(index, 1, index_copy_track, &reindex);
+	db_index_close(index);
+	if (!ret)
+		ret = reindex.ret;
+	for (req = requests; req && !ret; req = req->next) {
+		if (req->is_added)
+			ret = db_index_builder_add(reindex.builder, req->filename, &req->meta, now);
+	}
+	if (!ret)
+		ret = db_index_builder_commit(reindex.builder);
+	db_index_builder_destroy(reindex.builder);
+
+	return ret;
+}
+
+static void add_song(struct db_builder *builder, struct add_request *req)
+{
+	if (id3_get(req->filename, &req->meta))
+		return ;
+	if (!req->meta.artist || !req->meta.album || !req->meta.title)
+		return ;
+	if (make_title_unique(builder, req->filename, &req->meta))
+		return ;
+	req->is_added = !builder_add_song(builder, req->filename, &req->meta);
+}
+
+/* requests are all for the same db */
+static void add_songs(char *dirname, struct add_request *requests)
+{
+	struct db_builder builder;
+	struct add_request *req;
+	int ret;
+
+	ret = builder_open(&builder, dirname, NULL);
+	for (req = requests; req && !ret; req = req->next) {
+		add_song(&builder, req);
+		if (!req->is_added)
+			ESP_LOGW(TAG, "unable to add %s to db", req->filename);
+	}
+	if (!ret)
+		ret = reindex_with(dirname, requests);
+	if (ret)
+		ESP_LOGE(TAG, "failed to update db index %d", ret);
+	builder_close(&builder);
+}
+
+static void put_requests(struct add_request *requests)
+{
+	struct add_request *next;
+
+	while (requests) {
+		next = requests->next;
+		id3_put(&requests->meta);
+		free(requests);
+		requests = next;
+	}
+}
+
+/* db entries and index are written while no handle is opened on it, at low
+ * priority, so songs can be added from time critical tasks.
+ */
+static void add_task(void *arg)
+{
+	struct add_request *requests;
+	struct add_request **prev;
+	struct add_request *others;
+	struct add_request *req;
+
+	while (1) {
+		while (db_index_write_try())
+			vTaskDelay(pdMS_TO_TICKS(ADD_RETRY_MS));
+
+		taskENTER_CRITICAL(&add_mux);
+		requests = add_head;
+		add_head = NULL;
+		if (!requests)
+			is_adding = 0;
+		taskEXIT_CRITICAL(&add_mux);
+		if (!requests) {
+			db_index_write_end();
+			break;
+		}
+
+		/* other dbs wait for next round */
+		others = NULL;
+		prev = &requests->next;
+		while ((req = *prev)) {
+			if (strcmp(req->dirname, requests->dirname)) {
+				*prev = req->next;
+				req->next = others;
+				others = req;
+			} else {
+				prev = &req->next;
+			}
+		}
+		add_songs(requests->dirname, requests);
+		db_index_write_end();
+		put_requests(requests);
+
+		if (others) {
+			taskENTER_CRITICAL(&add_mux);
+			for (req = others; req->next; req = req->next)
+				;
+			req->next = add_head;
+			add_head = others;
+			taskEXIT_CRITICAL(&add_mux);
+		}
+	}
+
+	vTaskDelete(NULL);
+}
+
+/* add a single file to db without scanning music directories. It's done
+ * later by a background task, 0 means song is queued.
+ */
+int db_add_song(char *dirname, char *filename)
+{
+	struct add_request *req;
+	struct add_request **tail;
+	TaskHandle_t task;
+	BaseType_t res;
+	int is_started;
+	int len;
+
+	len = strlen(dirname) + strlen(filename) + 2;
+	req = malloc(sizeof(*req) + len);
+	if (!req)
+		return -1;
+	memset(req, 0, sizeof(*req));
+	req->dirname = (char *) (req + 1);
+	req->filename = req->dirname + strlen(dirname) + 1;
+	strcpy(req->dirname, dirname);
+	strcpy(req->filename, filename);
+
+	/* songs are added in order */
+	taskENTER_CRITICAL(&add_mux);
+	for (tail = &add_head; *tail; tail = &(*tail)->next)
+		;
+	*tail = req;
+	is_started = is_adding;
+	is_adding = 1;
+	taskEXIT_CRITICAL(&add_mux);
+	if (is_started)
+		return 0;
+
+	res = xTaskCreatePinnedToCore(add_task, "db add", 3 * 4096, NULL,
+				      tskIDLE_PRIORITY + 1, &task, tskNO_AFFINITY);
+	assert(res == pdPASS);
+
+	return 0;
+}
+
 /* read stuff */
 static int count_directories(char *root)
 {
@@ -649,19 +1246,46 @@ void *db_open(char *dirname)
 	memset(db, 0, sizeof(struct db));
 
 	db->dirname = dirname;
+	db->browse = db_browse_open(dirname);
+	if (!db->browse)
+		ESP_LOGW(TAG, "no browse index, use directory order");
+	db->thumb = db_thumb_open(dirname);
+	db->index = db_index_open(dirname);
 
 	return db;
 }
 
 void db_close(void *hdl)
 {
+	struct db *db = hdl;
+	int i;
+
+	ESP_LOGI(TAG, "album cache hit %d / miss %d", db->cache_hit_nb,
+		 db->cache_miss_nb);
+	for (i = 0; i < ALBUM_CACHE_NB; i++)
+		invalidate_cache(hdl, &db->cache[i]);
+	if (db->browse)
+		db_browse_close(db->browse);
+	if (db->thumb)
+		db_thumb_close(db->thumb);
+	if (db->index)
+		db_index_close(db->index);
 	free(hdl);
 }
 
+void db_cache_stats(int *hit_nb, int *miss_nb)
+{
+	*hit_nb = cache_hit_total;
+	*miss_nb = cache_miss_total;
+}
+
 int db_artist_get_nb(void *hdl)
 {
 	struct db *db = hdl;
 
+	if (db->browse)
+		return db_browse_artist_nb(db->browse);
+
 	return count_directories(db->dirname);
 }
 
@@ -674,15 +1298,31 @@ char *db_artist_get(void *hdl, int index)
 {
 	struct db *db = hdl;
 
+	if (db->browse)
+		return db_browse_artist(db->browse, index);
+
 	return dir_name(db->dirname, index);
 }
 
+int db_artist_jump(void *hdl, int index, int direction)
+{
+	struct db *db = hdl;
+
+	if (!db->browse)
+		return index;
+
+	return db_browse_jump(db->browse, index, direction);
+}
+
 int db_album_get_nb(void *hdl, char *artist)
 {
 	struct db *db = hdl;
 	char *dirname;
 	int ret;
 
+	if (db->browse)
+		return db_browse_album_nb(db->browse, artist);
+
 	dirname = concat(db->dirname, artist);
 	if (!dirname)
 		return 0;
@@ -698,6 +1338,9 @@ char *db_album_get(void *hdl, char *artist, int index)
 	char *dirname;
 	char *res;
 
+	if (db->browse)
+		return db_browse_album(db->browse, artist, index);
+
 	dirname = concat(db->dirname, artist);
 	if (!dirname)
 		return NULL;
@@ -707,6 +1350,16 @@ char *db_album_get(void *hdl, char *artist, int index)
 	return res;
 }
 
+int db_album_get_thumb(void *hdl, char *artist, char *album, uint16_t *pixels)
+{
+	struct db *db = hdl;
+
+	if (!db->thumb)
+		return -1;
+
+	return db_thumb_get(db->thumb, artist, album, pixels);
+}
+
 int db_song_get_nb(void *hdl, char *artist, char *album)
 {
 	struct db *db = hdl;
@@ -788,6 +1441,75 @@ int db_song_get_meta_from_file(void *hdl, char *path, struct id3_meta *meta)
 	return 0;
 }
 
+int db_song_get_id(void *hdl, char *artist, char *album, char *song, uint32_t *id)
+{
+	char *filepath;
+
+	filepath = db_song_get_filepath(hdl, artist, album, song);
+	if (!filepath)
+		return -1;
+	*id = db_track_id(filepath);
+	free(filepath);
+
+	return 0;
+}
+
+int db_track_get_from_file(void *hdl, char *path, struct db_track *track)
+{
+	struct db *db = hdl;
+	struct db_info db_info;
+	char *buffer = NULL;
+	int buffer_len = 0;
+	char *filename;
+	int ret;
+
+	filename = concat(db->dirname, path);
+	if (!filename)
+		return -1;
+	ret = read_db_file(filename, &buffer, &buffer_len, 0);
+	free(filename);
+	if (ret < 0) {
+		free(buffer);
+		return -1;
+	}
+
+	/* track strings point inside buffer which is released by db_track_put */
+	parse_db_info(buffer, &db_info);
+	memset(track, 0, sizeof(*track));
+	track->id = db_track_id(db_info.filepath);
+	track->filepath = db_info.filepath;
+	track->artist = db_info.meta.artist;
+	track->album = db_info.meta.album;
+	track->title = db_info.meta.title;
+	track->track_nb = db_info.meta.track_nb;
+	track->duration_in_ms = db_info.meta.duration_in_ms;
+	track->bitrate = db_info.meta.bitrate;
+	track->samplerate = db_info.meta.samplerate;
+	track->strings = buffer;
+
+	return 0;
+}
+
+int db_track_get(void *hdl, uint32_t id, struct db_track *track)
+{
+	struct db *db = hdl;
+	int idx;
+
+	if (!db->index)
+		return -1;
+
+	idx = db_index_find_track(db->index, id);
+	if (idx < 0)
+		return -1;
+
+	return db_index_get_track(db->index, idx, track);
+}
+
+void db_track_put(void *hdl, struct db_track *track)
+{
+	db_index_put_track(track);
+}
+
 void db_put_meta(void *hdl, struct id3_meta *meta)
 {
 	id3_put(meta);
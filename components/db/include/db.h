@@ -1,21 +1,32 @@
 #ifndef __DB__
 #define __DB__ 1
 
+#include <stdint.h>
+
 #include "id3.h"
+#include "db_index.h"
 
 int update_db(char *dirname, char *root_dir);
+int db_add_song(char *dirname, char *filename);
 
 void *db_open(char *dirname);
 void db_close(void *hdl);
+void db_cache_stats(int *hit_nb, int *miss_nb);
 int db_artist_get_nb(void *hdl);
 char *db_artist_get(void *hdl, int index);
+int db_artist_jump(void *hdl, int index, int direction);
 int db_album_get_nb(void *hdl, char *artist);
 char *db_album_get(void *hdl, char *artist, int index);
+int db_album_get_thumb(void *hdl, char *artist, char *album, uint16_t *pixels);
 int db_song_get_nb(void *hdl, char *artist, char *album);
 char *db_song_get(void *hdl, char *artist, char *album, int index);
 char *db_song_get_filepath(void *hdl, char *artist, char *album, char *song);
 int db_song_get_meta(void *hdl, char *artist, char *album, char *song, struct id3_meta *meta);
 int db_song_get_meta_from_file(void *hdl, char *path, struct id3_meta *meta);
+int db_song_get_id(void *hdl, char *artist, char *album, char *song, uint32_t *id);
+int db_track_get(void *hdl, uint32_t id, struct db_track *track);
+int db_track_get_from_file(void *hdl, char *path, struct db_track *track);
+void db_track_put(void *hdl, struct db_track *track);
 
 void db_put_item(void *hdl, char *name);
 void db_put_meta(void *hdl, struct id3_meta *meta);
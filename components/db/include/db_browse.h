@@ -0,0 +1,16 @@
+#ifndef __DB_BROWSE__
+#define __DB_BROWSE__ 1
+
+#include "db_index.h"
+
+int db_browse_build(char *dirname, struct db_track *tracks, int track_nb);
+
+void *db_browse_open(char *dirname);
+void db_browse_close(void *hdl);
+int db_browse_artist_nb(void *hdl);
+char *db_browse_artist(void *hdl, int index);
+int db_browse_album_nb(void *hdl, char *artist);
+char *db_browse_album(void *hdl, char *artist, int index);
+int db_browse_jump(void *hdl, int index, int direction);
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef __DB_INDEX__
+#define __DB_INDEX__ 1
+
+#include <stdint.h>
+
+#include "id3.h"
+
+/* browse order keys, only available while building the index */
+struct db_track_keys {
+	char *artist;
+	char *artist_dir;
+	char *album;
+	char *album_dir;
+	char *title;
+};
+
+struct db_track {
+	uint32_t id;
+	char *filepath;
+	char *artist;
+	char *album;
+	char *title;
+	int track_nb;
+	int duration_in_ms;
+	int bitrate;
+	int samplerate;
+	/* unix time track entered db */
+	uint32_t added;
+	/* private */
+	char *strings;
+	struct db_track_keys *keys;
+};
+
+typedef int (*db_index_scan_cb)(struct db_track *track, int idx, void *arg);
+
+/* track id to track index in tracks index */
+struct db_track_ref {
+	uint32_t id;
+	uint32_t idx;
+};
+
+uint32_t db_track_id(char *filepath);
+uint32_t db_album_id(char *artist, char *album);
+int db_track_is_new_artist(struct db_track *tracks, int idx);
+int db_track_is_new_album(struct db_track *tracks, int idx);
+char *db_index_path(char *dirname, char *name);
+int db_index_replace(char *dirname, char *tmp_name, char *name);
+void db_index_read_begin(void);
+void db_index_read_end(void);
+int db_index_write_try(void);
+void db_index_write_end(void);
+
+void *db_index_builder_create(char *dirname);
+void db_index_builder_destroy(void *hdl);
+int db_index_builder_add(void *hdl, char *filepath, struct id3_meta *meta, uint32_t added);
+int db_index_builder_commit(void *hdl);
+
+void *db_index_open(char *dirname);
+void db_index_close(void *hdl);
+int db_index_track_nb(void *hdl);
+int db_index_get_track(void *hdl, int idx, struct db_track *track);
+void db_index_put_track(struct db_track *track);
+int db_index_get_refs(void *hdl, int start, struct db_track_ref *refs, int nb);
+int db_index_find_track(void *hdl, uint32_t id);
+uint32_t db_index_stamp(void *hdl);
+int db_index_scan(void *hdl, int with_strings, db_index_scan_cb cb, void *arg);
+
+#endif
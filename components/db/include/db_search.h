@@ -0,0 +1,18 @@
+#ifndef __DB_SEARCH__
+#define __DB_SEARCH__ 1
+
+#include "db_index.h"
+
+struct db_search_result {
+	struct db_track track;
+	int score;
+};
+
+int db_search_build(char *dirname, struct db_track *tracks, int track_nb);
+
+void *db_search_open(char *dirname);
+void db_search_close(void *hdl);
+int db_search(void *hdl, char *query, struct db_search_result *results, int result_nb);
+void db_search_put_results(void *hdl, struct db_search_result *results, int result_nb);
+
+#endif
@@ -0,0 +1,9 @@
+#ifndef __DB_SMART__
+#define __DB_SMART__ 1
+
+#include <stdint.h>
+
+int db_smart_eval(char *dirname, char *rules_filename, uint32_t **ids, int *id_nb);
+void db_smart_put_ids(uint32_t *ids);
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef __DB_STATS__
+#define __DB_STATS__ 1
+
+#include <stdint.h>
+
+#include "db_index.h"
+
+enum db_stats_event {
+	DB_STATS_START,
+	DB_STATS_COMPLETE,
+	DB_STATS_SKIP,
+};
+
+enum db_stats_list {
+	DB_STATS_MOST_PLAYED,
+	DB_STATS_RECENTLY_PLAYED,
+	DB_STATS_NEVER_PLAYED,
+};
+
+/* per track counters. last_played is a unix time, 0 if never started */
+struct db_stats_track {
+	uint32_t id;
+	uint16_t play_nb;
+	uint16_t skip_nb;
+	uint32_t last_played;
+};
+
+void *db_stats_open(char *dirname);
+void db_stats_close(void *hdl);
+int db_stats_log(void *hdl, uint32_t track_id, enum db_stats_event event);
+int db_stats_flush(void *hdl);
+int db_stats_compact(char *dirname);
+
+/* all counters sorted by track id, to be released with free */
+int db_stats_counters(char *dirname, struct db_stats_track **tracks, int *track_nb);
+int db_stats_list(char *dirname, enum db_stats_list list, struct db_track *tracks, int track_nb);
+void db_stats_put_list(struct db_track *tracks, int track_nb);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __DB_THUMB__
+#define __DB_THUMB__ 1
+
+#include <stdint.h>
+
+#include "db_index.h"
+
+/* thumbnails are square RGB565 pixmaps in display byte order */
+#define DB_THUMB_SIZE		48
+#define DB_THUMB_BYTES		(DB_THUMB_SIZE * DB_THUMB_SIZE * 2)
+
+int db_thumb_build(char *dirname, struct db_track *tracks, int track_nb);
+
+void *db_thumb_open(char *dirname);
+void db_thumb_close(void *hdl);
+int db_thumb_get(void *hdl, char *artist, char *album, uint16_t *pixels);
+
+#endif
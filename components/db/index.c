@@ -0,0 +1,749 @@
+#include "db_index.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "utils.h"
+#include "db_search.h"
+#include "db_browse.h"
+#include "db_thumb.h"
+
+static const char* TAG = "rv3.db_index";
+
+#define INDEX_MAGIC		0x49335652
+#define INDEX_VERSION		4
+#define BUILDER_TRACK_CHUNK	256
+#define WRITER_BUFFER_SZ	(8 * 1024)
+#define SORT_KEY_SZ		64
+#define SCAN_TRACK_CHUNK	128
+#define SCAN_STRINGS_SZ		(8 * 1024)
+#define GATE_POLL_MS		100
+
+/* tracks file layout is :
+ *  - struct index_hdr
+ *  - track_nb struct index_track, in browse order. i.e ordered by artist
+ *    and album sort keys, then by track_nb.
+ *  - strings area. For each track filepath, artist, album and title '\0'
+ *    terminated strings.
+ *  - track_nb struct db_track_ref sorted by track id.
+ */
+struct index_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t track_nb;
+	uint32_t strings_offset;
+	uint32_t refs_offset;
+	/* changes on each rebuild */
+	uint32_t build_time;
+};
+
+struct index_track {
+	uint32_t id;
+	uint32_t strings;
+	uint16_t strings_len;
+	uint16_t track_nb;
+	uint32_t duration_in_ms;
+	uint16_t bitrate;
+	uint16_t samplerate;
+	uint32_t added;
+};
+
+struct index_builder {
+	char *dirname;
+	struct db_track *tracks;
+	int track_nb;
+	int track_max;
+};
+
+struct index {
+	int fd;
+	struct index_hdr hdr;
+};
+
+struct writer {
+	int fd;
+	int pos;
+	char buffer[WRITER_BUFFER_SZ];
+};
+
+static int writer_flush(struct writer *writer)
+{
+	int ret;
+
+	if (!writer->pos)
+		return 0;
+
+	ret = write(writer->fd, writer->buffer, writer->pos);
+	if (ret != writer->pos)
+		return -1;
+	writer->pos = 0;
+
+	return 0;
+}
+
+static int writer_write(struct writer *writer, void *data, int len)
+{
+	char *d = data;
+	int consume;
+	int ret;
+
+	while (len) {
+		consume = MIN(len, WRITER_BUFFER_SZ - writer->pos);
+		memcpy(&writer->buffer[writer->pos], d, consume);
+		writer->pos += consume;
+		d += consume;
+		len -= consume;
+		if (writer->pos == WRITER_BUFFER_SZ) {
+			ret = writer_flush(writer);
+			if (ret)
+				return ret;
+		}
+	}
+
+	return 0;
+}
+
+static int sort_tracks(const void *pa, const void *pb)
+{
+	const struct db_track *a = pa;
+	const struct db_track *b = pb;
+	int ret;
+
+	ret = strcmp(a->keys->artist, b->keys->artist);
+	if (ret)
+		return ret;
+	ret = strcmp(a->keys->artist_dir, b->keys->artist_dir);
+	if (ret)
+		return ret;
+	ret = strcmp(a->keys->album, b->keys->album);
+	if (ret)
+		return ret;
+	ret = strcmp(a->keys->album_dir, b->keys->album_dir);
+	if (ret)
+		return ret;
+	if (a->track_nb != b->track_nb)
+		return a->track_nb < b->track_nb ? -1 : 1;
+
+	return strcmp(a->keys->title, b->keys->title);
+}
+
+/* sort key is the folded string without leading article, so that
+ * "The Cure" sorts as "cure" and "Élodie" next to "elodie".
+ */
+static void sort_key(char *str, char *key)
+{
+	utf8_fold(str, key, SORT_KEY_SZ);
+	if (strncmp(key, "the ", 4) == 0 && key[4])
+		memmove(key, key + 4, strlen(key + 4) + 1);
+}
+
+static char *add_string(char **buf, char *str)
+{
+	char *res = *buf;
+
+	strcpy(res, str);
+	*buf += strlen(str) + 1;
+
+	return res;
+}
+
+static void parse_track_strings(struct db_track *track)
+{
+	char *buffer = track->strings;
+
+	track->filepath = buffer;
+	buffer += strlen(buffer) + 1;
+	track->artist = buffer;
+	buffer += strlen(buffer) + 1;
+	track->album = buffer;
+	buffer += strlen(buffer) + 1;
+	track->title = buffer;
+}
+
+static int track_strings_len(struct db_track *track)
+{
+	return strlen(track->filepath) + 1 + strlen(track->artist) + 1 +
+	       strlen(track->album) + 1 + strlen(track->title) + 1;
+}
+
+static int sort_refs(const void *pa, const void *pb)
+{
+	const struct db_track_ref *a = pa;
+	const struct db_track_ref *b = pb;
+
+	if (a->id == b->id)
+		return 0;
+
+	return a->id < b->id ? -1 : 1;
+}
+
+static int write_refs(struct index_builder *builder, struct writer *writer)
+{
+	struct db_track_ref *refs;
+	int ret;
+	int i;
+
+	refs = malloc(builder->track_nb * sizeof(struct db_track_ref) + 1);
+	if (!refs)
+		return -1;
+	for (i = 0; i < builder->track_nb; i++) {
+		refs[i].id = builder->tracks[i].id;
+		refs[i].idx = i;
+	}
+	qsort(refs, builder->track_nb, sizeof(struct db_track_ref), sort_refs);
+	ret = writer_write(writer, refs, builder->track_nb * sizeof(struct db_track_ref));
+	free(refs);
+
+	return ret;
+}
+
+static int write_tracks(struct index_builder *builder, char *filename)
+{
+	struct index_track rec;
+	struct index_hdr hdr;
+	struct writer *writer;
+	uint32_t strings = 0;
+	int ret = -1;
+	int i;
+
+	writer = malloc(sizeof(*writer));
+	if (!writer)
+		return -1;
+	writer->pos = 0;
+	writer->fd = creat(filename, 0666);
+	if (writer->fd < 0) {
+		free(writer);
+		return -1;
+	}
+
+	hdr.magic = INDEX_MAGIC;
+	hdr.version = INDEX_VERSION;
+	hdr.build_time = time(NULL);
+	hdr.track_nb = builder->track_nb;
+	hdr.strings_offset = sizeof(hdr) + builder->track_nb * sizeof(rec);
+	hdr.refs_offset = hdr.strings_offset;
+	for (i = 0; i < builder->track_nb; i++)
+		hdr.refs_offset += track_strings_len(&builder->tracks[i]);
+	if (writer_write(writer, &hdr, sizeof(hdr)))
+		goto error;
+
+	for (i = 0; i < builder->track_nb; i++) {
+		struct db_track *track = &builder->tracks[i];
+
+		memset(&rec, 0, sizeof(rec));
+		rec.id = track->id;
+		rec.strings = strings;
+		rec.strings_len = track_strings_len(track);
+		rec.track_nb = track->track_nb;
+		rec.duration_in_ms = track->duration_in_ms;
+		rec.bitrate = track->bitrate;
+		rec.samplerate = track->samplerate;
+		rec.added = track->added;
+		if (writer_write(writer, &rec, sizeof(rec)))
+			goto error;
+		strings += rec.strings_len;
+	}
+
+	for (i = 0; i < builder->track_nb; i++) {
+		struct db_track *track = &builder->tracks[i];
+
+		if (writer_write(writer, track->strings, track_strings_len(track)))
+			goto error;
+	}
+	if (write_refs(builder, writer))
+		goto error;
+	ret = writer_flush(writer);
+
+error:
+	close(writer->fd);
+	free(writer);
+
+	return ret;
+}
+
+/* index files are replaced in place when db is updated, so handles on them
+ * are counted. An update only starts once they're all closed and opening
+ * waits while it runs, except in updating task which reads the index it
+ * rebuilds.
+ */
+static portMUX_TYPE gate_mux = portMUX_INITIALIZER_UNLOCKED;
+static TaskHandle_t writer;
+static int reader_nb;
+
+/* public api */
+void db_index_read_begin(void)
+{
+	TaskHandle_t self = xTaskGetCurrentTaskHandle();
+	int is_open;
+
+	while (1) {
+		taskENTER_CRITICAL(&gate_mux);
+		is_open = !writer || writer == self;
+		if (is_open)
+			reader_nb++;
+		taskEXIT_CRITICAL(&gate_mux);
+		if (is_open)
+			return ;
+		vTaskDelay(pdMS_TO_TICKS(GATE_POLL_MS));
+	}
+}
+
+void db_index_read_end(void)
+{
+	taskENTER_CRITICAL(&gate_mux);
+	reader_nb--;
+	taskEXIT_CRITICAL(&gate_mux);
+}
+
+/* fat can't keep a removed file readable, so it fails while any is opened */
+int db_index_write_try(void)
+{
+	int ret = -1;
+
+	taskENTER_CRITICAL(&gate_mux);
+	if (!writer && !reader_nb) {
+		writer = xTaskGetCurrentTaskHandle();
+		ret = 0;
+	}
+	taskEXIT_CRITICAL(&gate_mux);
+
+	return ret;
+}
+
+void db_index_write_end(void)
+{
+	taskENTER_CRITICAL(&gate_mux);
+	writer = NULL;
+	taskEXIT_CRITICAL(&gate_mux);
+}
+
+uint32_t db_track_id(char *filepath)
+{
+	return fnv1a(FNV1A_INIT, filepath, strlen(filepath));
+}
+
+static uint32_t fnv1a_path(uint32_t hash, char *str)
+{
+	unsigned char c;
+
+	while (*str) {
+		c = *str++;
+		/* hash as sanitized so db directory names and raw names match */
+		if (c == '/' || c == '?' || c == ':' || c == '"')
+			c = '_';
+		hash = fnv1a(hash, &c, 1);
+	}
+
+	return hash;
+}
+
+uint32_t db_album_id(char *artist, char *album)
+{
+	uint32_t hash = FNV1A_INIT;
+
+	hash = fnv1a_path(hash, artist);
+	hash = fnv1a(hash, "/", 1);
+
+	return fnv1a_path(hash, album);
+}
+
+/* only valid while building, tracks must be in browse order */
+int db_track_is_new_artist(struct db_track *tracks, int idx)
+{
+	return idx == 0 ||
+	       strcmp(tracks[idx].keys->artist_dir, tracks[idx - 1].keys->artist_dir);
+}
+
+int db_track_is_new_album(struct db_track *tracks, int idx)
+{
+	return db_track_is_new_artist(tracks, idx) ||
+	       strcmp(tracks[idx].keys->album_dir, tracks[idx - 1].keys->album_dir);
+}
+
+char *db_index_path(char *dirname, char *name)
+{
+	char *index_dir = concat_with_delim(dirname, "idx", '.');
+	char *res;
+
+	if (!index_dir || !name)
+		return index_dir;
+
+	res = concat(index_dir, name);
+	free(index_dir);
+
+	return res;
+}
+
+int db_index_replace(char *dirname, char *tmp_name, char *name)
+{
+	char *tmp_path = db_index_path(dirname, tmp_name);
+	char *path = db_index_path(dirname, name);
+	int ret = -1;
+
+	if (tmp_path && path) {
+		unlink(path);
+		ret = rename(tmp_path, path);
+	}
+	free(tmp_path);
+	free(path);
+
+	return ret;
+}
+
+void *db_index_builder_create(char *dirname)
+{
+	struct index_builder *builder;
+
+	builder = malloc(sizeof(*builder));
+	if (!builder)
+		return NULL;
+	memset(builder, 0, sizeof(*builder));
+	builder->dirname = dirname;
+
+	return builder;
+}
+
+void db_index_builder_destroy(void *hdl)
+{
+	struct index_builder *builder = hdl;
+	int i;
+
+	for (i = 0; i < builder->track_nb; i++)
+		free(builder->tracks[i].keys);
+	free(builder->tracks);
+	free(builder);
+}
+
+int db_index_builder_add(void *hdl, char *filepath, struct id3_meta *meta, uint32_t added)
+{
+	struct index_builder *builder = hdl;
+	char artist_key[SORT_KEY_SZ];
+	char album_key[SORT_KEY_SZ];
+	char title_key[SORT_KEY_SZ];
+	struct db_track_keys *keys;
+	struct db_track *tracks;
+	struct db_track *track;
+	int strings_len;
+	int keys_len;
+	char *buf;
+
+	if (builder->track_nb == builder->track_max) {
+		tracks = realloc(builder->tracks, (builder->track_max + BUILDER_TRACK_CHUNK) *
+				 sizeof(struct db_track));
+		if (!tracks)
+			return -1;
+		builder->tracks = tracks;
+		builder->track_max += BUILDER_TRACK_CHUNK;
+	}
+
+	sort_key(meta->artist, artist_key);
+	sort_key(meta->album, album_key);
+	sort_key(meta->title, title_key);
+
+	track = &builder->tracks[builder->track_nb];
+	memset(track, 0, sizeof(*track));
+	track->filepath = filepath;
+	track->artist = meta->artist;
+	track->album = meta->album;
+	track->title = meta->title;
+	strings_len = track_strings_len(track);
+	keys_len = strlen(artist_key) + 1 + strlen(meta->artist) + 1 +
+		   strlen(album_key) + 1 + strlen(meta->album) + 1 +
+		   strlen(title_key) + 1;
+
+	/* keys, strings and keys strings share a single allocation */
+	keys = malloc(sizeof(*keys) + strings_len + keys_len);
+	if (!keys)
+		return -1;
+	track->keys = keys;
+	track->strings = (char *) (keys + 1);
+
+	buf = track->strings;
+	track->filepath = add_string(&buf, filepath);
+	track->artist = add_string(&buf, meta->artist);
+	track->album = add_string(&buf, meta->album);
+	track->title = add_string(&buf, meta->title);
+	keys->artist = add_string(&buf, artist_key);
+	keys->artist_dir = add_string(&buf, meta->artist);
+	sanitize_path(keys->artist_dir);
+	keys->album = add_string(&buf, album_key);
+	keys->album_dir = add_string(&buf, meta->album);
+	sanitize_path(keys->album_dir);
+	keys->title = add_string(&buf, title_key);
+
+	track->id = db_track_id(filepath);
+	track->track_nb = meta->track_nb;
+	track->duration_in_ms = meta->duration_in_ms;
+	track->bitrate = meta->bitrate;
+	track->samplerate = meta->samplerate;
+	track->added = added;
+	builder->track_nb++;
+
+	return 0;
+}
+
+int db_index_builder_commit(void *hdl)
+{
+	struct index_builder *builder = hdl;
+	char *filename;
+	int ret;
+
+	filename = db_index_path(builder->dirname, NULL);
+	if (!filename)
+		return -1;
+	ret = mkdir(filename, 0777);
+	free(filename);
+	if (ret && errno != EEXIST)
+		return -1;
+
+	ESP_LOGI(TAG, "commit index with %d tracks", builder->track_nb);
+	qsort(builder->tracks, builder->track_nb, sizeof(struct db_track),
+	      sort_tracks);
+
+	filename = db_index_path(builder->dirname, "tracks.tmp");
+	if (!filename)
+		return -1;
+	ret = write_tracks(builder, filename);
+	free(filename);
+	if (ret) {
+		ESP_LOGE(TAG, "unable to write tracks index");
+		return ret;
+	}
+	ret = db_index_replace(builder->dirname, "tracks.tmp", "tracks");
+	if (ret)
+		return ret;
+
+	ret = db_browse_build(builder->dirname, builder->tracks, builder->track_nb);
+	if (ret) {
+		ESP_LOGE(TAG, "unable to build browse index");
+		return ret;
+	}
+
+	/* missing covers are not fatal */
+	if (db_thumb_build(builder->dirname, builder->tracks, builder->track_nb))
+		ESP_LOGW(TAG, "unable to build thumbnails");
+
+	ret = db_search_build(builder->dirname, builder->tracks, builder->track_nb);
+	if (ret)
+		ESP_LOGE(TAG, "unable to build search index");
+
+	return ret;
+}
+
+void *db_index_open(char *dirname)
+{
+	struct index *index;
+	char *filename;
+
+	index = malloc(sizeof(*index));
+	if (!index)
+		return NULL;
+
+	db_index_read_begin();
+	filename = db_index_path(dirname, "tracks");
+	if (!filename)
+		goto error;
+	index->fd = open(filename, O_RDONLY);
+	free(filename);
+	if (index->fd < 0)
+		goto error;
+
+	if (read_at(index->fd, 0, &index->hdr, sizeof(index->hdr)))
+		goto read_error;
+	if (index->hdr.magic != INDEX_MAGIC || index->hdr.version != INDEX_VERSION) {
+		ESP_LOGW(TAG, "index has wrong version. Please update db");
+		goto read_error;
+	}
+
+	return index;
+
+read_error:
+	close(index->fd);
+error:
+	db_index_read_end();
+	free(index);
+
+	return NULL;
+}
+
+void db_index_close(void *hdl)
+{
+	struct index *index = hdl;
+
+	close(index->fd);
+	db_index_read_end();
+	free(index);
+}
+
+int db_index_track_nb(void *hdl)
+{
+	struct index *index = hdl;
+
+	return index->hdr.track_nb;
+}
+
+int db_index_get_track(void *hdl, int idx, struct db_track *track)
+{
+	struct index *index = hdl;
+	struct index_track rec;
+	int ret;
+
+	if (idx < 0 || idx >= index->hdr.track_nb)
+		return -1;
+
+	ret = read_at(index->fd, sizeof(index->hdr) + idx * sizeof(rec), &rec, sizeof(rec));
+	if (ret)
+		return ret;
+
+	track->strings = malloc(rec.strings_len);
+	if (!track->strings)
+		return -1;
+	ret = read_at(index->fd, index->hdr.strings_offset + rec.strings, track->strings,
+		      rec.strings_len);
+	if (ret) {
+		free(track->strings);
+		return ret;
+	}
+	track->strings[rec.strings_len - 1] = '\0';
+	parse_track_strings(track);
+	track->keys = NULL;
+	track->id = rec.id;
+	track->track_nb = rec.track_nb;
+	track->duration_in_ms = rec.duration_in_ms;
+	track->bitrate = rec.bitrate;
+	track->samplerate = rec.samplerate;
+	track->added = rec.added;
+
+	return 0;
+}
+
+uint32_t db_index_stamp(void *hdl)
+{
+	struct index *index = hdl;
+
+	return index->hdr.build_time ^ index->hdr.track_nb;
+}
+
+/* single sequential pass over tracks. Records and strings are read in
+ * large chunks, track strings are only valid during cb and are NULL unless
+ * with_strings is set. Scan stops when cb returns non zero.
+ */
+int db_index_scan(void *hdl, int with_strings, db_index_scan_cb cb, void *arg)
+{
+	struct index *index = hdl;
+	struct index_track *recs;
+	struct db_track track;
+	uint32_t win_start = 0;
+	uint32_t win_len = 0;
+	char *win = NULL;
+	int ret = -1;
+	int nb;
+	int i, j;
+
+	recs = malloc(SCAN_TRACK_CHUNK * sizeof(*recs));
+	if (!recs)
+		return -1;
+	if (with_strings) {
+		win = malloc(SCAN_STRINGS_SZ);
+		if (!win)
+			goto exit;
+	}
+
+	memset(&track, 0, sizeof(track));
+	for (i = 0; i < index->hdr.track_nb; i += nb) {
+		nb = MIN(SCAN_TRACK_CHUNK, (int) index->hdr.track_nb - i);
+		if (read_at(index->fd, sizeof(index->hdr) + i * sizeof(*recs), recs,
+			    nb * sizeof(*recs)))
+			goto exit;
+		for (j = 0; j < nb; j++) {
+			struct index_track *rec = &recs[j];
+
+			if (with_strings) {
+				/* strings are stored in track order so window only moves forward */
+				if (rec->strings < win_start ||
+				    rec->strings + rec->strings_len > win_start + win_len) {
+					if (rec->strings_len > SCAN_STRINGS_SZ)
+						goto exit;
+					win_start = rec->strings;
+					win_len = MIN(SCAN_STRINGS_SZ,
+						      index->hdr.refs_offset - index->hdr.strings_offset - win_start);
+					if (read_at(index->fd, index->hdr.strings_offset + win_start, win, win_len))
+						goto exit;
+				}
+				track.strings = win + rec->strings - win_start;
+				track.strings[rec->strings_len - 1] = '\0';
+				parse_track_strings(&track);
+			}
+			track.id = rec->id;
+			track.track_nb = rec->track_nb;
+			track.duration_in_ms = rec->duration_in_ms;
+			track.bitrate = rec->bitrate;
+			track.samplerate = rec->samplerate;
+			track.added = rec->added;
+			if (cb(&track, i + j, arg)) {
+				ret = 0;
+				goto exit;
+			}
+		}
+	}
+	ret = 0;
+
+exit:
+	free(win);
+	free(recs);
+
+	return ret;
+}
+
+int db_index_get_refs(void *hdl, int start, struct db_track_ref *refs, int nb)
+{
+	struct index *index = hdl;
+	int ret;
+
+	nb = MIN(nb, (int) index->hdr.track_nb - start);
+	if (nb <= 0)
+		return 0;
+
+	ret = read_at(index->fd, index->hdr.refs_offset + start * sizeof(struct db_track_ref),
+		      refs, nb * sizeof(struct db_track_ref));
+
+	return ret ? -1 : nb;
+}
+
+int db_index_find_track(void *hdl, uint32_t id)
+{
+	struct index *index = hdl;
+	struct db_track_ref ref;
+	int low = 0;
+	int high = index->hdr.track_nb - 1;
+	int mid;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (db_index_get_refs(hdl, mid, &ref, 1) != 1)
+			return -1;
+		if (ref.id == id)
+			return ref.idx;
+		if (ref.id < id)
+			low = mid + 1;
+		else
+			high = mid - 1;
+	}
+
+	return -1;
+}
+
+void db_index_put_track(struct db_track *track)
+{
+	free(track->strings);
+}
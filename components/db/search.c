@@ -0,0 +1,473 @@
+#include "db_search.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.db_search";
+
+#define SEARCH_MAGIC		0x53335652
+#define SEARCH_VERSION		1
+#define SEARCH_TOKEN_LEN	12
+#define SEARCH_PAGE_SZ		512
+#define SEARCH_PAGE_ENTRY_NB	(SEARCH_PAGE_SZ / sizeof(struct search_entry))
+#define SEARCH_READ_PAGE_NB	4
+#define SEARCH_WORD_MAX		4
+#define SEARCH_POSTING_MAX	2048
+#define SEARCH_FOLD_SZ		256
+#define BUILDER_ENTRY_CHUNK	1024
+
+/* search file layout is :
+ *  - struct search_hdr
+ *  - page_nb tokens. First token of each entries page.
+ *  - padding up to entries_offset which is page aligned.
+ *  - entry_nb struct search_entry sorted by token.
+ * A lookup reads the page tokens once on open, then only reads the few
+ * entries pages that may match the prefix.
+ */
+struct search_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_nb;
+	uint32_t page_nb;
+	uint32_t entries_offset;
+};
+
+/* token is folded (lower case, no diacritics) and '\0' padded. ref is track
+ * index in tracks index and field in the two lowest bits.
+ */
+struct search_entry {
+	char token[SEARCH_TOKEN_LEN];
+	uint32_t ref;
+};
+
+enum search_field {
+	FIELD_ARTIST,
+	FIELD_ALBUM,
+	FIELD_TITLE,
+	FIELD_NB
+};
+
+struct search_builder {
+	struct search_entry *entries;
+	int entry_nb;
+	int entry_max;
+};
+
+struct posting {
+	uint32_t track_idx;
+	int score;
+};
+
+struct search {
+	int fd;
+	void *index;
+	struct search_hdr hdr;
+	char *page_tokens;
+	struct search_entry pages[SEARCH_READ_PAGE_NB * SEARCH_PAGE_ENTRY_NB];
+};
+
+static const int field_weight[FIELD_NB] = {2, 1, 3};
+
+static int is_token_char(unsigned char c)
+{
+	return (c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c >= 0x80;
+}
+
+/* return next token start in str and set its length */
+static char *next_token(char *str, int *len)
+{
+	while (*str && !is_token_char(*str))
+		str++;
+	if (!*str)
+		return NULL;
+
+	*len = 0;
+	while (str[*len] && is_token_char(str[*len]))
+		(*len)++;
+
+	return str;
+}
+
+static int builder_add_entry(struct search_builder *builder, char *token, int len,
+			     uint32_t ref)
+{
+	struct search_entry *entries;
+	struct search_entry *entry;
+
+	if (builder->entry_nb == builder->entry_max) {
+		entries = realloc(builder->entries, (builder->entry_max + BUILDER_ENTRY_CHUNK) *
+				  sizeof(struct search_entry));
+		if (!entries)
+			return -1;
+		builder->entries = entries;
+		builder->entry_max += BUILDER_ENTRY_CHUNK;
+	}
+
+	entry = &builder->entries[builder->entry_nb++];
+	memset(entry->token, 0, SEARCH_TOKEN_LEN);
+	memcpy(entry->token, token, MIN(len, SEARCH_TOKEN_LEN));
+	entry->ref = ref;
+
+	return 0;
+}
+
+static int builder_add_field(struct search_builder *builder, char *str, int track_idx,
+			     enum search_field field)
+{
+	char folded[SEARCH_FOLD_SZ];
+	char *token;
+	int len;
+	int ret;
+
+	utf8_fold(str, folded, sizeof(folded));
+	token = next_token(folded, &len);
+	while (token) {
+		ret = builder_add_entry(builder, token, len, (track_idx << 2) | field);
+		if (ret)
+			return ret;
+		token = next_token(token + len, &len);
+	}
+
+	return 0;
+}
+
+static int sort_entries(const void *pa, const void *pb)
+{
+	const struct search_entry *a = pa;
+	const struct search_entry *b = pb;
+	int ret;
+
+	ret = memcmp(a->token, b->token, SEARCH_TOKEN_LEN);
+	if (ret)
+		return ret;
+	if (a->ref == b->ref)
+		return 0;
+
+	return a->ref < b->ref ? -1 : 1;
+}
+
+static int write_search(struct search_builder *builder, char *filename)
+{
+	static const char zero[SEARCH_PAGE_SZ];
+	struct search_hdr hdr;
+	FILE *f;
+	int pad;
+	int i;
+
+	f = fopen(filename, "w");
+	if (!f)
+		return -1;
+
+	hdr.magic = SEARCH_MAGIC;
+	hdr.version = SEARCH_VERSION;
+	hdr.entry_nb = builder->entry_nb;
+	hdr.page_nb = (builder->entry_nb + SEARCH_PAGE_ENTRY_NB - 1) / SEARCH_PAGE_ENTRY_NB;
+	hdr.entries_offset = sizeof(hdr) + hdr.page_nb * SEARCH_TOKEN_LEN;
+	hdr.entries_offset = (hdr.entries_offset + SEARCH_PAGE_SZ - 1) & ~(SEARCH_PAGE_SZ - 1);
+	pad = hdr.entries_offset - sizeof(hdr) - hdr.page_nb * SEARCH_TOKEN_LEN;
+
+	if (fwrite(&hdr, sizeof(hdr), 1, f) != 1)
+		goto error;
+	for (i = 0; i < hdr.page_nb; i++) {
+		if (fwrite(builder->entries[i * SEARCH_PAGE_ENTRY_NB].token,
+			   SEARCH_TOKEN_LEN, 1, f) != 1)
+			goto error;
+	}
+	if (pad && fwrite(zero, pad, 1, f) != 1)
+		goto error;
+	if (builder->entry_nb && fwrite(builder->entries, sizeof(struct search_entry),
+					builder->entry_nb, f) != builder->entry_nb)
+		goto error;
+
+	return fclose(f);
+
+error:
+	fclose(f);
+
+	return -1;
+}
+
+/* return index of last page whose first token is lower than word */
+static int find_start_page(struct search *search, char *word, int cmp_len)
+{
+	int low = 0;
+	int high = search->hdr.page_nb - 1;
+	int res = 0;
+	int mid;
+
+	while (low <= high) {
+		mid = (low + high) / 2;
+		if (memcmp(&search->page_tokens[mid * SEARCH_TOKEN_LEN], word, cmp_len) < 0) {
+			res = mid;
+			low = mid + 1;
+		} else {
+			high = mid - 1;
+		}
+	}
+
+	return res;
+}
+
+static int sort_postings_by_track(const void *pa, const void *pb)
+{
+	const struct posting *a = pa;
+	const struct posting *b = pb;
+
+	if (a->track_idx != b->track_idx)
+		return a->track_idx < b->track_idx ? -1 : 1;
+
+	return b->score - a->score;
+}
+
+static int sort_postings_by_score(const void *pa, const void *pb)
+{
+	const struct posting *a = pa;
+	const struct posting *b = pb;
+
+	if (a->score != b->score)
+		return b->score - a->score;
+
+	return a->track_idx < b->track_idx ? -1 : 1;
+}
+
+/* collect tracks matching word prefix. Result is ordered by track index with
+ * one posting per track holding best score.
+ */
+static int lookup_word(struct search *search, char *word, int word_len,
+		       struct posting *postings)
+{
+	int cmp_len = MIN(word_len, SEARCH_TOKEN_LEN);
+	int entry_idx;
+	int posting_nb = 0;
+	int entry_nb;
+	int ret;
+	int i;
+
+	if (!search->hdr.entry_nb)
+		return 0;
+
+	entry_idx = find_start_page(search, word, cmp_len) * SEARCH_PAGE_ENTRY_NB;
+	while (entry_idx < search->hdr.entry_nb && posting_nb < SEARCH_POSTING_MAX) {
+		entry_nb = MIN(ARRAY_SIZE(search->pages), search->hdr.entry_nb - entry_idx);
+		if (read_at(search->fd, search->hdr.entries_offset +
+			    entry_idx * sizeof(struct search_entry),
+			    search->pages, entry_nb * sizeof(struct search_entry)))
+			break;
+		for (i = 0; i < entry_nb && posting_nb < SEARCH_POSTING_MAX; i++) {
+			struct search_entry *entry = &search->pages[i];
+			int is_exact;
+			int cmp;
+
+			cmp = memcmp(entry->token, word, cmp_len);
+			if (cmp < 0)
+				continue;
+			if (cmp > 0)
+				goto done;
+
+			is_exact = word_len < SEARCH_TOKEN_LEN && entry->token[word_len] == '\0';
+			postings[posting_nb].track_idx = entry->ref >> 2;
+			postings[posting_nb].score = field_weight[entry->ref & 3] + is_exact;
+			posting_nb++;
+		}
+		entry_idx += entry_nb;
+	}
+
+done:
+	/* keep best score of each track */
+	qsort(postings, posting_nb, sizeof(struct posting), sort_postings_by_track);
+	ret = 0;
+	for (i = 0; i < posting_nb; i++) {
+		if (ret && postings[ret - 1].track_idx == postings[i].track_idx)
+			continue;
+		postings[ret++] = postings[i];
+	}
+
+	return ret;
+}
+
+/* keep tracks present in both lists and sum their scores into res */
+static int intersect(struct posting *res, int res_nb, struct posting *postings,
+		     int posting_nb)
+{
+	int nb = 0;
+	int i = 0;
+	int j = 0;
+
+	while (i < res_nb && j < posting_nb) {
+		if (res[i].track_idx < postings[j].track_idx) {
+			i++;
+		} else if (res[i].track_idx > postings[j].track_idx) {
+			j++;
+		} else {
+			res[nb].track_idx = res[i].track_idx;
+			res[nb].score = res[i].score + postings[j].score;
+			nb++;
+			i++;
+			j++;
+		}
+	}
+
+	return nb;
+}
+
+/* public api */
+int db_search_build(char *dirname, struct db_track *tracks, int track_nb)
+{
+	struct search_builder builder;
+	char *filename;
+	int ret = 0;
+	int i;
+
+	memset(&builder, 0, sizeof(builder));
+	for (i = 0; i < track_nb && !ret; i++) {
+		ret = builder_add_field(&builder, tracks[i].artist, i, FIELD_ARTIST);
+		if (!ret)
+			ret = builder_add_field(&builder, tracks[i].album, i, FIELD_ALBUM);
+		if (!ret)
+			ret = builder_add_field(&builder, tracks[i].title, i, FIELD_TITLE);
+	}
+	if (ret)
+		goto cleanup;
+
+	qsort(builder.entries, builder.entry_nb, sizeof(struct search_entry),
+	      sort_entries);
+	ESP_LOGI(TAG, "search index has %d tokens", builder.entry_nb);
+
+	ret = -1;
+	filename = db_index_path(dirname, "search.tmp");
+	if (!filename)
+		goto cleanup;
+	ret = write_search(&builder, filename);
+	free(filename);
+	if (!ret)
+		ret = db_index_replace(dirname, "search.tmp", "search");
+
+cleanup:
+	free(builder.entries);
+
+	return ret;
+}
+
+void *db_search_open(char *dirname)
+{
+	struct search *search;
+	char *filename;
+	int len;
+
+	search = malloc(sizeof(*search));
+	if (!search)
+		return NULL;
+	memset(search, 0, sizeof(*search));
+
+	search->index = db_index_open(dirname);
+	if (!search->index)
+		goto index_error;
+
+	filename = db_index_path(dirname, "search");
+	if (!filename)
+		goto open_error;
+	search->fd = open(filename, O_RDONLY);
+	free(filename);
+	if (search->fd < 0)
+		goto open_error;
+
+	if (read_at(search->fd, 0, &search->hdr, sizeof(search->hdr)))
+		goto read_error;
+	if (search->hdr.magic != SEARCH_MAGIC || search->hdr.version != SEARCH_VERSION)
+		goto read_error;
+
+	len = search->hdr.page_nb * SEARCH_TOKEN_LEN;
+	search->page_tokens = malloc(len + 1);
+	if (!search->page_tokens)
+		goto read_error;
+	if (read_at(search->fd, sizeof(search->hdr), search->page_tokens, len))
+		goto page_error;
+
+	return search;
+
+page_error:
+	free(search->page_tokens);
+read_error:
+	close(search->fd);
+open_error:
+	db_index_close(search->index);
+index_error:
+	free(search);
+
+	return NULL;
+}
+
+void db_search_close(void *hdl)
+{
+	struct search *search = hdl;
+
+	free(search->page_tokens);
+	close(search->fd);
+	db_index_close(search->index);
+	free(search);
+}
+
+int db_search(void *hdl, char *query, struct db_search_result *results, int result_nb)
+{
+	struct search *search = hdl;
+	uint32_t start = esp_log_timestamp();
+	char folded[SEARCH_FOLD_SZ];
+	struct posting *postings;
+	struct posting *res;
+	int word_nb = 0;
+	int res_nb = 0;
+	int posting_nb;
+	char *word;
+	int len;
+	int i;
+
+	postings = malloc(2 * SEARCH_POSTING_MAX * sizeof(struct posting));
+	if (!postings)
+		return -1;
+	res = &postings[SEARCH_POSTING_MAX];
+
+	utf8_fold(query, folded, sizeof(folded));
+	word = next_token(folded, &len);
+	while (word && word_nb < SEARCH_WORD_MAX) {
+		posting_nb = lookup_word(search, word, len, postings);
+		if (word_nb == 0) {
+			memcpy(res, postings, posting_nb * sizeof(struct posting));
+			res_nb = posting_nb;
+		} else {
+			res_nb = intersect(res, res_nb, postings, posting_nb);
+		}
+		word_nb++;
+		if (!res_nb)
+			break;
+		word = next_token(word + len, &len);
+	}
+
+	qsort(res, res_nb, sizeof(struct posting), sort_postings_by_score);
+	res_nb = MIN(res_nb, result_nb);
+	for (i = 0; i < res_nb; i++) {
+		if (db_index_get_track(search->index, res[i].track_idx, &results[i].track))
+			break;
+		results[i].score = res[i].score;
+	}
+	free(postings);
+	ESP_LOGI(TAG, "search '%s' => %d results in %d ms", query, i,
+		 esp_log_timestamp() - start);
+
+	return i;
+}
+
+void db_search_put_results(void *hdl, struct db_search_result *results, int result_nb)
+{
+	int i;
+
+	for (i = 0; i < result_nb; i++)
+		db_index_put_track(&results[i].track);
+}
@@ -0,0 +1,501 @@
+#include "db_smart.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <time.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "esp_log.h"
+#include "utils.h"
+#include "db_index.h"
+#include "db_stats.h"
+
+static const char* TAG = "rv3.db_smart";
+
+#define SMART_MAGIC		0x53535652
+#define SMART_VERSION		1
+#define SMART_RULE_MAX		8
+#define SMART_LINE_SZ		256
+#define SMART_FOLD_SZ		256
+#define SMART_ID_CHUNK		1024
+#define SECONDS_PER_DAY		(24 * 3600)
+/* 2020-01-01, clock is still near epoch until sntp sync */
+#define SMART_VALID_TIME	1577836800
+
+/* smart playlist file holds one rule per line, a track must match all of
+ * them. '#' starts a comment.
+ *   artist = Daft Punk	artist is, case and diacritics insensitive
+ *   album ~ live		album contains
+ *   title ~ remix
+ *   duration >= 600	in seconds. Operators are =, <, <=, > and >=
+ *   plays > 2		completed plays
+ *   added < 30		entered db less than 30 days ago
+ *   random 50		50 tracks picked at random among matching ones
+ * Matching tracks are cached in index directory until index, play counts
+ * or rules change.
+ */
+enum rule_field {
+	FIELD_ARTIST,
+	FIELD_ALBUM,
+	FIELD_TITLE,
+	FIELD_DURATION,
+	FIELD_PLAYS,
+	FIELD_ADDED,
+	FIELD_NB
+};
+
+enum rule_op {
+	OP_EQ,
+	OP_CONTAINS,
+	OP_LT,
+	OP_LE,
+	OP_GT,
+	OP_GE,
+};
+
+struct rule {
+	enum rule_field field;
+	enum rule_op op;
+	int value;
+	/* folded string for artist, album and title */
+	char str[SMART_FOLD_SZ];
+};
+
+struct smart {
+	struct rule rules[SMART_RULE_MAX];
+	int rule_nb;
+	int random_nb;
+	uint32_t hash;
+	int with_strings;
+	int with_plays;
+	int with_added;
+	/* evaluation state */
+	struct db_stats_track *counters;
+	int counter_nb;
+	uint32_t now;
+	int is_time_valid;
+	char fold[SMART_FOLD_SZ];
+	uint32_t *ids;
+	int id_nb;
+	int id_max;
+	int is_oom;
+};
+
+struct smart_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t rules_hash;
+	uint32_t index_stamp;
+	uint32_t stats_stamp;
+	uint32_t day;
+	uint32_t id_nb;
+};
+
+static const char *field_names[FIELD_NB] = {
+	"artist", "album", "title", "duration", "plays", "added"
+};
+
+static char *skip_blank(char *str)
+{
+	while (*str == ' ' || *str == '\t')
+		str++;
+
+	return str;
+}
+
+static void strip(char *str)
+{
+	int len = strlen(str);
+
+	while (len && (str[len - 1] == ' ' || str[len - 1] == '\t' ||
+		       str[len - 1] == '\r' || str[len - 1] == '\n'))
+		str[--len] = '\0';
+}
+
+static int parse_op(char **str, enum rule_op *op)
+{
+	static const struct {
+		char *str;
+		enum rule_op op;
+	} ops[] = {
+		{"<=", OP_LE}, {">=", OP_GE}, {"<", OP_LT}, {">", OP_GT},
+		{"=", OP_EQ}, {"~", OP_CONTAINS},
+	};
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(ops); i++) {
+		if (strncmp(*str, ops[i].str, strlen(ops[i].str)) == 0) {
+			*op = ops[i].op;
+			*str += strlen(ops[i].str);
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+static int parse_rule(struct smart *smart, char *line)
+{
+	struct rule *rule = &smart->rules[smart->rule_nb];
+	int len;
+	int i;
+
+	line = skip_blank(line);
+	strip(line);
+	if (!*line || *line == '#')
+		return 0;
+
+	if (strncmp(line, "random", 6) == 0) {
+		smart->random_nb = atoi(line + 6);
+		return 0;
+	}
+	if (smart->rule_nb == SMART_RULE_MAX)
+		return -1;
+
+	for (i = 0; i < FIELD_NB; i++) {
+		len = strlen(field_names[i]);
+		if (strncmp(line, field_names[i], len) == 0)
+			break;
+	}
+	if (i == FIELD_NB)
+		return -1;
+	rule->field = i;
+	line = skip_blank(line + len);
+	if (parse_op(&line, &rule->op))
+		return -1;
+	line = skip_blank(line);
+
+	switch (rule->field) {
+	case FIELD_ARTIST:
+	case FIELD_ALBUM:
+	case FIELD_TITLE:
+		if (rule->op != OP_EQ && rule->op != OP_CONTAINS)
+			return -1;
+		utf8_fold(line, rule->str, sizeof(rule->str));
+		smart->with_strings = 1;
+		break;
+	default:
+		if (rule->op == OP_CONTAINS)
+			return -1;
+		rule->value = atoi(line);
+		smart->with_plays |= rule->field == FIELD_PLAYS;
+		smart->with_added |= rule->field == FIELD_ADDED;
+	}
+	smart->rule_nb++;
+
+	return 0;
+}
+
+static int parse_rules(struct smart *smart, char *filename)
+{
+	char line[SMART_LINE_SZ];
+	FILE *f;
+
+	f = fopen(filename, "r");
+	if (!f) {
+		ESP_LOGW(TAG, "unable to open %s", filename);
+		return -1;
+	}
+
+	smart->hash = FNV1A_INIT;
+	while (fgets(line, sizeof(line), f)) {
+		smart->hash = fnv1a(smart->hash, line, strlen(line));
+		if (parse_rule(smart, line))
+			ESP_LOGW(TAG, "ignore rule '%s'", line);
+	}
+	fclose(f);
+
+	return 0;
+}
+
+/* play counts may change between two evaluations without index rebuild */
+static uint32_t stats_stamp(char *dirname)
+{
+	static char *names[] = {"stats", "events", "events.compact"};
+	uint32_t hash = FNV1A_INIT;
+	char *filename;
+	struct stat st;
+	int i;
+
+	for (i = 0; i < ARRAY_SIZE(names); i++) {
+		filename = db_index_path(dirname, names[i]);
+		if (!filename)
+			continue;
+		if (stat(filename, &st) == 0) {
+			hash = fnv1a(hash, &st.st_size, sizeof(st.st_size));
+			hash = fnv1a(hash, &st.st_mtime, sizeof(st.st_mtime));
+		}
+		free(filename);
+	}
+
+	return hash;
+}
+
+static void setup_hdr(struct smart *smart, char *dirname, void *index, struct smart_hdr *hdr)
+{
+	memset(hdr, 0, sizeof(*hdr));
+	hdr->magic = SMART_MAGIC;
+	hdr->version = SMART_VERSION;
+	hdr->rules_hash = smart->hash;
+	hdr->index_stamp = db_index_stamp(index);
+	if (smart->with_plays)
+		hdr->stats_stamp = stats_stamp(dirname);
+	if (smart->with_added)
+		hdr->day = smart->now / SECONDS_PER_DAY;
+}
+
+static int read_cache(char *filename, struct smart_hdr *key, struct smart *smart)
+{
+	struct smart_hdr hdr;
+	int ret = -1;
+	int len;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	if (read(fd, &hdr, sizeof(hdr)) != sizeof(hdr))
+		goto exit;
+	/* id_nb is the only field that's not part of the key */
+	if (memcmp(&hdr, key, offsetof(struct smart_hdr, id_nb)))
+		goto exit;
+
+	len = hdr.id_nb * sizeof(uint32_t);
+	smart->ids = malloc(len + 1);
+	if (!smart->ids)
+		goto exit;
+	if (read(fd, smart->ids, len) != len) {
+		free(smart->ids);
+		smart->ids = NULL;
+		goto exit;
+	}
+	smart->id_nb = hdr.id_nb;
+	ret = 0;
+
+exit:
+	close(fd);
+
+	return ret;
+}
+
+static void write_cache(char *filename, struct smart_hdr *hdr, struct smart *smart)
+{
+	int len = smart->id_nb * sizeof(uint32_t);
+	int ret;
+	int fd;
+
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return ;
+	hdr->id_nb = smart->id_nb;
+	ret = write(fd, hdr, sizeof(*hdr)) == sizeof(*hdr) &&
+	      write(fd, smart->ids, len) == len ? 0 : -1;
+	close(fd);
+	if (ret) {
+		ESP_LOGW(TAG, "unable to write %s", filename);
+		unlink(filename);
+	}
+}
+
+static int cmp_counter(const void *pkey, const void *pb)
+{
+	uint32_t id = *(const uint32_t *) pkey;
+	const struct db_stats_track *b = pb;
+
+	if (id == b->id)
+		return 0;
+
+	return id < b->id ? -1 : 1;
+}
+
+static int track_value(struct smart *smart, struct rule *rule, struct db_track *track)
+{
+	struct db_stats_track *counter;
+
+	switch (rule->field) {
+	case FIELD_DURATION:
+		return track->duration_in_ms / 1000;
+	case FIELD_PLAYS:
+		counter = bsearch(&track->id, smart->counters, smart->counter_nb,
+				  sizeof(struct db_stats_track), cmp_counter);
+		return counter ? counter->play_nb : 0;
+	case FIELD_ADDED:
+		/* unknown entry time is treated as old */
+		if (!track->added || track->added > smart->now)
+			return track->added ? 0 : INT32_MAX;
+		return (smart->now - track->added) / SECONDS_PER_DAY;
+	default:
+		return 0;
+	}
+}
+
+static int match_rule(struct smart *smart, struct rule *rule, struct db_track *track)
+{
+	char *str;
+	int value;
+
+	switch (rule->field) {
+	case FIELD_ARTIST:
+	case FIELD_ALBUM:
+	case FIELD_TITLE:
+		str = rule->field == FIELD_ARTIST ? track->artist :
+		      rule->field == FIELD_ALBUM ? track->album : track->title;
+		utf8_fold(str, smart->fold, sizeof(smart->fold));
+		if (rule->op == OP_EQ)
+			return strcmp(smart->fold, rule->str) == 0;
+		return strstr(smart->fold, rule->str) != NULL;
+	case FIELD_ADDED:
+		/* every track would look added today */
+		if (!smart->is_time_valid)
+			return 1;
+		break;
+	default:
+		break;
+	}
+
+	value = track_value(smart, rule, track);
+	switch (rule->op) {
+	case OP_EQ:
+		return value == rule->value;
+	case OP_LT:
+		return value < rule->value;
+	case OP_LE:
+		return value <= rule->value;
+	case OP_GT:
+		return value > rule->value;
+	case OP_GE:
+		return value >= rule->value;
+	default:
+		return 0;
+	}
+}
+
+static int eval_track(struct db_track *track, int idx, void *arg)
+{
+	struct smart *smart = arg;
+	uint32_t *ids;
+	int i;
+
+	for (i = 0; i < smart->rule_nb; i++) {
+		if (!match_rule(smart, &smart->rules[i], track))
+			return 0;
+	}
+
+	if (smart->id_nb == smart->id_max) {
+		ids = realloc(smart->ids, (smart->id_max + SMART_ID_CHUNK) * sizeof(uint32_t));
+		if (!ids) {
+			smart->is_oom = 1;
+			return -1;
+		}
+		smart->ids = ids;
+		smart->id_max += SMART_ID_CHUNK;
+	}
+	smart->ids[smart->id_nb++] = track->id;
+
+	return 0;
+}
+
+static int eval(struct smart *smart, char *dirname, void *index)
+{
+	int ret;
+
+	if (smart->with_plays) {
+		ret = db_stats_counters(dirname, &smart->counters, &smart->counter_nb);
+		if (ret)
+			return ret;
+	}
+
+	ret = db_index_scan(index, smart->with_strings, eval_track, smart);
+	free(smart->counters);
+	smart->counters = NULL;
+	/* eval_track only stops scan on allocation failure */
+	if (smart->is_oom)
+		ret = -1;
+
+	return ret;
+}
+
+/* keep random_nb tracks, partial fisher-yates */
+static void pick_random(struct smart *smart)
+{
+	uint32_t tmp;
+	int i, j;
+
+	if (!smart->random_nb || smart->random_nb >= smart->id_nb)
+		return;
+
+	for (i = 0; i < smart->random_nb; i++) {
+		j = i + rand() % (smart->id_nb - i);
+		tmp = smart->ids[i];
+		smart->ids[i] = smart->ids[j];
+		smart->ids[j] = tmp;
+	}
+	smart->id_nb = smart->random_nb;
+}
+
+int db_smart_eval(char *dirname, char *rules_filename, uint32_t **ids, int *id_nb)
+{
+	struct smart_hdr hdr;
+	struct smart *smart;
+	char *cache = NULL;
+	char name[16];
+	void *index;
+	int ret = -1;
+
+	smart = malloc(sizeof(*smart));
+	if (!smart)
+		return -1;
+	memset(smart, 0, sizeof(*smart));
+	smart->now = time(NULL);
+
+	index = db_index_open(dirname);
+	if (!index)
+		goto exit;
+	if (parse_rules(smart, rules_filename))
+		goto exit;
+	smart->is_time_valid = smart->now >= SMART_VALID_TIME;
+	if (smart->with_added && !smart->is_time_valid)
+		ESP_LOGW(TAG, "%s: clock not set, 'added' rules are ignored", rules_filename);
+
+	setup_hdr(smart, dirname, index, &hdr);
+	snprintf(name, sizeof(name), "smart.%08x",
+		 fnv1a(FNV1A_INIT, rules_filename, strlen(rules_filename)));
+	cache = db_index_path(dirname, name);
+	if (cache && read_cache(cache, &hdr, smart) == 0) {
+		ESP_LOGI(TAG, "%s: %d tracks from cache", rules_filename, smart->id_nb);
+	} else {
+		ret = eval(smart, dirname, index);
+		if (ret)
+			goto exit;
+		ESP_LOGI(TAG, "%s: %d tracks match %d rules among %d", rules_filename,
+			 smart->id_nb, smart->rule_nb, db_index_track_nb(index));
+		if (cache)
+			write_cache(cache, &hdr, smart);
+	}
+
+	pick_random(smart);
+	*ids = smart->ids;
+	*id_nb = smart->id_nb;
+	smart->ids = NULL;
+	ret = 0;
+
+exit:
+	free(cache);
+	if (index)
+		db_index_close(index);
+	free(smart->ids);
+	free(smart);
+
+	return ret;
+}
+
+void db_smart_put_ids(uint32_t *ids)
+{
+	free(ids);
+}
@@ -0,0 +1,599 @@
+#include "db_stats.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <errno.h>
+#include <time.h>
+#include <assert.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.db_stats";
+
+#define STATS_MAGIC		0x50335652
+#define STATS_VERSION		1
+#define STATS_SECTOR_SZ		512
+#define STATS_EVENT_NB		(STATS_SECTOR_SZ / sizeof(struct stats_event))
+#define STATS_COMPACT_SZ	(16 * STATS_SECTOR_SZ)
+#define STATS_REF_CHUNK		64
+
+/* events file is an append only log of struct stats_event. Events are
+ * buffered and appended one sector at a time, so that a played song only
+ * costs a few bytes of ram. Once the log is long enough it is folded into
+ * the stats file by a background task.
+ * stats file layout is :
+ *  - struct stats_hdr
+ *  - track_nb struct db_stats_track sorted by track id.
+ */
+struct stats_event {
+	uint32_t track_id;
+	uint32_t time;
+	uint32_t type;
+	uint32_t reserved;
+};
+
+struct stats_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t track_nb;
+};
+
+struct stats {
+	char *dirname;
+	int event_nb;
+	struct stats_event events[STATS_EVENT_NB];
+};
+
+/* serialize events appends with log rotation and stats file replacement */
+static SemaphoreHandle_t lock;
+static portMUX_TYPE lock_mux = portMUX_INITIALIZER_UNLOCKED;
+static int is_compacting;
+
+static void stats_lock(void)
+{
+	SemaphoreHandle_t mutex;
+
+	/* ui, compaction and smart playlist tasks may race on first use */
+	if (!lock) {
+		mutex = xSemaphoreCreateMutex();
+		assert(mutex);
+		taskENTER_CRITICAL(&lock_mux);
+		if (!lock) {
+			lock = mutex;
+			mutex = NULL;
+		}
+		taskEXIT_CRITICAL(&lock_mux);
+		if (mutex)
+			vSemaphoreDelete(mutex);
+	}
+	xSemaphoreTake(lock, portMAX_DELAY);
+}
+
+static void stats_unlock(void)
+{
+	xSemaphoreGive(lock);
+}
+
+/* a missing file is an empty file */
+static int load_file(char *dirname, char *name, void **buf, int *len)
+{
+	char *filename = db_index_path(dirname, name);
+	struct stat st;
+	int ret = -1;
+	int fd;
+
+	*buf = NULL;
+	*len = 0;
+	if (!filename)
+		return -1;
+	fd = open(filename, O_RDONLY);
+	free(filename);
+	if (fd < 0)
+		return errno == ENOENT ? 0 : -1;
+
+	if (fstat(fd, &st))
+		goto exit;
+	*buf = malloc(st.st_size + 1);
+	if (!*buf)
+		goto exit;
+	if (read(fd, *buf, st.st_size) != st.st_size) {
+		free(*buf);
+		*buf = NULL;
+		goto exit;
+	}
+	*len = st.st_size;
+	ret = 0;
+
+exit:
+	close(fd);
+
+	return ret;
+}
+
+static int load_counters(char *dirname, struct db_stats_track **tracks, int *track_nb)
+{
+	struct stats_hdr *hdr;
+	int ret;
+	int len;
+
+	*tracks = NULL;
+	*track_nb = 0;
+	ret = load_file(dirname, "stats", (void **) &hdr, &len);
+	if (ret || !hdr)
+		return ret;
+
+	if (len < sizeof(*hdr) || hdr->magic != STATS_MAGIC || hdr->version != STATS_VERSION ||
+	    len != sizeof(*hdr) + hdr->track_nb * sizeof(struct db_stats_track)) {
+		ESP_LOGW(TAG, "drop corrupted stats file");
+		free(hdr);
+		return 0;
+	}
+	*track_nb = hdr->track_nb;
+	*tracks = malloc(*track_nb * sizeof(struct db_stats_track) + 1);
+	if (!*tracks) {
+		free(hdr);
+		return -1;
+	}
+	memcpy(*tracks, hdr + 1, *track_nb * sizeof(struct db_stats_track));
+	free(hdr);
+
+	return 0;
+}
+
+static int write_counters(char *dirname, struct db_stats_track *tracks, int track_nb)
+{
+	struct stats_hdr hdr;
+	char *filename;
+	int len;
+	int ret;
+	int fd;
+
+	filename = db_index_path(dirname, "stats.tmp");
+	if (!filename)
+		return -1;
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	free(filename);
+	if (fd < 0)
+		return -1;
+
+	hdr.magic = STATS_MAGIC;
+	hdr.version = STATS_VERSION;
+	hdr.track_nb = track_nb;
+	len = track_nb * sizeof(struct db_stats_track);
+	ret = write(fd, &hdr, sizeof(hdr)) == sizeof(hdr) &&
+	      write(fd, tracks, len) == len ? 0 : -1;
+	close(fd);
+	if (ret)
+		return ret;
+
+	return db_index_replace(dirname, "stats.tmp", "stats");
+}
+
+static int sort_events(const void *pa, const void *pb)
+{
+	const struct stats_event *a = pa;
+	const struct stats_event *b = pb;
+
+	if (a->track_id == b->track_id)
+		return 0;
+
+	return a->track_id < b->track_id ? -1 : 1;
+}
+
+static void apply_event(struct db_stats_track *track, struct stats_event *event)
+{
+	switch (event->type) {
+	case DB_STATS_START:
+		if (event->time > track->last_played)
+			track->last_played = event->time;
+		break;
+	case DB_STATS_COMPLETE:
+		if (track->play_nb < UINT16_MAX)
+			track->play_nb++;
+		break;
+	case DB_STATS_SKIP:
+		if (track->skip_nb < UINT16_MAX)
+			track->skip_nb++;
+		break;
+	default:
+		ESP_LOGW(TAG, "unknown event type %d", (int) event->type);
+	}
+}
+
+/* merge events into counters. Both are sorted by track id */
+static int apply_events(struct db_stats_track **tracks, int *track_nb,
+			struct stats_event *events, int event_nb)
+{
+	struct db_stats_track *res;
+	struct db_stats_track cur;
+	int nb = 0;
+	int i = 0;
+	int j = 0;
+
+	if (!event_nb)
+		return 0;
+
+	res = malloc((*track_nb + event_nb) * sizeof(struct db_stats_track));
+	if (!res)
+		return -1;
+
+	qsort(events, event_nb, sizeof(struct stats_event), sort_events);
+	while (i < *track_nb || j < event_nb) {
+		if (j == event_nb || (i < *track_nb && (*tracks)[i].id < events[j].track_id)) {
+			res[nb++] = (*tracks)[i++];
+			continue;
+		}
+		if (i < *track_nb && (*tracks)[i].id == events[j].track_id) {
+			cur = (*tracks)[i++];
+		} else {
+			memset(&cur, 0, sizeof(cur));
+			cur.id = events[j].track_id;
+		}
+		for (; j < event_nb && events[j].track_id == cur.id; j++)
+			apply_event(&cur, &events[j]);
+		res[nb++] = cur;
+	}
+	free(*tracks);
+	*tracks = res;
+	*track_nb = nb;
+
+	return 0;
+}
+
+static int apply_log(char *dirname, char *name, struct db_stats_track **tracks, int *track_nb)
+{
+	struct stats_event *events;
+	int ret;
+	int len;
+
+	ret = load_file(dirname, name, (void **) &events, &len);
+	if (ret)
+		return ret;
+	ret = apply_events(tracks, track_nb, events, (int) (len / sizeof(struct stats_event)));
+	free(events);
+
+	return ret;
+}
+
+static int log_rotate(char *dirname)
+{
+	char *events = db_index_path(dirname, "events");
+	char *compact = db_index_path(dirname, "events.compact");
+	struct stat st;
+	int ret = -1;
+
+	if (!events || !compact)
+		goto exit;
+
+	/* a previous compaction was interrupted. Finish it first */
+	ret = 0;
+	if (stat(compact, &st) == 0)
+		goto exit;
+	if (stat(events, &st))
+		ret = 1;
+	else
+		ret = rename(events, compact);
+
+exit:
+	free(events);
+	free(compact);
+
+	return ret;
+}
+
+static void compact_task(void *arg)
+{
+	char *dirname = arg;
+
+	if (db_stats_compact(dirname))
+		ESP_LOGE(TAG, "unable to compact stats");
+	free(dirname);
+	is_compacting = 0;
+
+	vTaskDelete(NULL);
+}
+
+static void start_compaction(char *dirname)
+{
+	char *filename = db_index_path(dirname, "events");
+	TaskHandle_t task;
+	struct stat st;
+	BaseType_t res;
+	int ret;
+
+	if (!filename)
+		return;
+	ret = stat(filename, &st);
+	free(filename);
+	if (ret || st.st_size < STATS_COMPACT_SZ || is_compacting)
+		return;
+
+	dirname = strdup(dirname);
+	if (!dirname)
+		return;
+	is_compacting = 1;
+	res = xTaskCreatePinnedToCore(compact_task, "stats compact", 4096, dirname,
+				      tskIDLE_PRIORITY + 1, &task, tskNO_AFFINITY);
+	assert(res == pdPASS);
+}
+
+void *db_stats_open(char *dirname)
+{
+	struct stats *stats;
+
+	stats = malloc(sizeof(*stats));
+	if (!stats)
+		return NULL;
+
+	stats->dirname = strdup(dirname);
+	if (!stats->dirname) {
+		free(stats);
+		return NULL;
+	}
+	stats->event_nb = 0;
+
+	return stats;
+}
+
+void db_stats_close(void *hdl)
+{
+	struct stats *stats = hdl;
+
+	db_stats_flush(stats);
+	start_compaction(stats->dirname);
+	free(stats->dirname);
+	free(stats);
+}
+
+int db_stats_log(void *hdl, uint32_t track_id, enum db_stats_event event)
+{
+	struct stats *stats = hdl;
+	struct stats_event *e = &stats->events[stats->event_nb++];
+
+	e->track_id = track_id;
+	e->time = time(NULL);
+	e->type = event;
+	e->reserved = 0;
+
+	if (stats->event_nb == STATS_EVENT_NB)
+		return db_stats_flush(stats);
+
+	return 0;
+}
+
+/* buffered events are dropped on failure so log never blocks playback */
+int db_stats_flush(void *hdl)
+{
+	struct stats *stats = hdl;
+	char *filename;
+	int len;
+	int ret;
+	int fd;
+
+	if (!stats->event_nb)
+		return 0;
+
+	len = stats->event_nb * sizeof(struct stats_event);
+	stats->event_nb = 0;
+	filename = db_index_path(stats->dirname, "events");
+	if (!filename)
+		return -1;
+
+	stats_lock();
+	fd = open(filename, O_WRONLY | O_CREAT | O_APPEND, 0666);
+	if (fd >= 0) {
+		ret = write(fd, stats->events, len) == len ? 0 : -1;
+		close(fd);
+	} else {
+		ret = -1;
+	}
+	stats_unlock();
+	free(filename);
+	if (ret)
+		ESP_LOGW(TAG, "unable to append %d stats events", (int) (len / sizeof(struct stats_event)));
+
+	return ret;
+}
+
+int db_stats_compact(char *dirname)
+{
+	struct db_stats_track *tracks;
+	char *filename;
+	int track_nb;
+	int ret;
+
+	stats_lock();
+	ret = log_rotate(dirname);
+	stats_unlock();
+	if (ret)
+		return ret < 0 ? ret : 0;
+
+	ret = load_counters(dirname, &tracks, &track_nb);
+	if (ret)
+		return ret;
+	ret = apply_log(dirname, "events.compact", &tracks, &track_nb);
+	if (ret)
+		goto exit;
+
+	ESP_LOGI(TAG, "compact stats for %d tracks", track_nb);
+	filename = db_index_path(dirname, "events.compact");
+	if (!filename) {
+		ret = -1;
+		goto exit;
+	}
+	/* readers must not see the compacted events twice */
+	stats_lock();
+	ret = write_counters(dirname, tracks, track_nb);
+	if (!ret)
+		unlink(filename);
+	stats_unlock();
+	free(filename);
+
+exit:
+	free(tracks);
+
+	return ret;
+}
+
+/* counters and not yet compacted events */
+static int load_stats(char *dirname, struct db_stats_track **tracks, int *track_nb)
+{
+	int ret;
+
+	stats_lock();
+	ret = load_counters(dirname, tracks, track_nb);
+	if (!ret)
+		ret = apply_log(dirname, "events.compact", tracks, track_nb);
+	if (!ret)
+		ret = apply_log(dirname, "events", tracks, track_nb);
+	stats_unlock();
+
+	return ret;
+}
+
+int db_stats_counters(char *dirname, struct db_stats_track **tracks, int *track_nb)
+{
+	return load_stats(dirname, tracks, track_nb);
+}
+
+static int sort_most_played(const void *pa, const void *pb)
+{
+	const struct db_stats_track *a = pa;
+	const struct db_stats_track *b = pb;
+
+	if (a->play_nb != b->play_nb)
+		return a->play_nb > b->play_nb ? -1 : 1;
+	if (a->last_played != b->last_played)
+		return a->last_played > b->last_played ? -1 : 1;
+
+	return 0;
+}
+
+static int sort_recently_played(const void *pa, const void *pb)
+{
+	const struct db_stats_track *a = pa;
+	const struct db_stats_track *b = pb;
+
+	if (a->last_played != b->last_played)
+		return a->last_played > b->last_played ? -1 : 1;
+
+	return 0;
+}
+
+static int list_played(void *index, enum db_stats_list list,
+		       struct db_stats_track *counters, int counter_nb,
+		       struct db_track *tracks, int track_nb)
+{
+	int is_most = list == DB_STATS_MOST_PLAYED;
+	int res = 0;
+	int nb = 0;
+	int idx;
+	int i;
+
+	for (i = 0; i < counter_nb; i++) {
+		if (is_most ? counters[i].play_nb : counters[i].last_played)
+			counters[nb++] = counters[i];
+	}
+	qsort(counters, nb, sizeof(struct db_stats_track),
+	      is_most ? sort_most_played : sort_recently_played);
+
+	/* removed tracks still have counters */
+	for (i = 0; i < nb && res < track_nb; i++) {
+		idx = db_index_find_track(index, counters[i].id);
+		if (idx < 0)
+			continue;
+		if (db_index_get_track(index, idx, &tracks[res]) == 0)
+			res++;
+	}
+
+	return res;
+}
+
+/* join index refs and counters, both sorted by id, so that result is in
+ * browse order.
+ */
+static int list_never_played(void *index, struct db_stats_track *counters, int counter_nb,
+			     struct db_track *tracks, int track_nb)
+{
+	struct db_track_ref refs[STATS_REF_CHUNK];
+	int index_nb = db_index_track_nb(index);
+	uint8_t *is_played;
+	int res = 0;
+	int start;
+	int nb;
+	int i;
+	int j = 0;
+
+	is_played = calloc(index_nb / 8 + 1, 1);
+	if (!is_played)
+		return -1;
+
+	for (start = 0; start < index_nb; start += nb) {
+		nb = db_index_get_refs(index, start, refs, STATS_REF_CHUNK);
+		if (nb <= 0) {
+			free(is_played);
+			return -1;
+		}
+		for (i = 0; i < nb; i++) {
+			while (j < counter_nb && counters[j].id < refs[i].id)
+				j++;
+			if (j < counter_nb && counters[j].id == refs[i].id &&
+			    (counters[j].play_nb || counters[j].last_played))
+				is_played[refs[i].idx / 8] |= 1 << (refs[i].idx % 8);
+		}
+	}
+
+	for (i = 0; i < index_nb && res < track_nb; i++) {
+		if (is_played[i / 8] & (1 << (i % 8)))
+			continue;
+		if (db_index_get_track(index, i, &tracks[res]) == 0)
+			res++;
+	}
+	free(is_played);
+
+	return res;
+}
+
+int db_stats_list(char *dirname, enum db_stats_list list, struct db_track *tracks, int track_nb)
+{
+	struct db_stats_track *counters;
+	int counter_nb;
+	void *index;
+	int res;
+
+	index = db_index_open(dirname);
+	if (!index)
+		return -1;
+
+	res = load_stats(dirname, &counters, &counter_nb);
+	if (res)
+		goto exit;
+
+	if (list == DB_STATS_NEVER_PLAYED)
+		res = list_never_played(index, counters, counter_nb, tracks, track_nb);
+	else
+		res = list_played(index, list, counters, counter_nb, tracks, track_nb);
+	free(counters);
+
+exit:
+	db_index_close(index);
+
+	return res;
+}
+
+void db_stats_put_list(struct db_track *tracks, int track_nb)
+{
+	int i;
+
+	for (i = 0; i < track_nb; i++)
+		db_index_put_track(&tracks[i]);
+}
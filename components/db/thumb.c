@@ -0,0 +1,386 @@
+#include "db_thumb.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "esp32/rom/tjpgd.h"
+#include "id3.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.db_thumb";
+
+#define THUMB_MAGIC		0x54335652
+#define THUMB_VERSION		1
+#define THUMB_ALIGN		512
+/* rom tjpgd needs at least 3100 bytes of work area */
+#define JPEG_WORK_SZ		3100
+
+/* thumbs file layout is :
+ *  - struct thumb_hdr
+ *  - thumb_nb struct thumb_entry sorted by album id.
+ *  - padding up to data_offset which is sector aligned.
+ *  - DB_THUMB_BYTES pixmaps indexed by entry slot.
+ */
+struct thumb_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t size;
+	uint32_t thumb_nb;
+	uint32_t data_offset;
+};
+
+struct thumb_entry {
+	uint32_t album_id;
+	uint32_t slot;
+};
+
+struct thumb {
+	int fd;
+	struct thumb_hdr hdr;
+	struct thumb_entry *entries;
+};
+
+struct jpeg_src {
+	int fd;
+	int remain;
+	int scaled_width;
+	int scaled_height;
+	uint16_t *pixels;
+};
+
+/* fatfs is case insensitive */
+static const char *cover_names[] = {"folder.jpg", "cover.jpg"};
+
+static uint16_t rgb565(BYTE *rgb)
+{
+	uint16_t pixel = ((rgb[0] & 0xf8) << 8) | ((rgb[1] & 0xfc) << 3) | (rgb[2] >> 3);
+
+#if CONFIG_LV_COLOR_16_SWAP
+	pixel = (pixel >> 8) | (pixel << 8);
+#endif
+
+	return pixel;
+}
+
+static UINT jpeg_input(JDEC *jd, BYTE *buf, UINT len)
+{
+	struct jpeg_src *src = jd->device;
+	int ret;
+
+	len = MIN(len, src->remain);
+	if (buf) {
+		ret = read(src->fd, buf, len);
+		if (ret < 0)
+			return 0;
+		len = ret;
+	} else if (lseek(src->fd, len, SEEK_CUR) < 0) {
+		return 0;
+	}
+	src->remain -= len;
+
+	return len;
+}
+
+/* scale decoded block to thumbnail. Each source pixel covers the range of
+ * thumbnail pixels it maps to, so this works both ways.
+ */
+static UINT jpeg_output(JDEC *jd, void *bitmap, JRECT *rect)
+{
+	struct jpeg_src *src = jd->device;
+	BYTE *rgb = bitmap;
+	int tx0, tx1, ty0, ty1;
+	uint16_t pixel;
+	int x, y, tx, ty;
+
+	for (y = rect->top; y <= rect->bottom; y++) {
+		ty0 = y * DB_THUMB_SIZE / src->scaled_height;
+		ty1 = MIN(((y + 1) * DB_THUMB_SIZE - 1) / src->scaled_height, DB_THUMB_SIZE - 1);
+		for (x = rect->left; x <= rect->right; x++, rgb += 3) {
+			if (x >= src->scaled_width || y >= src->scaled_height)
+				continue;
+			tx0 = x * DB_THUMB_SIZE / src->scaled_width;
+			tx1 = MIN(((x + 1) * DB_THUMB_SIZE - 1) / src->scaled_width, DB_THUMB_SIZE - 1);
+			pixel = rgb565(rgb);
+			for (ty = ty0; ty <= ty1; ty++)
+				for (tx = tx0; tx <= tx1; tx++)
+					src->pixels[ty * DB_THUMB_SIZE + tx] = pixel;
+		}
+	}
+
+	return 1;
+}
+
+static int decode_jpeg(int fd, int size, uint16_t *pixels, void *work)
+{
+	struct jpeg_src src;
+	JRESULT res;
+	JDEC jd;
+	int scale;
+
+	src.fd = fd;
+	src.remain = size;
+	src.pixels = pixels;
+	res = jd_prepare(&jd, jpeg_input, work, JPEG_WORK_SZ, &src);
+	if (res != JDR_OK)
+		return -1;
+
+	/* let the decoder do most of the downscale */
+	for (scale = 3; scale > 0; scale--) {
+		if ((jd.width >> scale) >= DB_THUMB_SIZE && (jd.height >> scale) >= DB_THUMB_SIZE)
+			break;
+	}
+	src.scaled_width = jd.width >> scale;
+	src.scaled_height = jd.height >> scale;
+	if (!src.scaled_width || !src.scaled_height)
+		return -1;
+
+	res = jd_decomp(&jd, jpeg_output, scale);
+
+	return res == JDR_OK ? 0 : -1;
+}
+
+static int decode_file(char *filename, int offset, int size, uint16_t *pixels, void *work)
+{
+	int ret = -1;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+
+	if (size < 0)
+		size = lseek(fd, 0, SEEK_END);
+	if (size > 0 && lseek(fd, offset, SEEK_SET) == offset)
+		ret = decode_jpeg(fd, size, pixels, work);
+	close(fd);
+
+	return ret;
+}
+
+/* embedded cover first, then cover file next to the song */
+static int extract_cover(struct db_track *track, uint16_t *pixels, void *work)
+{
+	char *filename;
+	char *dir_end;
+	int offset;
+	int size;
+	int ret;
+	int i;
+
+	ret = id3_get_picture(track->filepath, &offset, &size);
+	if (!ret && !decode_file(track->filepath, offset, size, pixels, work))
+		return 0;
+
+	dir_end = strrchr(track->filepath, '/');
+	if (!dir_end)
+		return -1;
+	for (i = 0; i < ARRAY_SIZE(cover_names); i++) {
+		*dir_end = '\0';
+		filename = concat(track->filepath, (char *) cover_names[i]);
+		*dir_end = '/';
+		if (!filename)
+			return -1;
+		ret = decode_file(filename, 0, -1, pixels, work);
+		free(filename);
+		if (!ret)
+			return 0;
+	}
+
+	return -1;
+}
+
+static int sort_entries(const void *pa, const void *pb)
+{
+	const struct thumb_entry *a = pa;
+	const struct thumb_entry *b = pb;
+
+	if (a->album_id == b->album_id)
+		return 0;
+
+	return a->album_id < b->album_id ? -1 : 1;
+}
+
+static struct thumb_entry *find_entry(struct thumb *thumb, uint32_t album_id)
+{
+	struct thumb_entry key = {.album_id = album_id};
+
+	return bsearch(&key, thumb->entries, thumb->hdr.thumb_nb, sizeof(struct thumb_entry),
+		       sort_entries);
+}
+
+static int thumb_get_by_id(struct thumb *thumb, uint32_t album_id, uint16_t *pixels)
+{
+	struct thumb_entry *entry = find_entry(thumb, album_id);
+
+	if (!entry)
+		return -1;
+
+	return read_at(thumb->fd, thumb->hdr.data_offset + entry->slot * DB_THUMB_BYTES,
+		       pixels, DB_THUMB_BYTES);
+}
+
+static int write_thumbs(int fd, struct db_track *tracks, int track_nb,
+			struct thumb *old, struct thumb_hdr *hdr,
+			struct thumb_entry *entries, uint16_t *pixels, void *work)
+{
+	uint32_t album_id;
+	int decode_nb = 0;
+	int ret;
+	int i;
+
+	for (i = 0; i < track_nb; i++) {
+		if (!db_track_is_new_album(tracks, i))
+			continue;
+
+		/* only decode covers of new albums */
+		album_id = db_album_id(tracks[i].keys->artist_dir, tracks[i].keys->album_dir);
+		ret = old ? thumb_get_by_id(old, album_id, pixels) : -1;
+		if (ret) {
+			ret = extract_cover(&tracks[i], pixels, work);
+			decode_nb++;
+		}
+		if (ret)
+			continue;
+
+		ret = write_at(fd, hdr->data_offset + hdr->thumb_nb * DB_THUMB_BYTES, pixels,
+			       DB_THUMB_BYTES);
+		if (ret)
+			return ret;
+		entries[hdr->thumb_nb].album_id = album_id;
+		entries[hdr->thumb_nb].slot = hdr->thumb_nb;
+		hdr->thumb_nb++;
+	}
+	ESP_LOGI(TAG, "%d thumbnails, %d covers decoded", hdr->thumb_nb, decode_nb);
+
+	qsort(entries, hdr->thumb_nb, sizeof(struct thumb_entry), sort_entries);
+	ret = write_at(fd, 0, hdr, sizeof(*hdr));
+	if (ret)
+		return ret;
+	if (hdr->thumb_nb)
+		ret = write_at(fd, sizeof(*hdr), entries, hdr->thumb_nb * sizeof(struct thumb_entry));
+
+	return ret;
+}
+
+/* public api */
+int db_thumb_build(char *dirname, struct db_track *tracks, int track_nb)
+{
+	struct thumb_entry *entries = NULL;
+	uint16_t *pixels = NULL;
+	void *work = NULL;
+	struct thumb_hdr hdr;
+	struct thumb *old;
+	char *filename;
+	int album_nb = 0;
+	int ret = -1;
+	int fd;
+	int i;
+
+	for (i = 0; i < track_nb; i++)
+		album_nb += db_track_is_new_album(tracks, i);
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = THUMB_MAGIC;
+	hdr.version = THUMB_VERSION;
+	hdr.size = DB_THUMB_SIZE;
+	hdr.data_offset = sizeof(hdr) + album_nb * sizeof(struct thumb_entry);
+	hdr.data_offset = (hdr.data_offset + THUMB_ALIGN - 1) & ~(THUMB_ALIGN - 1);
+
+	filename = db_index_path(dirname, "thumbs.tmp");
+	if (!filename)
+		return -1;
+	fd = creat(filename, 0666);
+	free(filename);
+	if (fd < 0)
+		return -1;
+
+	entries = malloc(album_nb * sizeof(struct thumb_entry) + 1);
+	pixels = malloc(DB_THUMB_BYTES);
+	work = malloc(JPEG_WORK_SZ);
+	if (!entries || !pixels || !work)
+		goto error;
+
+	old = db_thumb_open(dirname);
+	ret = write_thumbs(fd, tracks, track_nb, old, &hdr, entries, pixels, work);
+	if (old)
+		db_thumb_close(old);
+
+error:
+	close(fd);
+	free(entries);
+	free(pixels);
+	free(work);
+	if (!ret)
+		ret = db_index_replace(dirname, "thumbs.tmp", "thumbs");
+
+	return ret;
+}
+
+void *db_thumb_open(char *dirname)
+{
+	struct thumb *thumb;
+	char *filename;
+	int ret;
+
+	thumb = malloc(sizeof(*thumb));
+	if (!thumb)
+		return NULL;
+	memset(thumb, 0, sizeof(*thumb));
+
+	db_index_read_begin();
+	filename = db_index_path(dirname, "thumbs");
+	if (!filename)
+		goto error;
+	thumb->fd = open(filename, O_RDONLY);
+	free(filename);
+	if (thumb->fd < 0)
+		goto error;
+
+	ret = read_at(thumb->fd, 0, &thumb->hdr, sizeof(thumb->hdr));
+	if (ret)
+		goto read_error;
+	if (thumb->hdr.magic != THUMB_MAGIC || thumb->hdr.version != THUMB_VERSION ||
+	    thumb->hdr.size != DB_THUMB_SIZE)
+		goto read_error;
+
+	thumb->entries = malloc(thumb->hdr.thumb_nb * sizeof(struct thumb_entry) + 1);
+	if (!thumb->entries)
+		goto read_error;
+	ret = read_at(thumb->fd, sizeof(thumb->hdr), thumb->entries,
+		      thumb->hdr.thumb_nb * sizeof(struct thumb_entry));
+	if (ret)
+		goto read_error;
+
+	return thumb;
+
+read_error:
+	free(thumb->entries);
+	close(thumb->fd);
+error:
+	db_index_read_end();
+	free(thumb);
+
+	return NULL;
+}
+
+void db_thumb_close(void *hdl)
+{
+	struct thumb *thumb = hdl;
+
+	close(thumb->fd);
+	db_index_read_end();
+	free(thumb->entries);
+	free(thumb);
+}
+
+int db_thumb_get(void *hdl, char *artist, char *album, uint16_t *pixels)
+{
+	return thumb_get_by_id(hdl, db_album_id(artist, album), pixels);
+}
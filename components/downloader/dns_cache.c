@@ -0,0 +1,131 @@
+#include "dns_cache.h"
+
+#include <string.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <arpa/inet.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+
+/* getaddrinfo doesn't give back record ttl, so entries live for a fixed
+ * time. A failed connection drops its entry before that.
+ */
+#define DNS_CACHE_NB		8
+#define DNS_CACHE_TTL_MS	(5 * 60 * 1000)
+#define DNS_CACHE_HOST_LEN	64
+
+static const char* TAG = "rv3.dns_cache";
+
+struct dns_entry {
+	char host[DNS_CACHE_HOST_LEN];
+	char ip[DNS_CACHE_IP_LEN];
+	int64_t expire;
+};
+
+static struct dns_entry entries[DNS_CACHE_NB];
+static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+
+static struct dns_entry *lookup(const char *host)
+{
+	int i;
+
+	for (i = 0; i < DNS_CACHE_NB; i++) {
+		if (strcmp(entries[i].host, host) == 0)
+			return &entries[i];
+	}
+
+	return NULL;
+}
+
+/* empty or oldest entry */
+static struct dns_entry *victim()
+{
+	struct dns_entry *res = &entries[0];
+	int i;
+
+	for (i = 1; i < DNS_CACHE_NB; i++) {
+		if (entries[i].expire < res->expire)
+			res = &entries[i];
+	}
+
+	return res;
+}
+
+static int resolve(const char *host, char *ip)
+{
+	const struct addrinfo hints = {
+		.ai_family = AF_INET,
+		.ai_socktype = SOCK_STREAM,
+	};
+	struct addrinfo *res;
+	struct in_addr *addr;
+	int ret;
+
+	ret = getaddrinfo(host, NULL, &hints, &res);
+	if (ret || !res) {
+		ESP_LOGW(TAG, "unable to resolve %s: %d", host, ret);
+		return -1;
+	}
+	addr = &((struct sockaddr_in *) res->ai_addr)->sin_addr;
+	inet_ntoa_r(*addr, ip, DNS_CACHE_IP_LEN);
+	freeaddrinfo(res);
+
+	return 0;
+}
+
+/* public api */
+/* ip must hold DNS_CACHE_IP_LEN bytes */
+int dns_cache_resolve(const char *host, char *ip)
+{
+	int64_t now = esp_timer_get_time();
+	struct dns_entry *entry;
+	int64_t start;
+	int ret = -1;
+
+	if (strlen(host) >= DNS_CACHE_HOST_LEN)
+		return resolve(host, ip);
+
+	portENTER_CRITICAL(&lock);
+	entry = lookup(host);
+	if (entry && entry->expire > now) {
+		strcpy(ip, entry->ip);
+		ret = 0;
+	}
+	portEXIT_CRITICAL(&lock);
+	if (!ret)
+		return 0;
+
+	start = esp_timer_get_time();
+	ret = resolve(host, ip);
+	if (ret)
+		return ret;
+	ESP_LOGI(TAG, "%s is %s, resolved in %d ms", host, ip,
+		 (int) ((esp_timer_get_time() - start) / 1000));
+
+	portENTER_CRITICAL(&lock);
+	entry = lookup(host);
+	if (!entry)
+		entry = victim();
+	strcpy(entry->host, host);
+	strcpy(entry->ip, ip);
+	entry->expire = esp_timer_get_time() + DNS_CACHE_TTL_MS * 1000LL;
+	portEXIT_CRITICAL(&lock);
+
+	return 0;
+}
+
+void dns_cache_invalidate(const char *host)
+{
+	struct dns_entry *entry;
+
+	portENTER_CRITICAL(&lock);
+	entry = lookup(host);
+	if (entry) {
+		entry->host[0] = '\0';
+		entry->expire = 0;
+	}
+	portEXIT_CRITICAL(&lock);
+}
@@ -11,10 +11,13 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <arpa/inet.h>
 
 #include "esp_http_client.h"
 #include "esp_log.h"
 
+#include "dns_cache.h"
+
 static const char* TAG = "rv3.downloader";
 static  const char* root_ca = \
 "-----BEGIN CERTIFICATE-----\n" \
@@ -165,17 +168,67 @@ static esp_err_t http_event_handle(esp_http_client_event_t *evt)
 	return ESP_OK;
 }
 
-int downloader_generic_with_headers(char *url, on_data_cb cb, on_header_cb hdr_cb,
-				    void *cb_ctx, char **headers)
+/* plain http url host is replaced by its address from dns cache, so
+ * switching between radios doesn't wait for a dns answer each time. Host
+ * header keeps original name for virtual hosting. Return NULL when url is
+ * to be used as is.
+ */
+static char *resolve_url(char *url, char *host, int host_len, char *authority,
+			 int authority_len)
+{
+	const char *scheme = "http://";
+	char ip[DNS_CACHE_IP_LEN];
+	struct in_addr addr;
+	char *resolved;
+	char *start;
+	char *end;
+	int len;
+
+	if (strncmp(url, scheme, strlen(scheme)))
+		return NULL;
+	start = url + strlen(scheme);
+	end = strpbrk(start, ":/");
+	if (!end)
+		end = start + strlen(start);
+	if (end - start >= host_len)
+		return NULL;
+	memcpy(host, start, end - start);
+	host[end - start] = '\0';
+	if (inet_aton(host, &addr))
+		return NULL;
+
+	len = strcspn(start, "/");
+	if (len >= authority_len)
+		return NULL;
+	memcpy(authority, start, len);
+	authority[len] = '\0';
+
+	if (dns_cache_resolve(host, ip))
+		return NULL;
+	len = strlen(scheme) + strlen(ip) + strlen(end) + 1;
+	resolved = malloc(len);
+	if (resolved)
+		snprintf(resolved, len, "%s%s%s", scheme, ip, end);
+
+	return resolved;
+}
+
+/* timeout_in_ms bounds each socket read, 0 keeps http client default */
+int downloader_stream(char *url, on_data_cb cb, on_header_cb hdr_cb,
+		      void *cb_ctx, char **headers, int timeout_in_ms)
 {
 	esp_http_client_config_t config = {0};
 	struct cb_info ctx = {cb, hdr_cb, cb_ctx};
 	esp_http_client_handle_t client;
+	char authority[96];
+	char *resolved;
+	char host[64];
 	char *key;
 	char *value;
 	int ret;
 
-	config.url = url;
+	resolved = resolve_url(url, host, sizeof(host), authority, sizeof(authority));
+	config.url = resolved ? resolved : url;
 	/* FIXME : next esp release should allow that. It will then be possible
 	 * to remove config.cert_pem = root_ca;
 	 */
@@ -185,12 +238,17 @@ int downloader_generic_with_headers(char *url, on_data_cb cb, on_header_cb hdr_c
 	config.buffer_size = 4096;
 	config.buffer_size_tx = 4096;
 	config.user_data = &ctx;
+	if (timeout_in_ms)
+		config.timeout_ms = timeout_in_ms;
 
 	client = esp_http_client_init(&config);
 	if (!client) {
 		ESP_LOGE(TAG, "unable to init http for %s", url);
+		free(resolved);
 		return -1;
 	}
+	if (resolved)
+		esp_http_client_set_header(client, "Host", authority);
 
 	if (headers) {
 		while (*headers) {
@@ -205,12 +263,94 @@ int downloader_generic_with_headers(char *url, on_data_cb cb, on_header_cb hdr_c
 	ret = esp_http_client_perform(client);
 	if (ret)
 		ESP_LOGE(TAG, "unable to perform http for %s", url);
+	/* address may have moved, resolve it again next time. Other errors,
+	 * like a stop asked from data callback, say nothing about it.
+	 */
+	if (ret == ESP_ERR_HTTP_CONNECT && resolved)
+		dns_cache_invalidate(host);
 
 	esp_http_client_cleanup(client);
+	free(resolved);
 
 	return ret;
 }
 
+/* keep-alive connection for successive requests, http client only reopens
+ * it when host changes or server closed it.
+ */
+struct downloader_session {
+	esp_http_client_handle_t client;
+	struct cb_info ctx;
+};
+
+void *downloader_session_create(char *url, int timeout_in_ms)
+{
+	struct downloader_session *self = malloc(sizeof(*self));
+	esp_http_client_config_t config = {0};
+
+	if (!self)
+		return NULL;
+
+	config.url = url;
+	config.cert_pem = root_ca;
+	config.event_handler = http_event_handle;
+	config.buffer_size = 4096;
+	config.buffer_size_tx = 4096;
+	config.user_data = &self->ctx;
+	if (timeout_in_ms)
+		config.timeout_ms = timeout_in_ms;
+
+	self->client = esp_http_client_init(&config);
+	if (!self->client) {
+		ESP_LOGE(TAG, "unable to init http for %s", url);
+		free(self);
+		return NULL;
+	}
+
+	return self;
+}
+
+void downloader_session_destroy(void *hdl)
+{
+	struct downloader_session *self = hdl;
+
+	esp_http_client_cleanup(self->client);
+	free(self);
+}
+
+int downloader_session_get(void *hdl, char *url, on_data_cb cb, void *cb_ctx)
+{
+	struct downloader_session *self = hdl;
+	int status;
+	int ret;
+
+	self->ctx.cb = cb;
+	self->ctx.hdr_cb = NULL;
+	self->ctx.cb_ctx = cb_ctx;
+	ret = esp_http_client_set_url(self->client, url);
+	if (ret)
+		return ret;
+
+	ret = esp_http_client_perform(self->client);
+	if (ret) {
+		ESP_LOGE(TAG, "unable to perform http for %s", url);
+		return ret;
+	}
+	status = esp_http_client_get_status_code(self->client);
+	if (status != 200) {
+		ESP_LOGE(TAG, "got status %d for %s", status, url);
+		return -1;
+	}
+
+	return 0;
+}
+
+int downloader_generic_with_headers(char *url, on_data_cb cb, on_header_cb hdr_cb,
+				    void *cb_ctx, char **headers)
+{
+	return downloader_stream(url, cb, hdr_cb, cb_ctx, headers, 0);
+}
+
 int downloader_generic(char *url, on_data_cb cb, void *cb_ctx)
 {
 	return downloader_generic_with_headers(url, cb, NULL, cb_ctx, NULL);
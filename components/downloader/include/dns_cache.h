@@ -0,0 +1,9 @@
+#ifndef __DNS_CACHE__
+#define __DNS_CACHE__ 1
+
+#define DNS_CACHE_IP_LEN	16
+
+int dns_cache_resolve(const char *host, char *ip);
+void dns_cache_invalidate(const char *host);
+
+#endif
@@ -7,6 +7,11 @@ typedef void (*on_header_cb)(char *key, char *value, void *cb_ctx);
 int downloader_generic(char *url, on_data_cb cb, void *cb_ctx);
 int downloader_generic_with_headers(char *url, on_data_cb cb, on_header_cb hdr_cb,
 				    void *cb_ctx, char **headers);
+int downloader_stream(char *url, on_data_cb cb, on_header_cb hdr_cb,
+		      void *cb_ctx, char **headers, int timeout_in_ms);
 int downloader_file(char *url, char *fullpath);
+void *downloader_session_create(char *url, int timeout_in_ms);
+void downloader_session_destroy(void *hdl);
+int downloader_session_get(void *hdl, char *url, on_data_cb cb, void *cb_ctx);
 
 #endif
@@ -5,15 +5,29 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
 
 #include "ring.h"
+#include "mpeg.h"
 
-#define BUFFER_LEN	512
+/* reads are aligned on block size inside file so they never cross a fat
+ * cluster and go straight from card to dma capable block buffer.
+ */
+#define BLOCK_SZ		(16 * 1024)
+#define BLOCK_FALLBACK_SZ	(4 * 1024)
+/* start of next song read ahead, smaller when there is no psram */
+#define PREFETCH_SZ		(64 * 1024)
+#define PREFETCH_INTERNAL_SZ	(16 * 1024)
+#define PREFETCH_CHUNK_SZ	4096
+
+#define MIN(a,b)	((a)<(b)?(a):(b))
 
 static const char* TAG = "rv3.fetch_file";
 
@@ -23,39 +37,217 @@ struct fetch_file {
 	volatile bool is_active;
 	SemaphoreHandle_t sem_en_of_task;
 	char *filename;
-	char buffer[BUFFER_LEN];
+	int offset;
+	/* bytes of file pushed so far */
+	volatile int pos;
+	char *block;
+	int block_sz;
+	struct fetch_file_stats stats;
+	/* something has been pushed for current song */
+	bool is_primed;
+	/* next song opened and its first bytes read while current one ends */
+	char *prefetch_buf;
+	int prefetch_sz;
+	char *prefetch_filename;
+	int prefetch_fd;
+	volatile int prefetch_len;
+	volatile bool is_prefetch_active;
+	SemaphoreHandle_t sem_end_of_prefetch;
+	/* fetch task is pushing prefetch_buf[0..drain_len[ */
+	int drain_len;
+	volatile bool is_draining;
 };
 
+/* ring_push waits until the whole block fits, so ring is refilled by full
+ * blocks once it has drained below its size instead of polling it.
+ */
+static int push(struct fetch_file *self, char *data, int len)
+{
+	int ret;
+
+	if (self->is_primed && ring_level(self->buffer_hdl) == 0)
+		self->stats.starve_nb++;
+	while (1) {
+		ret = ring_push(self->buffer_hdl, len, data);
+		if (!ret)
+			break;
+		/* timeout, retry unless we are stopped */
+		if (!self->is_active)
+			return -1;
+	}
+	self->pos += len;
+	self->is_primed = true;
+
+	return 0;
+}
+
+static void fetch_file_prefetch_task(void *arg)
+{
+	struct fetch_file *self = arg;
+	int len;
+
+	self->prefetch_fd = open(self->prefetch_filename, O_RDONLY);
+	while (self->prefetch_fd >= 0 && self->is_prefetch_active &&
+	       self->prefetch_len < self->prefetch_sz) {
+		len = read(self->prefetch_fd, self->prefetch_buf + self->prefetch_len,
+			   MIN(PREFETCH_CHUNK_SZ, self->prefetch_sz - self->prefetch_len));
+		if (len <= 0)
+			break;
+		self->prefetch_len += len;
+	}
+
+	xSemaphoreGive(self->sem_end_of_prefetch);
+	vTaskDelete(NULL);
+}
+
+static void stop_prefetch(struct fetch_file *self)
+{
+	self->is_prefetch_active = false;
+	xSemaphoreTake(self->sem_end_of_prefetch, portMAX_DELAY);
+}
+
+/* prefetch task must be stopped */
+static void release_prefetch(struct fetch_file *self)
+{
+	if (self->prefetch_fd >= 0)
+		close(self->prefetch_fd);
+	self->prefetch_fd = -1;
+	free(self->prefetch_filename);
+	self->prefetch_filename = NULL;
+}
+
+static void discard_prefetch(struct fetch_file *self)
+{
+	if (!self->prefetch_filename)
+		return ;
+
+	stop_prefetch(self);
+	release_prefetch(self);
+}
+
+/* take over prefetched file if it's the one we are asked to play */
+static void use_prefetch(struct fetch_file *self, char *filename, int offset)
+{
+	self->drain_len = 0;
+	if (!self->prefetch_filename)
+		return ;
+
+	if (offset || strcmp(self->prefetch_filename, filename)) {
+		discard_prefetch(self);
+		return ;
+	}
+
+	stop_prefetch(self);
+	/* file task only takes fd over along with data */
+	if (self->prefetch_fd < 0 || self->prefetch_len <= 0) {
+		release_prefetch(self);
+		return ;
+	}
+	ESP_LOGI(TAG, "start %s with %d bytes prefetched", filename, self->prefetch_len);
+	self->drain_len = self->prefetch_len;
+	self->is_draining = true;
+	free(self->prefetch_filename);
+	self->prefetch_filename = NULL;
+}
+
+/* return index of first frame header in buffer or len when none is found */
+static int find_frame(char *buffer, int len)
+{
+	int i;
+
+	for (i = 0; i + 3 <= len; i++) {
+		if (mpeg_is_frame_header((uint8_t *) buffer + i))
+			return i;
+	}
+
+	return len;
+}
+
+static int read_block(struct fetch_file *self, int fd, int file_pos)
+{
+	int64_t start = esp_timer_get_time();
+	uint32_t duration_in_ms;
+	int len;
+
+	len = read(fd, self->block, self->block_sz - file_pos % self->block_sz);
+	duration_in_ms = (esp_timer_get_time() - start) / 1000;
+	self->stats.read_nb++;
+	self->stats.read_time_in_ms += duration_in_ms;
+	if (duration_in_ms > self->stats.max_read_time_in_ms)
+		self->stats.max_read_time_in_ms = duration_in_ms;
+	if (len > 0)
+		self->stats.bytes += len;
+
+	return len;
+}
+
+static void log_stats(struct fetch_file *self)
+{
+	struct fetch_file_stats *stats = &self->stats;
+
+	ESP_LOGI(TAG, "%u KB in %u reads, %u ms in fat (max %u ms, %u KB/s), %u starvations",
+		 stats->bytes / 1024, stats->read_nb, stats->read_time_in_ms,
+		 stats->max_read_time_in_ms,
+		 stats->read_time_in_ms ? stats->bytes / stats->read_time_in_ms : 0,
+		 stats->starve_nb);
+}
+
 static void fetch_file_task(void *arg)
 {
 	struct fetch_file *self = arg;
+	/* resuming inside file, drop bytes up to next frame start */
+	int is_syncing = self->offset != 0;
+	int file_pos = self->offset;
+	int skip = 0;
+	int len;
 	int fd;
-	int ret;
+	int i;
 
-	fd = open(self->filename, O_RDONLY);
+	if (self->drain_len) {
+		fd = self->prefetch_fd;
+		self->prefetch_fd = -1;
+		for (i = 0; i < self->drain_len; i += len) {
+			len = MIN(self->block_sz, self->drain_len - i);
+			if (push(self, self->prefetch_buf + i, len))
+				break;
+		}
+		self->is_draining = false;
+		file_pos = self->drain_len;
+	} else {
+		fd = open(self->filename, O_RDONLY);
+	}
 	if (fd < 0)
 		goto exit;
+	if (self->offset && lseek(fd, self->offset, SEEK_SET) < 0) {
+		ESP_LOGE(TAG, "unable to seek at %d", self->offset);
+		goto exit;
+	}
 
 	while (self->is_active) {
-		ret = read(fd, self->buffer, BUFFER_LEN);
-		if (ret <= 0) {
-			ESP_LOGE(TAG, "read error %d / %d\n", ret, errno);
+		len = read_block(self, fd, file_pos);
+		if (len <= 0) {
+			if (len < 0)
+				ESP_LOGE(TAG, "read error %d / %d\n", len, errno);
 			goto exit;
 		}
-retry:
-		ret = ring_push(self->buffer_hdl, ret, self->buffer);
-		/* test if we got a timeout */
-		if (ret) {
-			if (self->is_active) {
-				vTaskDelay(10);
-				goto retry;
-			}
+		file_pos += len;
+		if (is_syncing) {
+			skip = find_frame(self->block, len);
+			is_syncing = skip == len;
+			self->pos += skip;
+			len -= skip;
+			if (!len)
+				continue;
 		}
+		if (push(self, self->block + skip, len))
+			break;
+		skip = 0;
 	}
 
 exit:
 	if (fd >= 0)
 		close(fd);
+	log_stats(self);
 	xSemaphoreGive(self->sem_en_of_task);
 	vTaskDelete(NULL);
 }
@@ -69,6 +261,28 @@ void *fetch_file_create(void *buffer_hdl)
 	self->buffer_hdl = buffer_hdl;
 	self->sem_en_of_task = xSemaphoreCreateBinary();
 	assert(self->sem_en_of_task);
+	self->block_sz = BLOCK_SZ;
+	self->block = heap_caps_malloc(self->block_sz, MALLOC_CAP_DMA);
+	if (!self->block) {
+		self->block_sz = BLOCK_FALLBACK_SZ;
+		self->block = malloc(self->block_sz);
+	}
+	assert(self->block);
+	memset(&self->stats, 0, sizeof(self->stats));
+
+	self->prefetch_filename = NULL;
+	self->prefetch_fd = -1;
+	self->is_draining = false;
+	self->sem_end_of_prefetch = xSemaphoreCreateBinary();
+	assert(self->sem_end_of_prefetch);
+	self->prefetch_sz = PREFETCH_SZ;
+	self->prefetch_buf = heap_caps_malloc(self->prefetch_sz, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (!self->prefetch_buf) {
+		self->prefetch_sz = PREFETCH_INTERNAL_SZ;
+		self->prefetch_buf = malloc(self->prefetch_sz);
+	}
+	if (!self->prefetch_buf)
+		ESP_LOGW(TAG, "no memory for prefetch buffer");
 
 	return self;
 }
@@ -78,19 +292,30 @@ void fetch_file_destroy(void *hdl)
 	struct fetch_file *self = hdl;
 	assert(hdl);
 
+	discard_prefetch(self);
 	vSemaphoreDelete(self->sem_en_of_task);
+	vSemaphoreDelete(self->sem_end_of_prefetch);
+	free(self->prefetch_buf);
+	free(self->block);
 
 	free(hdl);
 }
 
-void fetch_file_start(void *hdl, char *filename)
+void fetch_file_start(void *hdl, char *filename, int offset)
 {
 	struct fetch_file *self = hdl;
 	BaseType_t res;
 
 	assert(hdl);
 
-	self->filename = filename;
+	/* caller may release filename as soon as we return */
+	self->filename = strdup(filename);
+	assert(self->filename);
+	self->offset = offset;
+	self->pos = offset;
+	memset(&self->stats, 0, sizeof(self->stats));
+	self->is_primed = false;
+	use_prefetch(self, filename, offset);
 	self->is_active = true;
 	res = xTaskCreatePinnedToCore(fetch_file_task, "fetch_file", 4096, hdl,
 			tskIDLE_PRIORITY + 1, &self->task, tskNO_AFFINITY);
@@ -104,4 +329,47 @@ void fetch_file_stop(void *hdl)
 
 	self->is_active = false;
 	xSemaphoreTake(self->sem_en_of_task, portMAX_DELAY);
+	free(self->filename);
+	self->filename = NULL;
+}
+
+int fetch_file_pos(void *hdl)
+{
+	struct fetch_file *self = hdl;
+
+	return self->pos;
+}
+
+void fetch_file_get_stats(void *hdl, struct fetch_file_stats *stats)
+{
+	struct fetch_file *self = hdl;
+
+	*stats = self->stats;
+}
+
+/* open filename and read its first bytes in background so a following
+ * fetch_file_start on it doesn't wait for sd card.
+ */
+void fetch_file_prefetch(void *hdl, char *filename)
+{
+	struct fetch_file *self = hdl;
+	BaseType_t res;
+
+	assert(hdl);
+
+	if (!self->prefetch_buf || self->is_draining)
+		return ;
+	if (self->prefetch_filename && strcmp(self->prefetch_filename, filename) == 0)
+		return ;
+	discard_prefetch(self);
+
+	self->prefetch_filename = strdup(filename);
+	if (!self->prefetch_filename)
+		return ;
+	self->prefetch_fd = -1;
+	self->prefetch_len = 0;
+	self->is_prefetch_active = true;
+	res = xTaskCreatePinnedToCore(fetch_file_prefetch_task, "fetch_prefetch", 3072, hdl,
+			tskIDLE_PRIORITY + 1, NULL, tskNO_AFFINITY);
+	assert(res == pdPASS);
 }
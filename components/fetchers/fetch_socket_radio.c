@@ -1,32 +1,67 @@
 #include "fetch_socket_radio.h"
 
 #include <string.h>
+#include <stdlib.h>
 #include <assert.h>
 
 #include "freertos/FreeRTOS.h"
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_heap_caps.h"
 
 #include "ring.h"
 #include "downloader.h"
+#include "icy.h"
+#include "mpeg.h"
+#include "hls.h"
+#include "timeshift.h"
+#include "record.h"
 #include "utils.h"
 
 static const char* TAG = "rv3.fetch_socket_radio";
 
-enum icy_st {
-	ST_DATA,
-	ST_ICY_LEN,
-	ST_ICY_PAYLOAD
-};
-
-struct icy {
-	enum icy_st st;
-	int metaint;
-	int pos;
-	int icy_len;
-	char *icy_buffer;
-	int icy_pos;
+#define MAX(a,b)	((a)>(b)?(a):(b))
+
+/* delay before reconnecting doubles on each failed attempt */
+#define RECONNECT_MIN_DELAY_MS		500
+#define RECONNECT_MAX_DELAY_MS		30000
+/* a connection that lasted that long was fine, backoff starts over */
+#define RECONNECT_HEALTHY_MS		60000
+#define RECONNECT_POLL_MS		100
+/* give up pre-roll skipping when that much data at 320 kbps holds no frame */
+#define PREROLL_MAX_BYTES_PER_SEC	40000
+/* latest data kept by a warm connection, about 2 s at 128 kbps */
+#define HOLD_SZ				(32 * 1024)
+/* bitrate variants of a station, network and ring are sampled each period.
+ * Stream steps down when ring keeps on draining under down level and steps
+ * up after ring stayed over up level for up time, which doubles on each
+ * step down.
+ */
+#define VARIANT_NB			4
+#define VARIANT_PATH_LEN		128
+#define ADAPT_PERIOD_MS			1000
+#define ADAPT_DOWN_LEVEL		40
+#define ADAPT_DOWN_FALL_NB		3
+#define ADAPT_UP_LEVEL			90
+#define ADAPT_UP_TIME_MS		60000
+#define ADAPT_UP_MAX_TIME_MS		(10 * 60000)
+/* variant chosen on step down must fit in that part of throughput */
+#define ADAPT_HEADROOM_PERCENT		80
+
+/* pls, m3u and hls playlists */
+#define PLAYLIST_SZ			(16 * 1024)
+#define PLAYLIST_DEPTH			3
+#define SEGMENT_URL_LEN			512
+/* hls live stream is joined that many segments before its end */
+#define HLS_LIVE_EDGE_NB		3
+/* lower bound of live playlist reload period */
+#define HLS_RELOAD_MIN_MS		1000
+
+struct variant {
+	int kbps;
+	char path[VARIANT_PATH_LEN];
 };
 
 struct fetch_socket_radio {
@@ -34,190 +69,571 @@ struct fetch_socket_radio {
 	TaskHandle_t task;
 	volatile bool is_active;
 	SemaphoreHandle_t sem_en_of_task;
+	/* stream url, radio url once playlists are resolved */
 	char url[256];
+	char station_url[256];
+	char host[128];
 	int is_icy;
 	struct icy icy;
 	void *cb_hdl;
 	audio_track_info_cb track_info_cb;
+	/* pre-roll ad length in seconds, dropped at start of each connection */
 	int anti_ad;
+	int preroll_remain_in_us;
+	int preroll_bytes;
+	int frame_remain;
+	uint8_t hdr[MPEG_HEADER_SZ];
+	int hdr_len;
+	struct fetch_socket_radio_stats stats;
+	/* connection was lost, waiting first data of a new one */
+	bool is_recovering;
+	int64_t drop_time;
+	/* data is flowing on current connection */
+	volatile bool is_streaming;
+	volatile bool is_reconnect_requested;
+	/* silent connection is dropped after that long */
+	int stall_time_in_ms;
+	/* warm connection keeps its latest data in hold until promoted */
+	SemaphoreHandle_t hold_lock;
+	volatile bool is_held;
+	char *hold;
+	int hold_pos;
+	int hold_len;
+	volatile bool is_title_pending;
+	/* variants sorted by decreasing bitrate, variant_nb is set last */
+	struct variant variants[VARIANT_NB];
+	volatile int variant_nb;
+	int variant;
+	int next_variant;
+	/* connection ends on next frame boundary to switch variant */
+	bool is_switching;
+	/* new variant connection, drop data up to first frame */
+	bool is_syncing;
+	int64_t adapt_time;
+	uint32_t adapt_bytes;
+	int adapt_level;
+	int fall_nb;
+	int full_time_in_ms;
+	int up_time_in_ms;
+	/* hls live stream instead of a single long get */
+	bool is_hls;
+	char *text;
+	int text_len;
+	struct ts_demux ts;
+	bool is_ts;
+	bool is_segment_start;
+	int64_t segment_request_time;
+	/* stream is teed there, it decides whether ring gets it now */
+	void *timeshift_hdl;
+	/* stream is also recorded there */
+	void *record_hdl;
 };
 
+/* circular, older data is overwritten */
+static void hold_data(struct fetch_socket_radio *self, char *data, int data_len)
+{
+	int len;
+
+	if (data_len > HOLD_SZ) {
+		data += data_len - HOLD_SZ;
+		data_len = HOLD_SZ;
+	}
+	while (data_len) {
+		len = MIN(data_len, HOLD_SZ - self->hold_pos);
+		memcpy(self->hold + self->hold_pos, data, len);
+		self->hold_pos = (self->hold_pos + len) % HOLD_SZ;
+		self->hold_len = MIN(self->hold_len + len, HOLD_SZ);
+		data += len;
+		data_len -= len;
+	}
+}
+
+/* push held data oldest first */
+static void release_hold(struct fetch_socket_radio *self)
+{
+	int start = (self->hold_pos - self->hold_len + HOLD_SZ) % HOLD_SZ;
+	int len = MIN(self->hold_len, HOLD_SZ - start);
+
+	if (len)
+		ring_push(self->buffer_hdl, len, self->hold + start);
+	if (self->hold_len - len)
+		ring_push(self->buffer_hdl, self->hold_len - len, self->hold);
+	self->hold_len = 0;
+}
+
 static int write_buffer(void *data, int data_len, void *cb_ctx)
 {
 	struct fetch_socket_radio *self = cb_ctx;
 	int res;
 
-retry:
-	res = ring_push(self->buffer_hdl, data_len, data);
-	if (res) {
-		if (self->is_active)
-			goto retry;
+	if (self->is_held) {
+		xSemaphoreTake(self->hold_lock, portMAX_DELAY);
+		res = self->is_held;
+		if (res)
+			hold_data(self, data, data_len);
+		xSemaphoreGive(self->hold_lock);
+		if (res)
+			return self->is_active ? 0 : 1;
 	}
+	if (self->record_hdl)
+		record_write(self->record_hdl, data, data_len);
+	if (self->timeshift_hdl && !timeshift_write(self->timeshift_hdl, data, data_len))
+		return self->is_active ? 0 : 1;
+
+	/* ring_push waits for room, retry until it's there unless connection
+	 * is going away.
+	 */
+	do {
+		res = ring_push(self->buffer_hdl, data_len, data);
+	} while (res && self->is_active && !self->is_reconnect_requested);
+
+	return res ? 1 : 0;
+}
 
-	return self->is_active ? 0 : 1;
+static void reset_preroll(struct fetch_socket_radio *self)
+{
+	self->preroll_remain_in_us = self->anti_ad * 1000000;
+	self->preroll_bytes = 0;
+	self->frame_remain = 0;
+	self->hdr_len = 0;
 }
 
-static int handle_data(struct fetch_socket_radio *self, char *data, int len)
+/* hdr is full, drop its frame or slide one byte when not in sync */
+static void handle_preroll_header(struct fetch_socket_radio *self)
 {
-	struct icy *icy = &self->icy;
-	int consume;
-	int remain;
+	int duration_in_us;
+	int frame_len;
 
-	if (icy->metaint == 0) {
-		write_buffer(data, len, self);
-		return len;
+	if (mpeg_frame_info(self->hdr, &frame_len, &duration_in_us)) {
+		memmove(self->hdr, self->hdr + 1, MPEG_HEADER_SZ - 1);
+		self->hdr_len--;
+		return ;
 	}
+	self->frame_remain = frame_len - MPEG_HEADER_SZ;
+	self->preroll_remain_in_us -= duration_in_us;
+	self->hdr_len = 0;
+}
 
-	remain = icy->metaint - icy->pos;
-	consume = MIN(remain, len);
-	write_buffer(data, consume, self);
-	icy->pos += consume;
+/* drop whole mpeg frames until pre-roll duration has gone so decoder
+ * starts on the first frame of live stream. Return bytes of data dropped.
+ */
+static int skip_preroll(struct fetch_socket_radio *self, uint8_t *data, int data_len)
+{
+	int len = data_len;
+	int consume;
 
-	if (icy->pos == icy->metaint) {
-		icy->pos = 0;
-		icy->st = ST_ICY_LEN;
+	while (len && (self->preroll_remain_in_us > 0 || self->frame_remain)) {
+		if (self->frame_remain) {
+			consume = MIN(self->frame_remain, len);
+			self->frame_remain -= consume;
+		} else {
+			consume = 1;
+			self->hdr[self->hdr_len++] = *data;
+			if (self->hdr_len == MPEG_HEADER_SZ)
+				handle_preroll_header(self);
+		}
+		data += consume;
+		len -= consume;
+		self->preroll_bytes += consume;
+	}
+	if (self->preroll_bytes > self->anti_ad * PREROLL_MAX_BYTES_PER_SEC) {
+		ESP_LOGW(TAG, "no mpeg frame found, stop pre-roll skipping");
+		self->preroll_remain_in_us = 0;
+		self->frame_remain = 0;
 	}
+	if (self->preroll_remain_in_us <= 0 && !self->frame_remain && len)
+		ESP_LOGI(TAG, "skipped %d bytes of pre-roll", self->preroll_bytes);
 
-	return consume;
+	return data_len - len;
 }
 
-static int handle_icy_len(struct fetch_socket_radio *self, char *data, int len)
+static int write_audio(void *data, int data_len, void *cb_ctx)
 {
-	struct icy *icy = &self->icy;
+	struct fetch_socket_radio *self = cb_ctx;
+	int skip = 0;
+	int end;
+
+	if (self->preroll_remain_in_us > 0 || self->frame_remain)
+		skip = skip_preroll(self, data, data_len);
+	else if (self->is_syncing)
+		skip = mpeg_find_frame_boundary(data, data_len);
+	if (skip == data_len)
+		return 0;
+	self->is_syncing = false;
+	data = (char *) data + skip;
+	data_len -= skip;
+
+	if (!self->is_switching)
+		return write_buffer(data, data_len, cb_ctx);
+
+	/* cut old variant after its last whole frame */
+	end = mpeg_find_frame_boundary(data, data_len);
+	if (end && write_buffer(data, end, cb_ctx))
+		return 1;
+
+	return end < data_len ? 1 : 0;
+}
 
-	icy->icy_len = 16 * (unsigned char) data[0];
+static void track_info(char *title, void *cb_ctx)
+{
+	struct fetch_socket_radio *self = cb_ctx;
 
-	if (icy->icy_len) {
-		icy->icy_buffer = calloc(1, icy->icy_len);
-		assert(icy->icy_buffer);
-		icy->icy_pos = 0;
-		icy->st = ST_ICY_PAYLOAD;
-	} else {
-		icy->st = ST_DATA;
-	}
+	ESP_LOGI(TAG, "|%s|", title);
+	if (self->record_hdl)
+		record_title(self->record_hdl, title);
+	if (self->track_info_cb)
+		self->track_info_cb(self->cb_hdl, title);
+}
 
-	return 1;
+static void switch_variant(struct fetch_socket_radio *self, int variant, int kbps,
+			   int level)
+{
+	ESP_LOGI(TAG, "switch from %d to %d kbps (throughput %d kbps, ring %d%%)",
+		 self->variants[self->variant].kbps, self->variants[variant].kbps, kbps,
+		 level);
+	self->next_variant = variant;
+	self->is_switching = true;
+	self->fall_nb = 0;
+	self->full_time_in_ms = 0;
 }
 
-static void parse_item(struct fetch_socket_radio *self, char *buffer)
+/* highest lower variant that fits in throughput, at least one step down */
+static int lower_variant(struct fetch_socket_radio *self, int kbps)
 {
-	if (strncmp(buffer, "StreamTitle=", strlen("StreamTitle=")))
-		return ;
-	buffer += strlen("StreamTitle=") + 1;
-	buffer[strlen(buffer) - 1] = '\0';
-
-	if (strlen(buffer)) {
-		char *sep = index(buffer, '-');
-		if (sep) {
-			*(sep - 1) = '\n';
-			*(sep + 1) = '\n';
-		}
-		ESP_LOGI(TAG, "|%s|", buffer);
-		if (self->track_info_cb)
-			self->track_info_cb(self->cb_hdl, buffer);
+	int i;
+
+	for (i = self->variant + 1; i < self->variant_nb - 1; i++) {
+		if (self->variants[i].kbps * 100 <= kbps * ADAPT_HEADROOM_PERCENT)
+			break;
 	}
+
+	return i;
 }
 
-static char *split_item(struct fetch_socket_radio *self, char *buffer)
+static void adapt(struct fetch_socket_radio *self)
 {
-	char *next = index(buffer, ';');
-
-	if (!next)
-		return NULL;
+	int64_t now = esp_timer_get_time();
+	int level;
+	int kbps;
 
-	*next = '\0';
-	parse_item(self, buffer);
+	if (!self->variant_nb || self->is_held || self->is_switching)
+		return ;
+	if (!self->adapt_time) {
+		self->adapt_time = now;
+		self->adapt_bytes = self->stats.bytes;
+		self->adapt_level = ring_level(self->buffer_hdl);
+		return ;
+	}
+	if (now - self->adapt_time < ADAPT_PERIOD_MS * 1000LL)
+		return ;
 
-	return next + 1;
+	level = ring_level(self->buffer_hdl);
+	kbps = (self->stats.bytes - self->adapt_bytes) * 8 / ((now - self->adapt_time) / 1000);
+	self->fall_nb = level < self->adapt_level ? self->fall_nb + 1 : 0;
+	self->full_time_in_ms = level >= ADAPT_UP_LEVEL ?
+				self->full_time_in_ms + (now - self->adapt_time) / 1000 : 0;
+	self->adapt_time = now;
+	self->adapt_bytes = self->stats.bytes;
+	self->adapt_level = level;
+
+	if (level < ADAPT_DOWN_LEVEL && self->fall_nb >= ADAPT_DOWN_FALL_NB &&
+	    self->variant < self->variant_nb - 1) {
+		self->up_time_in_ms = MIN(self->up_time_in_ms * 2, ADAPT_UP_MAX_TIME_MS);
+		switch_variant(self, lower_variant(self, kbps), kbps, level);
+	} else if (self->full_time_in_ms >= self->up_time_in_ms && self->variant) {
+		switch_variant(self, self->variant - 1, kbps, level);
+	}
 }
 
-static void parse_icy_payload(struct fetch_socket_radio *self, char *buffer)
+static void account_data(struct fetch_socket_radio *self, int data_len)
 {
-	while (buffer)
-		buffer = split_item(self, buffer);
+	uint32_t recover_time_in_ms;
+
+	self->stats.bytes += data_len;
+	self->is_streaming = true;
+	if (!self->is_recovering)
+		return ;
+
+	self->is_recovering = false;
+	recover_time_in_ms = (esp_timer_get_time() - self->drop_time) / 1000;
+	self->stats.last_recover_time_in_ms = recover_time_in_ms;
+	if (recover_time_in_ms > self->stats.max_recover_time_in_ms)
+		self->stats.max_recover_time_in_ms = recover_time_in_ms;
+	ESP_LOGI(TAG, "stream recovered in %u ms", recover_time_in_ms);
 }
 
-static int handle_icy_payload(struct fetch_socket_radio *self, char *data, int len)
+static int write_buffer_icy(void *data, int data_len, void *cb_ctx)
 {
-	struct icy *icy = &self->icy;
-	int consume;
+	struct fetch_socket_radio *self = cb_ctx;
 
-	consume = MIN(icy->icy_len, len);
-	memcpy(&icy->icy_buffer[icy->icy_pos], data, consume);
-	icy->icy_pos += consume;
-	icy->icy_len -= consume;
-	if (!icy->icy_len) {
-		ESP_LOGI(TAG,"%s", icy->icy_buffer);
-		parse_icy_payload(self, icy->icy_buffer);
-		free(icy->icy_buffer);
-		icy->st = ST_DATA;
+	account_data(self, data_len);
+	/* closing connection sends us back to reconnect loop */
+	if (self->is_reconnect_requested)
+		return 1;
+	adapt(self);
+	/* title seen while warm is given to player once promoted */
+	if (self->is_title_pending) {
+		self->is_title_pending = false;
+		icy_notify(&self->icy);
 	}
 
-	return consume;
+	return icy_demux(&self->icy, data, data_len);
 }
 
-static int write_buffer_icy(void *data, int data_len, void *cb_ctx)
+static int write_text(void *data, int data_len, void *cb_ctx)
 {
 	struct fetch_socket_radio *self = cb_ctx;
-	struct icy *icy = &self->icy;
-	int ret = 0;
+	int len = MIN(data_len, PLAYLIST_SZ - 1 - self->text_len);
 
-	while (data_len) {
-		switch (icy->st) {
-		case ST_DATA:
-			ret = handle_data(self, data, data_len);
-			break;
-		case ST_ICY_LEN:
-			ret = handle_icy_len(self, data, data_len);
-			break;
-		case ST_ICY_PAYLOAD:
-			ret = handle_icy_payload(self, data, data_len);
-			break;
-		}
-		data_len -= ret;
-		data += ret;
-	}
+	memcpy(self->text + self->text_len, data, len);
+	self->text_len += len;
+	self->text[self->text_len] = '\0';
 
-	return self->is_active ? 0 : 1;
+	return 0;
 }
 
-static int write_buffer_icy_anti_ad(void *data, int data_len, void *cb_ctx)
+static void account_segment(struct fetch_socket_radio *self)
+{
+	uint32_t latency_in_ms = (esp_timer_get_time() - self->segment_request_time) / 1000;
+
+	self->stats.segment_nb++;
+	self->stats.last_segment_latency_in_ms = latency_in_ms;
+	if (latency_in_ms > self->stats.max_segment_latency_in_ms)
+		self->stats.max_segment_latency_in_ms = latency_in_ms;
+	ESP_LOGD(TAG, "segment #%u first byte after %u ms, ring %d%%", self->stats.segment_nb,
+		 latency_in_ms, ring_level(self->buffer_hdl));
+}
+
+/* segments are mpeg-ts or packed mpeg audio, possibly behind an id3 tag */
+static int write_segment(void *data, int data_len, void *cb_ctx)
 {
 	struct fetch_socket_radio *self = cb_ctx;
+	int ret;
+
+	account_data(self, data_len);
+	if (self->is_reconnect_requested)
+		return 1;
+	if (self->is_segment_start) {
+		self->is_segment_start = false;
+		account_segment(self);
+		self->is_ts = ((uint8_t *) data)[0] == 0x47;
+		if (self->is_ts)
+			ts_demux_init(&self->ts, write_audio, self);
+		else
+			self->is_syncing = true;
+	}
+	if (!self->is_ts)
+		return write_audio(data, data_len, self);
 
-	if (self->anti_ad)
-		self->anti_ad--;
+	ret = ts_demux_push(&self->ts, data, data_len);
+	if (ret < 0)
+		ESP_LOGE(TAG, "no mpeg audio in %s, aac is not supported", self->url);
 
-	return !self->anti_ad;
+	return ret ? 1 : 0;
 }
 
 static void hdr_cb(char *key, char *value, void *cb_ctx)
 {
 	const char *metaint = "icy-metaint";
 	struct fetch_socket_radio *self = cb_ctx;
-	struct icy *icy = &self->icy;
 
 	if (strncmp(key, metaint, strlen(metaint)))
 		return ;
 
-	icy->metaint = atoi(value);
+	icy_set_metaint(&self->icy, atoi(value));
+}
+
+static int backoff_delay(int attempt)
+{
+	int delay = RECONNECT_MIN_DELAY_MS << MIN(attempt, 8);
+
+	delay = MIN(delay, RECONNECT_MAX_DELAY_MS);
+
+	/* jitter so radios restarted together don't hammer server together */
+	return delay / 2 + rand() % (delay / 2 + 1);
+}
+
+static void wait_reconnect(struct fetch_socket_radio *self, int delay)
+{
+	while (self->is_active && delay > 0) {
+		vTaskDelay(pdMS_TO_TICKS(RECONNECT_POLL_MS));
+		delay -= RECONNECT_POLL_MS;
+	}
+}
+
+/* radio url may be a pls or m3u wrapping stream url, or an hls playlist */
+static void resolve_playlist(struct fetch_socket_radio *self)
+{
+	char url[sizeof(self->url)];
+	char *uri;
+	int i;
+
+	self->is_hls = false;
+	for (i = 0; i < PLAYLIST_DEPTH && hls_is_playlist_url(self->url); i++) {
+		self->text_len = 0;
+		self->text[0] = '\0';
+		if (downloader_generic(self->url, write_text, self))
+			return ;
+		if (hls_is_hls(self->text)) {
+			self->is_hls = true;
+			return ;
+		}
+		uri = hls_first_uri(self->text);
+		if (!uri || hls_resolve_url(self->url, uri, url, sizeof(url)))
+			return ;
+		ESP_LOGI(TAG, "playlist gives %s", url);
+		strcpy(self->url, url);
+	}
+}
+
+/* reload live media playlist and fetch its new segments over one keep-alive
+ * connection. Ring blocks downloads once it's full, so next segments are
+ * fetched while current ones are decoded. Return when connection fails.
+ */
+static int hls_stream(struct fetch_socket_radio *self)
+{
+	struct hls_playlist playlist;
+	bool has_seq = false;
+	uint32_t next_seq = 0;
+	char *segment_url;
+	void *session;
+	uint32_t end;
+	uint32_t seq;
+	int ret = -1;
+
+	segment_url = malloc(SEGMENT_URL_LEN);
+	session = downloader_session_create(self->url, self->stall_time_in_ms);
+	if (!segment_url || !session)
+		goto exit;
+
+	while (self->is_active && !self->is_reconnect_requested) {
+		self->text_len = 0;
+		self->text[0] = '\0';
+		ret = downloader_session_get(session, self->url, write_text, self);
+		if (ret)
+			break;
+		ret = -1;
+		if (hls_parse(self->text, &playlist)) {
+			ESP_LOGE(TAG, "invalid playlist %s", self->url);
+			break;
+		}
+		if (playlist.is_master) {
+			if (!playlist.variant ||
+			    hls_resolve_url(self->url, playlist.variant, segment_url, sizeof(self->url)))
+				break;
+			strcpy(self->url, segment_url);
+			ESP_LOGI(TAG, "hls variant %s", self->url);
+			continue;
+		}
+
+		end = playlist.seq + playlist.segment_nb;
+		if (!has_seq || next_seq < playlist.seq || next_seq > end) {
+			next_seq = playlist.seq + MAX(playlist.segment_nb - HLS_LIVE_EDGE_NB, 0);
+			has_seq = true;
+		}
+		for (seq = next_seq; seq < end && self->is_active; seq++) {
+			if (hls_resolve_url(self->url, playlist.segments[seq - playlist.seq],
+					    segment_url, SEGMENT_URL_LEN))
+				continue;
+			self->is_segment_start = true;
+			self->segment_request_time = esp_timer_get_time();
+			ret = downloader_session_get(session, segment_url, write_segment, self);
+			if (ret)
+				goto exit;
+		}
+		if (playlist.is_end) {
+			ESP_LOGW(TAG, "hls stream %s has ended", self->url);
+			break;
+		}
+
+		/* no new segment yet, half target duration is the usual pace */
+		self->is_streaming = false;
+		if (seq == next_seq)
+			wait_reconnect(self, MAX(playlist.target_duration * 1000 / 2,
+						 HLS_RELOAD_MIN_MS));
+		next_seq = seq;
+	}
+
+exit:
+	if (session)
+		downloader_session_destroy(session);
+	free(segment_url);
+
+	return ret;
 }
 
+/* stream ends on server close, network error or http client read timeout.
+ * Decoder keeps on draining ring meanwhile, so a quick reconnect is only
+ * heard as a small jump in stream.
+ */
 static void fetch_socket_radio_task(void *arg)
 {
 	struct fetch_socket_radio *self = arg;
 	char *headers[3] = {NULL, NULL, NULL};
+	int64_t start;
+	int attempt = 0;
+	int delay;
+	int ret;
 
 	ESP_LOGI(TAG, "request %s", self->url);
-	memset(&self->icy, 0, sizeof(self->icy));
+	icy_init(&self->icy, write_audio, track_info, self);
 	if (self->is_icy) {
 		headers[0] = "Icy-MetaData";
 		headers[1] = "1";
 	}
 
-	if (self->anti_ad)
-		downloader_generic_with_headers(self->url, write_buffer_icy_anti_ad, hdr_cb ,arg, headers);
-	downloader_generic_with_headers(self->url, write_buffer_icy, hdr_cb ,arg, headers);
+	if (hls_is_playlist_url(self->url)) {
+		self->text = heap_caps_malloc(PLAYLIST_SZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+		if (!self->text)
+			self->text = malloc(PLAYLIST_SZ);
+		if (self->text)
+			resolve_playlist(self);
+	}
+
+	while (self->is_active) {
+		/* metadata interval is given again by each new connection */
+		icy_reset(&self->icy);
+		reset_preroll(self);
+		self->is_reconnect_requested = false;
+		start = esp_timer_get_time();
+		self->stats.connect_nb++;
+		if (self->is_hls)
+			ret = hls_stream(self);
+		else
+			ret = downloader_stream(self->url, write_buffer_icy, hdr_cb ,arg, headers,
+						self->stall_time_in_ms);
+		self->is_streaming = false;
+		if (!self->is_active)
+			break;
+
+		/* variant switch, reconnect at once */
+		if (self->is_switching) {
+			self->is_switching = false;
+			self->variant = self->next_variant;
+			self->adapt_time = 0;
+			self->is_syncing = true;
+			self->stats.variant_kbps = self->variants[self->variant].kbps;
+			self->stats.variant_switch_nb++;
+			snprintf(self->url, sizeof(self->url), "http://%s%s", self->host,
+				 self->variants[self->variant].path);
+			ESP_LOGI(TAG, "request %s", self->url);
+			continue;
+		}
+
+		if (esp_timer_get_time() - start >= RECONNECT_HEALTHY_MS * 1000LL)
+			attempt = 0;
+		if (!self->is_recovering) {
+			self->is_recovering = true;
+			self->drop_time = esp_timer_get_time();
+		}
+		delay = backoff_delay(attempt++);
+		self->stats.reconnect_nb++;
+		ESP_LOGW(TAG, "stream lost (%d), reconnect #%u in %d ms", ret,
+			 self->stats.reconnect_nb, delay);
+		wait_reconnect(self, delay);
+	}
+	free(self->text);
+	self->text = NULL;
 
 	xSemaphoreGive(self->sem_en_of_task);
 	vTaskDelete(NULL);
@@ -230,8 +646,15 @@ void *fetch_socket_radio_create(void *buffer_hdl)
 	assert(self);
 
 	self->buffer_hdl = buffer_hdl;
+	self->stall_time_in_ms = 0;
 	self->sem_en_of_task = xSemaphoreCreateBinary();
 	assert(self->sem_en_of_task);
+	self->hold_lock = xSemaphoreCreateMutex();
+	assert(self->hold_lock);
+	self->is_held = false;
+	self->hold = NULL;
+	self->timeshift_hdl = NULL;
+	self->record_hdl = NULL;
 
 	return self;
 }
@@ -242,29 +665,113 @@ void fetch_socket_radio_destroy(void *hdl)
 	assert(hdl);
 
 	vSemaphoreDelete(self->sem_en_of_task);
+	vSemaphoreDelete(self->hold_lock);
 
 	free(hdl);
 }
 
-void fetch_socket_radio_start(void *hdl, char *url, char *port_nb, char *path, int meta,
-			      int anti_ad, void *cb_hdl, audio_track_info_cb track_info_cb)
+static void start(struct fetch_socket_radio *self, char *url, char *path, int meta,
+		  int anti_ad)
 {
-	struct fetch_socket_radio *self = hdl;
 	BaseType_t res;
 
-	assert(hdl);
-
 	snprintf(self->url, sizeof(self->url), "http://%s%s", url, path);
+	strcpy(self->station_url, self->url);
+	snprintf(self->host, sizeof(self->host), "%s", url);
+	self->is_hls = false;
+	self->text = NULL;
 	self->is_icy = meta;
-	self->track_info_cb = track_info_cb;
-	self->cb_hdl = cb_hdl;
+	self->variant_nb = 0;
+	self->is_switching = false;
+	self->is_syncing = false;
 	self->is_active = true;
 	self->anti_ad = anti_ad;
-	res = xTaskCreatePinnedToCore(fetch_socket_radio_task, "fetch_socket_radio", 4096, hdl,
+	memset(&self->stats, 0, sizeof(self->stats));
+	self->is_recovering = false;
+	self->is_streaming = false;
+	self->is_title_pending = false;
+	res = xTaskCreatePinnedToCore(fetch_socket_radio_task, "fetch_socket_radio", 4096, self,
 			tskIDLE_PRIORITY + 1, &self->task, tskNO_AFFINITY);
 	assert(res == pdPASS);
 }
 
+void fetch_socket_radio_start(void *hdl, char *url, char *port_nb, char *path, int meta,
+			      int anti_ad, void *cb_hdl, audio_track_info_cb track_info_cb)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	assert(hdl);
+
+	self->track_info_cb = track_info_cb;
+	self->cb_hdl = cb_hdl;
+	start(self, url, path, meta, anti_ad);
+}
+
+/* connect and read stream ahead, keeping latest data until
+ * fetch_socket_radio_promote makes it the playing one.
+ */
+int fetch_socket_radio_warm(void *hdl, char *url, char *port_nb, char *path, int meta,
+			    int anti_ad)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	assert(hdl);
+
+	self->hold = heap_caps_malloc(HOLD_SZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (!self->hold) {
+		ESP_LOGW(TAG, "no memory to warm %s%s", url, path);
+		return -1;
+	}
+	self->hold_pos = 0;
+	self->hold_len = 0;
+	self->is_held = true;
+	self->track_info_cb = NULL;
+	self->cb_hdl = NULL;
+	start(self, url, path, meta, anti_ad);
+
+	return 0;
+}
+
+int fetch_socket_radio_is_warm(void *hdl, char *url, char *path)
+{
+	struct fetch_socket_radio *self = hdl;
+	char buf[sizeof(self->url)];
+
+	if (!self->is_held || !self->is_active)
+		return 0;
+	snprintf(buf, sizeof(buf), "http://%s%s", url, path);
+
+	return strcmp(buf, self->station_url) == 0;
+}
+
+/* held data goes to ring right away, so decoder starts without waiting for
+ * network.
+ */
+void fetch_socket_radio_promote(void *hdl, void *cb_hdl, audio_track_info_cb track_info_cb)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	assert(hdl);
+
+	self->track_info_cb = track_info_cb;
+	self->cb_hdl = cb_hdl;
+	self->is_title_pending = true;
+	xSemaphoreTake(self->hold_lock, portMAX_DELAY);
+	ESP_LOGI(TAG, "promote %s with %d bytes held", self->url, self->hold_len);
+	release_hold(self);
+	self->is_held = false;
+	xSemaphoreGive(self->hold_lock);
+}
+
+static void release(struct fetch_socket_radio *self)
+{
+	self->is_held = false;
+	free(self->hold);
+	self->hold = NULL;
+	self->timeshift_hdl = NULL;
+	self->record_hdl = NULL;
+}
+
 void fetch_socket_radio_stop(void *hdl)
 {
 	struct fetch_socket_radio *self = hdl;
@@ -273,4 +780,140 @@ void fetch_socket_radio_stop(void *hdl)
 
 	self->is_active = false;
 	xSemaphoreTake(self->sem_en_of_task, portMAX_DELAY);
+	release(self);
+}
+
+/* ask task to end without waiting for it, it can take up to stall time.
+ * fetch_socket_radio_collect() tells when it is done.
+ */
+void fetch_socket_radio_cancel(void *hdl)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	assert(hdl);
+
+	self->is_active = false;
+}
+
+/* 0 once task of a cancelled fetcher has ended, it can then be started again */
+int fetch_socket_radio_collect(void *hdl)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	assert(hdl);
+
+	if (xSemaphoreTake(self->sem_en_of_task, 0) != pdTRUE)
+		return -1;
+	release(self);
+
+	return 0;
+}
+
+/* tee stream into time-shift buffer until stopped */
+void fetch_socket_radio_set_timeshift(void *hdl, void *timeshift_hdl)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	self->timeshift_hdl = timeshift_hdl;
+}
+
+/* tee stream into recorder, NULL stops. Current title is given again so
+ * first file is named after it.
+ */
+void fetch_socket_radio_set_record(void *hdl, void *record_hdl)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	self->record_hdl = record_hdl;
+	if (record_hdl)
+		self->is_title_pending = true;
+}
+
+void fetch_socket_radio_get_stats(void *hdl, struct fetch_socket_radio_stats *stats)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	*stats = self->stats;
+}
+
+/* drop current connection, it will be reopened through usual backoff. Only
+ * done while data flows, a silent connection is already ended by http
+ * client read timeout.
+ */
+int fetch_socket_radio_reconnect(void *hdl, const char *reason)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	if (!self->is_streaming || self->is_reconnect_requested)
+		return -1;
+
+	ESP_LOGW(TAG, "watchdog reconnect: %s", reason);
+	self->stats.watchdog_nb++;
+	self->stats.watchdog_reason = reason;
+	self->is_reconnect_requested = true;
+
+	return 0;
+}
+
+/* applies to next fetch_socket_radio_start */
+void fetch_socket_radio_set_stall_time(void *hdl, int stall_time_in_ms)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	self->stall_time_in_ms = stall_time_in_ms;
+}
+
+int fetch_socket_radio_is_streaming(void *hdl)
+{
+	struct fetch_socket_radio *self = hdl;
+
+	return self->is_streaming && !self->is_reconnect_requested;
+}
+
+/* variants is a "kbps:path,kbps:path" list of station streams on same host,
+ * one of them being the playing path. Stream then follows network
+ * conditions between them.
+ */
+void fetch_socket_radio_set_variants(void *hdl, char *variants)
+{
+	struct fetch_socket_radio *self = hdl;
+	const char *path = self->station_url + strlen("http://") + strlen(self->host);
+	struct variant variant;
+	char *item = variants;
+	char *sep;
+	int len;
+	int nb;
+	int i;
+
+	self->variant_nb = 0;
+	for (nb = 0; item && *item && nb < VARIANT_NB; nb++) {
+		variant.kbps = atoi(item);
+		sep = index(item, ':');
+		if (!sep || variant.kbps <= 0)
+			break;
+		len = strcspn(sep + 1, ",");
+		snprintf(variant.path, sizeof(variant.path), "%.*s", len, sep + 1);
+		item = sep[1 + len] ? sep + 2 + len : NULL;
+
+		for (i = nb; i > 0 && self->variants[i - 1].kbps < variant.kbps; i--)
+			self->variants[i] = self->variants[i - 1];
+		self->variants[i] = variant;
+	}
+
+	for (i = 0; i < nb; i++) {
+		if (strcmp(self->variants[i].path, path) == 0)
+			break;
+	}
+	if (nb < 2 || i == nb) {
+		ESP_LOGW(TAG, "no usable variant for %s", self->url);
+		return ;
+	}
+
+	self->variant = i;
+	self->adapt_time = 0;
+	self->fall_nb = 0;
+	self->full_time_in_ms = 0;
+	self->up_time_in_ms = ADAPT_UP_TIME_MS;
+	self->stats.variant_kbps = self->variants[i].kbps;
+	self->variant_nb = nb;
 }
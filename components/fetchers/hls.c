@@ -0,0 +1,299 @@
+#include "hls.h"
+
+#include <string.h>
+#include <stdlib.h>
+#include <strings.h>
+#include <stdio.h>
+
+#define MIN(a,b)	((a)<(b)?(a):(b))
+
+#define TS_SYNC			0x47
+#define PID_PAT			0x0000
+#define STREAM_TYPE_MPEG1_AUDIO	0x03
+#define STREAM_TYPE_MPEG2_AUDIO	0x04
+#define STREAM_TYPE_AAC		0x0f
+#define STREAM_TYPE_AAC_LATM	0x11
+/* mpeg audio codecs in EXT-X-STREAM-INF CODECS attribute */
+static const char *mp3_codecs[] = {"mp4a.40.34", "mp4a.6b", "mp4a.69"};
+
+static int has_suffix(const char *str, int len, const char *suffix)
+{
+	int suffix_len = strlen(suffix);
+
+	return len >= suffix_len && strncasecmp(str + len - suffix_len, suffix, suffix_len) == 0;
+}
+
+static char *next_line(char **cursor)
+{
+	char *line = *cursor;
+	char *end;
+
+	if (!*line)
+		return NULL;
+	end = line + strcspn(line, "\r\n");
+	*cursor = end + strspn(end, "\r\n");
+	*end = '\0';
+
+	return line;
+}
+
+static int is_mp3_variant(const char *attrs)
+{
+	const char *codecs = strstr(attrs, "CODECS=");
+	int i;
+
+	if (!codecs)
+		return 1;
+	for (i = 0; i < sizeof(mp3_codecs) / sizeof(mp3_codecs[0]); i++) {
+		if (strstr(codecs, mp3_codecs[i]))
+			return 1;
+	}
+
+	return 0;
+}
+
+static int attr_bandwidth(const char *attrs)
+{
+	const char *bandwidth = strstr(attrs, "BANDWIDTH=");
+
+	return bandwidth ? atoi(bandwidth + strlen("BANDWIDTH=")) : 0;
+}
+
+/* public api */
+/* .pls, .m3u and .m3u8 urls, query string apart */
+int hls_is_playlist_url(const char *url)
+{
+	int len = strcspn(url, "?#");
+
+	return has_suffix(url, len, ".pls") || has_suffix(url, len, ".m3u") ||
+	       has_suffix(url, len, ".m3u8");
+}
+
+int hls_is_hls(const char *text)
+{
+	return strstr(text, "#EXT-X-") != NULL;
+}
+
+/* stream url of a pls or m3u playlist, text is modified */
+char *hls_first_uri(char *text)
+{
+	char *cursor = text;
+	char *line;
+
+	while ((line = next_line(&cursor))) {
+		line += strspn(line, " \t");
+		if (strncasecmp(line, "File", 4) == 0 && strchr(line, '='))
+			return strchr(line, '=') + 1;
+		if (strncmp(line, "http://", 7) == 0 || strncmp(line, "https://", 8) == 0)
+			return line;
+	}
+
+	return NULL;
+}
+
+/* parse m3u8 in place. A master playlist gives its preferred variant, an
+ * mpeg audio one with highest bandwidth when codecs are announced.
+ */
+int hls_parse(char *text, struct hls_playlist *playlist)
+{
+	int best_bandwidth = -1;
+	int is_best_mp3 = 0;
+	char *stream_inf = NULL;
+	char *cursor = text;
+	int is_mp3;
+	int bandwidth;
+	char *line;
+
+	memset(playlist, 0, sizeof(*playlist));
+	line = next_line(&cursor);
+	if (!line || strncmp(line, "#EXTM3U", 7))
+		return -1;
+
+	while ((line = next_line(&cursor))) {
+		if (strncmp(line, "#EXT-X-TARGETDURATION:", 22) == 0) {
+			playlist->target_duration = atoi(line + 22);
+		} else if (strncmp(line, "#EXT-X-MEDIA-SEQUENCE:", 22) == 0) {
+			playlist->seq = strtoul(line + 22, NULL, 10);
+		} else if (strncmp(line, "#EXT-X-ENDLIST", 14) == 0) {
+			playlist->is_end = 1;
+		} else if (strncmp(line, "#EXT-X-STREAM-INF:", 18) == 0) {
+			stream_inf = line + 18;
+			playlist->is_master = 1;
+		} else if (line[0] == '#' || line[0] == '\0') {
+			continue;
+		} else if (stream_inf) {
+			is_mp3 = is_mp3_variant(stream_inf);
+			bandwidth = attr_bandwidth(stream_inf);
+			if ((is_mp3 && !is_best_mp3) ||
+			    (is_mp3 == is_best_mp3 && bandwidth > best_bandwidth)) {
+				playlist->variant = line;
+				best_bandwidth = bandwidth;
+				is_best_mp3 = is_mp3;
+			}
+			stream_inf = NULL;
+		} else {
+			/* keep last segments only */
+			if (playlist->segment_nb == HLS_SEGMENT_NB) {
+				memmove(&playlist->segments[0], &playlist->segments[1],
+					(HLS_SEGMENT_NB - 1) * sizeof(char *));
+				playlist->segment_nb--;
+				playlist->seq++;
+			}
+			playlist->segments[playlist->segment_nb++] = line;
+		}
+	}
+	if (playlist->target_duration <= 0)
+		playlist->target_duration = HLS_TARGET_DURATION_DEFAULT;
+
+	return 0;
+}
+
+/* url of ref found in playlist at base */
+int hls_resolve_url(const char *base, const char *ref, char *url, int url_len)
+{
+	const char *sep = "";
+	const char *slash;
+	const char *host;
+	const char *end;
+	int len;
+
+	if (strstr(ref, "://"))
+		return snprintf(url, url_len, "%s", ref) >= url_len ? -1 : 0;
+
+	host = strstr(base, "://");
+	if (!host)
+		return -1;
+	host += 3;
+	end = host + strcspn(host, "?#");
+	if (ref[0] == '/') {
+		len = host - base + strcspn(host, "/?#");
+	} else {
+		/* relative to playlist directory */
+		for (slash = end; slash > host && slash[-1] != '/'; slash--)
+			;
+		if (slash > host) {
+			len = slash - base;
+		} else {
+			len = end - base;
+			sep = "/";
+		}
+	}
+
+	return snprintf(url, url_len, "%.*s%s%s", len, base, sep, ref) >= url_len ? -1 : 0;
+}
+
+void ts_demux_init(struct ts_demux *ts, hls_audio_cb audio_cb, void *cb_ctx)
+{
+	ts->pkt_len = 0;
+	ts->pmt_pid = -1;
+	ts->audio_pid = -1;
+	ts->is_unsupported = 0;
+	ts->audio_cb = audio_cb;
+	ts->cb_ctx = cb_ctx;
+}
+
+static void parse_pat(struct ts_demux *ts, uint8_t *p, int len)
+{
+	int section_len;
+	int i;
+
+	if (len < 1 || len < 1 + p[0] + 8)
+		return ;
+	len -= 1 + p[0];
+	p += 1 + p[0];
+	section_len = MIN(((p[1] & 0x0f) << 8 | p[2]) + 3, len);
+	/* skip table header, stop before crc */
+	for (i = 8; i + 4 <= section_len - 4; i += 4) {
+		if ((p[i] << 8 | p[i + 1]) == 0)
+			continue;
+		ts->pmt_pid = (p[i + 2] & 0x1f) << 8 | p[i + 3];
+		return ;
+	}
+}
+
+static void parse_pmt(struct ts_demux *ts, uint8_t *p, int len)
+{
+	int section_len;
+	int stream_type;
+	int i;
+
+	if (len < 1 || len < 1 + p[0] + 12)
+		return ;
+	len -= 1 + p[0];
+	p += 1 + p[0];
+	section_len = MIN(((p[1] & 0x0f) << 8 | p[2]) + 3, len);
+	for (i = 12 + ((p[10] & 0x0f) << 8 | p[11]); i + 5 <= section_len - 4;
+	     i += 5 + ((p[i + 3] & 0x0f) << 8 | p[i + 4])) {
+		stream_type = p[i];
+		if (stream_type == STREAM_TYPE_MPEG1_AUDIO ||
+		    stream_type == STREAM_TYPE_MPEG2_AUDIO) {
+			ts->audio_pid = (p[i + 1] & 0x1f) << 8 | p[i + 2];
+			return ;
+		}
+		if (stream_type == STREAM_TYPE_AAC || stream_type == STREAM_TYPE_AAC_LATM)
+			ts->is_unsupported = 1;
+	}
+}
+
+static int handle_packet(struct ts_demux *ts, uint8_t *pkt)
+{
+	int is_start = pkt[1] & 0x40;
+	int pid = (pkt[1] & 0x1f) << 8 | pkt[2];
+	int afc = (pkt[3] >> 4) & 3;
+	int offset = 4;
+
+	if (pkt[0] != TS_SYNC || !(afc & 1))
+		return 0;
+	if (afc & 2)
+		offset += 1 + pkt[4];
+	if (offset >= TS_PACKET_SZ)
+		return 0;
+
+	if (pid == PID_PAT && is_start)
+		parse_pat(ts, pkt + offset, TS_PACKET_SZ - offset);
+	else if (pid == ts->pmt_pid && is_start && ts->audio_pid < 0)
+		parse_pmt(ts, pkt + offset, TS_PACKET_SZ - offset);
+	else if (pid == ts->audio_pid) {
+		/* pes header is in first packet of pes */
+		if (is_start) {
+			if (TS_PACKET_SZ - offset < 9)
+				return 0;
+			offset += 9 + pkt[offset + 8];
+		}
+		if (offset < TS_PACKET_SZ)
+			return ts->audio_cb(pkt + offset, TS_PACKET_SZ - offset, ts->cb_ctx);
+	}
+
+	return 0;
+}
+
+/* return audio_cb error, or -1 when segment has no mpeg audio stream */
+int ts_demux_push(struct ts_demux *ts, uint8_t *data, int len)
+{
+	int consume;
+	int ret;
+
+	while (len) {
+		if (ts->pkt_len || len < TS_PACKET_SZ) {
+			consume = MIN(TS_PACKET_SZ - ts->pkt_len, len);
+			memcpy(ts->pkt + ts->pkt_len, data, consume);
+			ts->pkt_len += consume;
+			data += consume;
+			len -= consume;
+			if (ts->pkt_len < TS_PACKET_SZ)
+				break;
+			ts->pkt_len = 0;
+			ret = handle_packet(ts, ts->pkt);
+		} else {
+			ret = handle_packet(ts, data);
+			data += TS_PACKET_SZ;
+			len -= TS_PACKET_SZ;
+		}
+		if (ret)
+			return ret;
+		if (ts->is_unsupported && ts->audio_pid < 0)
+			return -1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,127 @@
+#include "icy.h"
+
+#include <string.h>
+
+#define MIN(a,b)	((a)<(b)?(a):(b))
+
+#define STREAM_TITLE	"StreamTitle='"
+#define STREAM_TITLE_END	"';"
+
+/* title is shown as artist, '-' and song title on separated lines. It's
+ * formatted in its own buffer as icy_notify() may run while a metadata block
+ * is partly gathered.
+ */
+static void notify_title(struct icy *icy)
+{
+	char *title = icy->display;
+	char *sep;
+
+	memcpy(title, icy->title, icy->title_len);
+	title[icy->title_len] = '\0';
+	sep = strstr(title, " - ");
+	if (sep) {
+		sep[0] = '\n';
+		sep[2] = '\n';
+	}
+	icy->title_cb(title, icy->cb_ctx);
+}
+
+/* metadata block is a list of key='value'; items padded with zeros. Only
+ * StreamTitle is looked for and block is left untouched until title has
+ * changed.
+ */
+static void parse_meta(struct icy *icy)
+{
+	char *start;
+	char *end;
+	int len;
+
+	icy->meta[icy->meta_len] = '\0';
+	start = strstr(icy->meta, STREAM_TITLE);
+	if (!start)
+		return ;
+	start += strlen(STREAM_TITLE);
+	end = strstr(start, STREAM_TITLE_END);
+	if (!end)
+		end = start + strlen(start);
+	len = MIN(end - start, ICY_TITLE_MAX_SZ - 1);
+
+	if (len == icy->title_len && memcmp(start, icy->title, len) == 0)
+		return ;
+	memcpy(icy->title, start, len);
+	icy->title_len = len;
+	if (len && icy->title_cb)
+		notify_title(icy);
+}
+
+/* public api */
+void icy_init(struct icy *icy, icy_audio_cb audio_cb, icy_title_cb title_cb, void *cb_ctx)
+{
+	icy->audio_cb = audio_cb;
+	icy->title_cb = title_cb;
+	icy->cb_ctx = cb_ctx;
+	icy->title_len = 0;
+	icy_reset(icy);
+}
+
+/* new connection, last title is kept so a reconnect doesn't notify it again */
+void icy_reset(struct icy *icy)
+{
+	icy_set_metaint(icy, 0);
+}
+
+void icy_set_metaint(struct icy *icy, int metaint)
+{
+	icy->metaint = metaint;
+	icy->audio_remain = metaint;
+	icy->meta_remain = 0;
+	icy->meta_len = 0;
+}
+
+/* notify last title again, for a new listener */
+void icy_notify(struct icy *icy)
+{
+	if (icy->title_len && icy->title_cb)
+		notify_title(icy);
+}
+
+/* split chunk into audio spans given to audio_cb as is and metadata blocks
+ * gathered in meta buffer. Return audio_cb error if any.
+ */
+int icy_demux(struct icy *icy, char *data, int len)
+{
+	char *end = data + len;
+	int consume;
+	int ret;
+
+	if (!icy->metaint)
+		return len ? icy->audio_cb(data, len, icy->cb_ctx) : 0;
+
+	while (data < end) {
+		if (icy->audio_remain) {
+			consume = MIN(icy->audio_remain, end - data);
+			ret = icy->audio_cb(data, consume, icy->cb_ctx);
+			if (ret)
+				return ret;
+			icy->audio_remain -= consume;
+			data += consume;
+		} else if (icy->meta_remain == 0) {
+			icy->meta_len = 0;
+			icy->meta_remain = 16 * (unsigned char) *data++;
+			if (!icy->meta_remain)
+				icy->audio_remain = icy->metaint;
+		} else {
+			consume = MIN(icy->meta_remain, end - data);
+			memcpy(&icy->meta[icy->meta_len], data, consume);
+			icy->meta_len += consume;
+			icy->meta_remain -= consume;
+			data += consume;
+			if (!icy->meta_remain) {
+				parse_meta(icy);
+				icy->audio_remain = icy->metaint;
+			}
+		}
+	}
+
+	return 0;
+}
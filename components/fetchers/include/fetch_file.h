@@ -1,9 +1,24 @@
 #ifndef __FETCH_FILE__
 #define __FETCH_FILE__ 1
 
+#include <stdint.h>
+
+/* sd card reads of song being played */
+struct fetch_file_stats {
+	uint32_t bytes;
+	uint32_t read_nb;
+	uint32_t read_time_in_ms;
+	uint32_t max_read_time_in_ms;
+	/* ring found empty while song was being fetched */
+	uint32_t starve_nb;
+};
+
 void *fetch_file_create(void *buffer_hdl);
 void fetch_file_destroy(void *hdl);
-void fetch_file_start(void *hdl, char *filename);
+void fetch_file_start(void *hdl, char *filename, int offset);
 void fetch_file_stop(void *hdl);
+int fetch_file_pos(void *hdl);
+void fetch_file_get_stats(void *hdl, struct fetch_file_stats *stats);
+void fetch_file_prefetch(void *hdl, char *filename);
 
 #endif
\ No newline at end of file
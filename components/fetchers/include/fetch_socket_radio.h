@@ -1,12 +1,46 @@
 #ifndef __FETCH_SOCKET_RADIO__
 #define __FETCH_SOCKET_RADIO__ 1
 
+#include <stdint.h>
+
 #include "audio.h"
 
+struct fetch_socket_radio_stats {
+	uint32_t bytes;
+	uint32_t connect_nb;
+	uint32_t reconnect_nb;
+	/* from connection loss to first data of new connection */
+	uint32_t last_recover_time_in_ms;
+	uint32_t max_recover_time_in_ms;
+	/* reconnections asked by pipeline watchdog */
+	uint32_t watchdog_nb;
+	const char *watchdog_reason;
+	/* bitrate of playing variant, 0 without variants */
+	uint32_t variant_kbps;
+	uint32_t variant_switch_nb;
+	/* hls, request to first byte of segments */
+	uint32_t segment_nb;
+	uint32_t last_segment_latency_in_ms;
+	uint32_t max_segment_latency_in_ms;
+};
+
 void *fetch_socket_radio_create(void *buffer_hdl);
 void fetch_socket_radio_destroy(void *hdl);
 void fetch_socket_radio_start(void *hdl, char *url, char *port_nb, char *path, int meta,
 			      int anti_ad, void *cb_hdl, audio_track_info_cb track_info_cb);
+int fetch_socket_radio_warm(void *hdl, char *url, char *port_nb, char *path, int meta,
+			    int anti_ad);
+int fetch_socket_radio_is_warm(void *hdl, char *url, char *path);
+void fetch_socket_radio_promote(void *hdl, void *cb_hdl, audio_track_info_cb track_info_cb);
 void fetch_socket_radio_stop(void *hdl);
+void fetch_socket_radio_cancel(void *hdl);
+int fetch_socket_radio_collect(void *hdl);
+void fetch_socket_radio_get_stats(void *hdl, struct fetch_socket_radio_stats *stats);
+int fetch_socket_radio_reconnect(void *hdl, const char *reason);
+int fetch_socket_radio_is_streaming(void *hdl);
+void fetch_socket_radio_set_stall_time(void *hdl, int stall_time_in_ms);
+void fetch_socket_radio_set_variants(void *hdl, char *variants);
+void fetch_socket_radio_set_timeshift(void *hdl, void *timeshift_hdl);
+void fetch_socket_radio_set_record(void *hdl, void *record_hdl);
 
 #endif
\ No newline at end of file
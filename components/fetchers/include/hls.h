@@ -0,0 +1,45 @@
+#ifndef __HLS__
+#define __HLS__ 1
+
+#include <stdint.h>
+
+/* last segments of a live media playlist that are kept */
+#define HLS_SEGMENT_NB		16
+/* in seconds, when #EXT-X-TARGETDURATION is missing or invalid */
+#define HLS_TARGET_DURATION_DEFAULT	10
+#define TS_PACKET_SZ		188
+
+typedef int (*hls_audio_cb)(void *data, int data_len, void *cb_ctx);
+
+struct hls_playlist {
+	int is_master;
+	int is_end;
+	int target_duration;
+	/* media sequence of segments[0] */
+	uint32_t seq;
+	int segment_nb;
+	char *segments[HLS_SEGMENT_NB];
+	/* master playlist choice */
+	char *variant;
+};
+
+/* mpeg-ts segments, only mpeg audio streams are extracted */
+struct ts_demux {
+	uint8_t pkt[TS_PACKET_SZ];
+	int pkt_len;
+	int pmt_pid;
+	int audio_pid;
+	int is_unsupported;
+	hls_audio_cb audio_cb;
+	void *cb_ctx;
+};
+
+int hls_is_playlist_url(const char *url);
+int hls_is_hls(const char *text);
+char *hls_first_uri(char *text);
+int hls_parse(char *text, struct hls_playlist *playlist);
+int hls_resolve_url(const char *base, const char *ref, char *url, int url_len);
+void ts_demux_init(struct ts_demux *ts, hls_audio_cb audio_cb, void *cb_ctx);
+int ts_demux_push(struct ts_demux *ts, uint8_t *data, int len);
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef __ICY__
+#define __ICY__ 1
+
+/* metadata block length is given by a single byte in 16 bytes unit */
+#define ICY_META_MAX_SZ		(255 * 16)
+#define ICY_TITLE_MAX_SZ	256
+
+typedef int (*icy_audio_cb)(void *data, int data_len, void *cb_ctx);
+typedef void (*icy_title_cb)(char *title, void *cb_ctx);
+
+struct icy {
+	int metaint;
+	/* audio bytes left before next metadata length byte */
+	int audio_remain;
+	/* metadata bytes left to receive. Length byte is expected when both
+	 * audio_remain and meta_remain are 0.
+	 */
+	int meta_remain;
+	int meta_len;
+	icy_audio_cb audio_cb;
+	icy_title_cb title_cb;
+	void *cb_ctx;
+	/* last StreamTitle as received, used to only notify changes */
+	int title_len;
+	char title[ICY_TITLE_MAX_SZ];
+	/* title as given to title_cb */
+	char display[ICY_TITLE_MAX_SZ];
+	char meta[ICY_META_MAX_SZ + 1];
+};
+
+void icy_init(struct icy *icy, icy_audio_cb audio_cb, icy_title_cb title_cb, void *cb_ctx);
+void icy_reset(struct icy *icy);
+void icy_set_metaint(struct icy *icy, int metaint);
+int icy_demux(struct icy *icy, char *data, int len);
+void icy_notify(struct icy *icy);
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef __MPEG__
+#define __MPEG__ 1
+
+#include <stdint.h>
+
+#define MPEG_HEADER_SZ		4
+
+int mpeg_is_frame_header(uint8_t *p);
+int mpeg_frame_info(uint8_t *p, int *frame_len, int *duration_in_us);
+int mpeg_find_frame_boundary(uint8_t *data, int data_len);
+
+#endif
@@ -0,0 +1,24 @@
+#ifndef __RECORD__
+#define __RECORD__ 1
+
+#include <stdint.h>
+
+struct record_stats {
+	uint32_t file_nb;
+	uint32_t bytes;
+	uint32_t write_nb;
+	uint32_t write_time_in_ms;
+	uint32_t max_write_time_in_ms;
+	/* bytes lost because card could not keep up */
+	uint32_t drop_bytes;
+};
+
+void *record_create(void);
+void record_destroy(void *hdl);
+int record_start(void *hdl, char *dirname, char *db_dirname, char *station);
+void record_stop(void *hdl);
+void record_write(void *hdl, void *data, int data_len);
+void record_title(void *hdl, char *title);
+void record_get_stats(void *hdl, struct record_stats *stats);
+
+#endif
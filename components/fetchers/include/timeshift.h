@@ -0,0 +1,29 @@
+#ifndef __TIMESHIFT__
+#define __TIMESHIFT__ 1
+
+#include <stdint.h>
+
+struct timeshift_stats {
+	uint32_t write_nb;
+	uint32_t write_time_in_ms;
+	uint32_t max_write_time_in_ms;
+	/* bytes lost because card could not keep up */
+	uint32_t drop_bytes;
+	/* reader was overtaken by writer while paused too long */
+	uint32_t overrun_nb;
+};
+
+void *timeshift_create(void *buffer_hdl);
+void timeshift_destroy(void *hdl);
+int timeshift_start(void *hdl, const char *filename);
+void timeshift_stop(void *hdl);
+int timeshift_write(void *hdl, void *data, int data_len);
+void timeshift_pause(void *hdl);
+void timeshift_play(void *hdl, uint64_t pos);
+uint64_t timeshift_tell(void *hdl, int ring_bytes);
+int timeshift_seek(void *hdl, uint64_t pos, int delta_in_ms, uint64_t *new_pos);
+int timeshift_delay(void *hdl, uint64_t pos);
+int timeshift_is_live(void *hdl);
+void timeshift_get_stats(void *hdl, struct timeshift_stats *stats);
+
+#endif
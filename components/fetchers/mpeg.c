@@ -0,0 +1,98 @@
+#include "mpeg.h"
+
+enum {
+	VERSION_25 = 0,
+	VERSION_2 = 2,
+	VERSION_1 = 3
+};
+
+enum {
+	LAYER_3 = 1,
+	LAYER_2 = 2,
+	LAYER_1 = 3
+};
+
+/* in kbps, indexed by [mpeg1 ? 0 : 1][layer - 1][bitrate index] */
+static const uint16_t bitrates[2][3][16] = {
+	{
+		{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+		{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+	}, {
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+		{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+		{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+	}
+};
+
+static const uint16_t samplerates[3] = {44100, 48000, 32000};
+
+/* mpeg audio frame header: 11 bits sync, valid version, layer, bitrate
+ * and samplerate.
+ */
+int mpeg_is_frame_header(uint8_t *p)
+{
+	return p[0] == 0xff && (p[1] & 0xe0) == 0xe0 &&
+	       (p[1] & 0x18) != 0x08 && (p[1] & 0x06) != 0x00 &&
+	       (p[2] & 0xf0) != 0xf0 && (p[2] & 0x0c) != 0x0c;
+}
+
+/* return -1 for invalid or free format frame */
+int mpeg_frame_info(uint8_t *p, int *frame_len, int *duration_in_us)
+{
+	int version = (p[1] >> 3) & 3;
+	int layer = (p[1] >> 1) & 3;
+	int padding = (p[2] >> 1) & 1;
+	int bitrate;
+	int samplerate;
+	int samples;
+
+	if (!mpeg_is_frame_header(p))
+		return -1;
+	bitrate = bitrates[version != VERSION_1][layer - 1][p[2] >> 4] * 1000;
+	if (!bitrate)
+		return -1;
+	samplerate = samplerates[(p[2] >> 2) & 3];
+	if (version == VERSION_2)
+		samplerate /= 2;
+	else if (version == VERSION_25)
+		samplerate /= 4;
+
+	switch (layer) {
+	case LAYER_1:
+		samples = 384;
+		*frame_len = (12 * bitrate / samplerate + padding) * 4;
+		break;
+	case LAYER_2:
+		samples = 1152;
+		*frame_len = 144 * bitrate / samplerate + padding;
+		break;
+	default:
+		samples = version == VERSION_1 ? 1152 : 576;
+		*frame_len = samples / 8 * bitrate / samplerate + padding;
+		break;
+	}
+	*duration_in_us = samples * 1000000LL / samplerate;
+
+	return 0;
+}
+
+/* offset of first frame whose following frame header, when inside data,
+ * is also valid. data_len if there is none.
+ */
+int mpeg_find_frame_boundary(uint8_t *data, int data_len)
+{
+	int duration_in_us;
+	int frame_len;
+	int i;
+
+	for (i = 0; i + MPEG_HEADER_SZ <= data_len; i++) {
+		if (mpeg_frame_info(data + i, &frame_len, &duration_in_us))
+			continue;
+		if (i + frame_len + MPEG_HEADER_SZ > data_len ||
+		    mpeg_is_frame_header(data + i + frame_len))
+			return i;
+	}
+
+	return data_len;
+}
@@ -0,0 +1,448 @@
+#include "record.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "mpeg.h"
+#include "id3.h"
+#include "db.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.record";
+
+#define MIN(a,b)	((a)<(b)?(a):(b))
+
+/* network task only copies into staging, some 16 s at 128 kbps. Writer
+ * task gathers it into blocks written at block aligned offsets of files.
+ */
+#define STAGING_SZ		(256 * 1024)
+#define WRITE_SZ		(32 * 1024)
+/* title changes queued until writer reaches them */
+#define SPLIT_NB		4
+#define TITLE_SZ		256
+#define NAME_SZ			200
+#define FILEPATH_SZ		320
+#define WRITER_POLL_MS		100
+/* between artist and song title of icy titles */
+#define TITLE_SEP		"\n-\n"
+
+struct split {
+	uint32_t pos;
+	char title[TITLE_SZ];
+};
+
+struct record {
+	char *dirname;
+	char *db_dirname;
+	char *station;
+	volatile bool is_active;
+	TaskHandle_t writer;
+	SemaphoreHandle_t sem_end_of_writer;
+	/* positions and splits, held briefly by network task */
+	SemaphoreHandle_t lock;
+	char *staging;
+	/* bytes received and moved out of staging */
+	volatile uint32_t pos;
+	volatile uint32_t written;
+	/* file changes, oldest first */
+	struct split splits[SPLIT_NB];
+	int split_start;
+	int split_nb;
+	/* new title waits for next frame start to cut file there */
+	bool is_split_pending;
+	char pending_title[TITLE_SZ];
+	/* current file, data is gathered in block until it's full */
+	bool is_open;
+	int fd;
+	char filepath[FILEPATH_SZ];
+	uint32_t audio_len;
+	char *block;
+	int block_len;
+	struct record_stats stats;
+};
+
+static void write_block(struct record *self)
+{
+	int64_t start = esp_timer_get_time();
+	uint32_t duration_in_ms;
+	int len;
+
+	if (!self->block_len)
+		return ;
+
+	len = write(self->fd, self->block, self->block_len);
+	if (len != self->block_len)
+		ESP_LOGE(TAG, "write error %d / %d", len, errno);
+	self->block_len = 0;
+
+	duration_in_ms = (esp_timer_get_time() - start) / 1000;
+	self->stats.write_nb++;
+	self->stats.write_time_in_ms += duration_in_ms;
+	if (duration_in_ms > self->stats.max_write_time_in_ms)
+		self->stats.max_write_time_in_ms = duration_in_ms;
+}
+
+/* fat doesn't like those either */
+static void sanitize_name(char *name)
+{
+	sanitize_path(name);
+	for (; *name; name++) {
+		if (strchr("\\*<>|\n", *name))
+			*name = '_';
+	}
+}
+
+static void make_filepath(struct record *self, struct id3_meta *meta)
+{
+	char name[NAME_SZ];
+	int i;
+
+	snprintf(name, sizeof(name), "%s - %s", meta->artist, meta->title);
+	sanitize_name(name);
+	snprintf(self->filepath, sizeof(self->filepath), "%s/%s.mp3", self->dirname, name);
+	for (i = 2; access(self->filepath, F_OK) == 0; i++)
+		snprintf(self->filepath, sizeof(self->filepath), "%s/%s (%d).mp3",
+			 self->dirname, name, i);
+}
+
+/* title is "artist\n-\nsong" from icy, station stands for what is missing */
+static void open_file(struct record *self, char *title)
+{
+	char buf[TITLE_SZ];
+	struct id3_meta meta;
+	char *sep;
+	int len;
+
+	memset(&meta, 0, sizeof(meta));
+	snprintf(buf, sizeof(buf), "%s", title ? title : "");
+	sep = strstr(buf, TITLE_SEP);
+	if (sep) {
+		*sep = '\0';
+		meta.artist = buf;
+		meta.title = sep + strlen(TITLE_SEP);
+	} else {
+		meta.artist = self->station;
+		meta.title = buf;
+	}
+	if (!meta.title[0]) {
+		snprintf(buf, sizeof(buf), "%s %u", self->station, self->stats.file_nb + 1);
+		meta.title = buf;
+	}
+	meta.album = self->station;
+
+	self->is_open = true;
+	self->audio_len = 0;
+	self->block_len = 0;
+	self->stats.file_nb++;
+	make_filepath(self, &meta);
+	self->fd = open(self->filepath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	/* icy titles may not be valid in fat encoding, tag keeps the real one */
+	if (self->fd < 0) {
+		struct id3_meta fallback = { .artist = self->station };
+		char nb[12];
+
+		snprintf(nb, sizeof(nb), "%u", self->stats.file_nb);
+		fallback.title = nb;
+		make_filepath(self, &fallback);
+		self->fd = open(self->filepath, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	}
+	if (self->fd < 0) {
+		ESP_LOGE(TAG, "unable to create %s (%d)", self->filepath, errno);
+		return ;
+	}
+	ESP_LOGI(TAG, "record into %s", self->filepath);
+
+	len = id3_build_tag(&meta, self->block, WRITE_SZ);
+	if (len > 0)
+		self->block_len = len;
+}
+
+/* complete file is queued to enter music library, db is updated later */
+static void close_file(struct record *self)
+{
+	if (!self->is_open)
+		return ;
+
+	self->is_open = false;
+	if (self->fd < 0)
+		return ;
+	write_block(self);
+	close(self->fd);
+	self->fd = -1;
+
+	if (!self->audio_len) {
+		unlink(self->filepath);
+		return ;
+	}
+	if (self->db_dirname && db_add_song(self->db_dirname, self->filepath))
+		ESP_LOGW(TAG, "unable to add %s to library", self->filepath);
+}
+
+/* move staged data up to limit into block */
+static void append(struct record *self, uint32_t limit)
+{
+	int start = self->written % STAGING_SZ;
+	int len;
+
+	len = MIN(limit - self->written, WRITE_SZ - self->block_len);
+	len = MIN(len, STAGING_SZ - start);
+	if (self->fd >= 0) {
+		memcpy(self->block + self->block_len, self->staging + start, len);
+		self->block_len += len;
+		self->audio_len += len;
+		self->stats.bytes += len;
+	} else {
+		self->stats.drop_bytes += len;
+	}
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	self->written += len;
+	xSemaphoreGive(self->lock);
+
+	if (self->block_len == WRITE_SZ)
+		write_block(self);
+}
+
+static void flush(struct record *self)
+{
+	struct split *split;
+	uint32_t limit;
+
+	while (1) {
+		xSemaphoreTake(self->lock, portMAX_DELAY);
+		split = self->split_nb ? &self->splits[self->split_start] : NULL;
+		limit = split ? split->pos : self->pos;
+		xSemaphoreGive(self->lock);
+
+		/* network task never writes into queued splits */
+		if (split && split->pos == self->written) {
+			close_file(self);
+			open_file(self, split->title);
+			xSemaphoreTake(self->lock, portMAX_DELAY);
+			self->split_start = (self->split_start + 1) % SPLIT_NB;
+			self->split_nb--;
+			xSemaphoreGive(self->lock);
+			continue;
+		}
+		if (limit == self->written)
+			break;
+		if (!self->is_open)
+			open_file(self, NULL);
+		append(self, limit);
+	}
+}
+
+static void record_writer_task(void *arg)
+{
+	struct record *self = arg;
+
+	while (self->is_active) {
+		ulTaskNotifyTake(pdTRUE, WRITER_POLL_MS / portTICK_PERIOD_MS);
+		flush(self);
+	}
+	flush(self);
+	close_file(self);
+
+	xSemaphoreGive(self->sem_end_of_writer);
+	vTaskDelete(NULL);
+}
+
+static void queue_split(struct record *self, uint32_t pos)
+{
+	struct split *split;
+
+	self->is_split_pending = false;
+	if (self->split_nb == SPLIT_NB) {
+		ESP_LOGW(TAG, "title changes too fast, keep on current file");
+		return ;
+	}
+	split = &self->splits[(self->split_start + self->split_nb) % SPLIT_NB];
+	split->pos = pos;
+	strcpy(split->title, self->pending_title);
+	self->split_nb++;
+}
+
+static void release(struct record *self)
+{
+	free(self->dirname);
+	free(self->db_dirname);
+	free(self->station);
+	free(self->staging);
+	free(self->block);
+	self->dirname = NULL;
+	self->db_dirname = NULL;
+	self->station = NULL;
+	self->staging = NULL;
+	self->block = NULL;
+}
+
+static void log_stats(struct record *self)
+{
+	struct record_stats *stats = &self->stats;
+
+	ESP_LOGI(TAG, "%u files, %u KB in %u writes, %u ms in fat (max %u ms), %u bytes dropped",
+		 stats->file_nb, stats->bytes / 1024, stats->write_nb, stats->write_time_in_ms,
+		 stats->max_write_time_in_ms, stats->drop_bytes);
+}
+
+/* public api */
+void *record_create()
+{
+	struct record *self = malloc(sizeof(struct record));
+	assert(self);
+
+	memset(self, 0, sizeof(*self));
+	self->fd = -1;
+	self->sem_end_of_writer = xSemaphoreCreateBinary();
+	assert(self->sem_end_of_writer);
+	self->lock = xSemaphoreCreateMutex();
+	assert(self->lock);
+
+	return self;
+}
+
+void record_destroy(void *hdl)
+{
+	struct record *self = hdl;
+	assert(hdl);
+
+	vSemaphoreDelete(self->sem_end_of_writer);
+	vSemaphoreDelete(self->lock);
+
+	free(hdl);
+}
+
+/* record into dirname, one file per song. Complete files are added to db
+ * in db_dirname when not NULL.
+ */
+int record_start(void *hdl, char *dirname, char *db_dirname, char *station)
+{
+	struct record *self = hdl;
+	BaseType_t res;
+
+	assert(hdl);
+
+	if (mkdir(dirname, 0777) && errno != EEXIST) {
+		ESP_LOGW(TAG, "unable to create %s (%d)", dirname, errno);
+		return -1;
+	}
+	self->dirname = strdup(dirname);
+	self->db_dirname = db_dirname ? strdup(db_dirname) : NULL;
+	self->station = strdup(station);
+	self->staging = heap_caps_malloc(STAGING_SZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	self->block = heap_caps_malloc(WRITE_SZ, MALLOC_CAP_DMA);
+	if (!self->block)
+		self->block = heap_caps_malloc(WRITE_SZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	if (!self->dirname || (db_dirname && !self->db_dirname) || !self->station ||
+	    !self->staging || !self->block) {
+		ESP_LOGW(TAG, "no memory to record");
+		release(self);
+		return -1;
+	}
+
+	self->pos = 0;
+	self->written = 0;
+	self->split_start = 0;
+	self->split_nb = 0;
+	self->is_split_pending = false;
+	self->is_open = false;
+	self->fd = -1;
+	memset(&self->stats, 0, sizeof(self->stats));
+	self->is_active = true;
+	res = xTaskCreatePinnedToCore(record_writer_task, "record_writer", 8192, self,
+			tskIDLE_PRIORITY + 1, &self->writer, tskNO_AFFINITY);
+	assert(res == pdPASS);
+
+	return 0;
+}
+
+void record_stop(void *hdl)
+{
+	struct record *self = hdl;
+
+	assert(hdl);
+
+	self->is_active = false;
+	xTaskNotifyGive(self->writer);
+	xSemaphoreTake(self->sem_end_of_writer, portMAX_DELAY);
+	log_stats(self);
+	/* network task may still be on its way in */
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	release(self);
+	xSemaphoreGive(self->lock);
+}
+
+/* called by network task with stream audio, never waits for the card */
+void record_write(void *hdl, void *data, int data_len)
+{
+	struct record *self = hdl;
+	bool is_wakeup = false;
+	int start;
+	int len;
+	int cut;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	if (!self->is_active)
+		goto exit;
+	if (data_len > STAGING_SZ - (int) (self->pos - self->written)) {
+		self->stats.drop_bytes += data_len;
+		goto exit;
+	}
+
+	if (self->is_split_pending) {
+		cut = mpeg_find_frame_boundary(data, data_len);
+		if (cut < data_len) {
+			queue_split(self, self->pos + cut);
+			is_wakeup = true;
+		}
+	}
+	start = self->pos % STAGING_SZ;
+	len = MIN(data_len, STAGING_SZ - start);
+	memcpy(self->staging + start, data, len);
+	memcpy(self->staging, (char *) data + len, data_len - len);
+	if (self->pos / WRITE_SZ != (self->pos + data_len) / WRITE_SZ)
+		is_wakeup = true;
+	self->pos += data_len;
+
+exit:
+	xSemaphoreGive(self->lock);
+	if (is_wakeup)
+		xTaskNotifyGive(self->writer);
+}
+
+/* song changes, next file starts on next frame */
+void record_title(void *hdl, char *title)
+{
+	struct record *self = hdl;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	if (!self->is_active) {
+		xSemaphoreGive(self->lock);
+		return ;
+	}
+	snprintf(self->pending_title, sizeof(self->pending_title), "%s", title);
+	self->is_split_pending = true;
+	/* nothing received yet, first file gets that title */
+	if (!self->pos)
+		queue_split(self, 0);
+	xSemaphoreGive(self->lock);
+}
+
+void record_get_stats(void *hdl, struct record_stats *stats)
+{
+	struct record *self = hdl;
+
+	*stats = self->stats;
+}
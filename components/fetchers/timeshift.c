@@ -0,0 +1,600 @@
+#include "timeshift.h"
+
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#include "esp_log.h"
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+
+#include "ring.h"
+#include "mpeg.h"
+
+static const char* TAG = "rv3.timeshift";
+
+#define MIN(a,b)	((a)<(b)?(a):(b))
+
+/* circular file holds 30 minutes at 128 kbps, more at lower bitrates. It
+ * is only written by whole blocks aligned inside file, so writes are
+ * sequential, fill fat clusters and go from dma capable block buffer.
+ */
+#define BLOCK_SZ		(16 * 1024)
+#define FILE_SZ			((30 * 60 * 128 / 8 * 1000 + BLOCK_SZ - 1) / BLOCK_SZ * BLOCK_SZ)
+/* network task never waits for card, staging absorbs slow writes */
+#define STAGING_SZ		(8 * BLOCK_SZ)
+/* one entry per second of audio, an hour at most */
+#define INDEX_PERIOD_MS		1000
+#define INDEX_NB		3600
+#define WRITER_POLL_MS		100
+#define READER_POLL_MS		100
+
+struct index_entry {
+	uint64_t time_in_ms;
+	uint64_t pos;
+};
+
+/* positions are stream bytes since start, 64 bits so a radio left on for
+ * days never wraps them. They're not read atomically, so always under lock
+ * outside of the task updating them.
+ */
+struct timeshift {
+	void *buffer_hdl;
+	int fd;
+	volatile bool is_active;
+	SemaphoreHandle_t sem_end_of_writer;
+	TaskHandle_t writer;
+	volatile bool is_reading;
+	bool has_reader;
+	SemaphoreHandle_t sem_end_of_reader;
+	/* positions, staging and index. Held briefly, network task takes it */
+	SemaphoreHandle_t lock;
+	/* fd and block, held around card accesses */
+	SemaphoreHandle_t file_lock;
+	/* received from network, written to card, next to push to ring */
+	volatile uint64_t pos;
+	volatile uint64_t written;
+	volatile uint64_t play_pos;
+	/* network task pushes its data to ring itself */
+	volatile bool is_live;
+	char *staging;
+	char *block;
+	char *read_buf;
+	/* frames are followed to index stream by audio time */
+	uint8_t hdr[MPEG_HEADER_SZ];
+	int hdr_len;
+	int frame_remain;
+	uint64_t audio_time_in_us;
+	struct index_entry *index;
+	int index_start;
+	int index_nb;
+	struct timeshift_stats stats;
+};
+
+static struct index_entry *entry(struct timeshift *self, int i)
+{
+	return &self->index[(self->index_start + i) % INDEX_NB];
+}
+
+/* number of entries whose time or pos is not greater than value */
+static int count_up_to(struct timeshift *self, uint64_t value, bool is_time)
+{
+	int lo = 0;
+	int hi = self->index_nb;
+	uint64_t key;
+	int mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		key = is_time ? entry(self, mid)->time_in_ms : entry(self, mid)->pos;
+		if (key <= value)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo;
+}
+
+/* first position still in file, each block written overwrites oldest one */
+static uint64_t oldest_pos(struct timeshift *self)
+{
+	return self->written > FILE_SZ - BLOCK_SZ ? self->written - (FILE_SZ - BLOCK_SZ) : 0;
+}
+
+static int first_valid_entry(struct timeshift *self)
+{
+	uint64_t oldest = oldest_pos(self);
+
+	return oldest ? count_up_to(self, oldest - 1, false) : 0;
+}
+
+/* entry of frame holding pos, oldest one when pos is no more in file */
+static int find_pos(struct timeshift *self, uint64_t pos)
+{
+	int i = count_up_to(self, pos, false) - 1;
+	int first = first_valid_entry(self);
+
+	return i < first ? first : i;
+}
+
+static void add_index(struct timeshift *self, uint64_t pos)
+{
+	uint64_t time_in_ms = self->audio_time_in_us / 1000;
+	struct index_entry *e;
+
+	if (self->index_nb &&
+	    time_in_ms - entry(self, self->index_nb - 1)->time_in_ms < INDEX_PERIOD_MS)
+		return ;
+
+	if (self->index_nb == INDEX_NB) {
+		self->index_start = (self->index_start + 1) % INDEX_NB;
+		self->index_nb--;
+	}
+	e = entry(self, self->index_nb++);
+	e->time_in_ms = time_in_ms;
+	e->pos = pos;
+}
+
+/* hdr is full, index its frame or slide one byte when not in sync */
+static void handle_header(struct timeshift *self, uint64_t frame_pos)
+{
+	int duration_in_us;
+	int frame_len;
+
+	if (mpeg_frame_info(self->hdr, &frame_len, &duration_in_us)) {
+		memmove(self->hdr, self->hdr + 1, MPEG_HEADER_SZ - 1);
+		self->hdr_len--;
+		return ;
+	}
+	add_index(self, frame_pos);
+	self->audio_time_in_us += duration_in_us;
+	self->frame_remain = frame_len - MPEG_HEADER_SZ;
+	self->hdr_len = 0;
+}
+
+static void index_frames(struct timeshift *self, uint8_t *data, int data_len)
+{
+	uint64_t pos = self->pos;
+	int consume;
+
+	while (data_len) {
+		if (self->frame_remain) {
+			consume = MIN(self->frame_remain, data_len);
+			self->frame_remain -= consume;
+		} else {
+			consume = 1;
+			self->hdr[self->hdr_len++] = *data;
+			if (self->hdr_len == MPEG_HEADER_SZ)
+				handle_header(self, pos + 1 - MPEG_HEADER_SZ);
+		}
+		data += consume;
+		data_len -= consume;
+		pos += consume;
+	}
+}
+
+static void write_block(struct timeshift *self)
+{
+	int64_t start = esp_timer_get_time();
+	uint32_t duration_in_ms;
+	int len = -1;
+
+	xSemaphoreTake(self->file_lock, portMAX_DELAY);
+	memcpy(self->block, self->staging + self->written % STAGING_SZ, BLOCK_SZ);
+	if (lseek(self->fd, self->written % FILE_SZ, SEEK_SET) >= 0)
+		len = write(self->fd, self->block, BLOCK_SZ);
+	if (len != BLOCK_SZ)
+		ESP_LOGE(TAG, "write error %d / %d", len, errno);
+	/* even on error, staging must not fill up */
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	self->written += BLOCK_SZ;
+	xSemaphoreGive(self->lock);
+	xSemaphoreGive(self->file_lock);
+
+	duration_in_ms = (esp_timer_get_time() - start) / 1000;
+	self->stats.write_nb++;
+	self->stats.write_time_in_ms += duration_in_ms;
+	if (duration_in_ms > self->stats.max_write_time_in_ms)
+		self->stats.max_write_time_in_ms = duration_in_ms;
+}
+
+static bool is_block_staged(struct timeshift *self)
+{
+	bool res;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	res = self->pos - self->written >= BLOCK_SZ;
+	xSemaphoreGive(self->lock);
+
+	return res;
+}
+
+static void timeshift_writer_task(void *arg)
+{
+	struct timeshift *self = arg;
+
+	while (self->is_active) {
+		ulTaskNotifyTake(pdTRUE, WRITER_POLL_MS / portTICK_PERIOD_MS);
+		while (self->is_active && is_block_staged(self))
+			write_block(self);
+	}
+
+	xSemaphoreGive(self->sem_end_of_writer);
+	vTaskDelete(NULL);
+}
+
+/* data not yet on card is copied from staging */
+static int read_staging(struct timeshift *self)
+{
+	int start = self->play_pos % STAGING_SZ;
+	int len;
+
+	len = MIN(self->pos - self->play_pos, STAGING_SZ - start);
+	len = MIN(len, BLOCK_SZ);
+	memcpy(self->read_buf, self->staging + start, len);
+
+	return len;
+}
+
+/* reads stop on block boundaries so they never cross a fat cluster */
+static int read_file(struct timeshift *self)
+{
+	uint64_t oldest;
+	int len = -1;
+	int i;
+
+	xSemaphoreTake(self->file_lock, portMAX_DELAY);
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	oldest = oldest_pos(self);
+	if (self->play_pos < oldest) {
+		i = first_valid_entry(self);
+		self->play_pos = i < self->index_nb ? entry(self, i)->pos : oldest;
+		self->stats.overrun_nb++;
+		ESP_LOGW(TAG, "overrun, restart at %llu", (unsigned long long) self->play_pos);
+	}
+	len = MIN((int) (BLOCK_SZ - self->play_pos % BLOCK_SZ),
+		  (int) (self->written - self->play_pos));
+	xSemaphoreGive(self->lock);
+	if (len <= 0)
+		goto exit;
+
+	if (lseek(self->fd, self->play_pos % FILE_SZ, SEEK_SET) >= 0)
+		len = read(self->fd, self->block, len);
+	else
+		len = -1;
+	if (len > 0)
+		memcpy(self->read_buf, self->block, len);
+	else
+		ESP_LOGE(TAG, "read error %d / %d", len, errno);
+
+exit:
+	xSemaphoreGive(self->file_lock);
+
+	return len;
+}
+
+static int push(struct timeshift *self, int len)
+{
+	while (ring_push(self->buffer_hdl, len, self->read_buf)) {
+		if (!self->is_reading)
+			return -1;
+	}
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	self->play_pos += len;
+	xSemaphoreGive(self->lock);
+
+	return 0;
+}
+
+/* push shifted stream from file then from staging. Once it meets network
+ * data, network task takes over feeding ring without gap or overlap.
+ */
+static void timeshift_reader_task(void *arg)
+{
+	struct timeshift *self = arg;
+	bool is_staged;
+	int len = 0;
+
+	while (self->is_reading) {
+		xSemaphoreTake(self->lock, portMAX_DELAY);
+		if (self->play_pos == self->pos) {
+			self->is_live = true;
+			xSemaphoreGive(self->lock);
+			ESP_LOGI(TAG, "back to live stream");
+			break;
+		}
+		is_staged = self->play_pos >= self->written;
+		if (is_staged)
+			len = read_staging(self);
+		xSemaphoreGive(self->lock);
+		if (!is_staged)
+			len = read_file(self);
+		if (len < 0) {
+			vTaskDelay(READER_POLL_MS / portTICK_PERIOD_MS);
+			continue;
+		}
+		if (len && push(self, len))
+			break;
+	}
+
+	xSemaphoreGive(self->sem_end_of_reader);
+	vTaskDelete(NULL);
+}
+
+/* file is created once at full size so writes never extend it */
+static int preallocate(int fd)
+{
+	struct stat st;
+	char c = 0;
+
+	if (fstat(fd, &st) == 0 && st.st_size >= FILE_SZ)
+		return 0;
+	if (lseek(fd, FILE_SZ - 1, SEEK_SET) < 0 || write(fd, &c, 1) != 1)
+		return -1;
+
+	return fsync(fd);
+}
+
+static void release(struct timeshift *self)
+{
+	if (self->fd >= 0)
+		close(self->fd);
+	self->fd = -1;
+	free(self->staging);
+	free(self->block);
+	free(self->read_buf);
+	free(self->index);
+	self->staging = NULL;
+	self->block = NULL;
+	self->read_buf = NULL;
+	self->index = NULL;
+}
+
+static void log_stats(struct timeshift *self)
+{
+	struct timeshift_stats *stats = &self->stats;
+
+	ESP_LOGI(TAG, "%u KB in %u writes, %u ms in fat (max %u ms), %u bytes dropped, %u overruns",
+		 stats->write_nb * BLOCK_SZ / 1024, stats->write_nb, stats->write_time_in_ms,
+		 stats->max_write_time_in_ms, stats->drop_bytes, stats->overrun_nb);
+}
+
+/* public api */
+void *timeshift_create(void *buffer_hdl)
+{
+	struct timeshift *self = malloc(sizeof(struct timeshift));
+	assert(self);
+
+	memset(self, 0, sizeof(*self));
+	self->buffer_hdl = buffer_hdl;
+	self->fd = -1;
+	self->sem_end_of_writer = xSemaphoreCreateBinary();
+	assert(self->sem_end_of_writer);
+	self->sem_end_of_reader = xSemaphoreCreateBinary();
+	assert(self->sem_end_of_reader);
+	self->lock = xSemaphoreCreateMutex();
+	assert(self->lock);
+	self->file_lock = xSemaphoreCreateMutex();
+	assert(self->file_lock);
+
+	return self;
+}
+
+void timeshift_destroy(void *hdl)
+{
+	struct timeshift *self = hdl;
+	assert(hdl);
+
+	vSemaphoreDelete(self->sem_end_of_writer);
+	vSemaphoreDelete(self->sem_end_of_reader);
+	vSemaphoreDelete(self->lock);
+	vSemaphoreDelete(self->file_lock);
+
+	free(hdl);
+}
+
+/* start recording stream into filename, live stream keeps on being played */
+int timeshift_start(void *hdl, const char *filename)
+{
+	struct timeshift *self = hdl;
+	BaseType_t res;
+
+	assert(hdl);
+
+	self->staging = heap_caps_malloc(STAGING_SZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	self->read_buf = heap_caps_malloc(BLOCK_SZ, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	self->index = heap_caps_malloc(INDEX_NB * sizeof(struct index_entry),
+				       MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+	self->block = heap_caps_malloc(BLOCK_SZ, MALLOC_CAP_DMA);
+	if (!self->block)
+		self->block = malloc(BLOCK_SZ);
+	if (!self->staging || !self->read_buf || !self->index || !self->block) {
+		ESP_LOGW(TAG, "no memory for time-shift");
+		goto error;
+	}
+	self->fd = open(filename, O_RDWR | O_CREAT, 0666);
+	if (self->fd < 0 || preallocate(self->fd)) {
+		ESP_LOGW(TAG, "unable to setup %s (%d)", filename, errno);
+		goto error;
+	}
+
+	self->pos = 0;
+	self->written = 0;
+	self->play_pos = 0;
+	self->is_live = true;
+	self->hdr_len = 0;
+	self->frame_remain = 0;
+	self->audio_time_in_us = 0;
+	self->index_start = 0;
+	self->index_nb = 0;
+	memset(&self->stats, 0, sizeof(self->stats));
+	self->is_active = true;
+	res = xTaskCreatePinnedToCore(timeshift_writer_task, "timeshift_writer", 4096, self,
+			tskIDLE_PRIORITY + 1, &self->writer, tskNO_AFFINITY);
+	assert(res == pdPASS);
+
+	return 0;
+
+error:
+	release(self);
+
+	return -1;
+}
+
+void timeshift_stop(void *hdl)
+{
+	struct timeshift *self = hdl;
+
+	assert(hdl);
+
+	timeshift_pause(hdl);
+	self->is_active = false;
+	xSemaphoreTake(self->sem_end_of_writer, portMAX_DELAY);
+	log_stats(self);
+	release(self);
+}
+
+/* called by network task with each chunk of stream, never waits for the
+ * card. Return 1 when chunk must also be pushed to ring, stream being live.
+ */
+int timeshift_write(void *hdl, void *data, int data_len)
+{
+	struct timeshift *self = hdl;
+	bool is_block_full = false;
+	int is_live;
+	int start;
+	int len;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	is_live = self->is_live;
+	if (data_len > STAGING_SZ - (int) (self->pos - self->written)) {
+		/* frame tracking starts over after the hole */
+		self->stats.drop_bytes += data_len;
+		self->hdr_len = 0;
+		self->frame_remain = 0;
+		goto exit;
+	}
+
+	index_frames(self, data, data_len);
+	start = self->pos % STAGING_SZ;
+	len = MIN(data_len, STAGING_SZ - start);
+	memcpy(self->staging + start, data, len);
+	memcpy(self->staging, (char *) data + len, data_len - len);
+	is_block_full = self->pos / BLOCK_SZ != (self->pos + data_len) / BLOCK_SZ;
+	self->pos += data_len;
+
+exit:
+	xSemaphoreGive(self->lock);
+	if (is_block_full)
+		xTaskNotifyGive(self->writer);
+
+	return is_live;
+}
+
+/* stop feeding ring, either from file or from network */
+void timeshift_pause(void *hdl)
+{
+	struct timeshift *self = hdl;
+
+	if (self->has_reader) {
+		self->is_reading = false;
+		xSemaphoreTake(self->sem_end_of_reader, portMAX_DELAY);
+		self->has_reader = false;
+	}
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	self->is_live = false;
+	xSemaphoreGive(self->lock);
+}
+
+/* feed ring from pos, up to live stream */
+void timeshift_play(void *hdl, uint64_t pos)
+{
+	struct timeshift *self = hdl;
+	BaseType_t res;
+
+	timeshift_pause(hdl);
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	self->play_pos = pos;
+	xSemaphoreGive(self->lock);
+	self->is_reading = true;
+	self->has_reader = true;
+	res = xTaskCreatePinnedToCore(timeshift_reader_task, "timeshift_reader", 4096, self,
+			tskIDLE_PRIORITY + 1, NULL, tskNO_AFFINITY);
+	assert(res == pdPASS);
+}
+
+/* position decoder is at, ring_bytes being still queued in ring */
+uint64_t timeshift_tell(void *hdl, int ring_bytes)
+{
+	struct timeshift *self = hdl;
+	uint64_t pos;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	pos = self->is_live ? self->pos : self->play_pos;
+	xSemaphoreGive(self->lock);
+
+	return pos > ring_bytes ? pos - ring_bytes : 0;
+}
+
+/* frame start delta_in_ms of audio away from pos, clamped to what is
+ * recorded.
+ */
+int timeshift_seek(void *hdl, uint64_t pos, int delta_in_ms, uint64_t *new_pos)
+{
+	struct timeshift *self = hdl;
+	int64_t time_in_ms;
+	int first;
+	int i;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	first = first_valid_entry(self);
+	if (first >= self->index_nb) {
+		xSemaphoreGive(self->lock);
+		return -1;
+	}
+	time_in_ms = (int64_t) entry(self, find_pos(self, pos))->time_in_ms + delta_in_ms;
+	i = time_in_ms < 0 ? 0 : count_up_to(self, time_in_ms, true) - 1;
+	if (i < first)
+		i = first;
+	*new_pos = entry(self, i)->pos;
+	xSemaphoreGive(self->lock);
+
+	return 0;
+}
+
+/* ms of audio between pos and live stream */
+int timeshift_delay(void *hdl, uint64_t pos)
+{
+	struct timeshift *self = hdl;
+	int delay = 0;
+
+	xSemaphoreTake(self->lock, portMAX_DELAY);
+	if (self->index_nb && first_valid_entry(self) < self->index_nb)
+		delay = entry(self, self->index_nb - 1)->time_in_ms -
+			entry(self, find_pos(self, pos))->time_in_ms;
+	xSemaphoreGive(self->lock);
+
+	return delay;
+}
+
+int timeshift_is_live(void *hdl)
+{
+	struct timeshift *self = hdl;
+
+	return self->is_live;
+}
+
+void timeshift_get_stats(void *hdl, struct timeshift_stats *stats)
+{
+	struct timeshift *self = hdl;
+
+	*stats = self->stats;
+}
@@ -8,9 +8,11 @@
 #include <stdio.h>
 #include <unistd.h>
 
-#include <assert.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+
+#define MIN(a,b)	((a) < (b) ? (a) : (b))
 
 struct id3v2_header {
 	char magic[3];
@@ -26,531 +28,836 @@ struct id3v2_frame_header {
 	uint8_t flags[2];
 };
 
+#define ID3_WINDOW_SZ		4096
+/* enough for mpeg header and Xing or VBRI header with some leading junk */
+#define AUDIO_PROBE_SZ		512
+
+/* tag content is read through a window, so that a whole tag usually costs a
+ * single read. Frames we don't care about, like big pictures, are skipped
+ * without being read.
+ */
 struct id3_parser {
 	int fd;
-	int hdr_size;
+	int fd_pos;
+	int file_size;
+	int version;
 	int hdr_is_unsynchronisation;
-	struct id3v2_header hdr;
-	struct id3v2_frame_header fhdr;
+	/* file offsets of first frame, end of frames and first audio byte */
+	int frames_pos;
+	int tag_end;
+	int audio_pos;
 	char *title;
 	char *artist;
 	int track_nb;
 	char *album;
 	int duration_in_ms;
+	int bitrate;
+	int samplerate;
+	int win_pos;
+	int win_len;
+	unsigned char window[ID3_WINDOW_SZ];
+};
+
+struct text_out {
+	char *buf;
+	int size;
+	int pos;
+	int len;
+};
+
+/* frame header in a version independent form */
+struct id3_frame {
+	char frame_id[4];
+	int hdr_len;
+	int size;
+	/* bytes to skip before content, -1 if content is compressed or encrypted */
+	int skip;
+	int is_unsynchronisation;
+};
+
+struct id3v1_tag {
+	char magic[3];
+	char title[30];
+	char artist[30];
+	char album[30];
+	char year[4];
+	char comment[28];
+	uint8_t zero;
+	uint8_t track_nb;
+	uint8_t genre;
+};
+
+struct frame_handler {
+	char frame_id[4];
+	void (*parse)(struct id3_parser *parser, unsigned char *buf, int len);
 };
 
-static int utf16_to_utf8_len(uint16_t u16)
+static void text_put(struct text_out *out, unsigned char *utf8, int n)
 {
-	if (u16 < 0x0080)
-		return 1;
-	else if (u16 < 0x0800)
-		return 2;
+	/* never write a partial character */
+	if (out->pos == out->len && out->pos + n < out->size) {
+		memcpy(&out->buf[out->pos], utf8, n);
+		out->pos += n;
+	}
+	out->len += n;
+}
 
-	return 3;
+static void text_put_code(struct text_out *out, uint32_t code)
+{
+	unsigned char utf8[4];
+
+	if (code < 0x80) {
+		utf8[0] = code;
+		text_put(out, utf8, 1);
+	} else if (code < 0x800) {
+		utf8[0] = 0xc0 + (code >> 6);
+		utf8[1] = 0x80 + (code & 0x3f);
+		text_put(out, utf8, 2);
+	} else if (code < 0x10000) {
+		utf8[0] = 0xe0 + (code >> 12);
+		utf8[1] = 0x80 + ((code >> 6) & 0x3f);
+		utf8[2] = 0x80 + (code & 0x3f);
+		text_put(out, utf8, 3);
+	} else {
+		utf8[0] = 0xf0 + (code >> 18);
+		utf8[1] = 0x80 + ((code >> 12) & 0x3f);
+		utf8[2] = 0x80 + ((code >> 6) & 0x3f);
+		utf8[3] = 0x80 + (code & 0x3f);
+		text_put(out, utf8, 4);
+	}
 }
 
-static int iso_8859_1_to_utf8_len(uint8_t u8)
+static void text_put_utf16(struct text_out *out, unsigned char *buf, int len, int is_be)
 {
-	if (u8 < 0x80)
-		return 1;
+	uint32_t code;
+	uint16_t low;
 
-	return 2;
+	for (; len >= 2; buf += 2, len -= 2) {
+		code = is_be ? (buf[0] << 8) + buf[1] : (buf[1] << 8) + buf[0];
+		if (!code)
+			break;
+		if (code >= 0xd800 && code < 0xe000) {
+			low = len >= 4 ? (is_be ? (buf[2] << 8) + buf[3] : (buf[3] << 8) + buf[2]) : 0;
+			if (code < 0xdc00 && low >= 0xdc00 && low < 0xe000) {
+				code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+				buf += 2;
+				len -= 2;
+			} else {
+				/* unpaired surrogate */
+				code = 0xfffd;
+			}
+		}
+		text_put_code(out, code);
+	}
 }
 
-static unsigned char *utf16_to_utf8_encode(uint16_t u16, unsigned char *buf)
+/* decode text of given encoding into out as utf8. Like snprintf, return
+ * needed length which may be larger than size - 1. out is always '\0'
+ * terminated.
+ */
+static int text_decode_encoding(int encoding, unsigned char *buf, int len, char *out, int size)
 {
-	if (u16 < 0x0080) {
-		buf[0] = u16 & 0xff;
-		return buf + 1;
-	} else if (u16 < 0x0800) {
-		buf[0] = 0xc0 + (u16 >> 6);
-		buf[1] = 0x80 + (u16 & 0x3f);
-		return buf + 2;
-	} else {
-		buf[0] = 0xd0 + (u16 >> 12);
-		buf[1] = 0x80 + ((u16 >> 6) & 0x3f);
-		buf[2] = 0x80 + (u16 & 0x3f);
-		return buf + 3;
+	struct text_out text = {out, size, 0, 0};
+
+	switch (encoding) {
+	case 0:
+		for (; len > 0 && buf[0]; buf++, len--)
+			text_put_code(&text, buf[0]);
+		break;
+	case 1:
+		/* bom is mandatory but some taggers omit it. Assume little endian */
+		if (len >= 2 && buf[0] == 0xfe && buf[1] == 0xff) {
+			text_put_utf16(&text, buf + 2, len - 2, 1);
+			break;
+		}
+		if (len >= 2 && buf[0] == 0xff && buf[1] == 0xfe) {
+			buf += 2;
+			len -= 2;
+		}
+		text_put_utf16(&text, buf, len, 0);
+		break;
+	case 2:
+		text_put_utf16(&text, buf, len, 1);
+		break;
+	case 3:
+		for (; len > 0 && buf[0]; buf++, len--)
+			text_put(&text, buf, 1);
+		break;
+	default:
+		return -1;
 	}
+
+	if (size)
+		out[text.pos] = '\0';
+
+	return text.len;
 }
 
-static unsigned char *iso_8859_1_to_utf8_one(uint8_t u8, unsigned char *buf)
+/* text frame content starts with its encoding */
+static int text_decode(unsigned char *buf, int len, char *out, int size)
 {
-	if (u8 < 0x80) {
-		buf[0] = u8;
-		return buf + 1;
-	}
-	buf[0] = 0xc0 + (u8 >> 6);
-	buf[1] = 0x80 + (u8 & 0x3f);
+	if (len < 1)
+		return -1;
 
-	return buf + 2;
+	return text_decode_encoding(buf[0], buf + 1, len - 1, out, size);
 }
 
-static char *iso_8859_1_to_utf8_with_len(char *buf, int maxlen)
+static char *text_dup(unsigned char *buf, int len)
 {
-	unsigned char *b;
-	int len = 0;
-	uint8_t u8;
 	char *res;
-	char *tmp;
-	int ll;
-
-	assert(maxlen > 0);
-	ll = maxlen;
-	b = (unsigned char *) buf;
-	do {
-		u8 = (uint8_t ) b[0];
-		len += iso_8859_1_to_utf8_len(u8);
-		//printf("0x%02x : %d\n", u8, ll);
-		b += 1;
-		ll--;
-	} while (u8 && ll);
-	len += u8 ? 1 : 0;
-
-	res = malloc(len);
-	assert(res);
-
-	ll = maxlen;
-	b = (unsigned char *) buf;
-	tmp = res;
-	do {
-		u8 = (uint8_t ) b[0];
-		tmp = (char *) iso_8859_1_to_utf8_one(u8, (unsigned char *) tmp);
-		b += 1;
-		ll--;
-	} while (u8 && ll);
-	if (u8)
-		*tmp = '\0';
-	//printf("iso_8859_1_to_utf8 => %s\n", res);
+	int size;
+
+	size = text_decode(buf, len, NULL, 0);
+	if (size < 0)
+		return NULL;
+	res = malloc(size + 1);
+	if (res)
+		text_decode(buf, len, res, size + 1);
 
 	return res;
 }
 
-static char *utf16le_to_utf8_with_len(char *buf, int maxlen)
+static int text_to_int(unsigned char *buf, int len)
 {
-	int len = 0;
-	uint16_t u16;
-	unsigned char *b;
-	char *res;
-	char *tmp;
-	int ll;
-
-	assert(maxlen > 0);
-	assert(maxlen % 2 == 0);
-
-	ll = maxlen;
-	b = (unsigned char *) buf;
-	do {
-		//printf("b[0] = 0x%02x b[1] = 0x%02x\n", b[0], b[1]);
-		u16 = (b[1] << 8) + b[0];
-		len += utf16_to_utf8_len(u16);
-		b += 2;
-		//printf("u16 = 0x%04x (%d)\n", u16, len);
-		ll -= 2;
-	} while (u16 && ll);
-	len += u16 ? 1 : 0;
-	//printf("will use %d bytes\n", len);
-
-	res = malloc(len);
-	assert(res);
-
-	ll = maxlen;
-	b = (unsigned char *) buf;
-	tmp = res;
-	do {
-		u16 = (b[1] << 8) + b[0];
-		tmp = (char *) utf16_to_utf8_encode(u16, (unsigned char *) tmp);
-		b += 2;
-		ll -= 2;
-	} while (u16 && ll);
-	if (u16)
-		*tmp = '\0';
-	//printf("utf16le_to_utf8 => %s\n", res);
+	char tmp[16];
 
-	return res;
+	if (text_decode(buf, len, tmp, sizeof(tmp)) < 0)
+		return 0;
+
+	return atoi(tmp);
 }
 
-static char *utf16_to_utf8_with_len(char *buf, int len)
+/* return file bytes [pos, pos + len[. A new window of at most max_len
+ * bytes starting at pos is read if they are not in current one.
+ */
+static unsigned char *id3_read_at(struct id3_parser *parser, int pos, int len, int max_len)
 {
-	if (buf[0] == 0xfe)
-		assert(0);
-	else
-		return utf16le_to_utf8_with_len(&buf[2], len - 2);
+	int ret;
+
+	if (pos >= parser->win_pos && pos + len <= parser->win_pos + parser->win_len)
+		return &parser->window[pos - parser->win_pos];
+	if (len > ID3_WINDOW_SZ || len > max_len)
+		return NULL;
+
+	if (pos != parser->fd_pos && lseek(parser->fd, pos, SEEK_SET) != pos)
+		return NULL;
+	ret = read(parser->fd, parser->window, MIN(ID3_WINDOW_SZ, max_len));
+	parser->fd_pos = pos + (ret > 0 ? ret : 0);
+	parser->win_pos = pos;
+	parser->win_len = ret > 0 ? ret : 0;
+	if (ret < len)
+		return NULL;
+
+	return parser->window;
 }
 
-static char *utf8_to_utf8_with_len(char *buf, int len)
+/* return tag bytes [pos, pos + len[. Window never goes past tag end, except
+ * for the first one which also reads tag header.
+ */
+static unsigned char *id3_window(struct id3_parser *parser, int pos, int len)
 {
-	char *res;
+	return id3_read_at(parser, pos, len, parser->tag_end - pos);
+}
 
-	res = malloc(len);
-	memcpy(res, buf, len);
+static uint32_t be32(unsigned char *buf)
+{
+	return ((uint32_t) buf[0] << 24) + (buf[1] << 16) + (buf[2] << 8) + buf[3];
+}
 
-	assert(res[len - 1] == 0);
+static int syncsafe32(unsigned char *buf)
+{
+	return ((buf[0] & 0x7f) << 21) + ((buf[1] & 0x7f) << 14) + ((buf[2] & 0x7f) << 7) +
+	       (buf[3] & 0x7f);
+}
 
-	return res;
+/* remove unsynchronisation in place and return new size */
+static int unsynchronize(unsigned char *buf, int size)
+{
+	unsigned char prev = buf[0];
+	int res_size = 1;
+	unsigned char c;
+	int i;
+
+	for (i = 1; i < size; i++) {
+		c = buf[i];
+		if (prev != 0xff || c != 0x00)
+			buf[res_size++] = c;
+		prev = c;
+	}
+
+	return res_size;
 }
 
-static char *convert_to_utf8_with_len(char *buf, int len)
+/* before v2.4 unsynchronisation also applies to frame headers, so tag can't
+ * be walked in the file. Only frames in first window are parsed.
+ */
+static void unsynchronize_window(struct id3_parser *parser)
 {
-	switch (buf[0]) {
-	case 0:
-		return iso_8859_1_to_utf8_with_len(&buf[1], len - 1);
-	case 1:
-		return utf16_to_utf8_with_len(&buf[1], len -1);
-	case 2:
-		assert(0);
-	case 3:
-		return utf8_to_utf8_with_len(&buf[1], len - 1);
-	default:
-		assert(0);
+	int len = MIN(parser->win_len, parser->tag_end) - parser->frames_pos;
+
+	if (len <= 0) {
+		parser->tag_end = parser->frames_pos;
+		return;
 	}
+	len = unsynchronize(&parser->window[parser->frames_pos], len);
+	parser->win_len = parser->frames_pos + len;
+	parser->tag_end = parser->win_len;
 }
 
+/* return -2 if file has no id3v2 tag */
 static int id3_parse_header(struct id3_parser *parser)
 {
-	struct id3v2_header *hdr = &parser->hdr;
+	struct id3v2_header hdr;
+	unsigned char *ext;
+	int ext_size;
 	int ret;
-	int i;
 
-	ret = read(parser->fd, hdr, sizeof(*hdr));
-	if (ret != sizeof(*hdr))
+	ret = read(parser->fd, parser->window, ID3_WINDOW_SZ);
+	if (ret < 0)
 		return -1;
+	parser->fd_pos = ret;
+	parser->win_pos = 0;
+	parser->win_len = ret;
+	if (ret < (int) sizeof(hdr))
+		return -2;
+	memcpy(&hdr, parser->window, sizeof(hdr));
 
-	if (hdr->magic[0] != 'I' || hdr->magic[1] != 'D' || hdr->magic[2] != '3')
+	if (hdr.magic[0] != 'I' || hdr.magic[1] != 'D' || hdr.magic[2] != '3')
 		return -2;
+	if (hdr.version_major < 2 || hdr.version_major > 4) {
+		printf("unsupported id3 version %d.%d\n", hdr.version_major,
+		       hdr.version_minor);
+		return -2;
+	}
 
-	if (hdr->flags & 0x80)
-		parser->hdr_is_unsynchronisation = 1;
-	if ((hdr->flags & 0x7f) != 0) {
-		printf("hdr->flags != 0 : 0x%02x / v%d.%d \n", hdr->flags,
-			hdr->version_major, hdr->version_minor);
-		return -3;
+	parser->version = hdr.version_major;
+	parser->hdr_is_unsynchronisation = (hdr.flags & 0x80) != 0;
+	parser->frames_pos = sizeof(hdr);
+	parser->tag_end = sizeof(hdr) + syncsafe32(hdr.size);
+	parser->audio_pos = parser->tag_end;
+	/* footer */
+	if (parser->version == 4 && (hdr.flags & 0x10))
+		parser->audio_pos += sizeof(hdr);
+
+	/* v2.2 compression has never been defined, ignore frames */
+	if (parser->version == 2 && (hdr.flags & 0x40)) {
+		parser->tag_end = parser->frames_pos;
+		return 0;
+	}
+
+	if (parser->version >= 3 && (hdr.flags & 0x40)) {
+		ext = id3_window(parser, parser->frames_pos, 4);
+		if (!ext)
+			return 0;
+		/* v2.3 size doesn't include size field itself */
+		if (parser->version == 4)
+			ext_size = syncsafe32(ext);
+		else
+			ext_size = be32(ext) + 4;
+		if (ext_size < 4 || ext_size > parser->tag_end - parser->frames_pos)
+			ext_size = parser->tag_end - parser->frames_pos;
+		parser->frames_pos += ext_size;
 	}
 
-	parser->hdr_size = 0;
-	for (i = 0; i < 4; ++i)
-		parser->hdr_size = (parser->hdr_size << 7) + hdr->size[i];
-	//printf("id3 tag size is %d bytes v%d.%d\n", parser->hdr_size,
-	//       hdr->version_major, hdr->version_minor);
+	if (parser->version < 4 && parser->hdr_is_unsynchronisation)
+		unsynchronize_window(parser);
 
 	return 0;
 }
 
-static int is_frame_id(struct id3v2_frame_header *fhdr, char *frame_id)
-{
-	return !strncmp(fhdr->frame_id, frame_id, 4);
-}
+static const char v22_frame_ids[][2][4] = {
+	{{'T', 'T', '2'}, {'T', 'I', 'T', '2'}},
+	{{'T', 'P', '1'}, {'T', 'P', 'E', '1'}},
+	{{'T', 'A', 'L'}, {'T', 'A', 'L', 'B'}},
+	{{'T', 'R', 'K'}, {'T', 'R', 'C', 'K'}},
+	{{'T', 'L', 'E'}, {'T', 'L', 'E', 'N'}},
+	{{'P', 'I', 'C'}, {'A', 'P', 'I', 'C'}},
+};
 
-static int is_tit2(struct id3v2_frame_header *fhdr)
+static void id3_frame_v22(struct id3_frame *frame, unsigned char *buf)
 {
-	return is_frame_id(fhdr, "TIT2");
-}
+	int i;
 
-static int is_tpe1(struct id3v2_frame_header *fhdr)
-{
-	return is_frame_id(fhdr, "TPE1");
+	memset(frame, 0, sizeof(*frame));
+	frame->hdr_len = 6;
+	frame->size = (buf[3] << 16) + (buf[4] << 8) + buf[5];
+	/* frames we don't handle keep an empty id */
+	for (i = 0; i < sizeof(v22_frame_ids) / sizeof(v22_frame_ids[0]); i++) {
+		if (!memcmp(buf, v22_frame_ids[i][0], 3))
+			memcpy(frame->frame_id, v22_frame_ids[i][1], 4);
+	}
 }
 
-static int is_trck(struct id3v2_frame_header *fhdr)
+static void id3_frame_v23(struct id3_frame *frame, unsigned char *buf)
 {
-	return is_frame_id(fhdr, "TRCK");
+	uint8_t flags = buf[9];
+
+	memcpy(frame->frame_id, buf, 4);
+	frame->hdr_len = sizeof(struct id3v2_frame_header);
+	frame->size = be32(&buf[4]);
+	frame->is_unsynchronisation = 0;
+	frame->skip = 0;
+	/* compression or encryption */
+	if (flags & 0xc0)
+		frame->skip = -1;
+	else if (flags & 0x20)
+		frame->skip = 1;
 }
 
-static int is_talb(struct id3v2_frame_header *fhdr)
+static void id3_frame_v24(struct id3_parser *parser, struct id3_frame *frame, unsigned char *buf)
 {
-	return is_frame_id(fhdr, "TALB");
+	uint8_t flags = buf[9];
+
+	memcpy(frame->frame_id, buf, 4);
+	frame->hdr_len = sizeof(struct id3v2_frame_header);
+	frame->size = syncsafe32(&buf[4]);
+	frame->is_unsynchronisation = parser->hdr_is_unsynchronisation || (flags & 0x02);
+	frame->skip = 0;
+	/* compression or encryption */
+	if (flags & 0x0c) {
+		frame->skip = -1;
+		return;
+	}
+	/* group id and data length indicator */
+	if (flags & 0x40)
+		frame->skip++;
+	if (flags & 0x01)
+		frame->skip += 4;
 }
 
-static int is_tlen(struct id3v2_frame_header *fhdr)
+/* read frame header at pos. Return -1 on padding, garbage or end of tag */
+static int id3_read_frame(struct id3_parser *parser, int pos, struct id3_frame *frame)
 {
-	return is_frame_id(fhdr, "TLEN");
+	int hdr_len = parser->version == 2 ? 6 : sizeof(struct id3v2_frame_header);
+	unsigned char *buf;
+
+	if (pos + hdr_len > parser->tag_end)
+		return -1;
+	buf = id3_window(parser, pos, hdr_len);
+	if (!buf || buf[0] == 0)
+		return -1;
+
+	if (parser->version == 2)
+		id3_frame_v22(frame, buf);
+	else if (parser->version == 3)
+		id3_frame_v23(frame, buf);
+	else
+		id3_frame_v24(parser, frame, buf);
+	if (frame->size <= 0 || frame->size > parser->tag_end - pos - hdr_len)
+		return -1;
+
+	return 0;
 }
 
-static void id3_3_0_parse_tit2(struct id3_parser *parser, char *buf, int len)
+static void parse_title(struct id3_parser *parser, unsigned char *buf, int len)
 {
-	parser->title = convert_to_utf8_with_len(buf, len);
+	if (!parser->title)
+		parser->title = text_dup(buf, len);
 }
 
-static void id3_4_0_parse_tit2(struct id3_parser *parser, char *buf, int len)
+static void parse_artist(struct id3_parser *parser, unsigned char *buf, int len)
 {
-	parser->title = convert_to_utf8_with_len(buf, len);
+	if (!parser->artist)
+		parser->artist = text_dup(buf, len);
 }
 
-static void id3_3_0_parse_tpe1(struct id3_parser *parser, char *buf, int len)
+static void parse_album(struct id3_parser *parser, unsigned char *buf, int len)
 {
-	parser->artist = convert_to_utf8_with_len(buf, len);
+	if (!parser->album)
+		parser->album = text_dup(buf, len);
 }
 
-static void id3_4_0_parse_tpe1(struct id3_parser *parser, char *buf, int len)
+static void parse_track_nb(struct id3_parser *parser, unsigned char *buf, int len)
 {
-	parser->artist = convert_to_utf8_with_len(buf, len);
+	parser->track_nb = text_to_int(buf, len);
 }
 
-static void id3_3_0_parse_trck(struct id3_parser *parser, char *buf, int len)
+static void parse_duration(struct id3_parser *parser, unsigned char *buf, int len)
 {
-	char *tmp = convert_to_utf8_with_len(buf, len);
-
-	parser->track_nb = atoi(tmp);
-	free(tmp);
+	parser->duration_in_ms = text_to_int(buf, len);
 }
 
-static void id3_4_0_parse_trck(struct id3_parser *parser, char *buf, int len)
+static const struct frame_handler frame_handlers[] = {
+	{{'T', 'I', 'T', '2'}, parse_title},
+	{{'T', 'P', 'E', '1'}, parse_artist},
+	{{'T', 'A', 'L', 'B'}, parse_album},
+	{{'T', 'R', 'C', 'K'}, parse_track_nb},
+	{{'T', 'L', 'E', 'N'}, parse_duration},
+};
+
+static const struct frame_handler *get_frame_handler(struct id3_frame *frame)
 {
-	char *tmp = convert_to_utf8_with_len(buf, len);
+	int i;
+
+	for (i = 0; i < sizeof(frame_handlers) / sizeof(frame_handlers[0]); i++) {
+		if (!memcmp(frame->frame_id, frame_handlers[i].frame_id, 4))
+			return &frame_handlers[i];
+	}
 
-	parser->track_nb = atoi(tmp);
-	free(tmp);
+	return NULL;
 }
 
-static void id3_3_0_parse_talb(struct id3_parser *parser, char *buf, int len)
+static int is_meta_complete(struct id3_parser *parser)
 {
-	parser->album = convert_to_utf8_with_len(buf, len);
+	return parser->title && parser->artist && parser->album && parser->track_nb &&
+	       parser->duration_in_ms;
 }
 
-static void id3_4_0_parse_talb(struct id3_parser *parser, char *buf, int len)
+static void id3_parse_frames(struct id3_parser *parser)
 {
-	parser->album = convert_to_utf8_with_len(buf, len);
+	const struct frame_handler *handler;
+	int pos = parser->frames_pos;
+	struct id3_frame frame;
+	unsigned char *buf;
+	int data_len;
+
+	while (!is_meta_complete(parser) && !id3_read_frame(parser, pos, &frame)) {
+		pos += frame.hdr_len;
+		handler = get_frame_handler(&frame);
+		/* frame data is decoded in place from window */
+		if (handler && frame.skip >= 0 && frame.skip < frame.size &&
+		    (buf = id3_window(parser, pos, frame.size)) != NULL) {
+			data_len = frame.is_unsynchronisation ? unsynchronize(buf, frame.size) :
+								frame.size;
+			if (frame.skip < data_len)
+				handler->parse(parser, buf + frame.skip, data_len - frame.skip);
+		}
+		pos += frame.size;
+	}
 }
 
-static void id3_3_0_parse_tlen(struct id3_parser *parser, char *buf, int len)
-{
-	char *tmp = convert_to_utf8_with_len(buf, len);
+static const uint16_t mpeg1_bitrates[3][16] = {
+	{0, 32, 64, 96, 128, 160, 192, 224, 256, 288, 320, 352, 384, 416, 448, 0},
+	{0, 32, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 384, 0},
+	{0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0},
+};
 
-	parser->duration_in_ms = atoi(tmp);
-	free(tmp);
-}
+static const uint16_t mpeg2_bitrates[3][16] = {
+	{0, 32, 48, 56, 64, 80, 96, 112, 128, 144, 160, 176, 192, 224, 256, 0},
+	{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+	{0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0},
+};
+
+static const int mpeg_samplerates[3] = {44100, 48000, 32000};
+
+struct mpeg_header {
+	int is_mpeg1;
+	int layer;
+	int bitrate;
+	int samplerate;
+	int samples_per_frame;
+	int is_mono;
+};
 
-static void id3_4_0_parse_tlen(struct id3_parser *parser, char *buf, int len)
+static int parse_mpeg_header(unsigned char *buf, struct mpeg_header *mhdr)
 {
-	char *tmp = convert_to_utf8_with_len(buf, len);
+	int version = (buf[1] >> 3) & 3;
+	int layer = 4 - ((buf[1] >> 1) & 3);
+	int bitrate_idx = buf[2] >> 4;
+	int samplerate_idx = (buf[2] >> 2) & 3;
+
+	if (buf[0] != 0xff || (buf[1] & 0xe0) != 0xe0)
+		return -1;
+	/* reserved values */
+	if (version == 1 || layer == 4 || bitrate_idx == 15 || samplerate_idx == 3)
+		return -1;
+	/* free format */
+	if (bitrate_idx == 0)
+		return -1;
+
+	mhdr->is_mpeg1 = version == 3;
+	mhdr->layer = layer;
+	mhdr->bitrate = mhdr->is_mpeg1 ? mpeg1_bitrates[layer - 1][bitrate_idx] :
+					 mpeg2_bitrates[layer - 1][bitrate_idx];
+	mhdr->samplerate = mpeg_samplerates[samplerate_idx];
+	/* mpeg2 halves samplerate, mpeg2.5 quarters it */
+	if (version == 2)
+		mhdr->samplerate /= 2;
+	else if (version == 0)
+		mhdr->samplerate /= 4;
+	if (layer == 1)
+		mhdr->samples_per_frame = 384;
+	else if (layer == 3 && !mhdr->is_mpeg1)
+		mhdr->samples_per_frame = 576;
+	else
+		mhdr->samples_per_frame = 1152;
+	mhdr->is_mono = (buf[3] >> 6) == 3;
 
-	parser->duration_in_ms = atoi(tmp);
-	free(tmp);
+	return 0;
 }
 
-static void *unsynchronize(unsigned char *buf, int *size)
+/* return frame count of vbr file from Xing or VBRI header, or 0 if file is
+ * cbr. Set *bytes to audio bytes if header has it.
+ */
+static int parse_vbr_header(unsigned char *buf, int len, struct mpeg_header *mhdr,
+			    uint32_t *bytes)
 {
-	char *res = malloc(*size);
-	int res_size = 0;
-	int i;
+	int xing_offset;
+	uint32_t flags;
+	int pos;
 
-	assert(res);
-	assert(*size);
-	res[0] = buf[0];
-	res_size = 1;
-	for (i = 1; i < *size; i++) {
-		if (buf[i - 1] == 0xff && buf[i] == 0x00)
-			continue;
-		res[res_size++] = buf[i];
+	*bytes = 0;
+	if (mhdr->layer != 3)
+		return 0;
+
+	if (mhdr->is_mpeg1)
+		xing_offset = mhdr->is_mono ? 21 : 36;
+	else
+		xing_offset = mhdr->is_mono ? 13 : 21;
+	if (xing_offset + 16 <= len && (!memcmp(&buf[xing_offset], "Xing", 4) ||
+					!memcmp(&buf[xing_offset], "Info", 4))) {
+		flags = be32(&buf[xing_offset + 4]);
+		pos = xing_offset + 8;
+		if (!(flags & 1))
+			return 0;
+		if (flags & 2)
+			*bytes = be32(&buf[pos + 4]);
+		return be32(&buf[pos]);
 	}
-	free(buf);
-	*size = res_size;
 
-	return res;
+	if (36 + 18 <= len && !memcmp(&buf[36], "VBRI", 4)) {
+		*bytes = be32(&buf[36 + 10]);
+		return be32(&buf[36 + 14]);
+	}
+
+	return 0;
 }
 
-static int id3_3_0_parse_frames(struct id3_parser *parser)
+/* get bitrate, samplerate and duration if not given by tag from first
+ * audio frame. This cost at most one small read.
+ */
+static void id3_parse_audio(struct id3_parser *parser)
 {
-	struct id3v2_frame_header *fhdr = &parser->fhdr;
-	int len = parser->hdr_size;
+	int pos = parser->audio_pos;
+	struct mpeg_header mhdr = {0};
 	unsigned char *buf;
-	int size;
-	int ret;
+	uint32_t bytes;
+	int frame_nb;
+	int audio_len;
+	int len;
 	int i;
 
-	assert(parser->hdr_is_unsynchronisation == 0);
-	while (len >= sizeof(struct id3v2_frame_header)) {
-		//printf("> len = %d\n", len);
-		size = 0;
-		ret = read(parser->fd, fhdr, sizeof(*fhdr));
-		if (ret != sizeof(*fhdr))
-			return -1;
-		len -= sizeof(*fhdr);
-
-		/*if (fhdr->flags[0] != 0 || fhdr->flags[1]) {
-			printf("fhdr->flags[] != 0 : 0x%02x 0x%02x\n", fhdr->flags[0],
-				fhdr->flags[1]);
-			printf("frame id %c%c%c%c\n", fhdr->frame_id[0], fhdr->frame_id[1],
-				fhdr->frame_id[2], fhdr->frame_id[3]);
-			return -3;
-		}*/
-
-		for (i = 0; i < 4; ++i)
-			size = (size << 8) + fhdr->size[i];
-		if (size > len)
-			break;
-		if (size == 0)
+	if (parser->file_size <= pos)
+		return;
+	len = MIN(AUDIO_PROBE_SZ, parser->file_size - pos);
+	buf = id3_read_at(parser, pos, len, len);
+	if (!buf)
+		return;
+
+	for (i = 0; i + 4 <= len; i++) {
+		if (buf[i] == 0xff && !parse_mpeg_header(&buf[i], &mhdr))
 			break;
+	}
+	if (i + 4 > len)
+		return;
+	pos += i;
+	audio_len = parser->file_size - pos;
+
+	parser->samplerate = mhdr.samplerate;
+	parser->bitrate = mhdr.bitrate;
+	frame_nb = parse_vbr_header(&buf[i], len - i, &mhdr, &bytes);
+	if (frame_nb > 0) {
+		int duration_in_ms = (uint64_t) frame_nb * mhdr.samples_per_frame * 1000 /
+				     mhdr.samplerate;
+
+		if (!parser->duration_in_ms)
+			parser->duration_in_ms = duration_in_ms;
+		if (duration_in_ms)
+			parser->bitrate = (uint64_t) (bytes ? bytes : audio_len) * 8 / duration_in_ms;
+	} else if (!parser->duration_in_ms) {
+		/* kbps is also bits per ms */
+		parser->duration_in_ms = (uint64_t) audio_len * 8 / mhdr.bitrate;
+	}
+}
 
-		/*printf("frame id %c%c%c%c\n", fhdr->frame_id[0], fhdr->frame_id[1],
-			fhdr->frame_id[2], fhdr->frame_id[3]);
+static int is_jpeg_mime(char *mime)
+{
+	return strcasecmp(mime, "image/jpeg") == 0 || strcasecmp(mime, "image/jpg") == 0;
+}
 
-		printf("Will alloc %d bytes\n", size);*/
-		buf = malloc(size);
-		assert(buf);
-		ret = read(parser->fd, buf, size);
-		if (ret != size) {
-			free(buf);
-			return -4;
-		}
+/* return APIC header length, i.e offset of picture data in frame, or -1 if
+ * frame is not a jpeg picture. Set is_front_cover accordingly. v2.2 PIC
+ * frames have a three letters image format instead of a mime type.
+ */
+static int parse_apic_header(unsigned char *buf, int len, int is_v22, int *is_front_cover)
+{
+	int encoding = buf[0];
+	char *mime = (char *) &buf[1];
+	int pos;
 
-		/*{
-			for (i = 0; i < size; ++i)
-				printf("%02x ", buf[i]);
-			printf("\n");
-		}*/
-
-		if (is_tit2(fhdr))
-			id3_3_0_parse_tit2(parser, (char *) buf, size);
-		if (is_tpe1(fhdr))
-			id3_3_0_parse_tpe1(parser, (char *) buf, size);
-		if (is_trck(fhdr))
-			id3_3_0_parse_trck(parser, (char *) buf, size);
-		if (is_talb(fhdr))
-			id3_3_0_parse_talb(parser, (char *) buf, size);
-		if (is_tlen(fhdr))
-			id3_3_0_parse_tlen(parser, (char *) buf, size);
-
-		free(buf);
-		len -= size;
+	if (is_v22) {
+		pos = 1 + 3;
+		if (pos + 1 >= len || strncasecmp(mime, "JPG", 3))
+			return -1;
+	} else {
+		pos = 1 + strnlen(mime, len - 1) + 1;
+		if (pos + 1 >= len || !is_jpeg_mime(mime))
+			return -1;
+	}
+	*is_front_cover = buf[pos] == 3;
+	pos++;
+
+	/* skip description */
+	if (encoding == 1 || encoding == 2) {
+		while (pos + 1 < len && (buf[pos] || buf[pos + 1]))
+			pos += 2;
+		pos += 2;
+	} else {
+		while (pos < len && buf[pos])
+			pos++;
+		pos += 1;
 	}
 
-	return 0;
+	return pos <= len ? pos : -1;
 }
 
-static int id3_4_0_parse_frames(struct id3_parser *parser)
+/* locate embedded jpeg cover without reading it. Front cover is preferred
+ * over other pictures.
+ */
+static int id3_find_picture(struct id3_parser *parser, int *offset, int *size)
 {
-	struct id3v2_frame_header *fhdr = &parser->fhdr;
-	int len = parser->hdr_size;
+	int pos = parser->frames_pos;
+	struct id3_frame frame;
 	unsigned char *buf;
-	int frame_size;
-	int size;
-	int ret;
-	int i;
-	int is_unsynchronisation;
-	int has_data_length_indicator;
-
-	while (len >= sizeof(struct id3v2_frame_header)) {
-		is_unsynchronisation = parser->hdr_is_unsynchronisation;
-		has_data_length_indicator = 0;
-		size = 0;
-		ret = read(parser->fd, fhdr, sizeof(*fhdr));
-		if (ret != sizeof(*fhdr))
-			return -1;
-		len -= sizeof(*fhdr);
+	int is_front_cover;
+	int data_pos;
+	int data_len;
+	int hdr_len;
+	int ret = -1;
+	int len;
+
+	/* picture data can't be read in place if unsynchronized */
+	if (parser->hdr_is_unsynchronisation)
+		return -1;
 
-		if (fhdr->flags[0]) {
-			printf("fhdr->flags[] != 0 : 0x%02x 0x%02x\n", fhdr->flags[0],
-				fhdr->flags[1]);
-			return -3;
-		}
+	while (!id3_read_frame(parser, pos, &frame)) {
+		data_pos = pos + frame.hdr_len;
+		pos = data_pos + frame.size;
 
-		if (fhdr->flags[1] & 2)
-			is_unsynchronisation = 1;
-		if (fhdr->flags[1] & 1)
-			has_data_length_indicator = 1;
-		if (fhdr->flags[1] & 0xfc) {
-			printf("fhdr->flags[] != 0 : 0x%02x 0x%02x\n", fhdr->flags[0],
-				fhdr->flags[1]);
-			return -3;
-		}
+		if (memcmp(frame.frame_id, "APIC", 4))
+			continue;
+		/* skip compressed, encrypted or unsynchronized pictures */
+		if (frame.skip < 0 || frame.is_unsynchronisation)
+			continue;
+		data_pos += frame.skip;
+		data_len = frame.size - frame.skip;
 
-		for (i = 0; i < 4; ++i)
-			size = (size << 7) + fhdr->size[i];
-		if (size > len)
-			break;
-		if (size == 0)
+		len = MIN(data_len, 128);
+		if (len <= 0)
+			continue;
+		buf = id3_window(parser, data_pos, len);
+		if (!buf)
 			break;
-		frame_size = size;
-
-		/*printf("frame id %c%c%c%c / %d.%d\n", fhdr->frame_id[0], fhdr->frame_id[1],
-			fhdr->frame_id[2], fhdr->frame_id[3], is_unsynchronisation,
-			has_data_length_indicator);
-
-		printf("Will alloc %d bytes\n", size);*/
-		buf = malloc(size);
-		assert(buf);
-		ret = read(parser->fd, buf, size);
-		if (ret != size) {
-			free(buf);
-			return -4;
-		}
+		hdr_len = parse_apic_header(buf, len, parser->version == 2, &is_front_cover);
+		if (hdr_len < 0)
+			continue;
 
-		/*{
-			for (i = 0; i < size; ++i)
-				printf("%02x ", buf[i]);
-			printf("\n");
-		}*/
-
-		if (is_unsynchronisation)
-			buf = unsynchronize(buf, &size);
-		if (has_data_length_indicator) {
-			buf += 4;
-			size -= 4;
+		if (ret && !is_front_cover) {
+			*offset = data_pos + hdr_len;
+			*size = data_len - hdr_len;
+			ret = 0;
+		}
+		if (is_front_cover) {
+			*offset = data_pos + hdr_len;
+			*size = data_len - hdr_len;
+			return 0;
 		}
-
-		if (is_tit2(fhdr))
-			id3_4_0_parse_tit2(parser, (char *) buf, size);
-		if (is_tpe1(fhdr))
-			id3_4_0_parse_tpe1(parser, (char *) buf, size);
-		if (is_trck(fhdr))
-			id3_4_0_parse_trck(parser, (char *) buf, size);
-		if (is_talb(fhdr))
-			id3_4_0_parse_talb(parser, (char *) buf, size);
-		if (is_tlen(fhdr))
-			id3_4_0_parse_tlen(parser, (char *) buf, size);
-
-		if (has_data_length_indicator)
-			buf -= 4;
-
-		free(buf);
-		len -= frame_size;
 	}
 
+	return ret;
+}
+
+static char *v1_dup(char *field, int len)
+{
+	unsigned char *buf = (unsigned char *) field;
+	char *res;
+	int size;
+
+	while (len && (buf[len - 1] == ' ' || buf[len - 1] == '\0'))
+		len--;
+	if (!len)
+		return NULL;
+
+	size = text_decode_encoding(0, buf, len, NULL, 0);
+	res = malloc(size + 1);
+	if (res)
+		text_decode_encoding(0, buf, len, res, size + 1);
+
+	return res;
+}
+
+/* fill missing fields from id3v1 trailer. Return -1 if there is none */
+static int id3_parse_v1(struct id3_parser *parser)
+{
+	int pos = parser->file_size - sizeof(struct id3v1_tag);
+	struct id3v1_tag *tag;
+
+	if (pos < parser->audio_pos)
+		return -1;
+	tag = (struct id3v1_tag *) id3_read_at(parser, pos, sizeof(*tag), sizeof(*tag));
+	if (!tag || memcmp(tag->magic, "TAG", 3))
+		return -1;
+
+	if (!parser->title)
+		parser->title = v1_dup(tag->title, sizeof(tag->title));
+	if (!parser->artist)
+		parser->artist = v1_dup(tag->artist, sizeof(tag->artist));
+	if (!parser->album)
+		parser->album = v1_dup(tag->album, sizeof(tag->album));
+	/* v1.1 stores track number at end of comment */
+	if (!parser->track_nb && tag->zero == 0)
+		parser->track_nb = tag->track_nb;
+
 	return 0;
 }
 
-static int id3_parse_frames(struct id3_parser *parser)
+static int id3_open(struct id3_parser *parser, const char *filename)
 {
-	struct id3v2_header *hdr = &parser->hdr;
-	int version = hdr->version_major * 256 + hdr->version_minor;
+	struct stat st;
 
-	switch (version) {
-	case 0x400:
-		return id3_4_0_parse_frames(parser);
-	case 0x300:
-		return id3_3_0_parse_frames(parser);
-	default:
-		printf("unsupported id3 version %d.%d\n", hdr->version_major,
-		       hdr->version_minor);
+	memset(parser, 0, sizeof(struct id3_parser));
+	parser->fd = open(filename, O_RDONLY);
+	if (parser->fd < 0)
+		return -1;
+	if (fstat(parser->fd, &st)) {
+		close(parser->fd);
+		return -1;
 	}
+	parser->file_size = st.st_size;
 
-	return -1;
+	return 0;
 }
 
+/* a file without any tag is an error, a file with a partial or malformed
+ * tag is not.
+ */
 static struct id3_parser *id3_create(const char *filename)
 {
 	struct id3_parser *parser;
+	int has_v2;
 	int ret;
 
 	parser = malloc(sizeof(struct id3_parser));
 	if (!parser)
 		return NULL;
-	memset(parser, 0, sizeof(struct id3_parser));
 
-	parser->fd = open(filename, O_RDONLY);
-	if (parser->fd < 0) {
+	if (id3_open(parser, filename)) {
 		printf("Unable to open %s\n", filename);
 		goto open_error;
 	}
 
 	ret = id3_parse_header(parser);
-	if (ret < 0)
-		goto parse_error;
-
-	ret = id3_parse_frames(parser);
-	if (ret)
+	if (ret == -1)
 		goto parse_error;
+	has_v2 = ret == 0;
+	if (has_v2)
+		id3_parse_frames(parser);
+	id3_parse_audio(parser);
+	if (!parser->title || !parser->artist || !parser->album) {
+		ret = id3_parse_v1(parser);
+		if (ret && !has_v2)
+			goto parse_error;
+	}
 
 	close(parser->fd);
 
@@ -558,6 +865,9 @@ static struct id3_parser *id3_create(const char *filename)
 
 parse_error:
 	close(parser->fd);
+	free(parser->artist);
+	free(parser->album);
+	free(parser->title);
 open_error:
 	free(parser);
 
@@ -576,6 +886,8 @@ int id3_get(char *filename, struct id3_meta *meta)
 	meta->title = parser->title;
 	meta->track_nb = parser->track_nb;
 	meta->duration_in_ms = parser->duration_in_ms;
+	meta->bitrate = parser->bitrate;
+	meta->samplerate = parser->samplerate;
 
 	free(parser);
 
@@ -592,11 +904,38 @@ void id3_put(struct id3_meta *meta)
 		free(meta->title);
 }
 
+int id3_get_picture(char *filename, int *offset, int *size)
+{
+	struct id3_parser *parser;
+	int ret = -1;
+
+	parser = malloc(sizeof(struct id3_parser));
+	if (!parser)
+		return -1;
+
+	if (id3_open(parser, filename))
+		goto exit;
+
+	ret = id3_parse_header(parser);
+	if (!ret)
+		ret = id3_find_picture(parser, offset, size);
+	close(parser->fd);
+
+exit:
+	free(parser);
+
+	return ret;
+}
+
 int id3_dup_meta(struct id3_meta *meta, struct id3_meta *dup_meta)
 {
 	dup_meta->artist = strdup(meta->artist);
 	dup_meta->album = strdup(meta->album);
 	dup_meta->title = strdup(meta->title);
+	dup_meta->track_nb = meta->track_nb;
+	dup_meta->duration_in_ms = meta->duration_in_ms;
+	dup_meta->bitrate = meta->bitrate;
+	dup_meta->samplerate = meta->samplerate;
 
 	if (dup_meta->artist && dup_meta->album && dup_meta->title)
 		return 0;
@@ -605,3 +944,94 @@ int id3_dup_meta(struct id3_meta *meta, struct id3_meta *dup_meta)
 
 	return -1;
 }
+
+static void put_syncsafe32(uint8_t *p, int v)
+{
+	p[0] = (v >> 21) & 0x7f;
+	p[1] = (v >> 14) & 0x7f;
+	p[2] = (v >> 7) & 0x7f;
+	p[3] = v & 0x7f;
+}
+
+/* stream titles are often latin1, only claim utf8 when it's valid */
+static int is_utf8(unsigned char *s)
+{
+	int n;
+
+	while (*s) {
+		if (*s < 0x80)
+			n = 0;
+		else if ((*s & 0xe0) == 0xc0)
+			n = 1;
+		else if ((*s & 0xf0) == 0xe0)
+			n = 2;
+		else if ((*s & 0xf8) == 0xf0)
+			n = 3;
+		else
+			return 0;
+		for (s++; n; n--, s++) {
+			if ((*s & 0xc0) != 0x80)
+				return 0;
+		}
+	}
+
+	return 1;
+}
+
+static int put_text_frame(char *buf, int size, char *frame_id, char *text)
+{
+	struct id3v2_frame_header *hdr = (struct id3v2_frame_header *) buf;
+	int len = strlen(text);
+
+	if (sizeof(*hdr) + 1 + len > size)
+		return -1;
+	memcpy(hdr->frame_id, frame_id, 4);
+	put_syncsafe32(hdr->size, len + 1);
+	hdr->flags[0] = 0;
+	hdr->flags[1] = 0;
+	buf[sizeof(*hdr)] = is_utf8((unsigned char *) text) ? 3 : 0;
+	memcpy(buf + sizeof(*hdr) + 1, text, len);
+
+	return sizeof(*hdr) + 1 + len;
+}
+
+/* id3v2.4 tag with artist, album, title and track number of meta, for
+ * files we write. Return tag length or -1 if it doesn't fit in size.
+ */
+int id3_build_tag(struct id3_meta *meta, char *buf, int size)
+{
+	struct id3v2_header *hdr = (struct id3v2_header *) buf;
+	char track_nb[16];
+	int pos = sizeof(*hdr);
+	int len;
+
+	if (size < pos)
+		return -1;
+	memcpy(hdr->magic, "ID3", 3);
+	hdr->version_major = 4;
+	hdr->version_minor = 0;
+	hdr->flags = 0;
+
+	len = put_text_frame(buf + pos, size - pos, "TPE1", meta->artist);
+	if (len < 0)
+		return -1;
+	pos += len;
+	len = put_text_frame(buf + pos, size - pos, "TALB", meta->album);
+	if (len < 0)
+		return -1;
+	pos += len;
+	len = put_text_frame(buf + pos, size - pos, "TIT2", meta->title);
+	if (len < 0)
+		return -1;
+	pos += len;
+	if (meta->track_nb) {
+		snprintf(track_nb, sizeof(track_nb), "%d", meta->track_nb);
+		len = put_text_frame(buf + pos, size - pos, "TRCK", track_nb);
+		if (len < 0)
+			return -1;
+		pos += len;
+	}
+	put_syncsafe32(hdr->size, pos - sizeof(*hdr));
+
+	return pos;
+}
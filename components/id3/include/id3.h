@@ -7,10 +7,15 @@ struct id3_meta {
 	char *title;
 	int track_nb;
 	int duration_in_ms;
+	/* from first audio frame. bitrate is in kbps, average one for vbr */
+	int bitrate;
+	int samplerate;
 };
 
 int id3_get(char *filename, struct id3_meta *meta);
 void id3_put(struct id3_meta *meta);
+int id3_get_picture(char *filename, int *offset, int *size);
 int id3_dup_meta(struct id3_meta *meta, struct id3_meta *dup_meta);
+int id3_build_tag(struct id3_meta *meta, char *buf, int size);
 
 #endif
\ No newline at end of file
@@ -1,9 +1,13 @@
 #ifndef __MADDEC__
 #define __MADDEC__ 1
 
+#include <stdint.h>
+
 void *maddec_create(void *buffer_hdl, void *renderer_hdl);
 void maddec_destroy(void *hdl);
 void maddec_start(void *hdl);
 void maddec_stop(void *hdl);
+uint32_t maddec_frame_nb(void *hdl);
+int64_t maddec_first_frame_time(void *hdl);
 
 #endif
\ No newline at end of file
@@ -7,6 +7,7 @@
 #include "freertos/task.h"
 #include "freertos/semphr.h"
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #include "mad.h"
 
@@ -27,7 +28,11 @@ struct maddec {
 	unsigned char input_buffer[INPUT_BUFFER_SIZE];
 	unsigned char *end_buffer;
 	int16_t samples[1152][2];
-	int has_set_rate;
+	/* samplerate i2s is set to, stream may change it on the fly */
+	unsigned int rate;
+	/* decoded frames since start */
+	volatile uint32_t frame_nb;
+	volatile int64_t first_frame_time;
 };
 
 static int refill(struct maddec *self, int remain)
@@ -86,11 +91,11 @@ static enum mad_flow header_func(void *data, struct mad_header const *header)
 	struct maddec *self = data;
 
 	//printf("%s %ld.%ld\n", __FUNCTION__, header->duration.seconds, header->duration.fraction);
-	if (self->has_set_rate)
+	if (self->rate == header->samplerate)
 		return MAD_FLOW_CONTINUE;
 
 	i2s_set_sample_rates(0, header->samplerate);
-	self->has_set_rate = 1;
+	self->rate = header->samplerate;
 
 	return MAD_FLOW_CONTINUE;
 }
@@ -124,13 +129,19 @@ static enum mad_flow output_func(void *data, struct mad_header const *header, st
 	int res;
 	int i;
 
-	for(i = 0; i < 1152; i++) {
+	if (!self->frame_nb)
+		self->first_frame_time = esp_timer_get_time();
+	self->frame_nb++;
+	/* lower bitrate variants of a radio may be mono or mpeg2 with 576
+	 * samples per frame.
+	 */
+	for(i = 0; i < pcm->length; i++) {
 		self->samples[i][0] = scale(pcm->samples[0][i]);
-		self->samples[i][1] = scale(pcm->samples[1][i]);
+		self->samples[i][1] = scale(pcm->samples[pcm->channels - 1][i]);
 	}
 
 	while (self->is_active) {
-		res = stb350_write(self->renderer_hdl, self->samples, sizeof(self->samples), &i2s_bytes_write, 100 / portTICK_PERIOD_MS);
+		res = stb350_write(self->renderer_hdl, self->samples, pcm->length * sizeof(self->samples[0]), &i2s_bytes_write, 100 / portTICK_PERIOD_MS);
 		if (res)
 			continue;
 		break;
@@ -190,7 +201,9 @@ void maddec_start(void *hdl)
 	assert(hdl);
 
 	self->is_active = true;
-	self->has_set_rate = false;
+	self->rate = 0;
+	self->frame_nb = 0;
+	self->first_frame_time = 0;
 	res = xTaskCreatePinnedToCore(maddec_task, "maddec", 3 * 4096, hdl,
 			tskIDLE_PRIORITY + 1, &self->task, tskNO_AFFINITY);
 	assert(res == pdPASS);
@@ -205,3 +218,18 @@ void maddec_stop(void *hdl)
 	self->is_active = false;
 	xSemaphoreTake(self->sem_en_of_task, portMAX_DELAY);
 }
+
+uint32_t maddec_frame_nb(void *hdl)
+{
+	struct maddec *self = hdl;
+
+	return self->frame_nb;
+}
+
+/* esp_timer time of first decoded frame since start, 0 until then */
+int64_t maddec_first_frame_time(void *hdl)
+{
+	struct maddec *self = hdl;
+
+	return self->first_frame_time;
+}
@@ -0,0 +1,207 @@
+#include "playlist_bookmark.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.playlist_bookmark";
+
+#define BOOKMARK_MAGIC		0x426b6d6b
+#define BOOKMARK_SECTOR_SZ	512
+#define BOOKMARK_SECTOR_NB	8
+#define BOOKMARK_ENTRY_NB	((BOOKMARK_SECTOR_SZ - 3 * sizeof(uint32_t)) / sizeof(struct bookmark_entry))
+
+/* table is kept in memory and mirrored in a small file. A track always lands
+ * in sector track_id % BOOKMARK_SECTOR_NB so an update only dirties one
+ * sector. Once a sector is full, least recently updated entry is dropped. A
+ * sector damaged by a power loss during its write fails checksum and only
+ * its bookmarks are lost.
+ */
+struct bookmark_entry {
+	struct playlist_bookmark bookmark;
+	/* sector sequence number of last update, 0 for a free entry */
+	uint32_t seq;
+};
+
+struct bookmark_sector {
+	uint32_t magic;
+	uint32_t seq;
+	struct bookmark_entry entries[BOOKMARK_ENTRY_NB];
+	uint32_t checksum;
+};
+
+struct bookmark {
+	int fd;
+	uint32_t dirty;
+	struct bookmark_sector sectors[BOOKMARK_SECTOR_NB];
+};
+
+static uint32_t sector_checksum(struct bookmark_sector *sector)
+{
+	return fnv1a(FNV1A_INIT, sector, offsetof(struct bookmark_sector, checksum));
+}
+
+static struct bookmark_sector *get_sector(struct bookmark *bookmark, uint32_t track_id)
+{
+	return &bookmark->sectors[track_id % BOOKMARK_SECTOR_NB];
+}
+
+static struct bookmark_entry *find_entry(struct bookmark_sector *sector, uint32_t track_id)
+{
+	int i;
+
+	for (i = 0; i < BOOKMARK_ENTRY_NB; i++) {
+		if (sector->entries[i].seq && sector->entries[i].bookmark.track_id == track_id)
+			return &sector->entries[i];
+	}
+
+	return NULL;
+}
+
+static struct bookmark_entry *alloc_entry(struct bookmark_sector *sector)
+{
+	struct bookmark_entry *res = &sector->entries[0];
+	int i;
+
+	for (i = 0; i < BOOKMARK_ENTRY_NB; i++) {
+		if (sector->entries[i].seq < res->seq)
+			res = &sector->entries[i];
+	}
+
+	return res;
+}
+
+static void load_sectors(struct bookmark *bookmark)
+{
+	struct bookmark_sector *sector;
+	char buf[BOOKMARK_SECTOR_SZ];
+	int i;
+
+	for (i = 0; i < BOOKMARK_SECTOR_NB; i++) {
+		sector = &bookmark->sectors[i];
+		if (read(bookmark->fd, buf, sizeof(buf)) == sizeof(buf)) {
+			memcpy(sector, buf, sizeof(*sector));
+			if (sector->magic == BOOKMARK_MAGIC && sector->checksum == sector_checksum(sector))
+				continue;
+		}
+		memset(sector, 0, sizeof(*sector));
+		sector->magic = BOOKMARK_MAGIC;
+	}
+}
+
+static int write_sector(struct bookmark *bookmark, int idx)
+{
+	struct bookmark_sector *sector = &bookmark->sectors[idx];
+	char buf[BOOKMARK_SECTOR_SZ];
+	int ret;
+
+	sector->checksum = sector_checksum(sector);
+	memset(buf, 0, sizeof(buf));
+	memcpy(buf, sector, sizeof(*sector));
+	ret = lseek(bookmark->fd, idx * BOOKMARK_SECTOR_SZ, SEEK_SET);
+	if (ret >= 0)
+		ret = write(bookmark->fd, buf, sizeof(buf)) == sizeof(buf) ? 0 : -1;
+	if (!ret)
+		ret = fsync(bookmark->fd);
+	if (ret) {
+		ESP_LOGW(TAG, "unable to write bookmark sector %d", idx);
+		return ret;
+	}
+	bookmark->dirty &= ~(1 << idx);
+
+	return 0;
+}
+
+void *playlist_bookmark_open(char *filename)
+{
+	struct bookmark *bookmark;
+
+	bookmark = malloc(sizeof(*bookmark));
+	if (!bookmark)
+		return NULL;
+	memset(bookmark, 0, sizeof(*bookmark));
+
+	bookmark->fd = open(filename, O_RDWR | O_CREAT, 0666);
+	if (bookmark->fd < 0) {
+		ESP_LOGW(TAG, "unable to open %s", filename);
+		free(bookmark);
+		return NULL;
+	}
+	load_sectors(bookmark);
+
+	return bookmark;
+}
+
+void playlist_bookmark_close(void *hdl)
+{
+	struct bookmark *bookmark = hdl;
+	int i;
+
+	for (i = 0; i < BOOKMARK_SECTOR_NB; i++) {
+		if (bookmark->dirty & (1 << i))
+			write_sector(bookmark, i);
+	}
+	close(bookmark->fd);
+	free(bookmark);
+}
+
+int playlist_bookmark_get(void *hdl, uint32_t track_id, struct playlist_bookmark *res)
+{
+	struct bookmark *bookmark = hdl;
+	struct bookmark_entry *entry;
+
+	entry = find_entry(get_sector(bookmark, track_id), track_id);
+	if (!entry)
+		return -1;
+	*res = entry->bookmark;
+
+	return 0;
+}
+
+int playlist_bookmark_set(void *hdl, struct playlist_bookmark *update)
+{
+	struct bookmark *bookmark = hdl;
+	struct bookmark_sector *sector = get_sector(bookmark, update->track_id);
+	struct bookmark_entry *entry;
+
+	entry = find_entry(sector, update->track_id);
+	if (!entry)
+		entry = alloc_entry(sector);
+	entry->bookmark = *update;
+	entry->seq = ++sector->seq;
+	bookmark->dirty |= 1 << (update->track_id % BOOKMARK_SECTOR_NB);
+
+	return 0;
+}
+
+void playlist_bookmark_clear(void *hdl, uint32_t track_id)
+{
+	struct bookmark *bookmark = hdl;
+	struct bookmark_entry *entry;
+
+	entry = find_entry(get_sector(bookmark, track_id), track_id);
+	if (!entry)
+		return ;
+	memset(entry, 0, sizeof(*entry));
+	bookmark->dirty |= 1 << (track_id % BOOKMARK_SECTOR_NB);
+}
+
+int playlist_bookmark_flush(void *hdl)
+{
+	struct bookmark *bookmark = hdl;
+	int i;
+
+	for (i = 0; i < BOOKMARK_SECTOR_NB; i++) {
+		if (bookmark->dirty & (1 << i))
+			return write_sector(bookmark, i);
+	}
+
+	return 0;
+}
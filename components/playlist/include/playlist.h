@@ -1,20 +1,34 @@
 #ifndef __PLAYLIST__
 #define __PLAYLIST__ 1
 
+#include <stdint.h>
+
 #include "id3.h"
+#include "db_index.h"
 
 struct playlist_item {
 	char *filepath;
 	struct id3_meta meta;
+	/* private, filepath and meta strings point inside it */
+	struct db_track track;
 };
 
 void *playlist_create(void *db_hdl);
 void *playlist_create_from_file(void *db_hdl, char *pls);
+void *playlist_create_from_tracks(void *db_hdl, uint32_t *ids, int id_nb);
+void *playlist_restore(void *db_hdl, char *filename);
+int playlist_save(void *hdl, char *filename);
 void playlist_destroy(void *hdl);
 int playlist_add_song(void *hdl, char *artist, char *album, char *title);
+int playlist_add_track(void *hdl, uint32_t id);
 int playlist_rewind(void *hdl);
+int playlist_shuffle(void *hdl);
 int playlist_next(void *hdl, struct playlist_item *item, int is_random);
 int playlist_prev(void *hdl, struct playlist_item *item);
+int playlist_jump(void *hdl, int idx, struct playlist_item *item);
+void playlist_prefetch(void *hdl);
+int playlist_load(void *hdl);
+char *playlist_next_filepath(void *hdl);
 void playlist_put_item(void *hdl, struct playlist_item *item);
 int playlist_song_nb(void *hdl);
 int playlist_song_idx(void *hdl);
@@ -0,0 +1,21 @@
+#ifndef __PLAYLIST_BOOKMARK__
+#define __PLAYLIST_BOOKMARK__ 1
+
+#include <stdint.h>
+
+/* position reached inside a long track */
+struct playlist_bookmark {
+	uint32_t track_id;
+	uint32_t offset;
+	uint32_t time_in_ms;
+};
+
+void *playlist_bookmark_open(char *filename);
+void playlist_bookmark_close(void *hdl);
+int playlist_bookmark_get(void *hdl, uint32_t track_id, struct playlist_bookmark *bookmark);
+int playlist_bookmark_set(void *hdl, struct playlist_bookmark *bookmark);
+void playlist_bookmark_clear(void *hdl, uint32_t track_id);
+/* write at most one modified sector, caller decides how often */
+int playlist_bookmark_flush(void *hdl);
+
+#endif
@@ -0,0 +1,18 @@
+#ifndef __PLAYLIST_READER__
+#define __PLAYLIST_READER__ 1
+
+/* one playlist entry. Strings are valid until next playlist_reader_next call */
+struct playlist_reader_entry {
+	/* db entry path (artist/album/title) instead of an audio file path */
+	int is_db_entry;
+	char *path;
+	/* from #EXTINF or TitleN / LengthN, "" and -1 when unknown */
+	char *title;
+	int duration_in_ms;
+};
+
+void *playlist_reader_open(char *filename);
+void playlist_reader_close(void *hdl);
+int playlist_reader_next(void *hdl, struct playlist_reader_entry *entry);
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef __PLAYLIST_RESUME__
+#define __PLAYLIST_RESUME__ 1
+
+#include <stdint.h>
+
+/* where to restart playback of a saved queue */
+struct playlist_resume {
+	uint32_t track_id;
+	/* position of track in queue play order */
+	int32_t song_idx;
+	int32_t is_random;
+	/* file offset and time reached inside track */
+	uint32_t offset;
+	uint32_t time_in_ms;
+};
+
+void *playlist_resume_open(char *filename);
+void playlist_resume_close(void *hdl);
+int playlist_resume_write(void *hdl, struct playlist_resume *resume);
+int playlist_resume_read(char *filename, struct playlist_resume *resume);
+
+#endif
@@ -3,226 +3,479 @@
 #include <stdlib.h>
 #include <string.h>
 #include <stdio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
 
 #include "db.h"
+#include "playlist_reader.h"
 #include "esp_log.h"
+#include "utils.h"
 
 static const char* TAG = "rv3.playlist";
 
-struct playlist_song {
-	struct playlist_song *next;
-	char *artist;
-	char *album;
-	char *title;
-	int index;
+#define PLAYLIST_INIT_SONG_NB	16
+#define PLAYLIST_INIT_PATHS_LEN	1024
+#define PLAYLIST_LOOKAHEAD_NB	2
+/* playlist file songs loaded per playlist_load() call */
+#define PLAYLIST_LOAD_NB	32
+#define QUEUE_MAGIC		0x51756575
+#define QUEUE_VERSION		1
+
+/* a song is either a track id or a path read from a playlist file. path is
+ * an offset + 1 inside playlist paths, 0 when id is valid. A db entry path
+ * is replaced by its track id once resolved. An audio file path is kept
+ * along with its id so it can still be played when missing from index.
+ */
+struct playlist_ref {
+	uint32_t id;
+	uint32_t path:31;
+	uint32_t is_file:1;
+};
+
+/* resolved track of an upcoming song */
+struct playlist_cache {
+	/* refs index, -1 when slot is free */
+	int idx;
+	struct db_track track;
 };
 
+/* songs are kept as refs in insertion order. order is the play order,
+ * a permutation of refs indexes: order[0..pos[ have been played, order[pos..[
+ * are still to come. Random mode shuffles the unplayed part once, so next,
+ * prev and jump are all simple moves of pos.
+ * Metadata is only read for the current song and the few next ones.
+ */
 struct playlist {
 	void *db_hdl;
 	int is_db_close_on_exit;
-	struct playlist_song *unplayed;
-	int unplayed_nb;
-	struct playlist_song *played;
-	int played_nb;
+	struct playlist_ref *refs;
+	uint32_t *order;
 	int song_nb;
+	int song_max;
+	int pos;
+	int is_shuffled;
+	/* refs or order changed since last save */
+	int is_dirty;
+	char *paths;
+	int paths_len;
+	int paths_max;
+	/* playlist file still being loaded, NULL once done */
+	void *reader;
+	struct playlist_cache cache[PLAYLIST_LOOKAHEAD_NB];
 };
 
-/* taken from https://raw.githubusercontent.com/ivanrad/getline/master/getline.c */
-/* getline.c
- *
- * getdelim(), getline() - read a delimited record from stream, ersatz implementation
- *
- * For more details, see: http://pubs.opengroup.org/onlinepubs/9699919799/functions/getline.html
- *
- */
+/* saved queue is this header followed by refs, order and paths arrays */
+struct queue_hdr {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t song_nb;
+	uint32_t is_shuffled;
+	uint32_t paths_len;
+	uint32_t checksum;
+};
 
-//#include "getline.h"
-#define SSIZE_MAX	4096
-#include <stdlib.h>
-#include <errno.h>
-#include <limits.h>
+static int grow_arrays(struct playlist *playlist)
+{
+	int song_max = playlist->song_max ? playlist->song_max * 2 : PLAYLIST_INIT_SONG_NB;
+	struct playlist_ref *refs;
+	uint32_t *order;
+
+	refs = realloc(playlist->refs, song_max * sizeof(*refs));
+	if (!refs)
+		return -1;
+	playlist->refs = refs;
+	order = realloc(playlist->order, song_max * sizeof(uint32_t));
+	if (!order)
+		return -1;
+	playlist->order = order;
+	playlist->song_max = song_max;
+
+	return 0;
+}
+
+static int add_ref(struct playlist *playlist, uint32_t id, uint32_t path, int is_file)
+{
+	int idx = playlist->song_nb;
+	int ret;
+
+	if (playlist->song_nb == playlist->song_max) {
+		ret = grow_arrays(playlist);
+		if (ret)
+			return ret;
+	}
+
+	playlist->refs[idx].id = id;
+	playlist->refs[idx].path = path;
+	playlist->refs[idx].is_file = is_file;
+	playlist->order[idx] = idx;
+	playlist->song_nb++;
+	playlist->is_dirty = 1;
+	/* keep new song at a random place among unplayed ones */
+	if (playlist->is_shuffled && idx > playlist->pos) {
+		int j = playlist->pos + rand() % (idx - playlist->pos + 1);
+
+		playlist->order[idx] = playlist->order[j];
+		playlist->order[j] = idx;
+	}
 
-ssize_t getdelim(char **lineptr, size_t *n, int delim, FILE *stream) {
-    char *cur_pos, *new_lineptr;
-    size_t new_lineptr_len;
-    int c;
+	return 0;
+}
 
-    if (lineptr == NULL || n == NULL || stream == NULL) {
-        errno = EINVAL;
-        return -1;
-    }
+static int add_string(struct playlist *playlist, char *str)
+{
+	int len = strlen(str) + 1;
+	int paths_max;
+	char *paths;
+	int pos;
+
+	if (playlist->paths_len + len > playlist->paths_max) {
+		paths_max = playlist->paths_max ? playlist->paths_max : PLAYLIST_INIT_PATHS_LEN;
+		while (playlist->paths_len + len > paths_max)
+			paths_max *= 2;
+		paths = realloc(playlist->paths, paths_max);
+		if (!paths)
+			return -1;
+		playlist->paths = paths;
+		playlist->paths_max = paths_max;
+	}
+	pos = playlist->paths_len;
+	memcpy(playlist->paths + pos, str, len);
+	playlist->paths_len += len;
 
-    if (*lineptr == NULL) {
-        *n = 128; /* init len */
-        if ((*lineptr = (char *)malloc(*n)) == NULL) {
-            errno = ENOMEM;
-            return -1;
-        }
-    }
+	return pos;
+}
 
-    cur_pos = *lineptr;
-    for (;;) {
-        c = getc(stream);
+/* audio file entries store "path\0title\0duration\0" */
+static int add_entry(struct playlist *playlist, struct playlist_reader_entry *entry)
+{
+	char duration[12];
+	int pos;
 
-        if (ferror(stream) || (c == EOF && cur_pos == *lineptr))
-            return -1;
+	pos = add_string(playlist, entry->path);
+	if (pos < 0)
+		return -1;
+	if (entry->is_db_entry)
+		return add_ref(playlist, 0, pos + 1, 0);
 
-        if (c == EOF)
-            break;
+	snprintf(duration, sizeof(duration), "%d", entry->duration_in_ms);
+	if (add_string(playlist, entry->title) < 0 || add_string(playlist, duration) < 0)
+		return -1;
 
-        if ((*lineptr + *n - cur_pos) < 2) {
-            if (SSIZE_MAX / 2 < *n) {
-#ifdef EOVERFLOW
-                errno = EOVERFLOW;
-#else
-                errno = ERANGE; /* no EOVERFLOW defined */
-#endif
-                return -1;
-            }
-            new_lineptr_len = *n * 2;
+	return add_ref(playlist, db_track_id(entry->path), pos + 1, 1);
+}
 
-            if ((new_lineptr = (char *)realloc(*lineptr, new_lineptr_len)) == NULL) {
-                errno = ENOMEM;
-                return -1;
-            }
-            cur_pos = new_lineptr + (cur_pos - *lineptr);
-            *lineptr = new_lineptr;
-            *n = new_lineptr_len;
-        }
+/* load up to nb entries from playlist file. Return number of entries added */
+static int load_entries(struct playlist *playlist, int nb)
+{
+	struct playlist_reader_entry entry;
+	int count = 0;
 
-        *cur_pos++ = (char)c;
+	if (!playlist->reader)
+		return 0;
 
-        if (c == delim)
-            break;
-    }
+	while (count < nb) {
+		if (playlist_reader_next(playlist->reader, &entry)) {
+			playlist_reader_close(playlist->reader);
+			playlist->reader = NULL;
+			ESP_LOGI(TAG, "playlist %p loaded with %d songs", playlist, playlist->song_nb);
+			break;
+		}
+		ESP_LOGD(TAG, "entry = %s", entry.path);
+		if (add_entry(playlist, &entry)) {
+			ESP_LOGW(TAG, "Unable to add %s", entry.path);
+			continue;
+		}
+		count++;
+	}
 
-    *cur_pos = '\0';
-    return (ssize_t)(cur_pos - *lineptr);
+	return count;
 }
 
-ssize_t getline(char **lineptr, size_t *n, FILE *stream) {
-    return getdelim(lineptr, n, '\n', stream);
+/* fisher-yates on order[start..song_nb[ */
+static void shuffle(struct playlist *playlist, int start)
+{
+	uint32_t tmp;
+	int i, j;
+
+	for (i = playlist->song_nb - 1; i > start; i--) {
+		j = start + rand() % (i - start + 1);
+		tmp = playlist->order[i];
+		playlist->order[i] = playlist->order[j];
+		playlist->order[j] = tmp;
+	}
+	playlist->is_dirty = 1;
 }
 
-static struct playlist_song *list_tail_elem(struct playlist_song *tail)
+static int cmp_order(const void *pa, const void *pb)
 {
-	if (!tail)
-		return NULL;
+	uint32_t a = *(const uint32_t *) pa;
+	uint32_t b = *(const uint32_t *) pb;
 
-	while (tail->next)
-		tail = tail->next;
+	return a < b ? -1 : a > b;
+}
+
+/* switching mode only touches songs not yet played */
+static void set_random_mode(struct playlist *playlist, int is_random)
+{
+	int unplayed_nb = playlist->song_nb - playlist->pos;
 
-	return tail;
+	if (!!is_random == playlist->is_shuffled)
+		return;
+
+	if (is_random)
+		shuffle(playlist, playlist->pos);
+	else
+		qsort(&playlist->order[playlist->pos], unplayed_nb, sizeof(uint32_t), cmp_order);
+	playlist->is_shuffled = !!is_random;
+	playlist->is_dirty = 1;
 }
 
-static void populate_playlist_from_string(struct playlist *playlist, char *filename)
+/* audio file missing from index, use its tag or playlist title */
+static int resolve_file(struct playlist *playlist, struct playlist_ref *ref, struct db_track *track)
 {
+	char *path = playlist->paths + ref->path - 1;
+	char *title = path + strlen(path) + 1;
+	char *duration = title + strlen(title) + 1;
 	struct id3_meta meta;
+	char *strings[4];
+	char *buf;
+	int len = 0;
+	int ret;
+	int i;
+
+	ret = id3_get(path, &meta);
+	if (ret)
+		memset(&meta, 0, sizeof(meta));
+	strings[0] = path;
+	strings[1] = meta.artist ? meta.artist : "";
+	strings[2] = meta.album ? meta.album : "";
+	if (meta.title)
+		strings[3] = meta.title;
+	else if (*title)
+		strings[3] = title;
+	else
+		strings[3] = strrchr(path, '/') ? strrchr(path, '/') + 1 : path;
+	for (i = 0; i < 4; i++)
+		len += strlen(strings[i]) + 1;
+
+	/* single allocation so db_track_put can release it */
+	buf = malloc(len);
+	if (!buf) {
+		if (!ret)
+			id3_put(&meta);
+		return -1;
+	}
+	memset(track, 0, sizeof(*track));
+	track->strings = buf;
+	for (i = 0; i < 4; i++) {
+		strcpy(buf, strings[i]);
+		strings[i] = buf;
+		buf += strlen(buf) + 1;
+	}
+	track->id = ref->id;
+	track->filepath = strings[0];
+	track->artist = strings[1];
+	track->album = strings[2];
+	track->title = strings[3];
+	track->track_nb = meta.track_nb;
+	track->duration_in_ms = meta.duration_in_ms;
+	if (track->duration_in_ms <= 0 && atoi(duration) > 0)
+		track->duration_in_ms = atoi(duration);
+	track->bitrate = meta.bitrate;
+	track->samplerate = meta.samplerate;
+	if (!ret)
+		id3_put(&meta);
+
+	return 0;
+}
+
+static int resolve_ref(struct playlist *playlist, int idx, struct db_track *track)
+{
+	struct playlist_ref *ref = &playlist->refs[idx];
 	int ret;
 
-	ESP_LOGI(TAG, "filename = %s", filename);
+	if (!ref->path)
+		return db_track_get(playlist->db_hdl, ref->id, track);
 
-	ret = db_song_get_meta_from_file(playlist->db_hdl, filename, &meta);
-	if (ret) {
-		ESP_LOGW(TAG, "Unable to read meta from %s", filename);
-		return ;
+	if (ref->is_file) {
+		ret = db_track_get(playlist->db_hdl, ref->id, track);
+		if (ret)
+			ret = resolve_file(playlist, ref, track);
+		return ret;
 	}
 
-	playlist_add_song(playlist, meta.artist, meta.album, meta.title);
-	db_put_meta(playlist->db_hdl, &meta);
+	ret = db_track_get_from_file(playlist->db_hdl, playlist->paths + ref->path - 1, track);
+	if (ret)
+		return ret;
+
+	/* next resolution of this song will go through index */
+	ref->id = track->id;
+	ref->path = 0;
+
+	return 0;
 }
 
-static void populate_playlist_from_file(struct playlist *playlist, char *pls)
+static void cache_put(struct playlist *playlist, struct playlist_cache *slot)
 {
-	char *line = NULL;
-	size_t len = 0;
-	FILE *f;
-	int sz;
+	if (slot->idx < 0)
+		return;
 
-	f = fopen(pls, "r");
-	if (!f) {
-		ESP_LOGW(TAG, "Unable to open playlist %s", pls);
-		return ;
-	}
+	db_track_put(playlist->db_hdl, &slot->track);
+	slot->idx = -1;
+}
 
-	while (1) {
-		sz = getline(&line, &len, f);
-		if (sz < 0)
-			break;
-		if (line[sz - 1] == '\n')
-			line[sz - 1] = '\0';
-		populate_playlist_from_string(playlist, line);
+static struct playlist_cache *cache_lookup(struct playlist *playlist, int idx)
+{
+	int i;
+
+	for (i = 0; i < PLAYLIST_LOOKAHEAD_NB; i++) {
+		if (playlist->cache[i].idx == idx)
+			return &playlist->cache[i];
 	}
-	free(line);
 
-	fclose(f);
+	return NULL;
 }
 
-static void list_destroy_elem(struct playlist_song *current)
+static int is_in_lookahead(struct playlist *playlist, int idx)
 {
-	struct playlist_song *next;
+	int i;
 
-	while (current) {
-		ESP_LOGI(TAG , " destroy playlist item %p | %s/%s/%s", current, current->artist, current->album, current->title);
-		next = current->next;
-		free(current->artist);
-		free(current->album);
-		free(current->title);
-		free(current);
-		current = next;
+	for (i = playlist->pos; i < playlist->pos + PLAYLIST_LOOKAHEAD_NB && i < playlist->song_nb; i++) {
+		if (playlist->order[i] == idx)
+			return 1;
 	}
+
+	return 0;
 }
 
-static struct playlist_song *list_remove_at_index(struct playlist_song *current,
-						  int index,
-						  struct playlist_song **remove)
+static int resolve_item(struct playlist *playlist, int pos, struct playlist_item *item)
 {
-	struct playlist_song *head = current;
-	struct playlist_song *prev = NULL;
-	struct playlist_song *next;
+	int idx = playlist->order[pos];
+	struct playlist_cache *slot;
+	int ret;
 
-	while (index--) {
-		prev = current;
-		current = current->next;
+	slot = cache_lookup(playlist, idx);
+	if (slot) {
+		item->track = slot->track;
+		slot->idx = -1;
+	} else {
+		ret = resolve_ref(playlist, idx, &item->track);
+		if (ret) {
+			ESP_LOGW(TAG, "unable to fetch song %d for playlist %p", idx, playlist);
+			return -1;
+		}
 	}
-	*remove = current;
+	item->filepath = item->track.filepath;
+	item->meta.artist = item->track.artist;
+	item->meta.album = item->track.album;
+	item->meta.title = item->track.title;
+	item->meta.track_nb = item->track.track_nb;
+	item->meta.duration_in_ms = item->track.duration_in_ms;
+	item->meta.bitrate = item->track.bitrate;
+	item->meta.samplerate = item->track.samplerate;
+
+	ESP_LOGI(TAG , " queue playlist item %p/%d | %s/%s/%s | %s%s", playlist, pos,
+		 item->meta.artist, item->meta.album, item->meta.title, item->filepath,
+		 slot ? " (prefetched)" : "");
+
+	return 0;
+}
+
+static uint32_t queue_checksum(struct playlist *playlist)
+{
+	uint32_t hash = FNV1A_INIT;
 
-	next = current->next;
-	current->next = NULL;
+	hash = fnv1a(hash, playlist->refs, playlist->song_nb * sizeof(struct playlist_ref));
+	hash = fnv1a(hash, playlist->order, playlist->song_nb * sizeof(uint32_t));
 
-	if (head == current)
-		return next;
+	return fnv1a(hash, playlist->paths, playlist->paths_len);
+}
 
-	prev->next = next;
+static int write_all(int fd, void *data, int len)
+{
+	return write(fd, data, len) == len ? 0 : -1;
+}
 
-	return head;
+static int read_all(int fd, void *data, int len)
+{
+	return read(fd, data, len) == len ? 0 : -1;
 }
 
-static struct playlist_song *select_next(struct playlist *playlist, int is_random)
+static int write_queue(struct playlist *playlist, char *filename)
 {
-	struct playlist_song *current;
-	int index;
+	struct queue_hdr hdr;
+	int ret;
+	int fd;
 
-	if (!playlist->unplayed_nb)
-		return NULL;
+	fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if (fd < 0)
+		return -1;
 
-	index = is_random ? rand() % playlist->unplayed_nb : 0;
-	ESP_LOGD(TAG , "select index %d among [%d:%d[ / mode is %d",
-		 index, 0, playlist->unplayed_nb, is_random);
+	hdr.magic = QUEUE_MAGIC;
+	hdr.version = QUEUE_VERSION;
+	hdr.song_nb = playlist->song_nb;
+	hdr.is_shuffled = playlist->is_shuffled;
+	hdr.paths_len = playlist->paths_len;
+	hdr.checksum = queue_checksum(playlist);
+	ret = write_all(fd, &hdr, sizeof(hdr));
+	if (!ret)
+		ret = write_all(fd, playlist->refs, playlist->song_nb * sizeof(struct playlist_ref));
+	if (!ret)
+		ret = write_all(fd, playlist->order, playlist->song_nb * sizeof(uint32_t));
+	if (!ret)
+		ret = write_all(fd, playlist->paths, playlist->paths_len);
+	close(fd);
+
+	return ret;
+}
 
-	playlist->unplayed = list_remove_at_index(playlist->unplayed, index, &current);
-	playlist->unplayed_nb--;
+static int read_queue(struct playlist *playlist, char *filename)
+{
+	struct queue_hdr hdr;
+	int ret = -1;
+	int fd;
 
-	current->next = playlist->played;
-	playlist->played = current;
-	playlist->played_nb++;
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
 
-	return current;
+	if (read_all(fd, &hdr, sizeof(hdr)))
+		goto cleanup;
+	if (hdr.magic != QUEUE_MAGIC || hdr.version != QUEUE_VERSION || !hdr.song_nb)
+		goto cleanup;
+
+	playlist->refs = malloc(hdr.song_nb * sizeof(struct playlist_ref));
+	playlist->order = malloc(hdr.song_nb * sizeof(uint32_t));
+	playlist->paths = hdr.paths_len ? malloc(hdr.paths_len) : NULL;
+	if (!playlist->refs || !playlist->order || (hdr.paths_len && !playlist->paths))
+		goto cleanup;
+	playlist->song_nb = hdr.song_nb;
+	playlist->song_max = hdr.song_nb;
+	playlist->paths_len = hdr.paths_len;
+	playlist->paths_max = hdr.paths_len;
+	playlist->is_shuffled = hdr.is_shuffled;
+
+	if (read_all(fd, playlist->refs, hdr.song_nb * sizeof(struct playlist_ref)))
+		goto cleanup;
+	if (read_all(fd, playlist->order, hdr.song_nb * sizeof(uint32_t)))
+		goto cleanup;
+	if (read_all(fd, playlist->paths, hdr.paths_len))
+		goto cleanup;
+	if (queue_checksum(playlist) != hdr.checksum)
+		goto cleanup;
+	ret = 0;
+
+cleanup:
+	close(fd);
+
+	return ret;
 }
 
 void *playlist_create(void *db_hdl)
 {
 	struct playlist *playlist;
+	int i;
 
 	playlist = malloc(sizeof(*playlist));
 	if (!playlist)
@@ -230,6 +483,8 @@ void *playlist_create(void *db_hdl)
 
 	memset(playlist, 0, sizeof(*playlist));
 	playlist->db_hdl = db_hdl;
+	for (i = 0; i < PLAYLIST_LOOKAHEAD_NB; i++)
+		playlist->cache[i].idx = -1;
 	ESP_LOGI(TAG , "create playlist %p", playlist);
 
 	return playlist;
@@ -243,17 +498,101 @@ void *playlist_create_from_file(void *db_hdl, char *pls)
 		return NULL;
 
 	playlist->is_db_close_on_exit = 1;
-	populate_playlist_from_file(playlist, pls);
+	/* only wait for first song, remaining ones are loaded once it plays */
+	playlist->reader = playlist_reader_open(pls);
+	load_entries(playlist, 1);
+
+	return playlist;
+}
+
+/* playlist takes ownership of db_hdl, caller keeps it on failure. ids are
+ * copied.
+ */
+void *playlist_create_from_tracks(void *db_hdl, uint32_t *ids, int id_nb)
+{
+	struct playlist *playlist = playlist_create(db_hdl);
+	int i;
+
+	if (!playlist)
+		return NULL;
+
+	for (i = 0; i < id_nb; i++) {
+		if (add_ref(playlist, ids[i], 0, 0)) {
+			playlist_destroy(playlist);
+			return NULL;
+		}
+	}
+	playlist->is_db_close_on_exit = 1;
 
 	return playlist;
 }
 
+/* restored playlist takes ownership of db_hdl, caller keeps it on failure */
+void *playlist_restore(void *db_hdl, char *filename)
+{
+	struct playlist *playlist = playlist_create(db_hdl);
+	int ret;
+
+	if (!playlist)
+		return NULL;
+
+	ret = read_queue(playlist, filename);
+	if (ret) {
+		ESP_LOGW(TAG, "unable to restore playlist from %s", filename);
+		playlist_destroy(playlist);
+		return NULL;
+	}
+	playlist->is_db_close_on_exit = 1;
+	ESP_LOGI(TAG, "playlist %p restored with %d songs", playlist, playlist->song_nb);
+
+	return playlist;
+}
+
+/* queue is only written when it has changed. It goes to a temporary file
+ * first so a power loss never leaves a truncated queue behind. Songs still
+ * in playlist file are not part of it yet.
+ */
+int playlist_save(void *hdl, char *filename)
+{
+	struct playlist *playlist = hdl;
+	char *tmp;
+	int ret;
+
+	if (!playlist->is_dirty)
+		return 0;
+
+	tmp = malloc(strlen(filename) + 5);
+	if (!tmp)
+		return -1;
+	sprintf(tmp, "%s.tmp", filename);
+	ret = write_queue(playlist, tmp);
+	if (!ret) {
+		unlink(filename);
+		ret = rename(tmp, filename);
+	}
+	if (ret) {
+		ESP_LOGW(TAG, "unable to save playlist to %s", filename);
+		unlink(tmp);
+	} else {
+		playlist->is_dirty = 0;
+	}
+	free(tmp);
+
+	return ret;
+}
+
 void playlist_destroy(void *hdl)
 {
 	struct playlist *playlist = hdl;
+	int i;
 
-	list_destroy_elem(playlist->played);
-	list_destroy_elem(playlist->unplayed);
+	for (i = 0; i < PLAYLIST_LOOKAHEAD_NB; i++)
+		cache_put(playlist, &playlist->cache[i]);
+	if (playlist->reader)
+		playlist_reader_close(playlist->reader);
+	free(playlist->refs);
+	free(playlist->order);
+	free(playlist->paths);
 
 	if (playlist->is_db_close_on_exit)
 		db_close(playlist->db_hdl);
@@ -261,85 +600,159 @@ void playlist_destroy(void *hdl)
 	ESP_LOGI(TAG , "destroy playlist %p", playlist);
 }
 
+int playlist_add_track(void *hdl, uint32_t id)
+{
+	struct playlist *playlist = hdl;
+
+	ESP_LOGD(TAG , " add playlist item %p/%d | %08x", playlist, playlist->song_nb, id);
+
+	return add_ref(playlist, id, 0, 0);
+}
+
 int playlist_add_song(void *hdl, char *artist, char *album, char *title)
 {
 	struct playlist *playlist = hdl;
-	struct playlist_song *new;
-	struct playlist_song *tail = list_tail_elem(playlist->unplayed);
+	uint32_t id;
+	int ret;
 
-	new = malloc(sizeof(*new));
-	if (!new)
-		return -1;
+	ret = db_song_get_id(playlist->db_hdl, artist, album, title, &id);
+	if (ret) {
+		ESP_LOGW(TAG, "unable to find %s/%s/%s", artist, album, title);
+		return ret;
+	}
 
-	new->next = NULL;
-	new->artist = strdup(artist);
-	new->album = strdup(album);
-	new->title = strdup(title);
-	new->index = playlist->song_nb++;
-	playlist->unplayed_nb++;
-	if (tail)
-		tail->next = new;
-	else
-		playlist->unplayed = new;
+	return playlist_add_track(hdl, id);
+}
 
-	ESP_LOGI(TAG , " add playlist item %p/%p | %s/%s/%s", playlist, new, artist, album, title);
+int playlist_rewind(void *hdl)
+{
+	struct playlist *playlist = hdl;
+
+	if (!playlist->song_nb)
+		return -1;
+	playlist->pos = 0;
 
 	return 0;
 }
 
-int playlist_rewind(void *hdl)
+int playlist_shuffle(void *hdl)
 {
-	return -1;
+	struct playlist *playlist = hdl;
+
+	shuffle(playlist, playlist->pos);
+	playlist->is_shuffled = 1;
+
+	return 0;
 }
 
 int playlist_next(void *hdl, struct playlist_item *item, int is_random)
 {
 	struct playlist *playlist = hdl;
-	struct playlist_song *current;
-	int ret;
 
+	set_random_mode(playlist, is_random);
+	/* skip songs that vanished from db since they were queued */
+	while (playlist->pos < playlist->song_nb || load_entries(playlist, 1)) {
+		if (!resolve_item(playlist, playlist->pos++, item))
+			return 0;
+	}
+
+	return -1;
+}
 
-	current = select_next(playlist, is_random);
-	if (!current)
+int playlist_prev(void *hdl, struct playlist_item *item)
+{
+	struct playlist *playlist = hdl;
+
+	/* pos - 1 is the current song */
+	if (playlist->pos < 2)
 		return -1;
 
-	item->filepath = db_song_get_filepath(playlist->db_hdl,
-					      current->artist,
-					      current->album,
-					      current->title);
-	if (!item->filepath) {
-		ESP_LOGW(TAG, "unable to fetch filepath for playlist %p | %s/%s/%s", playlist, current->artist, current->album, current->title);
+	playlist->pos--;
+
+	return resolve_item(playlist, playlist->pos - 1, item);
+}
+
+int playlist_jump(void *hdl, int idx, struct playlist_item *item)
+{
+	struct playlist *playlist = hdl;
+
+	if (idx < 0 || idx >= playlist->song_nb)
 		return -1;
+
+	playlist->pos = idx + 1;
+
+	return resolve_item(playlist, idx, item);
+}
+
+/* resolve the next songs ahead of time. To be called once current song is
+ * started so metadata reads don't delay it.
+ */
+void playlist_prefetch(void *hdl)
+{
+	struct playlist *playlist = hdl;
+	struct playlist_cache *slot;
+	int i, j;
+	int idx;
+
+	/* release songs that are no more upcoming, i.e after prev, jump or mode change */
+	for (i = 0; i < PLAYLIST_LOOKAHEAD_NB; i++) {
+		if (playlist->cache[i].idx >= 0 &&
+		    !is_in_lookahead(playlist, playlist->cache[i].idx))
+			cache_put(playlist, &playlist->cache[i]);
 	}
-	ret = db_song_get_meta(playlist->db_hdl,
-			       current->artist,
-			       current->album,
-			       current->title,
-			       &item->meta);
-	if (ret) {
-		ESP_LOGW(TAG, "unable for fetch metadata for playlist %p | %s/%s/%s", playlist, current->artist, current->album, current->title);
-		db_put_item(playlist->db_hdl, item->filepath);
-		return -1;
+
+	for (i = playlist->pos; i < playlist->pos + PLAYLIST_LOOKAHEAD_NB && i < playlist->song_nb; i++) {
+		idx = playlist->order[i];
+		if (cache_lookup(playlist, idx))
+			continue;
+		slot = NULL;
+		for (j = 0; j < PLAYLIST_LOOKAHEAD_NB && !slot; j++) {
+			if (playlist->cache[j].idx < 0)
+				slot = &playlist->cache[j];
+		}
+		if (!slot)
+			break;
+		if (resolve_ref(playlist, idx, &slot->track))
+			continue;
+		slot->idx = idx;
 	}
+}
 
-	ESP_LOGI(TAG , " queue playlist item %p/%p | %s/%s/%s | %s", playlist, current, item->meta.artist, item->meta.album, item->meta.title, item->filepath);
+/* load some more songs of playlist file, from ui task while a song plays.
+ * Return 1 while some are left.
+ */
+int playlist_load(void *hdl)
+{
+	struct playlist *playlist = hdl;
 
-	return 0;
+	load_entries(playlist, PLAYLIST_LOAD_NB);
+
+	return playlist->reader ? 1 : 0;
 }
 
-int playlist_prev(void *hdl, struct playlist_item *item)
+/* file of upcoming song when it's already resolved, NULL otherwise. Valid
+ * until next playlist call.
+ */
+char *playlist_next_filepath(void *hdl)
 {
-	return -1;
+	struct playlist *playlist = hdl;
+	struct playlist_cache *slot;
+
+	if (playlist->pos >= playlist->song_nb)
+		return NULL;
+
+	slot = cache_lookup(playlist, playlist->order[playlist->pos]);
+
+	return slot ? slot->track.filepath : NULL;
 }
 
 void playlist_put_item(void *hdl, struct playlist_item *item)
 {
 	struct playlist *playlist = hdl;
 
-	ESP_LOGI(TAG , " put playlist item %p | %s/%s/%s", playlist, item->meta.artist, item->meta.album, item->meta.title);
+	ESP_LOGD(TAG , " put playlist item %p | %s/%s/%s", playlist, item->meta.artist, item->meta.album, item->meta.title);
 
-	db_put_item(playlist->db_hdl, item->filepath);
-	db_put_meta(playlist->db_hdl, &item->meta);
+	db_track_put(playlist->db_hdl, &item->track);
 }
 
 int playlist_song_nb(void *hdl)
@@ -353,5 +766,5 @@ int playlist_song_idx(void *hdl)
 {
 	struct playlist *playlist = hdl;
 
-	return playlist->played_nb;
+	return playlist->pos;
 }
@@ -0,0 +1,360 @@
+#include "playlist_reader.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <stdio.h>
+
+#include "esp_log.h"
+
+static const char* TAG = "rv3.playlist_reader";
+
+#define READER_BLOCK_SZ		4096
+#define READER_PATH_LEN		512
+#define READER_TITLE_LEN	128
+
+enum reader_format {
+	/* one db entry path per line, as written by web playlist editor */
+	FORMAT_DB,
+	FORMAT_M3U,
+	FORMAT_PLS,
+};
+
+struct reader_slot {
+	char path[READER_PATH_LEN];
+	char title[READER_TITLE_LEN];
+	int duration_in_ms;
+	/* pls entry number, -1 when slot is empty */
+	int pls_idx;
+};
+
+/* entries are returned from one slot while the other one is filled. This
+ * allow pls to gather FileN, TitleN and LengthN lines before emitting entry.
+ */
+struct playlist_reader {
+	int fd;
+	enum reader_format format;
+	int is_first_line;
+	char dir[READER_PATH_LEN];
+	struct reader_slot slots[2];
+	int cur;
+	/* buf[start..end[ is not yet parsed */
+	int start;
+	int end;
+	int is_eof;
+	int is_skipping;
+	char buf[READER_BLOCK_SZ + 1];
+};
+
+static int has_ext(char *filename, char *ext)
+{
+	int len = strlen(filename);
+	int ext_len = strlen(ext);
+
+	if (len < ext_len)
+		return 0;
+
+	return strcasecmp(filename + len - ext_len, ext) == 0;
+}
+
+static void reset_slot(struct reader_slot *slot)
+{
+	slot->path[0] = '\0';
+	slot->title[0] = '\0';
+	slot->duration_in_ms = -1;
+	slot->pls_idx = -1;
+}
+
+/* return next line without its end of line or NULL at end of file. Lines that
+ * don't fit in the block buffer are dropped.
+ */
+static char *read_line(struct playlist_reader *reader)
+{
+	char *line;
+	char *nl;
+	int ret;
+
+	while (1) {
+		nl = memchr(reader->buf + reader->start, '\n', reader->end - reader->start);
+		if (nl || (reader->is_eof && reader->start < reader->end)) {
+			line = reader->buf + reader->start;
+			if (!nl)
+				nl = reader->buf + reader->end;
+			*nl = '\0';
+			reader->start = nl - reader->buf + 1;
+			if (reader->start > reader->end)
+				reader->start = reader->end;
+			if (nl > line && nl[-1] == '\r')
+				nl[-1] = '\0';
+			if (reader->is_skipping) {
+				reader->is_skipping = 0;
+				continue;
+			}
+			return line;
+		}
+		if (reader->is_eof)
+			return NULL;
+
+		if (reader->start) {
+			memmove(reader->buf, reader->buf + reader->start, reader->end - reader->start);
+			reader->end -= reader->start;
+			reader->start = 0;
+		}
+		if (reader->end == READER_BLOCK_SZ) {
+			ESP_LOGW(TAG, "line too long, skip it");
+			reader->is_skipping = 1;
+			reader->end = 0;
+		}
+
+		ret = read(reader->fd, reader->buf + reader->end, READER_BLOCK_SZ - reader->end);
+		if (ret <= 0)
+			reader->is_eof = 1;
+		else
+			reader->end += ret;
+	}
+}
+
+/* remove '.', '..' and empty components of an absolute path */
+static void normalize_path(char *path)
+{
+	char *src = path;
+	char *dst = path;
+	int len;
+
+	while (*src) {
+		if (*src == '/') {
+			src++;
+			continue;
+		}
+		len = strcspn(src, "/");
+		if (len == 1 && src[0] == '.') {
+			/* skip */
+		} else if (len == 2 && src[0] == '.' && src[1] == '.') {
+			while (dst > path && *--dst != '/')
+				;
+		} else {
+			*dst++ = '/';
+			memmove(dst, src, len);
+			dst += len;
+		}
+		src += len;
+	}
+	if (dst == path)
+		*dst++ = '/';
+	*dst = '\0';
+}
+
+static int resolve_path(struct playlist_reader *reader, char *line, char *path)
+{
+	char *p;
+	int ret;
+
+	/* stream urls are not songs */
+	if (strstr(line, "://"))
+		return -1;
+
+	for (p = line; *p; p++) {
+		if (*p == '\\')
+			*p = '/';
+	}
+
+	if (line[0] == '/')
+		ret = snprintf(path, READER_PATH_LEN, "%s", line);
+	else
+		ret = snprintf(path, READER_PATH_LEN, "%s/%s", reader->dir, line);
+	if (ret >= READER_PATH_LEN)
+		return -1;
+	normalize_path(path);
+
+	return 0;
+}
+
+static void set_title(struct reader_slot *slot, char *title)
+{
+	while (*title == ' ')
+		title++;
+	snprintf(slot->title, READER_TITLE_LEN, "%s", title);
+}
+
+static void set_duration(struct reader_slot *slot, char *duration)
+{
+	int sec = atoi(duration);
+
+	slot->duration_in_ms = sec > 0 ? sec * 1000 : -1;
+}
+
+static void fill_entry(struct playlist_reader *reader, struct reader_slot *slot,
+		       struct playlist_reader_entry *entry)
+{
+	entry->is_db_entry = reader->format == FORMAT_DB;
+	entry->path = slot->path;
+	entry->title = slot->title;
+	entry->duration_in_ms = slot->duration_in_ms;
+}
+
+/* return slot to emit or NULL */
+static struct reader_slot *parse_m3u_line(struct playlist_reader *reader, char *line)
+{
+	struct reader_slot *slot = &reader->slots[reader->cur];
+	char *title;
+
+	if (line[0] == '#') {
+		if (strncasecmp(line, "#EXTINF:", 8))
+			return NULL;
+		set_duration(slot, line + 8);
+		title = strchr(line + 8, ',');
+		if (title)
+			set_title(slot, title + 1);
+		return NULL;
+	}
+
+	if (resolve_path(reader, line, slot->path)) {
+		reset_slot(slot);
+		return NULL;
+	}
+	reader->cur ^= 1;
+	reset_slot(&reader->slots[reader->cur]);
+
+	return slot;
+}
+
+static struct reader_slot *parse_pls_line(struct playlist_reader *reader, char *line)
+{
+	struct reader_slot *slot = &reader->slots[reader->cur];
+	struct reader_slot *pending = NULL;
+	char *value;
+	int idx;
+
+	value = strchr(line, '=');
+	if (!value)
+		return NULL;
+	*value++ = '\0';
+
+	if (strncasecmp(line, "File", 4) == 0) {
+		idx = atoi(line + 4);
+		if (slot->pls_idx == idx)
+			return NULL;
+		/* new entry, previous one is complete */
+		if (slot->pls_idx >= 0) {
+			pending = slot;
+			reader->cur ^= 1;
+			slot = &reader->slots[reader->cur];
+		}
+		reset_slot(slot);
+		if (!resolve_path(reader, value, slot->path))
+			slot->pls_idx = idx;
+	} else if (strncasecmp(line, "Title", 5) == 0) {
+		if (slot->pls_idx == atoi(line + 5))
+			set_title(slot, value);
+	} else if (strncasecmp(line, "Length", 6) == 0) {
+		if (slot->pls_idx == atoi(line + 6))
+			set_duration(slot, value);
+	}
+
+	return pending;
+}
+
+static void detect_format(struct playlist_reader *reader, char *line)
+{
+	if (strncasecmp(line, "#EXTM3U", 7) == 0)
+		reader->format = FORMAT_M3U;
+	else if (strncasecmp(line, "[playlist]", 10) == 0)
+		reader->format = FORMAT_PLS;
+}
+
+void *playlist_reader_open(char *filename)
+{
+	struct playlist_reader *reader;
+	char *sep;
+
+	reader = malloc(sizeof(*reader));
+	if (!reader)
+		return NULL;
+	memset(reader, 0, sizeof(*reader));
+
+	reader->fd = open(filename, O_RDONLY);
+	if (reader->fd < 0) {
+		ESP_LOGW(TAG, "Unable to open playlist %s", filename);
+		free(reader);
+		return NULL;
+	}
+
+	snprintf(reader->dir, READER_PATH_LEN, "%s", filename);
+	sep = strrchr(reader->dir, '/');
+	if (sep)
+		*sep = '\0';
+	else
+		strcpy(reader->dir, ".");
+
+	if (has_ext(filename, ".m3u") || has_ext(filename, ".m3u8"))
+		reader->format = FORMAT_M3U;
+	else if (has_ext(filename, ".pls"))
+		reader->format = FORMAT_PLS;
+	else
+		reader->format = FORMAT_DB;
+	reader->is_first_line = 1;
+	reset_slot(&reader->slots[0]);
+	reset_slot(&reader->slots[1]);
+
+	return reader;
+}
+
+void playlist_reader_close(void *hdl)
+{
+	struct playlist_reader *reader = hdl;
+
+	close(reader->fd);
+	free(reader);
+}
+
+int playlist_reader_next(void *hdl, struct playlist_reader_entry *entry)
+{
+	struct playlist_reader *reader = hdl;
+	struct reader_slot *slot;
+	char *line;
+
+	while ((line = read_line(reader))) {
+		/* utf-8 bom */
+		if (reader->is_first_line && strncmp(line, "\xef\xbb\xbf", 3) == 0)
+			line += 3;
+		if (reader->is_first_line)
+			detect_format(reader, line);
+		reader->is_first_line = 0;
+		if (!line[0])
+			continue;
+
+		switch (reader->format) {
+		case FORMAT_DB:
+			slot = &reader->slots[reader->cur];
+			snprintf(slot->path, READER_PATH_LEN, "%s", line);
+			break;
+		case FORMAT_M3U:
+			slot = parse_m3u_line(reader, line);
+			break;
+		case FORMAT_PLS:
+			slot = parse_pls_line(reader, line);
+			break;
+		default:
+			slot = NULL;
+		}
+		if (slot) {
+			fill_entry(reader, slot, entry);
+			return 0;
+		}
+	}
+
+	/* last pls entry */
+	slot = &reader->slots[reader->cur];
+	if (reader->format == FORMAT_PLS && slot->pls_idx >= 0) {
+		reader->cur ^= 1;
+		reset_slot(&reader->slots[reader->cur]);
+		fill_entry(reader, slot, entry);
+		return 0;
+	}
+
+	return -1;
+}
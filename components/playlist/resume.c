@@ -0,0 +1,133 @@
+#include "playlist_resume.h"
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+
+#include "esp_log.h"
+#include "utils.h"
+
+static const char* TAG = "rv3.playlist_resume";
+
+#define RESUME_MAGIC		0x52736d65
+#define RESUME_SLOT_SZ		512
+#define RESUME_SLOT_NB		2
+
+/* record is written alternately in two sectors. A write interrupted by a
+ * power loss can only damage the older slot, reader keeps the valid slot
+ * with the highest sequence number.
+ */
+struct resume_slot {
+	uint32_t magic;
+	uint32_t seq;
+	struct playlist_resume resume;
+	uint32_t checksum;
+};
+
+struct resume {
+	int fd;
+	uint32_t seq;
+};
+
+static uint32_t slot_checksum(struct resume_slot *slot)
+{
+	return fnv1a(FNV1A_INIT, slot, offsetof(struct resume_slot, checksum));
+}
+
+/* return index of most recent valid slot or -1 */
+static int read_slots(int fd, struct resume_slot *slot)
+{
+	struct resume_slot slots[RESUME_SLOT_NB];
+	int res = -1;
+	int i;
+
+	for (i = 0; i < RESUME_SLOT_NB; i++) {
+		if (lseek(fd, i * RESUME_SLOT_SZ, SEEK_SET) < 0)
+			break;
+		if (read(fd, &slots[i], sizeof(slots[i])) != sizeof(slots[i]))
+			break;
+		if (slots[i].magic != RESUME_MAGIC || slots[i].checksum != slot_checksum(&slots[i]))
+			continue;
+		if (res < 0 || slots[i].seq > slots[res].seq)
+			res = i;
+	}
+	if (res >= 0)
+		*slot = slots[res];
+
+	return res;
+}
+
+void *playlist_resume_open(char *filename)
+{
+	struct resume_slot slot;
+	struct resume *resume;
+
+	resume = malloc(sizeof(*resume));
+	if (!resume)
+		return NULL;
+
+	resume->fd = open(filename, O_RDWR | O_CREAT, 0666);
+	if (resume->fd < 0) {
+		ESP_LOGW(TAG, "unable to open %s", filename);
+		free(resume);
+		return NULL;
+	}
+	resume->seq = read_slots(resume->fd, &slot) >= 0 ? slot.seq : 0;
+
+	return resume;
+}
+
+void playlist_resume_close(void *hdl)
+{
+	struct resume *resume = hdl;
+
+	close(resume->fd);
+	free(resume);
+}
+
+int playlist_resume_write(void *hdl, struct playlist_resume *record)
+{
+	struct resume *resume = hdl;
+	char sector[RESUME_SLOT_SZ];
+	struct resume_slot *slot = (struct resume_slot *) sector;
+	int ret;
+
+	memset(sector, 0, sizeof(sector));
+	slot->magic = RESUME_MAGIC;
+	slot->seq = ++resume->seq;
+	slot->resume = *record;
+	slot->checksum = slot_checksum(slot);
+
+	/* whole sector so fat doesn't need to read it back first */
+	ret = lseek(resume->fd, (slot->seq % RESUME_SLOT_NB) * RESUME_SLOT_SZ, SEEK_SET);
+	if (ret >= 0)
+		ret = write(resume->fd, sector, sizeof(sector)) == sizeof(sector) ? 0 : -1;
+	if (!ret)
+		ret = fsync(resume->fd);
+	if (ret)
+		ESP_LOGW(TAG, "unable to write resume record");
+
+	return ret;
+}
+
+int playlist_resume_read(char *filename, struct playlist_resume *record)
+{
+	struct resume_slot slot;
+	int ret;
+	int fd;
+
+	fd = open(filename, O_RDONLY);
+	if (fd < 0)
+		return -1;
+	ret = read_slots(fd, &slot);
+	close(fd);
+	if (ret < 0)
+		return -1;
+	*record = slot.resume;
+
+	return 0;
+}
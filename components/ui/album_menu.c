@@ -7,6 +7,7 @@
 #include "esp_log.h"
 
 #include "db.h"
+#include "db_thumb.h"
 #include "paging_menu.h"
 #include "song_menu.h"
 #include "music_player.h"
@@ -65,12 +66,29 @@ static void long_select_item(void *ctx, char *selected_label, int index)
 	music_player_create(playlist_hdl);
 }
 
+static int album_get_item_thumb(void *ctx, int index, uint16_t *pixels)
+{
+	struct album_menu *menu = ctx;
+	char *album;
+	int ret;
+
+	album = db_album_get(menu->db_hdl, menu->artist, index);
+	if (!album)
+		return -1;
+	ret = db_album_get_thumb(menu->db_hdl, menu->artist, album, pixels);
+	db_put_item(menu->db_hdl, album);
+
+	return ret;
+}
+
 static struct paging_cbs cbs = {
 	.destroy = album_destroy,
 	.get_item_label = album_get_item_label,
 	.put_item_label = album_put_item_label,
 	.select_item = album_select_item,
 	.long_select_item = long_select_item,
+	.get_item_thumb = album_get_item_thumb,
+	.thumb_size = DB_THUMB_SIZE,
 };
 
 ui_hdl album_menu_create(void *db_hdl, char *artist)
@@ -45,11 +45,19 @@ static void artist_select_item(void *ctx, char *selected_label, int index)
 	album_menu_create(menu->db_hdl, selected_label);
 }
 
+static int artist_jump(void *ctx, int index, int direction)
+{
+	struct artist_menu *menu = ctx;
+
+	return db_artist_jump(menu->db_hdl, index, direction);
+}
+
 static struct paging_cbs cbs = {
 	.destroy = artist_destroy,
 	.get_item_label = artist_get_item_label,
 	.put_item_label = artist_put_item_label,
 	.select_item = artist_select_item,
+	.jump = artist_jump,
 };
 
 ui_hdl artist_menu_create()
@@ -0,0 +1,11 @@
+#ifndef __KEYBOARD__
+#define __KEYBOARD__ 1
+
+#include "lvgl.h"
+
+typedef void (*keyboard_done_cb)(void *ctx, char *text);
+
+void *keyboard_create(lv_obj_t *scr, keyboard_done_cb done_cb, void *ctx);
+void keyboard_destroy(void *hdl);
+
+#endif
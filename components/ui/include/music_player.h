@@ -4,5 +4,6 @@
 #include "ui.h"
 
 ui_hdl music_player_create(void *playlist_hdl);
+void music_player_offer_resume(void);
 
 #endif
\ No newline at end of file
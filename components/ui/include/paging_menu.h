@@ -1,6 +1,8 @@
 #ifndef __PAGING_MENU__
 #define __PAGING_MENU__ 1
 
+#include <stdint.h>
+
 #include "ui.h"
 
 struct paging_cbs {
@@ -10,6 +12,11 @@ struct paging_cbs {
 	void (*select_item)(void *ctx, char *selected_label, int index);
 	void (*long_select_item)(void *ctx, char *selected_label, int index);
 	int (*is_root)(void *ctx);
+	/* return first item index of next (direction > 0) or previous group */
+	int (*jump)(void *ctx, int index, int direction);
+	/* optional square RGB565 thumbnail of thumb_size pixels shown in item button */
+	int (*get_item_thumb)(void *ctx, int index, uint16_t *pixels);
+	int thumb_size;
 };
 
 ui_hdl paging_menu_create(int item_nb, struct paging_cbs *cbs, void *ctx);
@@ -4,6 +4,7 @@
 #include "ui.h"
 
 ui_hdl radio_player_create(const char *radio_label, const char *url, const char *port_nb,
-			   const char *path, int rate, int meta, int anti_ad);
+			   const char *path, int rate, int meta, int anti_ad,
+			   int min_kbps, int stall_time_in_sec);
 
 #endif
\ No newline at end of file
@@ -0,0 +1,8 @@
+#ifndef __SEARCH_MENU__
+#define __SEARCH_MENU__ 1
+
+#include "ui.h"
+
+ui_hdl search_menu_create(void);
+
+#endif
@@ -0,0 +1,8 @@
+#ifndef __STATS_MENU__
+#define __STATS_MENU__ 1
+
+#include "ui.h"
+
+ui_hdl stats_menu_create(void);
+
+#endif
@@ -0,0 +1,10 @@
+#ifndef __TRACK_MENU__
+#define __TRACK_MENU__ 1
+
+#include "ui.h"
+#include "db_index.h"
+
+/* tracks array ownership is transferred to track menu */
+ui_hdl track_menu_create(void *db_hdl, struct db_track *tracks, int track_nb);
+
+#endif
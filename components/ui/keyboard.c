@@ -0,0 +1,129 @@
+#include "keyboard.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "esp_log.h"
+
+static const char* TAG = "rv3.keyboard";
+
+enum kb_button {
+	KB_LEFT,
+	KB_CHAR,
+	KB_RIGHT,
+	KB_DELETE,
+	KB_DONE,
+	KB_BTN_NB
+};
+
+struct keyboard {
+	lv_obj_t *ta;
+	lv_obj_t *kb_btn[KB_BTN_NB];
+	lv_obj_t *kb_label[KB_BTN_NB];
+	char kb_current[2];
+	keyboard_done_cb done_cb;
+	void *ctx;
+};
+
+static enum kb_button get_btn_id_from_obj(struct keyboard *kb, lv_obj_t *btn)
+{
+	int i;
+
+	for (i = 0; i < KB_BTN_NB; i++) {
+		if (kb->kb_btn[i] == btn)
+			return i;
+	}
+
+	return KB_BTN_NB;
+}
+
+static void kb_event_cb(lv_obj_t *btn, lv_event_t event)
+{
+	struct keyboard *kb = lv_obj_get_user_data(btn);
+	enum kb_button btn_id = get_btn_id_from_obj(kb, btn);
+
+	if( event != LV_EVENT_CLICKED && event != LV_EVENT_LONG_PRESSED_REPEAT)
+		return;
+	if (event == LV_EVENT_LONG_PRESSED_REPEAT && btn_id != KB_LEFT && btn_id != KB_RIGHT)
+		return;
+
+	switch (btn_id) {
+	case KB_LEFT:
+		kb->kb_current[0]--;
+		if (kb->kb_current[0] < 0x20)
+			kb->kb_current[0] = 0x7E;
+		lv_label_set_text(kb->kb_label[KB_CHAR], kb->kb_current);
+		break;
+	case KB_RIGHT:
+		kb->kb_current[0]++;
+		if (kb->kb_current[0] >0x7E)
+			kb->kb_current[0] = 0x20;
+		lv_label_set_text(kb->kb_label[KB_CHAR], kb->kb_current);
+		break;
+	case KB_CHAR:
+		lv_textarea_add_char(kb->ta, kb->kb_current[0]);
+		break;
+	case KB_DELETE:
+		lv_textarea_del_char(kb->ta);
+		break;
+	case KB_DONE:
+		/* done_cb may delete the screen and the keyboard */
+		kb->done_cb(kb->ctx, (char *) lv_textarea_get_text(kb->ta));
+		break;
+	default:
+		ESP_LOGE(TAG, "unknown button %p", btn);
+	}
+}
+
+void *keyboard_create(lv_obj_t *scr, keyboard_done_cb done_cb, void *ctx)
+{
+	const int sizes[KB_BTN_NB][2] = {
+		{60, 55}, {60, 55}, {60, 55}, {60, 55}, {120, 55}
+	};
+	const lv_point_t pos[KB_BTN_NB] = {
+		{10, 80}, {130, 80}, {250, 80},
+		{10, 170}, {130, 170}
+	};
+	const char *labels[KB_BTN_NB] = {
+		"<", "a", ">", "del", "done"
+	};
+	struct keyboard *kb;
+	int i;
+
+	kb = malloc(sizeof(*kb));
+	if (!kb)
+		return NULL;
+	memset(kb, 0, sizeof(*kb));
+	kb->done_cb = done_cb;
+	kb->ctx = ctx;
+
+	kb->ta = lv_textarea_create(scr, NULL);
+	assert(kb->ta);
+	lv_textarea_set_one_line(kb->ta, true);
+	lv_obj_align(kb->ta, NULL, LV_ALIGN_IN_TOP_MID, 0, 10);
+	lv_obj_set_y(kb->ta, 24);
+	lv_textarea_set_text(kb->ta, "");
+
+	kb->kb_current[0] = labels[KB_CHAR][0];
+	kb->kb_current[1] = '\0';
+	for (i = 0; i < KB_BTN_NB; i++) {
+		kb->kb_btn[i] = lv_btn_create(scr, NULL);
+		assert(kb->kb_btn[i]);
+		lv_obj_set_user_data(kb->kb_btn[i], kb);
+		lv_obj_set_size(kb->kb_btn[i], sizes[i][0], sizes[i][1]);
+		lv_obj_set_pos(kb->kb_btn[i], pos[i].x, pos[i].y);
+		kb->kb_label[i] = lv_label_create(kb->kb_btn[i], NULL);
+		assert(kb->kb_label[i]);
+		lv_label_set_text(kb->kb_label[i], labels[i]);
+		lv_obj_set_event_cb(kb->kb_btn[i], kb_event_cb);
+	}
+
+	return kb;
+}
+
+/* lvgl objects are owned by the screen. Only release keyboard state */
+void keyboard_destroy(void *hdl)
+{
+	free(hdl);
+}
@@ -9,7 +9,10 @@
 #include "radio_menu.h"
 #include "system_menu.h"
 #include "artist_menu.h"
+#include "search_menu.h"
+#include "stats_menu.h"
 #include "playlist_menu.h"
+#include "music_player.h"
 #include "bt_player.h"
 #include "esp_system.h"
 
@@ -19,7 +22,7 @@
 
 static const char* TAG = "rv3.main";
 
-const char *main_labels[] = {"radio", "music", "playlist", "bluetooth", "settings"};
+const char *main_labels[] = {"radio", "music", "search", "stats", "playlist", "bluetooth", "settings"};
 
 static char *main_get_item_label(void *ctx, int index)
 {
@@ -40,12 +43,20 @@ static void main_select_item(void *ctx, char *selected_label, int index)
 		break;
 	case 2:
 		srand(esp_random());
-		playlist_menu_create("/sdcard/playlist");
+		search_menu_create();
 		break;
 	case 3:
-		bt_player_create();
+		srand(esp_random());
+		stats_menu_create();
 		break;
 	case 4:
+		srand(esp_random());
+		playlist_menu_create("/sdcard/playlist");
+		break;
+	case 5:
+		bt_player_create();
+		break;
+	case 6:
 		settings_create();
 		break;
 	default:
@@ -66,6 +77,12 @@ static struct paging_cbs cbs = {
 
 ui_hdl main_menu_create()
 {
+	ui_hdl hdl;
+
 	system_menu_create();
-	return paging_menu_create(ARRAY_SIZE(main_labels), &cbs, NULL);
+	hdl = paging_menu_create(ARRAY_SIZE(main_labels), &cbs, NULL);
+	/* playback interrupted by a power loss */
+	music_player_offer_resume();
+
+	return hdl;
 }
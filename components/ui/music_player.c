@@ -2,18 +2,35 @@
 
 #include <stdio.h>
 #include <assert.h>
+#include <unistd.h>
 
 #include "lvgl.h"
 #include "esp_log.h"
 
 #include "audio.h"
 #include "playlist.h"
+#include "playlist_resume.h"
+#include "playlist_bookmark.h"
+#include "db.h"
+#include "db_thumb.h"
+#include "db_stats.h"
 
 #include "system_menu.h"
 #include "fonts.h"
 
 static const char* TAG = "rv3.music_player";
 
+#define MUSIC_DB			"/sdcard/music.db"
+#define RESUME_PERIOD_MS		30000
+/* bookmarks are only kept for long tracks like audiobooks or mixes */
+#define BOOKMARK_MIN_DURATION_MS	(20 * 60 * 1000)
+#define BOOKMARK_MARGIN_MS		30000
+#define BOOKMARK_PERIOD_MS		10000
+#define BOOKMARK_FLUSH_PERIOD_MS	60000
+#define BOOKMARK_CHOICE_TIMEOUT_MS	10000
+/* next song is opened and read ahead during last seconds of current one */
+#define PREFETCH_LEAD_MS		15000
+
 #define container_of(ptr, type, member) ({ \
 	const typeof( ((type *)0)->member ) *__mptr = (ptr); \
 	(type *)( (char *)__mptr - offsetof(type,member) );})
@@ -30,9 +47,11 @@ enum music_player_button {
 
 enum music_player_state {
 	STATE_INIT,
+	STATE_WAIT_BOOKMARK_CHOICE,
 	STATE_WAIT_SONG_START,
 	STATE_SONG_RUNNING,
 	STATE_SONG_NEXT,
+	STATE_SONG_PREV,
 	STATE_PLAYLIST_DONE
 };
 
@@ -48,8 +67,38 @@ struct music_player {
 	lv_task_t *task_level;
 	void *playlist_hdl;
 	enum music_player_state state;
+	void *thumb_hdl;
+	lv_obj_t *thumb;
+	lv_img_dsc_t thumb_dsc;
+	uint16_t thumb_pixels[DB_THUMB_SIZE * DB_THUMB_SIZE];
+	void *stats_hdl;
+	uint32_t track_id;
+	int is_song_started;
+	/* queue and position saved to resume playback after reboot */
+	char *queue_path;
+	void *resume_hdl;
+	uint32_t resume_tick;
+	uint32_t song_tick;
+	uint32_t song_time_in_ms;
+	int song_duration_in_ms;
+	/* per track position of long tracks */
+	void *bookmark_hdl;
+	uint32_t bookmark_tick;
+	uint32_t bookmark_flush_tick;
+	lv_obj_t *bookmark_mbox;
+	struct playlist_item bookmark_item;
+	struct playlist_bookmark bookmark;
+	int is_next_prefetched;
+	/* remaining songs of a playlist file are loaded while playing */
+	int is_playlist_loaded;
 };
 
+static lv_obj_t *resume_mbox;
+static const char *resume_btns[] = {"Resume", "No", ""};
+static const char *bookmark_btns[] = {"Resume", "Restart", ""};
+
+static void update_bookmark(struct music_player *player);
+
 static inline struct music_player *get_music_player()
 {
 	struct ui_cbs *cbs = lv_obj_get_user_data(lv_disp_get_scr_act(NULL));
@@ -68,10 +117,25 @@ static void set_system_info(struct music_player *player)
 
 static void music_player_destroy(struct music_player *player)
 {
+	if (player->resume_hdl)
+		playlist_resume_close(player->resume_hdl);
+	free(player->queue_path);
+	if (player->state == STATE_WAIT_BOOKMARK_CHOICE)
+		playlist_put_item(player->playlist_hdl, &player->bookmark_item);
+	update_bookmark(player);
+	if (player->bookmark_hdl)
+		playlist_bookmark_close(player->bookmark_hdl);
 	playlist_destroy(player->playlist_hdl);
 	lv_task_del(player->task_level);
 	audio_music_stop();
+	/* message box goes away with screen */
+	if (player->bookmark_mbox)
+		lv_obj_set_event_cb(player->bookmark_mbox, NULL);
 	lv_obj_del(player->scr);
+	if (player->thumb_hdl)
+		db_thumb_close(player->thumb_hdl);
+	if (player->stats_hdl)
+		db_stats_close(player->stats_hdl);
 	free(player);
 }
 
@@ -114,6 +178,16 @@ static void music_player_event_cb(lv_obj_t *btn, lv_event_t event)
 	struct music_player *player = get_music_player();
 	enum music_player_button btn_id = get_btn_id_from_obj(player, btn);
 
+	/* long press on next goes back to previous song */
+	if (btn_id == MUSIC_PLAYER_NEXT) {
+		if (player->state == STATE_WAIT_BOOKMARK_CHOICE)
+			return;
+		if (event == LV_EVENT_SHORT_CLICKED)
+			player->state = STATE_SONG_NEXT;
+		else if (event == LV_EVENT_LONG_PRESSED)
+			player->state = STATE_SONG_PREV;
+		return;
+	}
 	if( event != LV_EVENT_CLICKED && event != LV_EVENT_LONG_PRESSED_REPEAT)
 		return;
 	if (event == LV_EVENT_LONG_PRESSED_REPEAT && btn_id != MUSIC_PLAYER_UP && btn_id != MUSIC_PLAYER_DOWN)
@@ -134,9 +208,6 @@ static void music_player_event_cb(lv_obj_t *btn, lv_event_t event)
 		lv_bar_set_value(player->sound_level,  audio_sound_level_down(),
 				 LV_ANIM_ON);
 		break;
-	case MUSIC_PLAYER_NEXT:
-		player->state = STATE_SONG_NEXT;
-		break;
 	case MUSIC_PLAYER_RANDOM:
 		/* do nothing */
 		break;
@@ -152,6 +223,222 @@ static int is_random_mode(struct music_player *player)
 	return LV_BTN_STATE_RELEASED == st;
 }
 
+static void update_thumb(struct music_player *player, struct playlist_item *item)
+{
+	int ret = -1;
+
+	if (player->thumb_hdl)
+		ret = db_thumb_get(player->thumb_hdl, item->meta.artist, item->meta.album,
+				   player->thumb_pixels);
+	lv_obj_set_hidden(player->thumb, ret != 0);
+	if (ret)
+		return;
+
+	lv_img_cache_invalidate_src(&player->thumb_dsc);
+	lv_img_set_src(player->thumb, &player->thumb_dsc);
+}
+
+static void log_event(struct music_player *player, enum db_stats_event event)
+{
+	if (player->stats_hdl)
+		db_stats_log(player->stats_hdl, player->track_id, event);
+}
+
+static uint32_t song_time(struct music_player *player)
+{
+	if (!player->is_song_started)
+		return player->song_time_in_ms;
+
+	return player->song_time_in_ms + lv_tick_elaps(player->song_tick);
+}
+
+static void save_resume(struct music_player *player, int offset)
+{
+	struct playlist_resume resume;
+
+	player->resume_tick = lv_tick_get();
+	if (!player->resume_hdl)
+		return ;
+
+	resume.track_id = player->track_id;
+	resume.song_idx = playlist_song_idx(player->playlist_hdl) - 1;
+	resume.is_random = is_random_mode(player);
+	resume.offset = offset;
+	resume.time_in_ms = song_time(player);
+	playlist_resume_write(player->resume_hdl, &resume);
+}
+
+/* nothing to resume once whole playlist has been played */
+static void clear_resume(struct music_player *player)
+{
+	char *resume_path = db_index_path(MUSIC_DB, "resume");
+
+	if (player->resume_hdl)
+		playlist_resume_close(player->resume_hdl);
+	player->resume_hdl = NULL;
+	if (resume_path)
+		unlink(resume_path);
+	free(resume_path);
+	if (player->queue_path)
+		unlink(player->queue_path);
+}
+
+static void start_song_at(struct music_player *player, struct playlist_item *item,
+			  int offset, uint32_t time_in_ms)
+{
+	player->state = STATE_WAIT_SONG_START;
+	player->track_id = item->track.id;
+	player->is_song_started = 0;
+	player->song_time_in_ms = time_in_ms;
+	player->song_duration_in_ms = item->meta.duration_in_ms;
+	player->bookmark_tick = lv_tick_get();
+	player->is_next_prefetched = 0;
+	lv_label_set_text(player->msg_label, item->meta.title);
+	update_thumb(player, item);
+	audio_music_play(item->filepath, offset);
+	playlist_put_item(player->playlist_hdl, item);
+	playlist_prefetch(player->playlist_hdl);
+	if (player->queue_path)
+		playlist_save(player->playlist_hdl, player->queue_path);
+	save_resume(player, offset);
+}
+
+static int is_bookmark_track(int duration_in_ms)
+{
+	return duration_in_ms >= BOOKMARK_MIN_DURATION_MS;
+}
+
+/* save position of current long track, forget it near both ends */
+static void update_bookmark(struct music_player *player)
+{
+	struct playlist_bookmark bookmark;
+	uint32_t time_in_ms;
+
+	player->bookmark_tick = lv_tick_get();
+	if (!player->bookmark_hdl || !player->is_song_started)
+		return ;
+	if (!is_bookmark_track(player->song_duration_in_ms))
+		return ;
+
+	time_in_ms = song_time(player);
+	if (time_in_ms < BOOKMARK_MARGIN_MS ||
+	    time_in_ms + BOOKMARK_MARGIN_MS > player->song_duration_in_ms) {
+		playlist_bookmark_clear(player->bookmark_hdl, player->track_id);
+		return ;
+	}
+	bookmark.track_id = player->track_id;
+	bookmark.offset = audio_music_position();
+	bookmark.time_in_ms = time_in_ms;
+	playlist_bookmark_set(player->bookmark_hdl, &bookmark);
+}
+
+static void prefetch_next_song(struct music_player *player)
+{
+	char *filepath;
+
+	if (player->is_next_prefetched || player->song_duration_in_ms <= 0)
+		return ;
+	if (song_time(player) + PREFETCH_LEAD_MS < player->song_duration_in_ms)
+		return ;
+
+	player->is_next_prefetched = 1;
+	filepath = playlist_next_filepath(player->playlist_hdl);
+	if (filepath)
+		audio_music_prefetch(filepath);
+}
+
+static void load_playlist(struct music_player *player)
+{
+	if (player->is_playlist_loaded)
+		return ;
+	if (playlist_load(player->playlist_hdl))
+		return ;
+
+	/* queue saved on song start missed songs still in file */
+	player->is_playlist_loaded = 1;
+	if (player->queue_path)
+		playlist_save(player->playlist_hdl, player->queue_path);
+}
+
+/* writes are coalesced so sd card sees at most one sector per minute */
+static void flush_bookmarks(struct music_player *player)
+{
+	if (lv_tick_elaps(player->bookmark_flush_tick) < BOOKMARK_FLUSH_PERIOD_MS)
+		return ;
+
+	player->bookmark_flush_tick = lv_tick_get();
+	if (player->bookmark_hdl)
+		playlist_bookmark_flush(player->bookmark_hdl);
+}
+
+static void start_bookmarked_song(struct music_player *player, int is_resume)
+{
+	player->bookmark_mbox = NULL;
+	if (player->state != STATE_WAIT_BOOKMARK_CHOICE)
+		return ;
+
+	if (is_resume) {
+		ESP_LOGI(TAG, "resume song at bookmark offset %u", player->bookmark.offset);
+		start_song_at(player, &player->bookmark_item, player->bookmark.offset,
+			      player->bookmark.time_in_ms);
+	} else {
+		playlist_bookmark_clear(player->bookmark_hdl, player->bookmark.track_id);
+		start_song_at(player, &player->bookmark_item, 0, 0);
+	}
+}
+
+static void bookmark_event_handler(lv_obj_t *obj, lv_event_t event)
+{
+	struct music_player *player = get_music_player();
+
+	if (event == LV_EVENT_DELETE) {
+		lv_obj_del_async(lv_obj_get_parent(obj));
+		/* closed without a choice, resume by default */
+		start_bookmarked_song(player, 1);
+	} else if (event == LV_EVENT_VALUE_CHANGED) {
+		lv_msgbox_start_auto_close(obj, 0);
+		start_bookmarked_song(player, lv_msgbox_get_active_btn(obj) == 0);
+	}
+}
+
+static void ask_bookmark(struct music_player *player, struct playlist_item *item)
+{
+	uint32_t sec = player->bookmark.time_in_ms / 1000;
+	char msg[128];
+	lv_obj_t *obj;
+
+	player->state = STATE_WAIT_BOOKMARK_CHOICE;
+	player->is_song_started = 0;
+	player->bookmark_item = *item;
+	player->bookmark_tick = lv_tick_get();
+	snprintf(msg, sizeof(msg), "Resume %s at %u:%02u:%02u ?", item->meta.title,
+		 sec / 3600, (sec / 60) % 60, sec % 60);
+
+	obj = lv_obj_create(player->scr, NULL);
+	lv_obj_set_style_local_bg_color(obj, LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_COLOR_BLACK);
+	lv_obj_set_style_local_bg_opa(obj, LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_OPA_20);
+	lv_obj_set_pos(obj, 0, 0);
+	lv_obj_set_size(obj, LV_HOR_RES, LV_VER_RES);
+
+	player->bookmark_mbox = lv_msgbox_create(obj, NULL);
+	lv_obj_set_width(player->bookmark_mbox, LV_HOR_RES - 40);
+	lv_msgbox_set_text(player->bookmark_mbox, msg);
+	lv_msgbox_add_btns(player->bookmark_mbox, bookmark_btns);
+	lv_obj_align(player->bookmark_mbox, NULL, LV_ALIGN_CENTER, 0, 0);
+	lv_obj_set_event_cb(player->bookmark_mbox, bookmark_event_handler);
+}
+
+static void start_song(struct music_player *player, struct playlist_item *item)
+{
+	if (player->bookmark_hdl && is_bookmark_track(item->meta.duration_in_ms) &&
+	    !playlist_bookmark_get(player->bookmark_hdl, item->track.id, &player->bookmark)) {
+		ask_bookmark(player, item);
+		return ;
+	}
+
+	start_song_at(player, item, 0, 0);
+}
+
 static void start_next_song(struct music_player *player)
 {
 	struct playlist_item item;
@@ -163,10 +450,25 @@ static void start_next_song(struct music_player *player)
 		player->state = STATE_PLAYLIST_DONE;
 		return ;
 	}
-	player->state = STATE_WAIT_SONG_START;
-	lv_label_set_text(player->msg_label, item.meta.title);
-	audio_music_play(item.filepath);
-	playlist_put_item(player->playlist_hdl, &item);
+	start_song(player, &item);
+}
+
+static void start_prev_song(struct music_player *player)
+{
+	struct playlist_item item;
+	int ret;
+
+	ret = playlist_prev(player->playlist_hdl, &item);
+	/* already on first song, restart it */
+	if (ret)
+		ret = playlist_jump(player->playlist_hdl,
+				    playlist_song_idx(player->playlist_hdl) - 1, &item);
+	ESP_LOGI(TAG, "start_prev_song ret = %d\n", ret);
+	if (ret) {
+		player->state = STATE_PLAYLIST_DONE;
+		return ;
+	}
+	start_song(player, &item);
 }
 
 static void update_state(struct music_player *player)
@@ -174,23 +476,55 @@ static void update_state(struct music_player *player)
 	switch (player->state) {
 	case STATE_INIT:
 		break;
+	case STATE_WAIT_BOOKMARK_CHOICE:
+		/* nobody answers, keep playing from bookmark */
+		if (lv_tick_elaps(player->bookmark_tick) >= BOOKMARK_CHOICE_TIMEOUT_MS &&
+		    player->bookmark_mbox)
+			lv_msgbox_start_auto_close(player->bookmark_mbox, 0);
+		break;
 	case STATE_WAIT_SONG_START:
-		if (audio_buffer_level())
+		if (audio_buffer_level()) {
 			player->state = STATE_SONG_RUNNING;
+			player->is_song_started = 1;
+			player->song_tick = lv_tick_get();
+			log_event(player, DB_STATS_START);
+		}
 		break;
 	case STATE_SONG_RUNNING:
+		if (lv_tick_elaps(player->resume_tick) >= RESUME_PERIOD_MS)
+			save_resume(player, audio_music_position());
+		if (lv_tick_elaps(player->bookmark_tick) >= BOOKMARK_PERIOD_MS)
+			update_bookmark(player);
+		flush_bookmarks(player);
+		prefetch_next_song(player);
+		load_playlist(player);
 		if (audio_buffer_level() == 0) {
+			log_event(player, DB_STATS_COMPLETE);
+			if (player->bookmark_hdl)
+				playlist_bookmark_clear(player->bookmark_hdl, player->track_id);
+			player->is_song_started = 0;
 			audio_music_stop();
 			start_next_song(player);
 		}
 		break;
 	case STATE_PLAYLIST_DONE:
+		clear_resume(player);
 		handle_back_event(player);
 		break;
 	case STATE_SONG_NEXT:
+		if (player->is_song_started)
+			log_event(player, DB_STATS_SKIP);
+		update_bookmark(player);
 		audio_music_stop();
 		start_next_song(player);
 		break;
+	case STATE_SONG_PREV:
+		if (player->is_song_started)
+			log_event(player, DB_STATS_SKIP);
+		update_bookmark(player);
+		audio_music_stop();
+		start_prev_song(player);
+		break;
 	default:
 		assert(0);
 	}
@@ -246,12 +580,23 @@ static void music_player_screen(struct music_player *player)
 	player->msg_label = lv_label_create(player->scr, NULL);
 	assert(player->msg_label);
 	lv_obj_set_style_local_text_font(player->msg_label, LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, &lv_font_rv3_24);
-	lv_obj_align(player->msg_label, NULL, LV_ALIGN_CENTER, 0, 0);
+	lv_obj_align(player->msg_label, NULL, LV_ALIGN_CENTER, 0, DB_THUMB_SIZE / 2);
 	lv_obj_set_auto_realign(player->msg_label, true);
 	lv_label_set_align(player->msg_label, LV_LABEL_ALIGN_CENTER);
 	lv_label_set_long_mode(player->msg_label, LV_LABEL_LONG_BREAK);
 	lv_obj_set_width(player->msg_label, 140);
 
+	player->thumb_dsc.header.always_zero = 0;
+	player->thumb_dsc.header.w = DB_THUMB_SIZE;
+	player->thumb_dsc.header.h = DB_THUMB_SIZE;
+	player->thumb_dsc.header.cf = LV_IMG_CF_TRUE_COLOR;
+	player->thumb_dsc.data_size = DB_THUMB_BYTES;
+	player->thumb_dsc.data = (uint8_t *) player->thumb_pixels;
+	player->thumb = lv_img_create(player->scr, NULL);
+	assert(player->thumb);
+	lv_obj_set_pos(player->thumb, (320 - DB_THUMB_SIZE) / 2, 20);
+	lv_obj_set_hidden(player->thumb, true);
+
 	player->bar_level = lv_bar_create(player->scr, NULL);
 	assert(player->bar_level);
 	lv_bar_set_range(player->bar_level, 0, 100);
@@ -269,13 +614,32 @@ static void music_player_screen(struct music_player *player)
 
 	player->task_level = lv_task_create(task_level_cb, 250, LV_TASK_PRIO_LOW, NULL);
 	assert(player->task_level);
+}
 
-	start_next_song(player);
+static void start_resumed_song(struct music_player *player, struct playlist_resume *resume)
+{
+	struct playlist_item item;
+	int ret;
+
+	ret = playlist_jump(player->playlist_hdl, resume->song_idx, &item);
+	if (ret) {
+		start_next_song(player);
+		return ;
+	}
+	/* queue and record are not from same session, restart song */
+	if (item.track.id != resume->track_id) {
+		resume->offset = 0;
+		resume->time_in_ms = 0;
+	}
+	ESP_LOGI(TAG, "resume song %d at offset %u", resume->song_idx, resume->offset);
+	start_song_at(player, &item, resume->offset, resume->time_in_ms);
 }
 
-ui_hdl music_player_create(void *playlist_hdl)
+static struct music_player *create_player(void *playlist_hdl)
 {
+	char *resume_path = db_index_path(MUSIC_DB, "resume");
 	struct music_player *player;
+	char *bookmark_path;
 
 	player = malloc(sizeof(*player));
 	if (!player)
@@ -286,8 +650,127 @@ ui_hdl music_player_create(void *playlist_hdl)
 	player->state = STATE_INIT;
 	player->prev_scr = lv_disp_get_scr_act(NULL);
 	player->cbs.destroy_chained = destroy_chained;
+	player->thumb_hdl = db_thumb_open(MUSIC_DB);
+	player->stats_hdl = db_stats_open(MUSIC_DB);
+	player->queue_path = db_index_path(MUSIC_DB, "queue");
+	bookmark_path = db_index_path(MUSIC_DB, "bookmarks");
+	if (bookmark_path)
+		player->bookmark_hdl = playlist_bookmark_open(bookmark_path);
+	free(bookmark_path);
+	player->bookmark_flush_tick = lv_tick_get();
+	if (resume_path)
+		player->resume_hdl = playlist_resume_open(resume_path);
+	free(resume_path);
 	music_player_screen(player);
 	system_menu_set_user_label("");
 
+	return player;
+}
+
+ui_hdl music_player_create(void *playlist_hdl)
+{
+	struct music_player *player;
+
+	player = create_player(playlist_hdl);
+	if (!player)
+		return NULL;
+	start_next_song(player);
+
 	return &player->cbs;
 }
+
+static ui_hdl music_player_resume(struct playlist_resume *resume)
+{
+	struct music_player *player;
+	void *playlist_hdl;
+	void *db_hdl;
+	char *queue_path;
+
+	queue_path = db_index_path(MUSIC_DB, "queue");
+	if (!queue_path)
+		return NULL;
+	db_hdl = db_open(MUSIC_DB);
+	playlist_hdl = db_hdl ? playlist_restore(db_hdl, queue_path) : NULL;
+	free(queue_path);
+	if (!playlist_hdl) {
+		if (db_hdl)
+			db_close(db_hdl);
+		return NULL;
+	}
+
+	player = create_player(playlist_hdl);
+	if (!player) {
+		playlist_destroy(playlist_hdl);
+		return NULL;
+	}
+	if (resume->is_random)
+		lv_btn_set_state(player->btn[MUSIC_PLAYER_RANDOM], LV_BTN_STATE_RELEASED);
+	start_resumed_song(player, resume);
+
+	return &player->cbs;
+}
+
+static void resume_event_handler(lv_obj_t *obj, lv_event_t event)
+{
+	struct playlist_resume resume;
+	char *resume_path;
+	int ret = -1;
+
+	if (event == LV_EVENT_DELETE && obj == resume_mbox) {
+		lv_obj_del_async(lv_obj_get_parent(resume_mbox));
+		resume_mbox = NULL;
+	} else if (event == LV_EVENT_VALUE_CHANGED) {
+		lv_msgbox_start_auto_close(resume_mbox, 0);
+		if (lv_msgbox_get_active_btn(obj) != 0)
+			return ;
+		resume_path = db_index_path(MUSIC_DB, "resume");
+		if (resume_path)
+			ret = playlist_resume_read(resume_path, &resume);
+		free(resume_path);
+		if (!ret)
+			music_player_resume(&resume);
+	}
+}
+
+void music_player_offer_resume()
+{
+	struct playlist_resume resume;
+	struct db_track track;
+	char *resume_path;
+	char msg[128];
+	void *db_hdl;
+	lv_obj_t *obj;
+	int ret;
+
+	resume_path = db_index_path(MUSIC_DB, "resume");
+	if (!resume_path)
+		return ;
+	ret = playlist_resume_read(resume_path, &resume);
+	free(resume_path);
+	if (ret)
+		return ;
+
+	snprintf(msg, sizeof(msg), "Resume playback at %u:%02u ?",
+		 resume.time_in_ms / 60000, (resume.time_in_ms / 1000) % 60);
+	db_hdl = db_open(MUSIC_DB);
+	if (db_hdl && !db_track_get(db_hdl, resume.track_id, &track)) {
+		snprintf(msg, sizeof(msg), "Resume %s at %u:%02u ?", track.title,
+			 resume.time_in_ms / 60000, (resume.time_in_ms / 1000) % 60);
+		db_track_put(db_hdl, &track);
+	}
+	if (db_hdl)
+		db_close(db_hdl);
+
+	obj = lv_obj_create(lv_scr_act(), NULL);
+	lv_obj_set_style_local_bg_color(obj, LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_COLOR_BLACK);
+	lv_obj_set_style_local_bg_opa(obj, LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_OPA_20);
+	lv_obj_set_pos(obj, 0, 0);
+	lv_obj_set_size(obj, LV_HOR_RES, LV_VER_RES);
+
+	resume_mbox = lv_msgbox_create(obj, NULL);
+	lv_obj_set_width(resume_mbox, LV_HOR_RES - 40);
+	lv_msgbox_set_text(resume_mbox, msg);
+	lv_msgbox_add_btns(resume_mbox, resume_btns);
+	lv_obj_align(resume_mbox, NULL, LV_ALIGN_CENTER, 0, 0);
+	lv_obj_set_event_cb(resume_mbox, resume_event_handler);
+}
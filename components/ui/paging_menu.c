@@ -11,6 +11,7 @@
 #define container_of(ptr, type, member) ({ \
 	const typeof( ((type *)0)->member ) *__mptr = (ptr); \
 	(type *)( (char *)__mptr - offsetof(type,member) );})
+#define MIN(a,b)	((a) < (b) ? (a) : (b))
 
 static const char* TAG = "rv3.paging_menu";
 
@@ -31,9 +32,14 @@ struct paging_menu {
 	lv_obj_t *scr;
 	lv_obj_t *btn[MENU_BTN_NB];
 	lv_obj_t *label[MENU_BTN_NB];
+	lv_obj_t *thumb[3];
+	lv_img_dsc_t thumb_dsc[3];
+	uint16_t *thumb_pixels;
 	int page_nb;
 	int page_count;
 	int item_nb;
+	/* lvgl still send clicked event on release after a long press */
+	int is_click_ignored;
 	struct paging_cbs *client_cbs;
 	void *ctx;
 };
@@ -64,6 +70,7 @@ static void paging_menu_destroy(struct paging_menu *menu)
 	if (menu->client_cbs->destroy)
 		menu->client_cbs->destroy(menu->ctx);
 	lv_obj_del(menu->scr);
+	free(menu->thumb_pixels);
 	free(menu);
 }
 
@@ -116,6 +123,22 @@ static enum menu_button get_btn_id_from_obj(struct paging_menu *menu, lv_obj_t *
 	return MENU_BTN_NB;
 }
 
+static void paging_menu_setup_thumb(struct paging_menu *menu, int slot, int index)
+{
+	int size = menu->client_cbs->thumb_size;
+	uint16_t *pixels = &menu->thumb_pixels[slot * size * size];
+	int ret;
+
+	ret = menu->client_cbs->get_item_thumb(menu->ctx, index, pixels);
+	lv_obj_set_hidden(menu->thumb[slot], ret != 0);
+	if (ret)
+		return;
+
+	/* same descriptor with new pixels, drop lvgl cached version */
+	lv_img_cache_invalidate_src(&menu->thumb_dsc[slot]);
+	lv_img_set_src(menu->thumb[slot], &menu->thumb_dsc[slot]);
+}
+
 static void paging_menu_setup_page(struct paging_menu *menu, int page_nb)
 {
 	int page_start = page_nb * 3;
@@ -136,25 +159,45 @@ static void paging_menu_setup_page(struct paging_menu *menu, int page_nb)
 		lv_label_set_text(menu->label[btn_id], item_name);
 		if (menu->client_cbs->put_item_label)
 			menu->client_cbs->put_item_label(menu->ctx, item_name);
+		if (menu->thumb_pixels)
+			paging_menu_setup_thumb(menu, btn_id - MENU_BTN_0, i);
 	}
 	for (i = page_end; i < page_start + 3; i++, btn_id++)
 		lv_obj_set_hidden(menu->btn[btn_id], true);
 }
 
-static void paging_menu_event_long_pressed_cb(struct paging_menu *menu, enum menu_button btn_id)
+static void paging_menu_jump(struct paging_menu *menu, int direction)
 {
-	if (!menu->client_cbs->long_select_item)
+	int index = menu->page_nb * 3;
+
+	/* going forward starts from page last item so we always leave the page */
+	if (direction > 0)
+		index = MIN(index + 2, menu->item_nb - 1);
+	index = menu->client_cbs->jump(menu->ctx, index, direction);
+	if (index < 0 || index >= menu->item_nb)
 		return;
 
+	paging_menu_setup_page(menu, index / 3);
+}
+
+static void paging_menu_event_long_pressed_cb(struct paging_menu *menu, enum menu_button btn_id)
+{
 	switch (btn_id) {
 	case MENU_MENU:
 	case MENU_BACK:
+		break;
 	case MENU_UP:
 	case MENU_DOWN:
+		if (!menu->client_cbs->jump)
+			break;
+		menu->is_click_ignored = 1;
+		paging_menu_jump(menu, btn_id == MENU_DOWN ? 1 : -1);
 		break;
 	case MENU_BTN_0:
 	case MENU_BTN_1:
 	case MENU_BTN_2:
+		if (!menu->client_cbs->long_select_item)
+			break;
 		ESP_LOGI(TAG, "You select %s", lv_label_get_text(menu->label[btn_id]));
 		menu->client_cbs->long_select_item(menu->ctx,
 						   lv_label_get_text(menu->label[btn_id]),
@@ -206,6 +249,11 @@ static void paging_menu_event_cb(lv_obj_t *btn, lv_event_t event)
 		return ;
 	btn_id = get_btn_id_from_obj(menu, btn);
 
+	if (event == LV_EVENT_CLICKED && menu->is_click_ignored) {
+		menu->is_click_ignored = 0;
+		return;
+	}
+
 	if (event == LV_EVENT_LONG_PRESSED)
 		paging_menu_event_long_pressed_cb(menu, btn_id);
 	else
@@ -223,6 +271,32 @@ static void setup_new_screen(struct paging_menu *menu)
 	lv_obj_set_size(menu->scr, 320, 240);
 }
 
+static void setup_thumbs(struct paging_menu *menu)
+{
+	int size = menu->client_cbs->thumb_size;
+	int i;
+
+	menu->thumb_pixels = malloc(3 * size * size * sizeof(uint16_t));
+	if (!menu->thumb_pixels)
+		return;
+
+	for (i = 0; i < 3; i++) {
+		menu->thumb_dsc[i].header.always_zero = 0;
+		menu->thumb_dsc[i].header.w = size;
+		menu->thumb_dsc[i].header.h = size;
+		menu->thumb_dsc[i].header.cf = LV_IMG_CF_TRUE_COLOR;
+		menu->thumb_dsc[i].data_size = size * size * sizeof(uint16_t);
+		menu->thumb_dsc[i].data = (uint8_t *) &menu->thumb_pixels[i * size * size];
+		menu->thumb[i] = lv_img_create(menu->btn[MENU_BTN_0 + i], NULL);
+		assert(menu->thumb[i]);
+		lv_obj_align(menu->thumb[i], NULL, LV_ALIGN_IN_LEFT_MID, 2, 0);
+		lv_obj_set_hidden(menu->thumb[i], true);
+		/* leave room for thumbnail */
+		lv_obj_set_width(menu->label[MENU_BTN_0 + i], 120 - size - 4);
+		lv_obj_align(menu->label[MENU_BTN_0 + i], NULL, LV_ALIGN_IN_RIGHT_MID, -2, 0);
+	}
+}
+
 static void setup_paging_menu(struct paging_menu *menu)
 {
 	const int sizes[MENU_BTN_NB][2] = {
@@ -253,6 +327,8 @@ static void setup_paging_menu(struct paging_menu *menu)
 		lv_obj_set_width(menu->label[i], sizes[i][0]);
 		lv_label_set_align(menu->label[i], LV_LABEL_ALIGN_CENTER);
 	}
+	if (menu->client_cbs->get_item_thumb)
+		setup_thumbs(menu);
 
 	if (!menu->client_cbs->is_root || !menu->client_cbs->is_root(menu->ctx)) {
 		lv_obj_set_hidden(menu->btn[MENU_MENU], false);
@@ -9,12 +9,15 @@
 
 #include "paging_menu.h"
 #include "db.h"
+#include "db_smart.h"
 #include "playlist.h"
 #include "music_player.h"
 #include "utils.h"
 
 static const char* TAG = "rv3.playlist_menu";
 
+#define MUSIC_DB		"/sdcard/music.db"
+
 struct playlist_entry {
 	int is_dir;
 	char *name;
@@ -158,6 +161,36 @@ static void playlist_select_dir(struct playlist_menu *menu, int index)
 	free(dir);
 }
 
+static int is_smart_playlist(char *name)
+{
+	int len = strlen(name);
+
+	return len > 6 && strcmp(name + len - 6, ".smart") == 0;
+}
+
+static void *create_smart_playlist(void *db_hdl, char *pls)
+{
+	void *playlist_hdl;
+	uint32_t *ids;
+	int id_nb;
+	int ret;
+
+	ret = db_smart_eval(MUSIC_DB, pls, &ids, &id_nb);
+	if (ret || !id_nb) {
+		ESP_LOGW(TAG, "no track match smart playlist %s", pls);
+		if (!ret)
+			db_smart_put_ids(ids);
+		db_close(db_hdl);
+		return NULL;
+	}
+	playlist_hdl = playlist_create_from_tracks(db_hdl, ids, id_nb);
+	db_smart_put_ids(ids);
+	if (!playlist_hdl)
+		db_close(db_hdl);
+
+	return playlist_hdl;
+}
+
 static void playlist_select_pls(struct playlist_menu *menu, int index)
 {
 	void *playlist_hdl;
@@ -165,13 +198,20 @@ static void playlist_select_pls(struct playlist_menu *menu, int index)
 	char *pls;
 
 	/* db will be close on playlist destroy */
-	db_hdl = db_open("/sdcard/music.db");
+	db_hdl = db_open(MUSIC_DB);
 	assert(db_hdl);
 	pls = concat_with_delim(menu->path, menu->entries[index]->name, '/');
 	assert(pls);
-	playlist_hdl = playlist_create_from_file(db_hdl, pls);
-	assert(playlist_hdl);
-	free(pls);
+	if (is_smart_playlist(menu->entries[index]->name)) {
+		playlist_hdl = create_smart_playlist(db_hdl, pls);
+		free(pls);
+		if (!playlist_hdl)
+			return ;
+	} else {
+		playlist_hdl = playlist_create_from_file(db_hdl, pls);
+		assert(playlist_hdl);
+		free(pls);
+	}
 	music_player_create(playlist_hdl);
 }
 
@@ -11,6 +11,7 @@
 #include "lvgl.h"
 #include "esp_log.h"
 
+#include "audio.h"
 #include "radio_player.h"
 #include "wifi.h"
 #include "paging_menu.h"
@@ -47,6 +48,13 @@ struct radio {
 	char *rate;
 	char *meta;
 	char *anti_ad;
+	/* watchdog thresholds, kbps and seconds */
+	char *min_kbps;
+	char *stall_time;
+	/* keep connected while next to playing station */
+	char *warm;
+	/* "kbps:path,..." bitrate variants of path */
+	char *variants;
 };
 
 struct radio_menu {
@@ -183,6 +191,26 @@ static int primitive_is_anti_ad(struct db_parser *dbp, jsmntok_t *t)
 	return primitive_is_string(dbp, t, "anti_ad");
 }
 
+static int primitive_is_min_kbps(struct db_parser *dbp, jsmntok_t *t)
+{
+	return primitive_is_string(dbp, t, "min_kbps");
+}
+
+static int primitive_is_stall_time(struct db_parser *dbp, jsmntok_t *t)
+{
+	return primitive_is_string(dbp, t, "stall_time");
+}
+
+static int primitive_is_warm(struct db_parser *dbp, jsmntok_t *t)
+{
+	return primitive_is_string(dbp, t, "warm");
+}
+
+static int primitive_is_variants(struct db_parser *dbp, jsmntok_t *t)
+{
+	return primitive_is_string(dbp, t, "variants");
+}
+
 static jsmntok_t *fetch_next_token(struct db_parser *dbp)
 {
 	jsmntok_t *t;
@@ -296,6 +324,10 @@ static struct entry *parse_radio_in_range(struct db_parser *dbp, int start, int
 	char *rate = NULL;
 	char *meta = NULL;
 	char *anti_ad = NULL;
+	char *min_kbps = NULL;
+	char *stall_time = NULL;
+	char *warm = NULL;
+	char *variants = NULL;
 
 	while (t) {
 		//print_token(dbp, t);
@@ -313,6 +345,14 @@ static struct entry *parse_radio_in_range(struct db_parser *dbp, int start, int
 			meta = dup_next_string_in_range(dbp, start, end);
 		else if (primitive_is_anti_ad(dbp, t))
 			anti_ad = dup_next_string_in_range(dbp, start, end);
+		else if (primitive_is_min_kbps(dbp, t))
+			min_kbps = dup_next_string_in_range(dbp, start, end);
+		else if (primitive_is_stall_time(dbp, t))
+			stall_time = dup_next_string_in_range(dbp, start, end);
+		else if (primitive_is_warm(dbp, t))
+			warm = dup_next_string_in_range(dbp, start, end);
+		else if (primitive_is_variants(dbp, t))
+			variants = dup_next_string_in_range(dbp, start, end);
 		t = fetch_next_token_in_range(dbp, start, end);
 	}
 	radio = malloc(sizeof(*radio));
@@ -327,6 +367,10 @@ static struct entry *parse_radio_in_range(struct db_parser *dbp, int start, int
 		radio->rate = rate;
 		radio->meta = meta;
 		radio->anti_ad = anti_ad;
+		radio->min_kbps = min_kbps;
+		radio->stall_time = stall_time;
+		radio->warm = warm;
+		radio->variants = variants;
 	} else {
 		if (radio)
 			free(radio);
@@ -344,6 +388,14 @@ static struct entry *parse_radio_in_range(struct db_parser *dbp, int start, int
 			free(meta);
 		if (anti_ad)
 			free(anti_ad);
+		if (min_kbps)
+			free(min_kbps);
+		if (stall_time)
+			free(stall_time);
+		if (warm)
+			free(warm);
+		if (variants)
+			free(variants);
 		radio = NULL;
 		return NULL;
 	}
@@ -436,6 +488,14 @@ static void radio_db_delete(struct entry *root)
 				free(radio->meta);
 			if (radio->anti_ad)
 				free(radio->anti_ad);
+			if (radio->min_kbps)
+				free(radio->min_kbps);
+			if (radio->stall_time)
+				free(radio->stall_time);
+			if (radio->warm)
+				free(radio->warm);
+			if (radio->variants)
+				free(radio->variants);
 			free(radio);
 		} else if (current->type == ENTRY_FOLDER) {
 			radio_db_delete(current->sub);
@@ -474,8 +534,10 @@ static void radio_menu_destroy(void *ctx)
 {
 	struct radio_menu *menu = ctx;
 
-	if (menu->is_root)
+	if (menu->is_root) {
+		audio_radio_cool();
 		radio_db_delete(menu->entries);
+	}
 
 	free(menu);
 }
@@ -499,13 +561,59 @@ static void radio_menu_put_item_label(void *ctx, char *item_label)
 	free(item_label);
 }
 
-static void radio_menu_select_radio(struct radio_menu *menu, struct entry *entry)
+static int radio_is_warm(struct entry *entry)
+{
+	struct radio *radio = container_of(entry, struct radio, entry);
+
+	return entry->type == ENTRY_RADIO && radio->warm && atoi(radio->warm);
+}
+
+/* connect ahead to station in slot if it asks for it, release slot otherwise */
+static void radio_menu_warm(int slot, struct entry *entry)
+{
+	struct radio *radio = entry ? container_of(entry, struct radio, entry) : NULL;
+
+	if (!entry || !radio_is_warm(entry)) {
+		audio_radio_warm(slot, NULL, NULL, NULL, 0, 0);
+		return ;
+	}
+
+	ESP_LOGI(TAG, "warm radio %s", entry->name);
+	audio_radio_warm(slot, radio->url, radio->port, radio->path,
+			 radio->meta ? atoi(radio->meta) : 0, radio->anti_ad ? atoi(radio->anti_ad) : 0);
+}
+
+/* nothing plays yet when menu is shown, first stations listed that ask for
+ * it are warmed instead of neighbours.
+ */
+static void radio_menu_warm_listed(struct radio_menu *menu)
+{
+	struct entry *entry;
+	int slot = 0;
+
+	for (entry = menu->entries; entry && slot < AUDIO_RADIO_WARM_NB; entry = entry->next) {
+		if (radio_is_warm(entry))
+			radio_menu_warm(slot++, entry);
+	}
+	for (; slot < AUDIO_RADIO_WARM_NB; slot++)
+		radio_menu_warm(slot, NULL);
+}
+
+/* once a station plays, its neighbours are warmed as they're the ones
+ * switched to next.
+ */
+static void radio_menu_select_radio(struct radio_menu *menu, struct entry *entry, int index)
 {
 	struct radio *radio = container_of(entry, struct radio, entry);
 
 	ESP_LOGI(TAG, "select radio %s", entry->name);
+	audio_radio_set_variants(radio->variants);
 	radio_player_create(entry->name, radio->url, radio->port, radio->path, atoi(radio->rate),
-			    radio->meta ? atoi(radio->meta) : 0, radio->anti_ad ? atoi(radio->anti_ad) : 0);
+			    radio->meta ? atoi(radio->meta) : 0, radio->anti_ad ? atoi(radio->anti_ad) : 0,
+			    radio->min_kbps ? atoi(radio->min_kbps) : 0,
+			    radio->stall_time ? atoi(radio->stall_time) : 0);
+	radio_menu_warm(0, index ? entry_get_at_index(menu->entries, index - 1) : NULL);
+	radio_menu_warm(1, entry->next);
 }
 
 static void radio_menu_select_folder(struct radio_menu *menu, struct entry *entry)
@@ -533,7 +641,7 @@ static void radio_menu_select_item(void *ctx, char *selected_label, int index)
 
 	switch (entry->type) {
 	case ENTRY_RADIO:
-		radio_menu_select_radio(menu, entry);
+		radio_menu_select_radio(menu, entry, index);
 		break;
 	case ENTRY_FOLDER:
 		radio_menu_select_folder(menu, entry);
@@ -570,6 +678,7 @@ static ui_hdl radio_menu_create_with_entry(struct entry *root, int is_root)
 		free(menu);
 		return NULL;
 	}
+	radio_menu_warm_listed(menu);
 
 	return paging;
 }
@@ -1,5 +1,7 @@
 #include "radio_player.h"
 
+#include <stdio.h>
+#include <string.h>
 #include <assert.h>
 
 #include "lvgl.h"
@@ -8,8 +10,12 @@
 #include "audio.h"
 
 #include "system_menu.h"
+#include "sdcard.h"
 #include "fonts.h"
 
+/* rewind button step */
+#define REWIND_SEC		30
+
 #define container_of(ptr, type, member) ({ \
 	const typeof( ((type *)0)->member ) *__mptr = (ptr); \
 	(type *)( (char *)__mptr - offsetof(type,member) );})
@@ -19,6 +25,10 @@ enum radio_player_button {
 	RADIO_PLAYER_BACK,
 	RADIO_PLAYER_UP,
 	RADIO_PLAYER_DOWN,
+	RADIO_PLAYER_REWIND,
+	RADIO_PLAYER_PAUSE,
+	RADIO_PLAYER_LIVE,
+	RADIO_PLAYER_RECORD,
 	RADIO_PLAYER_NB
 };
 
@@ -32,6 +42,8 @@ struct radio_player {
 	lv_obj_t *bar_level;
 	lv_obj_t *sound_level;
 	lv_task_t *task_level;
+	int delay;
+	char *radio_label;
 };
 
 static inline struct radio_player *get_radio_player()
@@ -45,6 +57,7 @@ static void radio_player_destroy(struct radio_player *player)
 	lv_task_del(player->task_level);
 	audio_radio_stop();
 	lv_obj_del(player->scr);
+	free(player->radio_label);
 	free(player);
 }
 
@@ -89,7 +102,8 @@ static void radio_player_event_cb(lv_obj_t *btn, lv_event_t event)
 
 	if( event != LV_EVENT_CLICKED && event != LV_EVENT_LONG_PRESSED_REPEAT)
 		return;
-	if (event == LV_EVENT_LONG_PRESSED_REPEAT && btn_id != RADIO_PLAYER_UP && btn_id != RADIO_PLAYER_DOWN)
+	if (event == LV_EVENT_LONG_PRESSED_REPEAT && btn_id != RADIO_PLAYER_UP &&
+	    btn_id != RADIO_PLAYER_DOWN && btn_id != RADIO_PLAYER_REWIND)
 		return;
 
 	switch (btn_id) {
@@ -107,6 +121,29 @@ static void radio_player_event_cb(lv_obj_t *btn, lv_event_t event)
 		lv_bar_set_value(player->sound_level,  audio_sound_level_down(),
 				 LV_ANIM_ON);
 		break;
+	case RADIO_PLAYER_REWIND:
+		audio_radio_seek(-REWIND_SEC);
+		break;
+	case RADIO_PLAYER_PAUSE:
+		if (audio_radio_is_paused())
+			audio_radio_resume();
+		else
+			audio_radio_pause();
+		lv_label_set_text(player->label[RADIO_PLAYER_PAUSE],
+				  audio_radio_is_paused() ? LV_SYMBOL_PLAY : LV_SYMBOL_PAUSE);
+		break;
+	case RADIO_PLAYER_LIVE:
+		audio_radio_live();
+		lv_label_set_text(player->label[RADIO_PLAYER_PAUSE], LV_SYMBOL_PAUSE);
+		break;
+	case RADIO_PLAYER_RECORD:
+		if (audio_radio_is_recording())
+			audio_radio_record_stop();
+		else
+			audio_radio_record(player->radio_label);
+		lv_btn_set_state(btn, audio_radio_is_recording() ? LV_BTN_STATE_CHECKED_RELEASED :
+								   LV_BTN_STATE_RELEASED);
+		break;
 	default:
 		assert(0);
 	}
@@ -116,7 +153,21 @@ static void task_level_cb(struct _lv_task_t *task)
 {
 	struct radio_player *player = get_radio_player();
 
+	char info[16];
+	int delay;
+
 	lv_bar_set_value(player->bar_level, audio_buffer_level(), LV_ANIM_ON);
+
+	/* time behind live radio */
+	delay = audio_radio_delay();
+	if (delay == player->delay)
+		return ;
+	player->delay = delay;
+	if (delay)
+		snprintf(info, sizeof(info), "-%d:%02d", delay / 60, delay % 60);
+	else
+		info[0] = '\0';
+	system_menu_set_user_label(info);
 }
 
 static void setup_new_screen(struct radio_player *player)
@@ -138,16 +189,19 @@ static void radio_player_track_info_cb(void *hdl, char *track_title)
 
 static void radio_player_screen(struct radio_player *player, const char *radio_label,
 				const char *url, const char * port_nb, const char *path,
-				int rate, int meta, int anti_ad)
+				int rate, int meta, int anti_ad, int min_kbps,
+				int stall_time_in_sec)
 {
 	const int sizes[RADIO_PLAYER_NB][2] = {
-		{60, 55}, {60, 55}, {60, 55}, {60, 55}
+		{60, 55}, {60, 55}, {60, 55}, {60, 55}, {44, 40}, {44, 40}, {44, 40}, {60, 40}
 	};
 	const lv_point_t pos[RADIO_PLAYER_NB] = {
-		{20, 24}, {20, 168}, {240, 24}, {240, 168}
+		{20, 24}, {20, 168}, {240, 24}, {240, 168}, {88, 190}, {138, 190}, {188, 190},
+		{130, 10}
 	};
 	const char *labels[RADIO_PLAYER_NB] = {
-		"MENU", "BACK", "UP", "DOWN"
+		"MENU", "BACK", "UP", "DOWN", LV_SYMBOL_PREV, LV_SYMBOL_PAUSE, LV_SYMBOL_NEXT,
+		"REC"
 	};
 	int i;
 
@@ -192,13 +246,18 @@ static void radio_player_screen(struct radio_player *player, const char *radio_l
 	player->task_level = lv_task_create(task_level_cb, 250, LV_TASK_PRIO_LOW, NULL);
 	assert(player->task_level);
 
+	audio_radio_set_watchdog(min_kbps, stall_time_in_sec * 1000);
 	audio_radio_play((char *) url, (char *) port_nb, (char *) path, rate, meta,
 			 anti_ad, player, radio_player_track_info_cb);
+	/* no sdcard, no time-shift nor recording */
+	for (i = RADIO_PLAYER_REWIND; i <= RADIO_PLAYER_LIVE; i++)
+		lv_obj_set_hidden(player->btn[i], !audio_radio_is_timeshift());
+	lv_obj_set_hidden(player->btn[RADIO_PLAYER_RECORD], !sdcard_is_present());
 }
 
 ui_hdl radio_player_create(const char *radio_label, const char *url,
 			   const char *port_nb, const char *path, int rate,
-			   int meta, int anti_ad)
+			   int meta, int anti_ad, int min_kbps, int stall_time_in_sec)
 {
 	struct radio_player *player;
 
@@ -207,9 +266,15 @@ ui_hdl radio_player_create(const char *radio_label, const char *url,
 		return NULL;
 	memset(player, 0, sizeof(*player));
 
+	player->radio_label = strdup(radio_label);
+	if (!player->radio_label) {
+		free(player);
+		return NULL;
+	}
 	player->prev_scr = lv_disp_get_scr_act(NULL);
 	player->cbs.destroy_chained = destroy_chained;
-	radio_player_screen(player, radio_label, url, port_nb, path, rate, meta, anti_ad);
+	radio_player_screen(player, radio_label, url, port_nb, path, rate, meta, anti_ad,
+			    min_kbps, stall_time_in_sec);
 	system_menu_set_user_label("");
 
 	return &player->cbs;
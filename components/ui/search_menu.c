@@ -0,0 +1,171 @@
+#include "search_menu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lvgl.h"
+#include "esp_log.h"
+
+#include "db.h"
+#include "db_search.h"
+#include "keyboard.h"
+#include "track_menu.h"
+#include "system_menu.h"
+
+#define container_of(ptr, type, member) ({ \
+	const typeof( ((type *)0)->member ) *__mptr = (ptr); \
+	(type *)( (char *)__mptr - offsetof(type,member) );})
+
+#define SEARCH_RESULT_NB	30
+
+static const char* TAG = "rv3.search_menu";
+
+struct search_menu {
+	struct ui_cbs cbs;
+	lv_obj_t *prev_scr;
+	lv_obj_t *scr;
+	lv_obj_t *back_btn;
+	lv_obj_t *label_status;
+	void *kb;
+	void *db_hdl;
+	void *search_hdl;
+	struct db_search_result results[SEARCH_RESULT_NB];
+};
+
+static void search_menu_destroy(struct search_menu *menu)
+{
+	db_search_close(menu->search_hdl);
+	db_close(menu->db_hdl);
+	lv_obj_del(menu->scr);
+	keyboard_destroy(menu->kb);
+	free(menu);
+}
+
+static void search_leave(struct search_menu *menu)
+{
+	ui_hdl prev = lv_obj_get_user_data(menu->prev_scr);
+
+	lv_disp_load_scr(menu->prev_scr);
+	if (prev->restore_event)
+		prev->restore_event(prev);
+
+	search_menu_destroy(menu);
+}
+
+static void destroy_chained(struct ui_cbs *cbs)
+{
+	struct search_menu *menu = container_of(cbs, struct search_menu, cbs);
+	ui_hdl prev = lv_obj_get_user_data(menu->prev_scr);
+
+	prev->destroy_chained(prev);
+	search_menu_destroy(menu);
+}
+
+static void restore_event(struct ui_cbs *cbs)
+{
+	system_menu_set_user_label("search");
+}
+
+static void kb_done_cb(void *ctx, char *text)
+{
+	struct search_menu *menu = ctx;
+	struct db_track *tracks;
+	int result_nb;
+	int i;
+
+	result_nb = db_search(menu->search_hdl, text, menu->results, SEARCH_RESULT_NB);
+	if (result_nb <= 0) {
+		lv_label_set_text(menu->label_status, "no result");
+		return;
+	}
+
+	tracks = malloc(result_nb * sizeof(struct db_track));
+	if (!tracks) {
+		db_search_put_results(menu->search_hdl, menu->results, result_nb);
+		return;
+	}
+	for (i = 0; i < result_nb; i++)
+		tracks[i] = menu->results[i].track;
+
+	lv_label_set_text(menu->label_status, "");
+	track_menu_create(menu->db_hdl, tracks, result_nb);
+}
+
+static void back_event_cb(lv_obj_t *btn, lv_event_t event)
+{
+	struct search_menu *menu = lv_obj_get_user_data(btn);
+
+	if (event != LV_EVENT_CLICKED)
+		return;
+
+	search_leave(menu);
+}
+
+static void setup_search_screen(struct search_menu *menu)
+{
+	lv_obj_t *label;
+
+	menu->scr = lv_obj_create(NULL, NULL);
+	assert(menu->scr);
+	lv_obj_set_user_data(menu->scr, &menu->cbs);
+	lv_disp_load_scr(menu->scr);
+	lv_obj_set_size(menu->scr, 320, 240);
+
+	menu->label_status = lv_label_create(menu->scr, NULL);
+	assert(menu->label_status);
+	lv_label_set_text(menu->label_status, "");
+	lv_obj_set_pos(menu->label_status, 10, 60);
+
+	menu->back_btn = lv_btn_create(menu->scr, NULL);
+	assert(menu->back_btn);
+	lv_obj_set_user_data(menu->back_btn, menu);
+	lv_obj_set_size(menu->back_btn, 60, 55);
+	lv_obj_set_pos(menu->back_btn, 250, 170);
+	label = lv_label_create(menu->back_btn, NULL);
+	assert(label);
+	lv_label_set_text(label, "BACK");
+	lv_obj_set_event_cb(menu->back_btn, back_event_cb);
+}
+
+ui_hdl search_menu_create()
+{
+	struct search_menu *menu;
+
+	menu = malloc(sizeof(*menu));
+	if (!menu)
+		return NULL;
+	memset(menu, 0, sizeof(*menu));
+
+	menu->db_hdl = db_open("/sdcard/music.db");
+	if (!menu->db_hdl)
+		goto db_open_error;
+	menu->search_hdl = db_search_open("/sdcard/music.db");
+	if (!menu->search_hdl) {
+		ESP_LOGW(TAG, "no search index. Please update db");
+		goto search_open_error;
+	}
+
+	menu->prev_scr = lv_disp_get_scr_act(NULL);
+	menu->cbs.destroy_chained = destroy_chained;
+	menu->cbs.restore_event = restore_event;
+	setup_search_screen(menu);
+	menu->kb = keyboard_create(menu->scr, kb_done_cb, menu);
+	if (!menu->kb)
+		goto keyboard_error;
+	restore_event(&menu->cbs);
+
+	return &menu->cbs;
+
+keyboard_error:
+	lv_disp_load_scr(menu->prev_scr);
+	lv_obj_del(menu->scr);
+	db_search_close(menu->search_hdl);
+search_open_error:
+	db_close(menu->db_hdl);
+db_open_error:
+	free(menu);
+
+	return NULL;
+}
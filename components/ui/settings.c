@@ -1,6 +1,7 @@
 #include "settings.h"
 
 #include <stdio.h>
+#include <errno.h>
 #include <assert.h>
 #include <sys/types.h>
 #include <sys/socket.h>
@@ -103,11 +104,9 @@ static void about_event_handler(lv_obj_t * obj, lv_event_t event)
 	}
 }
 
-static void display_about_message()
+static void display_message(const char *msg)
 {
-	char msg[128];
 	lv_obj_t *obj;
-	const esp_app_desc_t *app_desc = esp_ota_get_app_description();
 
 	obj = lv_obj_create(lv_scr_act(), NULL);
 	lv_obj_set_style_local_bg_color(obj, LV_OBJ_PART_MAIN, LV_STATE_DEFAULT, LV_COLOR_BLACK);
@@ -117,13 +116,19 @@ static void display_about_message()
 
 	mbox = lv_msgbox_create(obj, NULL);
 	lv_obj_set_width(mbox, LV_HOR_RES - 40);
-	snprintf(msg, sizeof(msg), "%s", app_desc->version);
 	lv_msgbox_set_text(mbox, msg);
 	lv_msgbox_add_btns(mbox, btns_about);
 	lv_obj_align(mbox, NULL, LV_ALIGN_CENTER, 0, 0);
 	lv_obj_set_event_cb(mbox, about_event_handler);
 }
 
+static void display_about_message()
+{
+	const esp_app_desc_t *app_desc = esp_ota_get_app_description();
+
+	display_message(app_desc->version);
+}
+
 static int vnetwork(const char *format, va_list va)
 {
 	int res = vsnprintf(console_buffer, CONSOLE_BUFFER_LEN, format, va);
@@ -218,7 +223,9 @@ static void settings_select_item(void *ctx, char *selected_label, int index)
 		ota_update_start(mbox);
 		break;
 	case 1:
-		update_db("/sdcard/music.db", "/sdcard/Music");
+		/* index can't be replaced while music player reads it */
+		if (update_db("/sdcard/music.db", "/sdcard/Music") == -EBUSY)
+			display_message("Music is in use, stop it and retry");
 		break;
 	case 0:
 		if (!wifi_is_connected())
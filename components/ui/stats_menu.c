@@ -0,0 +1,91 @@
+#include "stats_menu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "lvgl.h"
+#include "esp_log.h"
+
+#include "db.h"
+#include "db_stats.h"
+#include "paging_menu.h"
+#include "track_menu.h"
+
+#define ARRAY_SIZE(a)		(sizeof(a)/sizeof(a[0]))
+#define STATS_TRACK_NB		50
+
+static const char* TAG = "rv3.stats_menu";
+
+static const char *stats_labels[] = {"most played", "recently played", "never played"};
+static const enum db_stats_list stats_lists[] = {
+	DB_STATS_MOST_PLAYED, DB_STATS_RECENTLY_PLAYED, DB_STATS_NEVER_PLAYED
+};
+
+struct stats_menu {
+	void *db_hdl;
+};
+
+static void stats_destroy(void *ctx)
+{
+	struct stats_menu *menu = ctx;
+
+	db_close(menu->db_hdl);
+	free(menu);
+}
+
+static char *stats_get_item_label(void *ctx, int index)
+{
+	return (char *) stats_labels[index];
+}
+
+static void stats_select_item(void *ctx, char *selected_label, int index)
+{
+	struct stats_menu *menu = ctx;
+	struct db_track *tracks;
+	int track_nb;
+
+	tracks = malloc(STATS_TRACK_NB * sizeof(struct db_track));
+	if (!tracks)
+		return;
+
+	track_nb = db_stats_list("/sdcard/music.db", stats_lists[index], tracks, STATS_TRACK_NB);
+	ESP_LOGI(TAG, "%s has %d tracks", selected_label, track_nb);
+	if (track_nb <= 0) {
+		free(tracks);
+		return;
+	}
+
+	track_menu_create(menu->db_hdl, tracks, track_nb);
+}
+
+static struct paging_cbs cbs = {
+	.destroy = stats_destroy,
+	.get_item_label = stats_get_item_label,
+	.select_item = stats_select_item,
+};
+
+ui_hdl stats_menu_create()
+{
+	struct stats_menu *menu;
+	ui_hdl paging;
+
+	menu = malloc(sizeof(*menu));
+	if (!menu)
+		return NULL;
+
+	menu->db_hdl = db_open("/sdcard/music.db");
+	if (!menu->db_hdl) {
+		free(menu);
+		return NULL;
+	}
+
+	paging = paging_menu_create(ARRAY_SIZE(stats_labels), &cbs, menu);
+	if (!paging) {
+		db_close(menu->db_hdl);
+		free(menu);
+		return NULL;
+	}
+
+	return paging;
+}
@@ -0,0 +1,123 @@
+#include "track_menu.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "lvgl.h"
+#include "esp_log.h"
+
+#include "db.h"
+#include "paging_menu.h"
+#include "music_player.h"
+#include "playlist.h"
+
+static const char* TAG = "rv3.track_menu";
+
+struct track_menu {
+	void *db_hdl;
+	struct db_track *tracks;
+	int track_nb;
+};
+
+static void track_destroy(void *ctx)
+{
+	struct track_menu *menu = ctx;
+	int i;
+
+	for (i = 0; i < menu->track_nb; i++)
+		db_index_put_track(&menu->tracks[i]);
+	free(menu->tracks);
+	free(menu);
+}
+
+static char *track_get_item_label(void *ctx, int index)
+{
+	struct track_menu *menu = ctx;
+	struct db_track *track = &menu->tracks[index];
+	int len = strlen(track->title) + strlen(track->artist) + 4;
+	char *label;
+
+	label = malloc(len);
+	if (label)
+		snprintf(label, len, "%s / %s", track->title, track->artist);
+
+	return label;
+}
+
+static void track_put_item_label(void *ctx, char *item_label)
+{
+	free(item_label);
+}
+
+static void track_select_item(void *ctx, char *selected_label, int index)
+{
+	struct track_menu *menu = ctx;
+	struct db_track *track = &menu->tracks[index];
+	void *playlist_hdl;
+
+	ESP_LOGI(TAG, "selected %s", track->filepath);
+	playlist_hdl = playlist_create(menu->db_hdl);
+	assert(playlist_hdl);
+	playlist_add_track(playlist_hdl, track->id);
+	music_player_create(playlist_hdl);
+}
+
+static void track_long_select_item(void *ctx, char *selected_label, int index)
+{
+	struct track_menu *menu = ctx;
+	struct db_track *track = &menu->tracks[index];
+	void *playlist_hdl;
+	char *songname;
+	int song_nb;
+	int i;
+
+	playlist_hdl = playlist_create(menu->db_hdl);
+	assert(playlist_hdl);
+	song_nb = db_song_get_nb(menu->db_hdl, track->artist, track->album);
+	for (i = 0 ; i < song_nb; i++) {
+		songname = db_song_get(menu->db_hdl, track->artist, track->album, i);
+		if (!songname)
+			continue;
+		playlist_add_song(playlist_hdl, track->artist, track->album, songname);
+		db_put_item(menu->db_hdl, songname);
+	}
+	music_player_create(playlist_hdl);
+}
+
+static struct paging_cbs cbs = {
+	.destroy = track_destroy,
+	.get_item_label = track_get_item_label,
+	.put_item_label = track_put_item_label,
+	.select_item = track_select_item,
+	.long_select_item = track_long_select_item,
+};
+
+ui_hdl track_menu_create(void *db_hdl, struct db_track *tracks, int track_nb)
+{
+	struct track_menu *menu;
+	ui_hdl paging;
+
+	menu = malloc(sizeof(*menu));
+	if (!menu)
+		goto error;
+
+	menu->db_hdl = db_hdl;
+	menu->tracks = tracks;
+	menu->track_nb = track_nb;
+	paging = paging_menu_create(track_nb, &cbs, menu);
+	if (!paging) {
+		track_destroy(menu);
+		return NULL;
+	}
+
+	return paging;
+
+error:
+	while (track_nb--)
+		db_index_put_track(&tracks[track_nb]);
+	free(tracks);
+
+	return NULL;
+}
@@ -10,6 +10,7 @@
 #include "esp_log.h"
 
 #include "system_menu.h"
+#include "keyboard.h"
 
 #define container_of(ptr, type, member) ({ \
 	const typeof( ((type *)0)->member ) *__mptr = (ptr); \
@@ -17,15 +18,6 @@
 
 static const char* TAG = "rv3.settings.wifi";
 
-enum kb_button {
-	KB_LEFT,
-	KB_CHAR,
-	KB_RIGHT,
-	KB_DELETE,
-	KB_DONE,
-	KB_BTN_NB
-};
-
 typedef void (*cb)(lv_obj_t *scr, lv_event_t event);
 
 struct wifi_setting_menu {
@@ -35,10 +27,7 @@ struct wifi_setting_menu {
 	lv_obj_t *label_status;
 	lv_obj_t *btn[3];
 	lv_obj_t *label[3];
-	lv_obj_t *ta;
-	lv_obj_t *kb_btn[KB_BTN_NB];
-	lv_obj_t *kb_label[KB_BTN_NB];
-	char kb_current[2];
+	void *kb;
 	char *ssid;
 };
 
@@ -57,65 +46,25 @@ static void wifi_leave(struct wifi_setting_menu *wifi)
 		prev->restore_event(prev);
 
 	lv_obj_del(wifi->scr);
+	if (wifi->kb)
+		keyboard_destroy(wifi->kb);
 	if (wifi->ssid)
 		free(wifi->ssid);
 	free(wifi);
 }
 
-static enum kb_button get_btn_id_from_obj(struct wifi_setting_menu *wifi, lv_obj_t *btn)
+static void kb_done_cb(void *ctx, char *text)
 {
-	int i;
-
-	for (i = 0; i < KB_BTN_NB; i++) {
-		if (wifi->kb_btn[i] == btn)
-			return i;
-	}
-
-	return KB_BTN_NB;
-}
-
-static void kb_event_cb(lv_obj_t *btn, lv_event_t event)
-{
-	struct wifi_setting_menu *wifi = get_wifi_setting();
-	enum kb_button btn_id = get_btn_id_from_obj(wifi, btn);
+	struct wifi_setting_menu *wifi = ctx;
 	int ret;
 
-	if( event != LV_EVENT_CLICKED && event != LV_EVENT_LONG_PRESSED_REPEAT)
-		return;
-	if (event == LV_EVENT_LONG_PRESSED_REPEAT && btn_id != KB_LEFT && btn_id != KB_RIGHT)
-		return;
-
-	switch (btn_id) {
-	case KB_LEFT:
-		wifi->kb_current[0]--;
-		if (wifi->kb_current[0] < 0x20)
-			wifi->kb_current[0] = 0x7E;
-		lv_label_set_text(wifi->kb_label[KB_CHAR], wifi->kb_current);
-		break;
-	case KB_RIGHT:
-		wifi->kb_current[0]++;
-		if (wifi->kb_current[0] >0x7E)
-			wifi->kb_current[0] = 0x20;
-		lv_label_set_text(wifi->kb_label[KB_CHAR], wifi->kb_current);
-		break;
-	case KB_CHAR:
-		lv_textarea_add_char(wifi->ta, wifi->kb_current[0]);
-		break;
-	case KB_DELETE:
-		lv_textarea_del_char(wifi->ta);
-		break;
-	case KB_DONE:
-		printf("ssid = %s\n", wifi->ssid);
-		printf("passwd = %s\n", lv_textarea_get_text(wifi->ta));
-		ret = wifi_set_credentials(wifi->ssid, (char *) lv_textarea_get_text(wifi->ta));
-		if (!ret)
-			wifi_connect_start();
+	printf("ssid = %s\n", wifi->ssid);
+	printf("passwd = %s\n", text);
+	ret = wifi_set_credentials(wifi->ssid, text);
+	if (!ret)
+		wifi_connect_start();
 
-		wifi_leave(wifi);
-		break;
-	default:
-		assert(0);
-	}
+	wifi_leave(wifi);
 }
 
 static int sort_by_rssi(const void *a, const void *b)
@@ -145,38 +94,11 @@ static void setup_new_screen(struct wifi_setting_menu *wifi)
 
 static void setup_pwd_screen(struct wifi_setting_menu *wifi)
 {
-	const int sizes[KB_BTN_NB][2] = {
-		{60, 55}, {60, 55}, {60, 55}, {60, 55}, {120, 55}
-	};
-	const lv_point_t pos[KB_BTN_NB] = {
-		{10, 80}, {130, 80}, {250, 80},
-		{10, 170}, {130, 170}
-	};
-	const char *labels[KB_BTN_NB] = {
-		"<", "a", ">", "del", "done"
-	};
-	int i;
-
 	setup_new_screen(wifi);
 
-	wifi->ta = lv_textarea_create(wifi->scr, NULL);
-	lv_textarea_set_one_line(wifi->ta, true);
-	lv_obj_align(wifi->ta, NULL, LV_ALIGN_IN_TOP_MID, 0, 10);
-	lv_obj_set_y(wifi->ta, 24);
-	lv_textarea_set_text(wifi->ta, "");
-
-	wifi->kb_current[0] = labels[KB_CHAR][0];
-	wifi->kb_current[1] = '\0';
-	for (i = 0; i < KB_BTN_NB; i++) {
-		wifi->kb_btn[i] = lv_btn_create(wifi->scr, NULL);
-		assert(wifi->kb_btn[i]);
-		lv_obj_set_size(wifi->kb_btn[i], sizes[i][0], sizes[i][1]);
-		lv_obj_set_pos(wifi->kb_btn[i], pos[i].x, pos[i].y);
-		wifi->kb_label[i] = lv_label_create(wifi->kb_btn[i], NULL);
-		assert(wifi->kb_label[i]);
-		lv_label_set_text(wifi->kb_label[i], labels[i]);
-		lv_obj_set_event_cb(wifi->kb_btn[i], kb_event_cb);
-	}
+	wifi->kb = keyboard_create(wifi->scr, kb_done_cb, wifi);
+	if (!wifi->kb)
+		wifi_leave(wifi);
 }
 
 static void select_ssid_cb(lv_obj_t *btn, lv_event_t event)
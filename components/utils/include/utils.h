@@ -2,6 +2,8 @@
 #define __UTILS__ 1
 
 #include <stddef.h>
+#include <stdint.h>
+#include <sys/types.h>
 
 #define container_of(ptr, type, member) ({ \
 	const typeof( ((type *)0)->member ) *__mptr = (ptr); \
@@ -10,6 +12,9 @@
 #define ARRAY_SIZE(a)		(sizeof(a)/sizeof(a[0]))
 #define MIN(a,b)		((a)<(b)?(a):(b))
 
+/* offset basis to start a fnv1a() hash with */
+#define FNV1A_INIT		2166136261u
+
 typedef int (*walk_dir_entry_cb)(char *root, char *filename, void *arg);
 typedef int (*walk_dir_leave_cb)(char *root, void *arg);
 
@@ -24,7 +29,12 @@ char *concat(char *str1, char *str2);
 char *concat3(char *str1, char *str2, char *str3);
 char *concat4(char *str1, char *str2, char *str3, char *str4);
 char *concat_with_delim(char *str1, char *str2, char delim);
+void sanitize_path(char *name);
+int utf8_fold(const char *str, char *buf, int buf_len);
 int walk_dir(char *root, struct walk_dir_cbs *cbs, void *arg);
 int remove_directories(char *dir);
+int read_at(int fd, off_t offset, void *buf, int len);
+int write_at(int fd, off_t offset, void *buf, int len);
+uint32_t fnv1a(uint32_t hash, const void *data, int len);
 
 #endif
@@ -5,11 +5,29 @@
 #include <string.h>
 #include <sys/types.h>
 #include <dirent.h>
+#include <unistd.h>
 
 #include "esp_log.h"
 
 static const char* TAG = "rv3.utils";
 
+/* ascii fallback for U+00C0 - U+00FF */
+static const char *latin1_fold[64] = {
+	"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+	"d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th", "ss",
+	"a", "a", "a", "a", "a", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+	"d", "n", "o", "o", "o", "o", "o", " ", "o", "u", "u", "u", "u", "y", "th", "y"
+};
+
+/* ascii fallback for U+0100 - U+017F */
+static const char latin_ext_a_fold[] =
+	"aaaaaaccccccccdddd"
+	"eeeeeeeeeegggggggghhhh"
+	"iiiiiiiiiijjjjkkk"
+	"llllllllllnnnnnnnnn"
+	"oooooooorrrrrrssssssss"
+	"ttttttuuuuuuuuuuuuwwyyyzzzzzzs";
+
 static int remove_file(char *dir, char *name, void *arg)
 {
 	char *fp;
@@ -105,6 +123,83 @@ char *concat_with_delim(char *str1, char *str2, char delim)
 	return res;
 }
 
+static int utf8_decode(const unsigned char *str, unsigned int *cp)
+{
+	if (str[0] < 0x80) {
+		*cp = str[0];
+		return 1;
+	}
+	if ((str[0] & 0xe0) == 0xc0 && (str[1] & 0xc0) == 0x80) {
+		*cp = ((str[0] & 0x1f) << 6) | (str[1] & 0x3f);
+		return 2;
+	}
+	if ((str[0] & 0xf0) == 0xe0 && (str[1] & 0xc0) == 0x80 &&
+	    (str[2] & 0xc0) == 0x80) {
+		*cp = ((str[0] & 0x0f) << 12) | ((str[1] & 0x3f) << 6) | (str[2] & 0x3f);
+		return 3;
+	}
+
+	/* invalid or 4 bytes sequence, keep byte as is */
+	*cp = 0;
+	return 1;
+}
+
+void sanitize_path(char *name)
+{
+	int len = strlen(name);
+	int i;
+
+	for (i = 0; i < len; ++i) {
+		if (name[i] == '/' || name[i] == '?' || name[i] == ':' ||
+		    name[i] == '"')
+			name[i] = '_';
+	}
+}
+
+int utf8_fold(const char *str, char *buf, int buf_len)
+{
+	const unsigned char *s = (const unsigned char *) str;
+	const char *fold;
+	char one[2] = {0, 0};
+	unsigned int cp;
+	int len = 0;
+	int n;
+	int i;
+
+	while (*s) {
+		n = utf8_decode(s, &cp);
+		fold = NULL;
+		if (cp && cp < 0x80) {
+			one[0] = (cp >= 'A' && cp <= 'Z') ? cp + 'a' - 'A' : cp;
+			fold = one;
+		} else if (cp >= 0xc0 && cp <= 0xff) {
+			fold = latin1_fold[cp - 0xc0];
+		} else if (cp == 0x132 || cp == 0x133) {
+			fold = "ij";
+		} else if (cp == 0x152 || cp == 0x153) {
+			fold = "oe";
+		} else if (cp >= 0x100 && cp <= 0x17f) {
+			one[0] = latin_ext_a_fold[cp - 0x100];
+			fold = one;
+		}
+
+		if (fold) {
+			while (*fold && len < buf_len - 1)
+				buf[len++] = *fold++;
+		} else {
+			/* no fallback, copy utf8 sequence as is */
+			if (len + n > buf_len - 1)
+				break;
+			for (i = 0; i < n; i++)
+				buf[len++] = s[i];
+		}
+		s += n;
+	}
+	buf[len] = '\0';
+
+	return len;
+}
+
 int walk_dir(char *root, struct walk_dir_cbs *cbs, void *arg)
 {
 	struct dirent *entry;
@@ -174,3 +269,39 @@ int remove_directories(char *dir)
 	cbs.exit_cb = remove_dir;
 	return walk_dir(dir, &cbs, NULL);
 }
+
+/* 0 once len bytes are transferred at offset, -1 otherwise */
+int read_at(int fd, off_t offset, void *buf, int len)
+{
+	int ret;
+
+	if (lseek(fd, offset, SEEK_SET) != offset)
+		return -1;
+	ret = read(fd, buf, len);
+
+	return ret == len ? 0 : -1;
+}
+
+int write_at(int fd, off_t offset, void *buf, int len)
+{
+	int ret;
+
+	if (lseek(fd, offset, SEEK_SET) != offset)
+		return -1;
+	ret = write(fd, buf, len);
+
+	return ret == len ? 0 : -1;
+}
+
+/* 32 bits fnv-1a, hash is FNV1A_INIT or result of a previous call */
+uint32_t fnv1a(uint32_t hash, const void *data, int len)
+{
+	const uint8_t *p = data;
+
+	while (len--) {
+		hash ^= *p++;
+		hash *= 16777619u;
+	}
+
+	return hash;
+}
@@ -12,10 +12,18 @@
 #include "mongoose.h"
 #include "ring.h"
 #include "system.h"
+#include "db.h"
+#include "db_search.h"
+#include "audio.h"
+#include "fetch_file.h"
+#include "fetch_socket_radio.h"
+#include "timeshift.h"
+#include "record.h"
 
 #define MIN(a,b)	((a) < (b) ? (a) : (b))
 #define RING_SZ_KB	(64)
 #define BUFFER_SZ	(8 * 1024)
+#define SEARCH_RESULT_NB	20
 
 static const char* TAG = "rv3.web_server";
 
@@ -308,13 +316,24 @@ internal_error:
 
 static void handle_get_system(struct mg_connection *nc)
 {
+	struct fetch_socket_radio_stats radio_stats;
+	struct fetch_file_stats music_stats;
+	struct timeshift_stats timeshift_stats;
+	struct record_stats record_stats;
 	uint64_t total_size;
 	uint64_t free_size;
+	int cache_hit_nb;
+	int cache_miss_nb;
 	int ret;
 
 	ret = system_get_sdcard_info(&total_size, &free_size);
 	if (ret)
 		goto error;
+	audio_music_stats(&music_stats);
+	audio_radio_stats(&radio_stats);
+	audio_radio_timeshift_stats(&timeshift_stats);
+	audio_radio_record_stats(&record_stats);
+	db_cache_stats(&cache_hit_nb, &cache_miss_nb);
 
 	mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\n"
 		  "Content-Type: application/json; charset=utf-8"
@@ -322,8 +341,37 @@ static void handle_get_system(struct mg_connection *nc)
 
 	mg_printf_http_chunk(nc, "{");
 	mg_printf_http_chunk(nc, "\"name\": \"%s\",", system_get_name());
-	mg_printf_http_chunk(nc, "\"sdcard\": {\"total\": %lld, \"free\": %lld}",
+	mg_printf_http_chunk(nc, "\"sdcard\": {\"total\": %lld, \"free\": %lld},",
 			     total_size, free_size);
+	mg_printf_http_chunk(nc, "\"music\": {\"bytes\": %u, \"reads\": %u, "
+			     "\"read_time_ms\": %u, \"max_read_time_ms\": %u, \"starvations\": %u},",
+			     music_stats.bytes, music_stats.read_nb, music_stats.read_time_in_ms,
+			     music_stats.max_read_time_in_ms, music_stats.starve_nb);
+	mg_printf_http_chunk(nc, "\"db\": {\"album_cache_hits\": %d, \"album_cache_misses\": %d},",
+			     cache_hit_nb, cache_miss_nb);
+	mg_printf_http_chunk(nc, "\"timeshift\": {\"writes\": %u, \"write_time_ms\": %u, "
+			     "\"max_write_time_ms\": %u, \"drop_bytes\": %u, \"overruns\": %u},",
+			     timeshift_stats.write_nb, timeshift_stats.write_time_in_ms,
+			     timeshift_stats.max_write_time_in_ms, timeshift_stats.drop_bytes,
+			     timeshift_stats.overrun_nb);
+	mg_printf_http_chunk(nc, "\"record\": {\"files\": %u, \"bytes\": %u, \"writes\": %u, "
+			     "\"write_time_ms\": %u, \"max_write_time_ms\": %u, \"drop_bytes\": %u},",
+			     record_stats.file_nb, record_stats.bytes, record_stats.write_nb,
+			     record_stats.write_time_in_ms, record_stats.max_write_time_in_ms,
+			     record_stats.drop_bytes);
+	mg_printf_http_chunk(nc, "\"radio\": {\"bytes\": %u, \"connects\": %u, \"reconnects\": %u, "
+			     "\"last_recover_time_ms\": %u, \"max_recover_time_ms\": %u, "
+			     "\"watchdog_trips\": %u, \"watchdog_reason\": \"%s\", "
+			     "\"variant_kbps\": %u, \"variant_switches\": %u, "
+			     "\"segments\": %u, \"last_segment_latency_ms\": %u, "
+			     "\"max_segment_latency_ms\": %u, \"buffer_level\": %d}",
+			     radio_stats.bytes, radio_stats.connect_nb, radio_stats.reconnect_nb,
+			     radio_stats.last_recover_time_in_ms, radio_stats.max_recover_time_in_ms,
+			     radio_stats.watchdog_nb,
+			     radio_stats.watchdog_reason ? radio_stats.watchdog_reason : "",
+			     radio_stats.variant_kbps, radio_stats.variant_switch_nb,
+			     radio_stats.segment_nb, radio_stats.last_segment_latency_in_ms,
+			     radio_stats.max_segment_latency_in_ms, audio_buffer_level());
 	mg_printf_http_chunk(nc, "}");
 
 	mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
@@ -356,6 +404,88 @@ internal_error:
 		  "Content-Length: 0\r\n\r\n");
 }
 
+static void send_json_string(struct mg_connection *nc, char *str)
+{
+	char buffer[128];
+	int pos = 0;
+
+	buffer[pos++] = '"';
+	for (; *str; str++) {
+		if (pos > (int) sizeof(buffer) - 8) {
+			mg_send_http_chunk(nc, buffer, pos);
+			pos = 0;
+		}
+		if (*str == '"' || *str == '\\') {
+			buffer[pos++] = '\\';
+			buffer[pos++] = *str;
+		} else if ((unsigned char) *str < 0x20) {
+			pos += sprintf(&buffer[pos], "\\u%04x", *str);
+		} else
+			buffer[pos++] = *str;
+	}
+	buffer[pos++] = '"';
+	mg_send_http_chunk(nc, buffer, pos);
+}
+
+static void handle_search(struct mg_connection *nc, struct http_message *hm)
+{
+	struct db_search_result *results;
+	char query[64];
+	void *search;
+	int result_nb;
+	int i;
+
+	if (mg_get_http_var(&hm->query_string, "q", query, sizeof(query)) <= 0)
+		goto bad_request;
+
+	results = malloc(SEARCH_RESULT_NB * sizeof(*results));
+	if (!results)
+		goto internal_error;
+	search = db_search_open("/sdcard/music.db");
+	if (!search) {
+		free(results);
+		goto internal_error;
+	}
+	result_nb = db_search(search, query, results, SEARCH_RESULT_NB);
+
+	mg_printf(nc, "%s", "HTTP/1.1 200 OK\r\n"
+		  "Content-Type: application/json; charset=utf-8"
+		  "\r\nTransfer-Encoding: chunked\r\n\r\n");
+	mg_printf_http_chunk(nc, "[");
+	for (i = 0; i < result_nb; i++) {
+		struct db_track *track = &results[i].track;
+
+		mg_printf_http_chunk(nc, "%c{\"score\": %d, \"artist\": ", i ? ',' : ' ',
+				     results[i].score);
+		send_json_string(nc, track->artist);
+		mg_printf_http_chunk(nc, ", \"album\": ");
+		send_json_string(nc, track->album);
+		mg_printf_http_chunk(nc, ", \"title\": ");
+		send_json_string(nc, track->title);
+		mg_printf_http_chunk(nc, ", \"path\": ");
+		send_json_string(nc, track->filepath);
+		mg_printf_http_chunk(nc, ", \"duration\": %d, \"bitrate\": %d, \"samplerate\": %d}",
+				     track->duration_in_ms, track->bitrate, track->samplerate);
+	}
+	mg_printf_http_chunk(nc, "]\n");
+	mg_send_http_chunk(nc, "", 0); /* Send empty chunk, the end of response */
+
+	db_search_put_results(search, results, result_nb > 0 ? result_nb : 0);
+	db_search_close(search);
+	free(results);
+
+	return ;
+
+bad_request:
+	mg_printf(nc, "%s", "HTTP/1.0 400 Bad Request\r\n"
+		  "Content-Length: 0\r\n\r\n");
+	return ;
+
+internal_error:
+	mg_printf(nc, "%s", "HTTP/1.0 500 Internal Server Error\r\n"
+		  "Content-Length: 0\r\n\r\n");
+}
+
 static void ev_handler(struct mg_connection *nc, int ev, void *ev_data)
 {
 	static const struct mg_str dir_api_prefix = MG_MK_STR("/api/v1/dir");
@@ -399,6 +529,11 @@ static void ev_handler(struct mg_connection *nc, int ev, void *ev_data)
 				handle_set_system(nc, hm);
 			else
 				goto not_found;
+		} else if (mg_vcmp(&hm->uri, "/api/v1/search") == 0) {
+			if (mg_strcmp(hm->method, s_get_method) == 0)
+				handle_search(nc, hm);
+			else
+				goto not_found;
 		} else
 			mg_serve_http(nc, hm, opts);
 		break;
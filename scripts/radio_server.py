@@ -0,0 +1,146 @@
+import argparse
+import random
+import socketserver
+import sys
+import time
+
+# Stand-in for an internet radio that misbehaves. It streams an mp3 file in a
+# loop at its nominal bitrate with icy metadata and randomly drops, stalls,
+# trickles or refuses connections so reconnection and watchdog of the radio
+# can be exercised. Extra paths may serve other bitrate variants and
+# bandwidth may be periodically congested to exercise variant switching.
+# http.server is not used since its 'copy' import would pick copy.py from
+# this directory.
+
+CHUNK_SZ = 1024
+
+class RadioHandler(socketserver.StreamRequestHandler):
+	def log_message(self, msg):
+		sys.stderr.write("%s %s %s\n" % (time.strftime("%H:%M:%S"), self.client_address[0], msg))
+
+	def read_headers(self):
+		headers = {}
+		self.path = self.rfile.readline().decode('latin-1').split(' ')[1]
+		while True:
+			line = self.rfile.readline().decode('latin-1').strip()
+			if not line:
+				break
+			key, _, value = line.partition(':')
+			headers[key.strip().lower()] = value.strip()
+
+		return headers
+
+	def handle(self):
+		opts = self.server.opts
+		headers = self.read_headers()
+		if random.random() < opts.refuse:
+			self.log_message("refuse connection")
+			self.wfile.write(b"HTTP/1.0 503 Service Unavailable\r\nContent-Length: 0\r\n\r\n")
+			return
+
+		metaint = opts.metaint if headers.get('icy-metadata') == '1' else 0
+		hdr = "HTTP/1.0 200 OK\r\nContent-Type: audio/mpeg\r\nicy-name: radiov3 test radio\r\n"
+		if metaint:
+			hdr += "icy-metaint: %d\r\n" % metaint
+		self.wfile.write((hdr + "\r\n").encode('latin-1'))
+
+		data, bitrate = self.server.variants.get(self.path, (self.server.data, opts.bitrate))
+		duration = random.expovariate(1.0 / opts.drop_mean)
+		if random.random() < opts.trickle:
+			bitrate = opts.trickle_rate
+		self.log_message("stream %s for %.1f s at %d kbps (metaint %d)" % (self.path, duration, bitrate, metaint))
+		try:
+			self.stream(duration, metaint, data, bitrate)
+		except (BrokenPipeError, ConnectionResetError):
+			self.log_message("client went away")
+
+	def rate(self, bitrate):
+		opts = self.server.opts
+		if opts.congestion_period and int(time.time() / opts.congestion_period) % 2:
+			return min(bitrate, opts.congestion_kbps)
+
+		return bitrate
+
+	def stream(self, duration, metaint, data, bitrate):
+		opts = self.server.opts
+		start = time.time()
+		# a burst is sent at connection, then stream is paced at its rate
+		deadline = start - opts.burst
+		sent = 0
+		pos = random.randrange(len(data))
+		to_meta = metaint
+		while time.time() - start < duration:
+			if random.random() < opts.stall:
+				self.log_message("stall for %d s" % opts.stall_time)
+				time.sleep(opts.stall_time)
+			size = CHUNK_SZ
+			if metaint:
+				size = min(size, to_meta)
+			chunk = data[pos:pos + size]
+			if not chunk:
+				pos = 0
+				continue
+			self.wfile.write(chunk)
+			pos += len(chunk)
+			sent += len(chunk)
+			if metaint:
+				to_meta -= len(chunk)
+				if to_meta == 0:
+					self.wfile.write(self.metadata())
+					to_meta = metaint
+			deadline += len(chunk) / (self.rate(bitrate) * 1000 / 8)
+			ahead = deadline - time.time()
+			if ahead > 0:
+				time.sleep(ahead)
+		self.log_message("drop connection after %d bytes" % sent)
+
+	def metadata(self):
+		title = "StreamTitle='Test Artist - Song %d';" % (int(time.time()) // 30)
+		payload = title.encode('utf-8')
+		blocks = (len(payload) + 15) // 16
+		payload = payload.ljust(blocks * 16, b'\0')
+
+		return bytes([blocks]) + payload
+
+class RadioServer(socketserver.ThreadingMixIn, socketserver.TCPServer):
+	allow_reuse_address = True
+	daemon_threads = True
+
+def main():
+	parser = argparse.ArgumentParser(description='unreliable icy radio server')
+	parser.add_argument('file', help='mp3 file to stream in a loop')
+	parser.add_argument('--port', type=int, default=8000)
+	parser.add_argument('--bitrate', type=int, default=128, help='kbps used to pace stream')
+	parser.add_argument('--metaint', type=int, default=16000)
+	parser.add_argument('--drop-mean', type=float, default=30, help='mean connection duration in s')
+	parser.add_argument('--refuse', type=float, default=0.2, help='probability to answer 503')
+	parser.add_argument('--stall', type=float, default=0.0005, help='probability to stall per chunk')
+	parser.add_argument('--stall-time', type=int, default=15)
+	parser.add_argument('--trickle', type=float, default=0, help='probability to send at trickle rate')
+	parser.add_argument('--trickle-rate', type=int, default=4, help='kbps of trickling connection')
+	parser.add_argument('--variant', action='append', default=[], metavar='PATH=FILE:KBPS',
+			    help='serve FILE at KBPS on PATH, other paths get main file')
+	parser.add_argument('--congestion-period', type=float, default=0,
+			    help='bandwidth is capped every other period of that many s')
+	parser.add_argument('--congestion-kbps', type=int, default=48)
+	parser.add_argument('--burst', type=float, default=2, help='seconds sent ahead at connection')
+	opts = parser.parse_args()
+
+	server = RadioServer(('', opts.port), RadioHandler)
+	server.opts = opts
+	server.data = open(opts.file, 'rb').read()
+	server.variants = {}
+	for variant in opts.variant:
+		path, _, spec = variant.partition('=')
+		filename, _, kbps = spec.rpartition(':')
+		server.variants[path] = (open(filename, 'rb').read(), int(kbps))
+	print("serving %s on port %d" % (opts.file, opts.port))
+	server.serve_forever()
+
+if __name__ == '__main__':
+	# example python3 scripts/radio_server.py song.mp3 --port 8000 --drop-mean 20
+	# then add station 192.168.1.2:8000 with path / on the radio
+	# variants: song.mp3 --bitrate 128 --variant /lo=song-32.mp3:32
+	# --congestion-period 60 --congestion-kbps 64 and station variants
+	# "128:/,32:/lo"
+	main()
@@ -14,7 +14,11 @@ function radiolist_to_nodes(radiolist)
 					  'port': radiolist[i]['port'],
 					  'rate': radiolist[i]['rate'],
 					  'meta': radiolist[i]['meta'] ? radiolist[i]['meta'] : '0',
-					  'anti_ad': radiolist[i]['anti_ad'] ? radiolist[i]['anti_ad'] : '0'});
+					  'anti_ad': radiolist[i]['anti_ad'] ? radiolist[i]['anti_ad'] : '0',
+					  'min_kbps': radiolist[i]['min_kbps'] ? radiolist[i]['min_kbps'] : '0',
+					  'stall_time': radiolist[i]['stall_time'] ? radiolist[i]['stall_time'] : '0',
+					  'warm': radiolist[i]['warm'] ? radiolist[i]['warm'] : '0',
+					  'variants': radiolist[i]['variants'] ? radiolist[i]['variants'] : ''});
 		} else {
 			res.push({'name': radiolist[i]['folder'], children: radiolist_to_nodes(radiolist[i]['entries'])});
 		}
@@ -37,7 +41,11 @@ function nodes_to_radiolist(nods)
 					  'port': nods[i]['port'],
 					  'rate': nods[i]['rate'],
 					  'meta': nods[i]['meta'],
-					  'anti_ad': nods[i]['anti_ad']});
+					  'anti_ad': nods[i]['anti_ad'],
+					  'min_kbps': nods[i]['min_kbps'],
+					  'stall_time': nods[i]['stall_time'],
+					  'warm': nods[i]['warm'],
+					  'variants': nods[i]['variants']});
 		} else {
 			res.push({'folder': nods[i]['name'], 'entries': nodes_to_radiolist(nods[i]['children'])});
 		}
@@ -112,9 +120,25 @@ function edit_node(radio)
 		<input type=\"text\" name=\"meta\" value=\"" + radio['meta'] + "\"> \
 	</div>\
 	<div class=\"form-radio\">\
-		<label for=\"anti_ad\">anti_ad: </label> \
+		<label for=\"anti_ad\">anti_ad (s): </label> \
 		<input type=\"text\" name=\"anti_ad\" value=\"" + radio['anti_ad'] + "\"> \
 	</div>\
+	<div class=\"form-radio\">\
+		<label for=\"min_kbps\">min_kbps: </label> \
+		<input type=\"text\" name=\"min_kbps\" value=\"" + radio['min_kbps'] + "\"> \
+	</div>\
+	<div class=\"form-radio\">\
+		<label for=\"stall_time\">stall_time (s): </label> \
+		<input type=\"text\" name=\"stall_time\" value=\"" + radio['stall_time'] + "\"> \
+	</div>\
+	<div class=\"form-radio\">\
+		<label for=\"warm\">warm: </label> \
+		<input type=\"text\" name=\"warm\" value=\"" + radio['warm'] + "\"> \
+	</div>\
+	<div class=\"form-radio\">\
+		<label for=\"variants\">variants (kbps:path,...): </label> \
+		<input type=\"text\" name=\"variants\" value=\"" + radio['variants'] + "\"> \
+	</div>\
 </form>\
 	"));
 
@@ -173,7 +197,11 @@ function add_radio()
 							  'port': '80',
 							  'rate': '44100',
 							  'meta': '0',
-							  'anti_ad': '0'});
+							  'anti_ad': '0',
+							  'min_kbps': '0',
+							  'stall_time': '0',
+							  'warm': '0',
+							  'variants': ''});
 }
 
 function edit_radio()
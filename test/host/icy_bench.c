@@ -0,0 +1,93 @@
+/* icy_demux() throughput for the chunk sizes socket reads give, on a
+ * stream with metadata every 16000 bytes as most shoutcast servers send.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "icy.h"
+
+#define METAINT		16000
+#define AUDIO_SZ	(4 * 1024 * 1024)
+#define STREAM_MAX_SZ	(AUDIO_SZ + AUDIO_SZ / METAINT * 256)
+#define RUN_TIME_S	1
+
+static char sink[METAINT];
+static int title_nb;
+
+/* audio is copied out like player does into its buffer */
+static int audio_cb(void *data, int data_len, void *cb_ctx)
+{
+	memcpy(sink, data, data_len);
+
+	return 0;
+}
+
+static void title_cb(char *title, void *cb_ctx)
+{
+	title_nb++;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	static const int sizes[] = { 512, 1460, 4096, 16384 };
+	struct icy *icy = malloc(sizeof(*icy));
+	char *stream = malloc(STREAM_MAX_SZ);
+	int stream_len = 0;
+	double elapsed;
+	double start;
+	long bytes;
+	char meta[128];
+	int blk_nb;
+	int len;
+	int s;
+	int i;
+
+	if (!icy || !stream)
+		return 1;
+
+	for (i = 0; i + METAINT <= AUDIO_SZ; i += METAINT) {
+		memset(&stream[stream_len], i, METAINT);
+		stream_len += METAINT;
+		snprintf(meta, sizeof(meta), "StreamTitle='Artist %d - Song %d';StreamUrl='';",
+			 i / METAINT / 10, i / METAINT / 10);
+		blk_nb = (strlen(meta) + 15) / 16;
+		stream[stream_len++] = blk_nb;
+		memset(&stream[stream_len], 0, blk_nb * 16);
+		memcpy(&stream[stream_len], meta, strlen(meta));
+		stream_len += blk_nb * 16;
+	}
+
+	icy_init(icy, audio_cb, title_cb, NULL);
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		bytes = 0;
+		start = now();
+		do {
+			icy_reset(icy);
+			icy_set_metaint(icy, METAINT);
+			for (i = 0; i < stream_len; i += len) {
+				len = stream_len - i < sizes[s] ? stream_len - i : sizes[s];
+				if (icy_demux(icy, &stream[i], len))
+					return 1;
+			}
+			bytes += stream_len;
+			elapsed = now() - start;
+		} while (elapsed < RUN_TIME_S);
+		printf("icy_demux: %5d byte chunks, %.0f MB/s\n", sizes[s], bytes / 1e6 / elapsed);
+	}
+	free(stream);
+	free(icy);
+
+	/* keeps sink copies */
+	return title_nb && sink[0] != 1 ? 0 : 1;
+}
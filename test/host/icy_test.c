@@ -0,0 +1,210 @@
+/* icy demuxer unit tests. A stream with a metadata block every METAINT
+ * audio bytes is fed in chunks of various sizes, audio must come out
+ * unchanged and titles notified once per change.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "icy.h"
+
+#define METAINT		1000
+#define AUDIO_SZ	(METAINT * 40)
+#define STREAM_MAX_SZ	(AUDIO_SZ * 2)
+
+#define CHECK(cond) do { \
+	if (!(cond)) { \
+		fprintf(stderr, "%s:%d: %s\n", __func__, __LINE__, #cond); \
+		return -1; \
+	} \
+} while (0)
+
+static char audio[AUDIO_SZ];
+static char stream[STREAM_MAX_SZ];
+static int stream_len;
+
+static char out[AUDIO_SZ];
+static int out_len;
+static char last_title[ICY_TITLE_MAX_SZ];
+static int title_nb;
+
+static int audio_cb(void *data, int data_len, void *cb_ctx)
+{
+	if (out_len + data_len > sizeof(out))
+		return -1;
+	memcpy(&out[out_len], data, data_len);
+	out_len += data_len;
+
+	return 0;
+}
+
+static void title_cb(char *title, void *cb_ctx)
+{
+	snprintf(last_title, sizeof(last_title), "%s", title);
+	title_nb++;
+}
+
+static void put_meta(const char *meta)
+{
+	int blk_nb = (strlen(meta) + 15) / 16;
+
+	stream[stream_len++] = blk_nb;
+	memset(&stream[stream_len], 0, blk_nb * 16);
+	memcpy(&stream[stream_len], meta, strlen(meta));
+	stream_len += blk_nb * 16;
+}
+
+/* song changes every 4 blocks, one block out of 3 is empty */
+static void build_stream(void)
+{
+	char meta[128];
+	int i;
+
+	for (i = 0; i < AUDIO_SZ; i++)
+		audio[i] = rand();
+	stream_len = 0;
+	for (i = 0; i < AUDIO_SZ / METAINT; i++) {
+		memcpy(&stream[stream_len], &audio[i * METAINT], METAINT);
+		stream_len += METAINT;
+		if (i % 3 == 2) {
+			stream[stream_len++] = 0;
+			continue;
+		}
+		snprintf(meta, sizeof(meta), "StreamTitle='Artist %d - Song %d';StreamUrl='';",
+			 i / 4, i / 4);
+		put_meta(meta);
+	}
+}
+
+static void reset(struct icy *icy, int metaint)
+{
+	icy_init(icy, audio_cb, title_cb, NULL);
+	icy_set_metaint(icy, metaint);
+	out_len = 0;
+	title_nb = 0;
+	last_title[0] = '\0';
+}
+
+static int test_chunks(struct icy *icy)
+{
+	static const int sizes[] = { 1, 2, 7, 16, METAINT - 1, METAINT + 1, 4096, STREAM_MAX_SZ };
+	int song_nb = (AUDIO_SZ / METAINT - 1) / 4 + 1;
+	int len;
+	int s;
+	int i;
+
+	for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+		reset(icy, METAINT);
+		for (i = 0; i < stream_len; i += len) {
+			len = stream_len - i < sizes[s] ? stream_len - i : sizes[s];
+			CHECK(icy_demux(icy, &stream[i], len) == 0);
+		}
+		CHECK(out_len == AUDIO_SZ);
+		CHECK(memcmp(out, audio, AUDIO_SZ) == 0);
+		CHECK(title_nb == song_nb);
+		CHECK(strcmp(last_title, "Artist 9\n-\nSong 9") == 0);
+	}
+
+	return 0;
+}
+
+/* notifying a new listener while a block with a new title is half received */
+static int test_notify_in_block(struct icy *icy)
+{
+	int split;
+
+	stream_len = 0;
+	memcpy(stream, audio, METAINT);
+	stream_len += METAINT;
+	put_meta("StreamTitle='First';");
+	memcpy(&stream[stream_len], &audio[METAINT], METAINT);
+	stream_len += METAINT;
+	split = stream_len + 1 + 10;
+	put_meta("StreamTitle='Second';");
+	memcpy(&stream[stream_len], &audio[METAINT * 2], METAINT);
+	stream_len += METAINT;
+
+	reset(icy, METAINT);
+	CHECK(icy_demux(icy, stream, split) == 0);
+	CHECK(title_nb == 1);
+	icy_notify(icy);
+	CHECK(title_nb == 2);
+	CHECK(strcmp(last_title, "First") == 0);
+
+	CHECK(icy_demux(icy, &stream[split], stream_len - split) == 0);
+	CHECK(title_nb == 3);
+	CHECK(strcmp(last_title, "Second") == 0);
+	CHECK(out_len == METAINT * 3);
+	CHECK(memcmp(out, audio, METAINT * 3) == 0);
+
+	return 0;
+}
+
+/* a reconnect gets current title again, it must not be notified twice */
+static int test_reset(struct icy *icy)
+{
+	reset(icy, METAINT);
+	CHECK(icy_demux(icy, stream, METAINT * 2) == 0);
+	CHECK(title_nb == 1);
+	icy_reset(icy);
+	icy_set_metaint(icy, METAINT);
+	CHECK(icy_demux(icy, stream, METAINT * 2) == 0);
+	CHECK(title_nb == 1);
+
+	return 0;
+}
+
+static int test_no_metaint(struct icy *icy)
+{
+	reset(icy, 0);
+	CHECK(icy_demux(icy, audio, AUDIO_SZ) == 0);
+	CHECK(out_len == AUDIO_SZ);
+	CHECK(memcmp(out, audio, AUDIO_SZ) == 0);
+	CHECK(title_nb == 0);
+
+	return 0;
+}
+
+static int test_long_title(struct icy *icy)
+{
+	char meta[ICY_META_MAX_SZ];
+	int len;
+
+	/* no terminating quote, title runs to end of block */
+	len = snprintf(meta, sizeof(meta), "StreamTitle='");
+	memset(&meta[len], 'x', 1000);
+	meta[len + 1000] = '\0';
+
+	stream_len = 0;
+	memcpy(stream, audio, METAINT);
+	stream_len += METAINT;
+	put_meta(meta);
+
+	reset(icy, METAINT);
+	CHECK(icy_demux(icy, stream, stream_len) == 0);
+	CHECK(title_nb == 1);
+	CHECK(strlen(last_title) == ICY_TITLE_MAX_SZ - 1);
+	CHECK(strspn(last_title, "x") == ICY_TITLE_MAX_SZ - 1);
+
+	return 0;
+}
+
+int main(void)
+{
+	struct icy *icy = malloc(sizeof(*icy));
+	int ret = 0;
+
+	if (!icy)
+		return 1;
+	build_stream();
+	ret |= test_chunks(icy);
+	ret |= test_reset(icy);
+	ret |= test_no_metaint(icy);
+	/* following tests overwrite stream */
+	ret |= test_notify_in_block(icy);
+	ret |= test_long_title(icy);
+	free(icy);
+	fprintf(stderr, "icy_test: %s\n", ret ? "FAILED" : "ok");
+
+	return ret ? 1 : 0;
+}
@@ -0,0 +1,174 @@
+/* id3_get() throughput on tags whose text frames are spread around a
+ * large cover and a private frame, as written by most taggers.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <time.h>
+
+#include "id3.h"
+
+#define FILE_NB		200
+#define APIC_SZ		(150 * 1024)
+#define PRIV_SZ		(30 * 1024)
+#define AUDIO_SZ	(16 * 1024)
+#define RUN_TIME_S	2
+/* latin1, mime, front cover, empty description */
+#define APIC_HEADER	"\0image/jpeg\0\3"
+
+static long read_nb;
+static long read_bytes;
+
+ssize_t __real_read(int fd, void *buf, size_t count);
+
+ssize_t __wrap_read(int fd, void *buf, size_t count)
+{
+	ssize_t ret = __real_read(fd, buf, count);
+
+	read_nb++;
+	if (ret > 0)
+		read_bytes += ret;
+
+	return ret;
+}
+
+static void put_size(FILE *f, int version, uint32_t size)
+{
+	if (version == 4)
+		size = (size & 0x7f) | ((size & 0x3f80) << 1) |
+		       ((size & 0x1fc000) << 2) | ((size & 0xfe00000) << 3);
+	fputc(size >> 24, f);
+	fputc(size >> 16, f);
+	fputc(size >> 8, f);
+	fputc(size, f);
+}
+
+static void put_frame(FILE *f, int version, const char *id, const void *data, int len)
+{
+	fwrite(id, 1, 4, f);
+	put_size(f, version, len);
+	fputc(0, f);
+	fputc(0, f);
+	fwrite(data, 1, len, f);
+}
+
+static void put_text(FILE *f, int version, const char *id, const char *text)
+{
+	char buf[256];
+
+	buf[0] = 0;
+	strcpy(buf + 1, text);
+	put_frame(f, version, id, buf, strlen(text) + 1);
+}
+
+static int write_file(const char *path, int i, char *blob)
+{
+	int version = i % 2 ? 3 : 4;
+	int tag_sz = 10 * 6 + 64 * 4 + APIC_SZ + PRIV_SZ + 512;
+	char text[64];
+	FILE *f;
+
+	f = fopen(path, "wb");
+	if (!f)
+		return -1;
+
+	fwrite("ID3", 1, 3, f);
+	fputc(version, f);
+	fputc(0, f);
+	fputc(0, f);
+	put_size(f, 4, tag_sz);
+
+	snprintf(text, sizeof(text), "Title %d", i);
+	put_text(f, version, "TIT2", text);
+	put_frame(f, version, "APIC", blob, APIC_SZ);
+	put_frame(f, version, "PRIV", blob, PRIV_SZ);
+	snprintf(text, sizeof(text), "Artist %d", i % 7);
+	put_text(f, version, "TPE1", text);
+	put_text(f, version, "TALB", "Album");
+	snprintf(text, sizeof(text), "%d/12", i % 12 + 1);
+	put_text(f, version, "TRCK", text);
+	/* padding up to announced size */
+	fseek(f, 10 + tag_sz, SEEK_SET);
+
+	/* mpeg1 layer 3, 128 kbps, 44.1 kHz */
+	fwrite("\xff\xfb\x90\x44", 1, 4, f);
+	fwrite(blob, 1, AUDIO_SZ, f);
+
+	return fclose(f);
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/id3_bench.XXXXXX";
+	char path[FILE_NB][64] = {{0}};
+	struct id3_meta meta;
+	long tag_nb = 0;
+	double start;
+	double elapsed;
+	char *blob;
+	int ret = 1;
+	int offset;
+	int size;
+	int i;
+
+	if (!mkdtemp(dir))
+		return 1;
+	blob = calloc(1, APIC_SZ);
+	if (!blob)
+		goto exit;
+	/* also used as other frames and audio payload */
+	memcpy(blob, APIC_HEADER, sizeof(APIC_HEADER));
+	for (i = 0; i < FILE_NB; i++) {
+		snprintf(path[i], sizeof(path[i]), "%s/%03d.mp3", dir, i);
+		if (write_file(path[i], i, blob))
+			goto exit;
+	}
+
+	read_nb = 0;
+	read_bytes = 0;
+	start = now();
+	do {
+		for (i = 0; i < FILE_NB; i++) {
+			if (id3_get(path[i], &meta)) {
+				fprintf(stderr, "%s: no tag\n", path[i]);
+				goto exit;
+			}
+			id3_put(&meta);
+		}
+		tag_nb += FILE_NB;
+		elapsed = now() - start;
+	} while (elapsed < RUN_TIME_S);
+
+	printf("id3_get: %.0f tags/s, %.1f reads and %.1f KB read per tag\n",
+	       tag_nb / elapsed, (double) read_nb / tag_nb,
+	       read_bytes / 1024.0 / tag_nb);
+
+	read_nb = 0;
+	read_bytes = 0;
+	if (id3_get_picture(path[0], &offset, &size)) {
+		fprintf(stderr, "%s: no picture\n", path[0]);
+		goto exit;
+	}
+	printf("id3_get_picture: %ld reads, %.1f KB read, cover %d bytes at %d\n",
+	       read_nb, read_bytes / 1024.0, size, offset);
+	ret = 0;
+
+exit:
+	for (i = 0; i < FILE_NB; i++)
+		unlink(path[i]);
+	rmdir(dir);
+	free(blob);
+
+	return ret;
+}
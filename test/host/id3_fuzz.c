@@ -0,0 +1,282 @@
+/* Mutation fuzzer for the id3 parser. Seed files cover every tag layout
+ * the parser knows about, then random bytes of their tag, trailer or
+ * audio start are altered and files truncated. Built with ASan/UBSan, so
+ * a finding aborts.
+ *   id3_fuzz [iterations [seed]]
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#include "id3.h"
+
+#define FILE_MAX_SZ	(64 * 1024)
+#define SEED_NB		8
+/* mutations mostly hit tag area */
+#define HEAD_SZ		8192
+#define FRAME_SZ	417
+
+struct seed {
+	unsigned char data[FILE_MAX_SZ];
+	int len;
+	/* tag size field to patch once body is known */
+	int size_pos;
+	int has_tag;
+};
+
+static struct seed seeds[SEED_NB];
+
+static void put(struct seed *s, const void *data, int len)
+{
+	memcpy(&s->data[s->len], data, len);
+	s->len += len;
+}
+
+static void put_u32(struct seed *s, uint32_t v, int is_syncsafe)
+{
+	unsigned char b[4];
+
+	if (is_syncsafe)
+		v = (v & 0x7f) | ((v & 0x3f80) << 1) | ((v & 0x1fc000) << 2) |
+		    ((v & 0xfe00000) << 3);
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >> 8;
+	b[3] = v;
+	put(s, b, 4);
+}
+
+static void tag_begin(struct seed *s, int version, int flags)
+{
+	unsigned char hdr[6] = { 'I', 'D', '3', version, 0, flags };
+
+	put(s, hdr, sizeof(hdr));
+	s->has_tag = 1;
+	s->size_pos = s->len;
+	put_u32(s, 0, 1);
+}
+
+static void tag_end(struct seed *s, int padding)
+{
+	int len = s->len;
+
+	memset(&s->data[s->len], 0, padding);
+	s->len += padding;
+	s->len = s->size_pos;
+	put_u32(s, len + padding - s->size_pos - 4, 1);
+	s->len = len + padding;
+}
+
+static void frame(struct seed *s, int version, const char *id, const void *data,
+		  int len, int flags)
+{
+	unsigned char b[2] = { flags >> 8, flags };
+
+	if (version == 2) {
+		put(s, id, 3);
+		put_u32(s, len << 8, 0);
+		s->len--;
+	} else {
+		put(s, id, 4);
+		put_u32(s, len, version == 4);
+		put(s, b, 2);
+	}
+	put(s, data, len);
+}
+
+#define FRAME(s, v, id, str)	frame(s, v, id, str, sizeof(str) - 1, 0)
+
+static void audio(struct seed *s, int is_xing)
+{
+	unsigned char f[FRAME_SZ] = { 0xff, 0xfb, 0x90, 0x44 };
+	int i;
+
+	for (i = 0; i < 40; i++) {
+		memset(&f[4], 0, FRAME_SZ - 4);
+		if (is_xing && !i) {
+			/* frames, bytes */
+			memcpy(&f[36], "Xing\0\0\0\3\0\0\x07\xd0\0\x07\xa1\x20", 16);
+		}
+		put(s, f, FRAME_SZ);
+	}
+}
+
+static void v1_trailer(struct seed *s)
+{
+	unsigned char t[128];
+
+	memset(t, 0, sizeof(t));
+	memcpy(t, "TAG", 3);
+	memcpy(&t[3], "Title v1", 8);
+	memcpy(&t[33], "Artist v1", 9);
+	memcpy(&t[63], "Album v1", 8);
+	memcpy(&t[93], "2000", 4);
+	t[126] = 7;
+	t[127] = 12;
+	put(s, t, sizeof(t));
+	s->has_tag = 1;
+}
+
+static void build_seeds(void)
+{
+	unsigned char unsync[64];
+	struct seed *s;
+	int len = 0;
+	int i;
+
+	/* v2.2, utf-16 with bom, PIC cover */
+	s = &seeds[0];
+	tag_begin(s, 2, 0);
+	FRAME(s, 2, "TT2", "\0Title 22");
+	FRAME(s, 2, "TP1", "\1\xff\xfe" "A\0r\0t\0");
+	FRAME(s, 2, "TAL", "\0Album");
+	FRAME(s, 2, "TRK", "\0" "5/9");
+	FRAME(s, 2, "PIC", "\0JPG\3desc\0\xff\xd8\xff\xe0 cover");
+	tag_end(s, 20);
+	audio(s, 0);
+
+	/* v2.3 extended header, utf-16be with surrogate pair, utf-8 */
+	s = &seeds[1];
+	tag_begin(s, 3, 0x40);
+	put_u32(s, 6, 0);
+	put(s, "\0\0\0\0\0\0", 6);
+	FRAME(s, 3, "TIT2", "\2\0B\0E\xd8\x3d\xde\x00");
+	FRAME(s, 3, "TPE1", "\1\xfe\xff\0A\0B");
+	FRAME(s, 3, "TALB", "\3Alb\xc3\xa9");
+	tag_end(s, 0);
+	audio(s, 1);
+
+	/* v2.4 extended header and footer, data length indicator flag */
+	s = &seeds[2];
+	tag_begin(s, 4, 0x50);
+	put_u32(s, 6, 1);
+	put(s, "\1\0", 2);
+	FRAME(s, 4, "TIT2", "\0Title 24");
+	FRAME(s, 4, "TPE1", "\3Artist 24");
+	frame(s, 4, "TALB", "\0\0\0\x0a\0Album 24", 14, 0x0001);
+	tag_end(s, 0);
+	put(s, "3DI\4\0\x50", 6);
+	put(s, &s->data[s->size_pos], 4);
+	audio(s, 0);
+
+	/* id3v1 only */
+	s = &seeds[3];
+	audio(s, 0);
+	v1_trailer(s);
+
+	/* incomplete v2 falling back to v1 */
+	s = &seeds[4];
+	tag_begin(s, 3, 0);
+	FRAME(s, 3, "TIT2", "\0Only title");
+	tag_end(s, 0);
+	audio(s, 0);
+	v1_trailer(s);
+
+	/* v2.3 tag level unsynchronisation */
+	s = &seeds[5];
+	{
+		struct seed raw = { .len = 0 };
+
+		FRAME(&raw, 3, "TIT2", "\0T\xff\xe0x");
+		FRAME(&raw, 3, "TPE1", "\0Art");
+		FRAME(&raw, 3, "TALB", "\0Alb");
+		for (i = 0; i < raw.len; i++) {
+			unsync[len++] = raw.data[i];
+			if (raw.data[i] == 0xff)
+				unsync[len++] = 0;
+		}
+	}
+	tag_begin(s, 3, 0x80);
+	put(s, unsync, len);
+	tag_end(s, 0);
+	audio(s, 0);
+
+	/* v2.4 compressed frame, APIC ahead of text */
+	s = &seeds[6];
+	tag_begin(s, 4, 0);
+	FRAME(s, 4, "APIC", "\0image/jpeg\0\3\0\xff\xd8\xff\xe0 cover");
+	frame(s, 4, "TIT2", "\0\0\0\x10xxxxxxxx", 12, 0x0009);
+	FRAME(s, 4, "TIT2", "\0Title");
+	FRAME(s, 4, "TPE1", "\0Artist");
+	FRAME(s, 4, "TALB", "\0Album");
+	FRAME(s, 4, "TRCK", "\0" "3");
+	tag_end(s, 100);
+	audio(s, 0);
+
+	/* no tag at all */
+	s = &seeds[7];
+	audio(s, 1);
+}
+
+static int write_file(const char *path, unsigned char *data, int len)
+{
+	FILE *f = fopen(path, "wb");
+
+	if (!f)
+		return -1;
+	fwrite(data, 1, len, f);
+
+	return fclose(f);
+}
+
+int main(int argc, char **argv)
+{
+	static unsigned char buf[FILE_MAX_SZ];
+	char path[] = "/tmp/id3_fuzz.XXXXXX";
+	int iterations = argc > 1 ? atoi(argv[1]) : 5000;
+	struct id3_meta meta;
+	int parsed_nb = 0;
+	int offset;
+	int size;
+	int head;
+	int len;
+	int fd;
+	int i;
+	int j;
+	int k;
+
+	/* parser reports rejected tags on stdout */
+	if (!freopen("/dev/null", "w", stdout))
+		return 1;
+	srand(argc > 2 ? atoi(argv[2]) : 1);
+	build_seeds();
+	fd = mkstemp(path);
+	if (fd < 0)
+		return 1;
+	close(fd);
+
+	for (i = 0; i < iterations; i++) {
+		struct seed *s = &seeds[i % SEED_NB];
+
+		len = s->len;
+		memcpy(buf, s->data, len);
+		/* first round runs untouched seeds */
+		head = len < HEAD_SZ ? len : HEAD_SZ;
+		k = i < SEED_NB ? 0 : rand() % 16 + 1;
+		for (j = 0; j < k; j++) {
+			int pos = rand() % 3 == 0 ? len - 128 + rand() % 128 : rand() % head;
+
+			buf[pos] = rand() % 4 == 0 ? 0xff : rand();
+		}
+		if (i >= SEED_NB && rand() % 8 == 0)
+			len = rand() % len;
+
+		if (write_file(path, buf, len))
+			break;
+		if (!id3_get(path, &meta)) {
+			parsed_nb++;
+			id3_put(&meta);
+		} else if (i < SEED_NB && s->has_tag) {
+			fprintf(stderr, "seed %d not parsed\n", i);
+			unlink(path);
+			return 1;
+		}
+		id3_get_picture(path, &offset, &size);
+	}
+	unlink(path);
+	fprintf(stderr, "%d files, %d parsed\n", i, parsed_nb);
+
+	return i == iterations ? 0 : 1;
+}
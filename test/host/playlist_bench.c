@@ -0,0 +1,125 @@
+/* Play queue operations on a large queue. db is stubbed, tracks resolve
+ * to constant strings, so only playlist bookkeeping is measured.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "playlist.h"
+#include "db.h"
+
+#define TRACK_NB	20000
+
+uint32_t db_track_id(char *filepath)
+{
+	return strtoul(filepath, NULL, 10);
+}
+
+int db_song_get_id(void *hdl, char *artist, char *album, char *song, uint32_t *id)
+{
+	return -1;
+}
+
+int db_track_get(void *hdl, uint32_t id, struct db_track *track)
+{
+	memset(track, 0, sizeof(*track));
+	track->id = id;
+	track->filepath = "/sdcard/Music/track.mp3";
+	track->artist = "artist";
+	track->album = "album";
+	track->title = "title";
+
+	return 0;
+}
+
+int db_track_get_from_file(void *hdl, char *path, struct db_track *track)
+{
+	return db_track_get(hdl, db_track_id(path), track);
+}
+
+void db_track_put(void *hdl, struct db_track *track)
+{
+}
+
+void db_close(void *hdl)
+{
+}
+
+static double now_in_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(void)
+{
+	struct playlist_item item;
+	double build_ms;
+	double next_ms;
+	double shuffle_ms;
+	double start;
+	char *seen;
+	void *playlist;
+	int ret = 1;
+	int i;
+
+	seen = calloc(TRACK_NB, 1);
+	playlist = playlist_create(NULL);
+	if (!seen || !playlist)
+		return 1;
+
+	start = now_in_ms();
+	for (i = 0; i < TRACK_NB; i++) {
+		if (playlist_add_track(playlist, i)) {
+			fprintf(stderr, "add %d failed\n", i);
+			goto exit;
+		}
+	}
+	build_ms = now_in_ms() - start;
+
+	/* random order visits every track once */
+	start = now_in_ms();
+	for (i = 0; i < TRACK_NB; i++) {
+		if (playlist_next(playlist, &item, 1)) {
+			fprintf(stderr, "next %d failed\n", i);
+			goto exit;
+		}
+		if (seen[item.track.id]++) {
+			fprintf(stderr, "track %u played twice\n", item.track.id);
+			goto exit;
+		}
+		playlist_put_item(playlist, &item);
+	}
+	next_ms = now_in_ms() - start;
+	if (!playlist_next(playlist, &item, 1)) {
+		fprintf(stderr, "queue not exhausted\n");
+		goto exit;
+	}
+
+	playlist_rewind(playlist);
+	start = now_in_ms();
+	playlist_shuffle(playlist);
+	shuffle_ms = now_in_ms() - start;
+
+	/* song index counts current song */
+	if (playlist_jump(playlist, TRACK_NB - 1, &item) ||
+	    playlist_song_idx(playlist) != TRACK_NB) {
+		fprintf(stderr, "jump failed\n");
+		goto exit;
+	}
+	playlist_put_item(playlist, &item);
+
+	printf("%d tracks: build %.2f ms, random next through all %.2f ms, reshuffle %.2f ms\n",
+	       TRACK_NB, build_ms, next_ms, shuffle_ms);
+	ret = 0;
+
+exit:
+	playlist_destroy(playlist);
+	free(seen);
+
+	return ret;
+}
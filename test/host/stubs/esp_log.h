@@ -0,0 +1,18 @@
+#ifndef __ESP_LOG_STUB__
+#define __ESP_LOG_STUB__ 1
+
+#include <stdio.h>
+
+#ifdef HOST_TEST_VERBOSE
+#define ESP_LOGE(tag, fmt, ...)	fprintf(stderr, "E %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...)	fprintf(stderr, "W %s: " fmt "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...)	fprintf(stderr, "I %s: " fmt "\n", tag, ##__VA_ARGS__)
+#else
+#define ESP_LOGE(tag, fmt, ...)	do { (void) tag; } while (0)
+#define ESP_LOGW(tag, fmt, ...)	do { (void) tag; } while (0)
+#define ESP_LOGI(tag, fmt, ...)	do { (void) tag; } while (0)
+#endif
+#define ESP_LOGD(tag, fmt, ...)	do { (void) tag; } while (0)
+#define ESP_LOGV(tag, fmt, ...)	do { (void) tag; } while (0)
+
+#endif